@@ -0,0 +1,159 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/filter.h>
+}
+
+#include "cansocket.hpp"
+
+#define BPF_FILTER_OFFSET_CAN_ID					0
+#define BPF_FILTER_OFFSET_LEN						4
+#define BPF_FILTER_OFFSET_DATA						8
+/* snap length returned for accepted frames, larger than any CAN (FD) frame */
+#define BPF_FILTER_ACCEPT						0xFFFF
+#define BPF_FILTER_DROP							0
+
+/*
+ * Compiler of receive filters into classic BPF.
+ *
+ * Each rule matches the CAN ID like a struct can_filter (including
+ * CAN_INV_FILTER) and additionally requires the payload bytes given by its
+ * predicates to match (data[index] & mask) == value. A frame too short for a
+ * predicate does not match. A frame is accepted if any rule matches.
+ *
+ * The rules come as a flat table:
+ *   can_id, can_mask, count, count * (index, value, mask), ...
+ *
+ * Generated code per rule, all jumps to the next rule on mismatch:
+ *   ld  [0]          ; can_id
+ *   and #can_mask
+ *   jeq #can_id & can_mask
+ *   per predicate:
+ *   ldb [4]          ; len
+ *   jgt #index
+ *   ldb [8 + index]
+ *   and #mask
+ *   jeq #value
+ *   ret #accept
+ * followed by a final ret #drop.
+ *
+ * The socket filter sees the struct can_frame in host byte order, whereas
+ * word loads of BPF are big endian, so ID and mask are converted with htonl.
+ */
+
+static void emit(struct sock_filter *prog, int *pc, __u16 code, __u8 jt, __u8 jf, __u32 k) {
+	prog[*pc].code = code;
+	prog[*pc].jt = jt;
+	prog[*pc].jf = jf;
+	prog[*pc].k = k;
+	(*pc)++;
+}
+
+/*
+ * Checks the rule table and returns the number of instructions needed, or -1
+ * with errno set to EINVAL if the table is malformed or E2BIG if the program
+ * would be too long.
+ */
+static int bpfFilterLength(const jint *rules, jint len) {
+	int insns = 1;
+	jint i = 0;
+	while (i < len) {
+		if (i + 3 > len) {
+			errno = EINVAL;
+			return -1;
+		}
+		const jint count = rules[i + 2];
+		if (count < 0 || count > BPF_FILTER_MAX_PREDICATES || i + 3 + 3 * count > len) {
+			errno = EINVAL;
+			return -1;
+		}
+		for (jint p = 0; p < count; p++) {
+			const jint index = rules[i + 3 + 3 * p];
+			if (index < 0 || index >= CANFD_MAX_DLEN) {
+				errno = EINVAL;
+				return -1;
+			}
+		}
+		insns += 4 + 5 * count;
+		i += 3 + 3 * count;
+	}
+	if (insns > BPF_MAXINSNS) {
+		errno = E2BIG;
+		return -1;
+	}
+	return insns;
+}
+
+/*
+ * Compiles the rules and attaches the program to the socket with
+ * SO_ATTACH_FILTER. Returns 0 on success and -1 with errno set on failure
+ * (EINVAL or E2BIG for an unusable rule table).
+ */
+int bpfFilterAttach(int fd, const jint *rules, jint len) {
+	const int insns = bpfFilterLength(rules, len);
+	if (insns == -1) {
+		return -1;
+	}
+	std::unique_ptr<struct sock_filter[]> prog(new struct sock_filter[insns]);
+	int pc = 0;
+	jint i = 0;
+	while (i < len) {
+		const __u32 canid = (__u32) rules[i];
+		const __u32 mask = (__u32) rules[i + 1];
+		const jint count = rules[i + 2];
+		const __u32 wanted = (canid & ~CAN_INV_FILTER) & mask;
+		//instructions of the rule left after the current one up to the next rule
+		int left = 3 + 5 * count;
+
+		emit(prog.get(), &pc, BPF_LD | BPF_W | BPF_ABS, 0, 0, BPF_FILTER_OFFSET_CAN_ID);
+		emit(prog.get(), &pc, BPF_ALU | BPF_AND | BPF_K, 0, 0, htonl(mask));
+		left -= 2;
+		if (canid & CAN_INV_FILTER) {
+			emit(prog.get(), &pc, BPF_JMP | BPF_JEQ | BPF_K, left, 0, htonl(wanted));
+		} else {
+			emit(prog.get(), &pc, BPF_JMP | BPF_JEQ | BPF_K, 0, left, htonl(wanted));
+		}
+		for (jint p = 0; p < count; p++) {
+			const jint *pred = &rules[i + 3 + 3 * p];
+			const __u32 index = (__u32) pred[0];
+			const __u32 pmask = (__u32) pred[2] & 0xFF;
+			const __u32 value = (__u32) pred[1] & pmask;
+			left -= 1;
+			emit(prog.get(), &pc, BPF_LD | BPF_B | BPF_ABS, 0, 0, BPF_FILTER_OFFSET_LEN);
+			left -= 1;
+			emit(prog.get(), &pc, BPF_JMP | BPF_JGT | BPF_K, 0, left, index);
+			left -= 1;
+			emit(prog.get(), &pc, BPF_LD | BPF_B | BPF_ABS, 0, 0, BPF_FILTER_OFFSET_DATA + index);
+			left -= 1;
+			emit(prog.get(), &pc, BPF_ALU | BPF_AND | BPF_K, 0, 0, pmask);
+			left -= 1;
+			emit(prog.get(), &pc, BPF_JMP | BPF_JEQ | BPF_K, 0, left, value);
+		}
+		emit(prog.get(), &pc, BPF_RET | BPF_K, 0, 0, BPF_FILTER_ACCEPT);
+		i += 3 + 3 * count;
+	}
+	emit(prog.get(), &pc, BPF_RET | BPF_K, 0, 0, BPF_FILTER_DROP);
+
+	struct sock_fprog fprog;
+	fprog.len = (unsigned short) pc;
+	fprog.filter = prog.get();
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}
+
+int bpfFilterDetach(int fd) {
+	const int dummy = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy)) == -1 && errno != ENOENT) {
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+}
+
+#include "cansocket.hpp"
+
+#define BULK_BATCH_SIZE						  64
+#define BULK_BACKOFF_MIN_US					 100
+#define BULK_MAX_RETRIES					  10
+#define SOCKET_ERROR_BACKOFF_MS				 100
+#define NSEC_PER_SEC				   1000000000ULL
+
+/*
+ * Sends count frames on the interface the socket is bound to with as few
+ * sendmmsg calls as possible. If the kernel accepts only part of a batch the
+ * transmission resumes with the first frame not accepted. A congested device
+ * (ENOBUFS) is retried with an exponential backoff for a bounded time.
+ * Returns the number of frames accepted by the kernel, or -1 with errno set
+ * if not a single frame could be sent.
+ */
+int bulkSend(int fd, const struct can_frame *frames, int count) {
+	struct mmsghdr msgs[BULK_BATCH_SIZE];
+	struct iovec iovs[BULK_BATCH_SIZE];
+	int sent = 0;
+	int retries = 0;
+	int backoff = BULK_BACKOFF_MIN_US;
+
+	while (sent < count) {
+		const int batch = std::min(count - sent, BULK_BATCH_SIZE);
+		for (int i = 0; i < batch; i++) {
+			iovs[i].iov_base = (void*) &frames[sent + i];
+			iovs[i].iov_len = sizeof(struct can_frame);
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		const int rc = sendmmsg(fd, msgs, batch, 0);
+		if (rc > 0) {
+			sent += rc;
+			retries = 0;
+			backoff = BULK_BACKOFF_MIN_US;
+			continue;
+		}
+		if (rc == -1 && errno == EINTR) {
+			continue;
+		}
+		const int err = errno;
+		if (rc == -1 && (err == ENOBUFS || err == EAGAIN) && retries < BULK_MAX_RETRIES) {
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			poll(&pfd, 1, backoff / 1000 + 1);
+			if (err == ENOBUFS) {
+				usleep(backoff);
+			}
+			retries++;
+			backoff *= 2;
+			continue;
+		}
+		if (sent == 0 && rc == -1) {
+			errno = err;
+			return -1;
+		}
+		break;
+	}
+	return sent;
+}
+
+/* the SO_TIMESTAMPNS receive time (CLOCK_REALTIME) of the message, 0 if it has none */
+__u64 cmsgTimestampNs(struct msghdr *msg) {
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			return (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Receives up to count frames with as few recvmmsg calls as possible. Blocks
+ * (subject to SO_RCVTIMEO) until the first frame arrives, then takes only
+ * what is already queued. Frames of a different size (CAN FD) are skipped.
+ * timestampsNs, if not NULL, gets the receive time of every frame, see
+ * cmsgTimestampNs(). Returns the number of frames stored, or -1 with errno
+ * set if not a single frame could be received.
+ */
+int bulkRecv(int fd, struct can_frame *frames, __u64 *timestampsNs, int count) {
+	struct mmsghdr msgs[BULK_BATCH_SIZE];
+	struct iovec iovs[BULK_BATCH_SIZE];
+	char controls[BULK_BATCH_SIZE][CMSG_SPACE(sizeof(struct timespec))];
+	int received = 0;
+	int flags = MSG_WAITFORONE;
+
+	while (received < count) {
+		const int batch = std::min(count - received, BULK_BATCH_SIZE);
+		for (int i = 0; i < batch; i++) {
+			iovs[i].iov_base = (void*) &frames[received + i];
+			iovs[i].iov_len = sizeof(struct can_frame);
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			if (timestampsNs != NULL) {
+				msgs[i].msg_hdr.msg_control = controls[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+			}
+		}
+		const int rc = recvmmsg(fd, msgs, batch, flags, NULL);
+		if (rc == -1) {
+			if (errno == EINTR && received == 0) {
+				continue;
+			}
+			if (received == 0) {
+				return -1;
+			}
+			break;
+		}
+		int kept = 0;
+		for (int i = 0; i < rc; i++) {
+			if (msgs[i].msg_len == sizeof(struct can_frame) && (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) == 0) {
+				if (kept != i) {
+					frames[received + kept] = frames[received + i];
+				}
+				if (timestampsNs != NULL) {
+					timestampsNs[received + kept] = cmsgTimestampNs(&msgs[i].msg_hdr);
+				}
+				kept++;
+			}
+		}
+		received += kept;
+		if (rc < batch) {
+			break;
+		}
+		//once there is a frame do not wait for more
+		flags = received > 0 ? MSG_DONTWAIT : MSG_WAITFORONE;
+	}
+	return received;
+}
+
+/*
+ * Called when poll() reports POLLERR or POLLHUP on a CAN socket. Reads and
+ * thereby clears the pending socket error, e.g. ENETDOWN once the interface
+ * went down, otherwise poll() keeps reporting it and the caller spins. While
+ * the interface is down or gone it also waits SOCKET_ERROR_BACKOFF_MS, or
+ * until stopFd (-1 if none) becomes readable. Returns the error taken.
+ */
+int socketErrorBackoff(int fd, int stopFd) {
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+		err = errno;
+	}
+	if (err == ENETDOWN || err == ENODEV || err == 0) {
+		struct pollfd pfd;
+		pfd.fd = stopFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll(&pfd, stopFd != -1 ? 1 : 0, SOCKET_ERROR_BACKOFF_MS);
+	}
+	return err;
+}
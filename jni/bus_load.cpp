@@ -0,0 +1,332 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define BUS_LOAD_MAX							16
+#define BUS_LOAD_BATCH							32
+#define BUS_LOAD_BUCKET_NS				100000000ULL
+/* 60 s of history, the longest window */
+#define BUS_LOAD_BUCKETS					   600
+#define NSEC_PER_SEC				   1000000000ULL
+
+/*
+ * Bus load meter.
+ *
+ * One meter per interface receives all frames of the interface on a private
+ * socket, frames sent by other sockets of this host included as long as
+ * they do not disable CAN_RAW_LOOPBACK. It computes the time each frame
+ * occupied the bus from its on-wire length (see frame_bits.cpp) and the
+ * nominal and data bitrate, and adds it to a bucket of BUS_LOAD_BUCKET_NS.
+ * The load of a window is the bus time of the complete buckets it covers
+ * divided by its length, so it lags by one bucket at most. The buckets form
+ * a ring, windows of up to BUS_LOAD_BUCKETS buckets can be queried.
+ *
+ * Frames are put into the bucket of the time the meter read them, a burst
+ * read late may push a bucket beyond 100 %. Frames dropped because the
+ * socket overflowed are not seen at all.
+ */
+typedef struct _BusLoadBucket {
+	__u64 index;
+	__u64 busyNs;
+	__u64 frames;
+	__u64 bits;
+} BusLoadBucket;
+
+typedef struct _BusLoad {
+	int ifIndex;
+	int stuffing;
+	jlong bitrate;
+	jlong dataBitrate;
+	int fd;
+	int stopFd;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	__u64 startBucket;
+	__u64 totalFrames;
+	__u64 totalBits;
+	BusLoadBucket buckets[BUS_LOAD_BUCKETS];
+} BusLoad;
+
+static BusLoad *busLoads[BUS_LOAD_MAX];
+static pthread_mutex_t busLoadsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static __u64 monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void busLoadAccount(BusLoad *b, const struct canfd_frame *frames, const struct mmsghdr *msgs, int count,
+		__u64 nowNs) {
+	__u64 busyNs = 0;
+	__u64 bits = 0;
+	int n = 0;
+	for (int i = 0; i < count; i++) {
+		if (msgs[i].msg_len != CAN_MTU && msgs[i].msg_len != CANFD_MTU) {
+			continue;
+		}
+		int dataBits;
+		const int nominalBits = frameBits(&frames[i], msgs[i].msg_len == CANFD_MTU, b->stuffing, &dataBits);
+		busyNs += (__u64) nominalBits * NSEC_PER_SEC / b->bitrate + (__u64) dataBits * NSEC_PER_SEC / b->dataBitrate;
+		bits += nominalBits + dataBits;
+		n++;
+	}
+	const __u64 index = nowNs / BUS_LOAD_BUCKET_NS;
+	pthread_mutex_lock(&b->lock);
+	BusLoadBucket *bucket = &b->buckets[index % BUS_LOAD_BUCKETS];
+	if (bucket->index != index) {
+		memset(bucket, 0, sizeof(*bucket));
+		bucket->index = index;
+	}
+	bucket->busyNs += busyNs;
+	bucket->frames += n;
+	bucket->bits += bits;
+	b->totalFrames += n;
+	b->totalBits += bits;
+	pthread_mutex_unlock(&b->lock);
+}
+
+static void* busLoadWorker(void *arg) {
+	BusLoad *b = (BusLoad*) arg;
+	struct canfd_frame frames[BUS_LOAD_BATCH];
+	struct mmsghdr msgs[BUS_LOAD_BATCH];
+	struct iovec iovs[BUS_LOAD_BATCH];
+	struct pollfd pfds[2];
+	pfds[0].fd = b->fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = b->stopFd;
+	pfds[1].events = POLLIN;
+
+	while (__atomic_load_n(&b->running, __ATOMIC_ACQUIRE)) {
+		pfds[0].revents = 0;
+		pfds[1].revents = 0;
+		if (poll(pfds, 2, -1) <= 0) {
+			continue;
+		}
+		if ((pfds[0].revents & POLLIN) == 0) {
+			if (pfds[0].revents & (POLLERR | POLLHUP)) {
+				socketErrorBackoff(b->fd, b->stopFd);
+			}
+			continue;
+		}
+		for (int i = 0; i < BUS_LOAD_BATCH; i++) {
+			iovs[i].iov_base = &frames[i];
+			iovs[i].iov_len = sizeof(frames[i]);
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		const int n = recvmmsg(b->fd, msgs, BUS_LOAD_BATCH, MSG_DONTWAIT, NULL);
+		if (n > 0) {
+			busLoadAccount(b, frames, msgs, n, monotonicNs());
+		}
+	}
+	return NULL;
+}
+
+static int busLoadOpen(BusLoad *b) {
+	const int fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+	if (fd == -1) {
+		return -1;
+	}
+	const int enable = 1;
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = b->ifIndex;
+	//CAN FD frames are only received on interfaces supporting them, the option fails on old kernels only
+	setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable));
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	b->fd = fd;
+	b->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (b->stopFd == -1) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Starts measuring the load of the interface. bitrate and dataBitrate 0 take
+ * the bitrates configured for the controller, a virtual interface needs them
+ * given; dataBitrate is only used for CAN FD frames with BRS. Returns 0 on
+ * success and -1 with errno set on failure, EEXIST if the load of the
+ * interface is measured already and EINVAL for an unknown bitrate.
+ */
+int busLoadStart(int ifIndex, int stuffing, jint bitrate, jint dataBitrate) {
+	if (ifIndex <= 0 || bitrate < 0 || dataBitrate < 0 || (stuffing != BUSLOAD_STUFFING_NONE
+			&& stuffing != BUSLOAD_STUFFING_WORST && stuffing != BUSLOAD_STUFFING_EXACT)) {
+		errno = EINVAL;
+		return -1;
+	}
+	LinkInfo info;
+	memset(&info, 0, sizeof(info));
+	if ((bitrate == 0 || dataBitrate == 0) && netlinkLinkQuery(ifIndex, &info) == -1) {
+		return -1;
+	}
+	BusLoad *b = (BusLoad*) calloc(1, sizeof(BusLoad));
+	if (b == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	b->ifIndex = ifIndex;
+	b->stuffing = stuffing;
+	b->bitrate = bitrate > 0 ? bitrate : info.values[LINK_INFO_BITRATE];
+	b->dataBitrate = dataBitrate > 0 ? dataBitrate : info.values[LINK_INFO_DATA_BITRATE];
+	if (b->dataBitrate <= 0) {
+		b->dataBitrate = b->bitrate;
+	}
+	if (b->bitrate <= 0) {
+		free(b);
+		errno = EINVAL;
+		return -1;
+	}
+	b->startBucket = monotonicNs() / BUS_LOAD_BUCKET_NS;
+	pthread_mutex_init(&b->lock, NULL);
+
+	pthread_mutex_lock(&busLoadsLock);
+	int freeSlot = -1;
+	for (int i = BUS_LOAD_MAX - 1; i >= 0; i--) {
+		if (busLoads[i] != NULL && busLoads[i]->ifIndex == ifIndex) {
+			pthread_mutex_unlock(&busLoadsLock);
+			pthread_mutex_destroy(&b->lock);
+			free(b);
+			errno = EEXIST;
+			return -1;
+		}
+		if (busLoads[i] == NULL) {
+			freeSlot = i;
+		}
+	}
+	int rc = -1;
+	int err = ENOSPC;
+	if (freeSlot != -1) {
+		if (busLoadOpen(b) == 0) {
+			b->running = 1;
+			err = pthread_create(&b->thread, NULL, busLoadWorker, (void*) b);
+			if (err == 0) {
+				busLoads[freeSlot] = b;
+				rc = 0;
+			} else {
+				close(b->stopFd);
+				close(b->fd);
+			}
+		} else {
+			err = errno;
+		}
+	}
+	pthread_mutex_unlock(&busLoadsLock);
+	if (rc == -1) {
+		pthread_mutex_destroy(&b->lock);
+		free(b);
+		errno = err;
+	}
+	return rc;
+}
+
+int busLoadStop(int ifIndex) {
+	BusLoad *b = NULL;
+	pthread_mutex_lock(&busLoadsLock);
+	for (int i = 0; i < BUS_LOAD_MAX; i++) {
+		if (busLoads[i] != NULL && busLoads[i]->ifIndex == ifIndex) {
+			b = busLoads[i];
+			busLoads[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&busLoadsLock);
+	if (b == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	__atomic_store_n(&b->running, 0, __ATOMIC_RELEASE);
+	eventfd_write(b->stopFd, 1);
+	pthread_join(b->thread, NULL);
+	close(b->stopFd);
+	close(b->fd);
+	pthread_mutex_destroy(&b->lock);
+	free(b);
+	return 0;
+}
+
+/*
+ * Fills values (BUSLOAD_STATS_COUNT) with the load of the last windowMs,
+ * rounded up to whole buckets. A window reaching back before the start of
+ * the meter is shortened to the time measured. Returns -1 with errno set if
+ * the load of the interface is not measured.
+ */
+int busLoadGet(int ifIndex, jint windowMs, jlong *values) {
+	const __u64 windowNs = (__u64) std::max(windowMs, 1) * 1000000ULL;
+	const __u64 windowBuckets = std::min((windowNs + BUS_LOAD_BUCKET_NS - 1) / BUS_LOAD_BUCKET_NS,
+			(__u64) BUS_LOAD_BUCKETS);
+	const __u64 current = monotonicNs() / BUS_LOAD_BUCKET_NS;
+	memset(values, 0, sizeof(jlong) * BUSLOAD_STATS_COUNT);
+	//the busLoadStop() of another thread waits for the lock of the table
+	pthread_mutex_lock(&busLoadsLock);
+	BusLoad *b = NULL;
+	for (int i = 0; i < BUS_LOAD_MAX && b == NULL; i++) {
+		if (busLoads[i] != NULL && busLoads[i]->ifIndex == ifIndex) {
+			b = busLoads[i];
+		}
+	}
+	if (b == NULL) {
+		pthread_mutex_unlock(&busLoadsLock);
+		errno = ENOENT;
+		return -1;
+	}
+	pthread_mutex_lock(&b->lock);
+	__u64 busyNs = 0;
+	__u64 covered = 0;
+	for (__u64 index = current - windowBuckets; index < current; index++) {
+		if (index < b->startBucket) {
+			continue;
+		}
+		covered++;
+		const BusLoadBucket *bucket = &b->buckets[index % BUS_LOAD_BUCKETS];
+		if (bucket->index != index) {
+			continue;
+		}
+		busyNs += bucket->busyNs;
+		values[BUSLOAD_FRAMES] += bucket->frames;
+		values[BUSLOAD_BITS] += bucket->bits;
+		values[BUSLOAD_PEAK_PPM] = std::max(values[BUSLOAD_PEAK_PPM],
+				(jlong) (bucket->busyNs * 1000000ULL / BUS_LOAD_BUCKET_NS));
+	}
+	if (covered > 0) {
+		values[BUSLOAD_LOAD_PPM] = (jlong) (busyNs * 1000000ULL / (covered * BUS_LOAD_BUCKET_NS));
+	}
+	values[BUSLOAD_WINDOW_MS] = (jlong) (covered * BUS_LOAD_BUCKET_NS / 1000000ULL);
+	values[BUSLOAD_TOTAL_FRAMES] = b->totalFrames;
+	values[BUSLOAD_TOTAL_BITS] = b->totalBits;
+	values[BUSLOAD_BITRATE] = b->bitrate;
+	values[BUSLOAD_DATA_BITRATE] = b->dataBitrate;
+	pthread_mutex_unlock(&b->lock);
+	pthread_mutex_unlock(&busLoadsLock);
+	return 0;
+}
@@ -0,0 +1,403 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/netlink.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define BUS_SUPERVISOR_MAX						16
+/* how often the controller state is polled via netlink, for drivers without error frames */
+#define BUS_SUPERVISOR_POLL_MS				 1000
+#define NSEC_PER_MSEC					  1000000LL
+
+/*
+ * Bus-off supervisor.
+ *
+ * One supervisor per interface watches the controller state, pushed by the
+ * error monitor of the interface (bus-off and restarted error frames) and
+ * polled via netlink for drivers that report the state only there.
+ * On bus-off it pauses the cyclic frames and the transmit queues of the
+ * sockets bound to the interface and restarts the controller through
+ * netlink. The delay before a restart starts at initialBackoffMs and doubles
+ * up to maxBackoffMs with every restart, it is reset once the bus stayed up
+ * for stableMs, so a permanently broken bus is not hammered with restarts.
+ * After the recovery the queues are resumed one by one, resumeStaggerMs
+ * apart, and the cyclic frames last, so the frames held back do not hit the
+ * bus all at once. A missed cycle is not made up.
+ * Only the transmit queues and the cyclic frames are held back, frames sent
+ * directly, in bulk, through a transmit ring or io_uring go to the driver
+ * as before and fail or are dropped there while the controller is bus-off.
+ * Bus-off and recovery increment the event counter Java can wait for.
+ */
+struct _BusSupervisor {
+	int ifIndex;
+	int refs;
+	int running;
+	int netlinkState;
+	jint initialBackoffMs;
+	jint maxBackoffMs;
+	jint stableMs;
+	jint resumeStaggerMs;
+	ErrorMonitor *monitor;
+	int wakeups;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t event;
+	jlong stats[BUSSUP_STATS_COUNT];
+};
+
+typedef struct _BusSupervisor BusSupervisor;
+
+typedef struct _QueueResume {
+	int ifIndex;
+	int paused;
+	int resumed;
+} QueueResume;
+
+static BusSupervisor *busSupervisors[BUS_SUPERVISOR_MAX];
+static pthread_mutex_t busSupervisorsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static __s64 monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__s64) ts.tv_sec * 1000 * NSEC_PER_MSEC + ts.tv_nsec;
+}
+
+/* the conditions wait on CLOCK_MONOTONIC, a stepped wall clock does not stretch or cut the waits */
+static void deadlineIn(struct timespec *deadline, __s64 ns) {
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	ns += deadline->tv_nsec;
+	deadline->tv_sec += ns / (1000 * NSEC_PER_MSEC);
+	deadline->tv_nsec = ns % (1000 * NSEC_PER_MSEC);
+}
+
+static int boundInterface(int fd) {
+	struct sockaddr_can addr;
+	socklen_t len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len) == -1) {
+		return 0;
+	}
+	return addr.can_ifindex;
+}
+
+/*
+ * Pauses the queues of the sockets bound to the interface, or resumes the
+ * first paused one. Sockets not bound to a specific interface are left
+ * alone, they may transmit on other interfaces as well.
+ */
+static void pauseQueue(SocketContext *ctx, void *arg) {
+	QueueResume *req = (QueueResume*) arg;
+	if (ctx->txQueue == NULL || req->resumed || boundInterface(ctx->fd) != req->ifIndex) {
+		return;
+	}
+	if (txQueueSetPaused(ctx->txQueue, req->paused) && !req->paused) {
+		req->resumed = 1;
+	}
+}
+
+static void pauseTransmissions(BusSupervisor *s) {
+	cyclicalTaskSetPaused(s->ifIndex, 1);
+	QueueResume req = { s->ifIndex, 1, 0 };
+	socketContextForEach(pauseQueue, &req);
+}
+
+static void resumeTransmissions(BusSupervisor *s, int staggerMs) {
+	while (1) {
+		QueueResume req = { s->ifIndex, 0, 0 };
+		socketContextForEach(pauseQueue, &req);
+		if (!req.resumed) {
+			break;
+		}
+		if (staggerMs > 0) {
+			usleep(staggerMs * 1000);
+		}
+	}
+	cyclicalTaskSetPaused(s->ifIndex, 0);
+}
+
+static void event(BusSupervisor *s, int counter) {
+	pthread_mutex_lock(&s->lock);
+	s->stats[counter]++;
+	s->stats[BUSSUP_STAT_EVENTS]++;
+	s->stats[BUSSUP_STAT_PAUSED] = counter == BUSSUP_STAT_BUS_OFFS;
+	pthread_cond_broadcast(&s->event);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void count(BusSupervisor *s, int counter) {
+	pthread_mutex_lock(&s->lock);
+	s->stats[counter]++;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* called by the error monitor thread on every state transition */
+static void onStateChange(void *arg, __u32 state) {
+	BusSupervisor *s = (BusSupervisor*) arg;
+	pthread_mutex_lock(&s->lock);
+	s->wakeups++;
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* netlink knows the state the controller is in right now, error frames may be stale or missing */
+static int currentState(BusSupervisor *s) {
+	LinkInfo info;
+	if (s->netlinkState && netlinkLinkQuery(s->ifIndex, &info) == 0 && info.values[LINK_INFO_STATE] >= 0) {
+		return (int) info.values[LINK_INFO_STATE];
+	}
+	return (int) errorMonitorState(s->monitor);
+}
+
+static void restart(BusSupervisor *s) {
+	if (netlinkCanRestart(s->ifIndex) == 0) {
+		count(s, BUSSUP_STAT_RESTARTS);
+		CANLOG_INFO("CAN interface %d: restarted after bus-off", s->ifIndex);
+	} else if (errno != EBUSY) {
+		//EBUSY: not in bus-off state anymore, restarted by the kernel (restart-ms)
+		count(s, BUSSUP_STAT_RESTART_FAILURES);
+		CANLOG_WARN("CAN interface %d: restart failed: %s", s->ifIndex, strerror(errno));
+	}
+}
+
+static void* busSupervisorWorker(void *arg) {
+	BusSupervisor *s = (BusSupervisor*) arg;
+	jint backoffMs = s->initialBackoffMs;
+	int busOff = 0;
+	__s64 outageStartNs = 0;
+	__s64 recoveredNs = 0;
+	__s64 nextRestartNs = 0;
+
+	pthread_mutex_lock(&s->lock);
+	while (s->running) {
+		const int wakeups = s->wakeups;
+		pthread_mutex_unlock(&s->lock);
+
+		const int state = currentState(s);
+		const __s64 now = monotonicNs();
+		__s64 waitNs = BUS_SUPERVISOR_POLL_MS * NSEC_PER_MSEC;
+		if (state == CAN_STATE_BUS_OFF) {
+			if (!busOff) {
+				busOff = 1;
+				outageStartNs = now;
+				nextRestartNs = now + backoffMs * NSEC_PER_MSEC;
+				pauseTransmissions(s);
+				event(s, BUSSUP_STAT_BUS_OFFS);
+				CANLOG_WARN("CAN interface %d: bus-off, restart in %d ms", s->ifIndex, backoffMs);
+			} else if (now >= nextRestartNs) {
+				restart(s);
+				backoffMs = (jint) std::min((jlong) backoffMs * 2, (jlong) s->maxBackoffMs);
+				nextRestartNs = now + backoffMs * NSEC_PER_MSEC;
+			}
+			waitNs = std::min(waitNs, std::max(nextRestartNs - now, (__s64) 0));
+		} else if (busOff) {
+			busOff = 0;
+			recoveredNs = now;
+			pthread_mutex_lock(&s->lock);
+			s->stats[BUSSUP_STAT_LAST_OUTAGE_MS] = (now - outageStartNs) / NSEC_PER_MSEC;
+			pthread_mutex_unlock(&s->lock);
+			resumeTransmissions(s, s->resumeStaggerMs);
+			event(s, BUSSUP_STAT_RECOVERIES);
+			CANLOG_INFO("CAN interface %d: recovered from bus-off", s->ifIndex);
+		} else if (backoffMs != s->initialBackoffMs && now - recoveredNs >= s->stableMs * NSEC_PER_MSEC) {
+			backoffMs = s->initialBackoffMs;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		s->stats[BUSSUP_STAT_BACKOFF_MS] = backoffMs;
+		struct timespec deadline;
+		deadlineIn(&deadline, waitNs);
+		while (s->running && s->wakeups == wakeups) {
+			if (pthread_cond_timedwait(&s->wake, &s->lock, &deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+	if (busOff) {
+		//nobody restarts the controller anymore, do not keep the frames back forever
+		resumeTransmissions(s, 0);
+	}
+	return NULL;
+}
+
+static void busSupervisorPut(BusSupervisor *s) {
+	pthread_mutex_lock(&busSupervisorsLock);
+	const int refs = --s->refs;
+	pthread_mutex_unlock(&busSupervisorsLock);
+	if (refs > 0) {
+		return;
+	}
+	pthread_cond_destroy(&s->event);
+	pthread_cond_destroy(&s->wake);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+}
+
+/* takes a reference to the supervisor of the interface, NULL if there is none */
+static BusSupervisor *busSupervisorGet(int ifIndex) {
+	BusSupervisor *s = NULL;
+	pthread_mutex_lock(&busSupervisorsLock);
+	for (int i = 0; i < BUS_SUPERVISOR_MAX; i++) {
+		if (busSupervisors[i] != NULL && busSupervisors[i]->ifIndex == ifIndex) {
+			s = busSupervisors[i];
+			s->refs++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&busSupervisorsLock);
+	return s;
+}
+
+/*
+ * Starts supervising the interface. Returns 0 on success and -1 with errno
+ * set on failure, EEXIST if the interface is supervised already.
+ */
+int busSupervisorStart(int ifIndex, jint initialBackoffMs, jint maxBackoffMs, jint stableMs,
+		jint resumeStaggerMs) {
+	if (ifIndex <= 0 || initialBackoffMs < 1 || maxBackoffMs < initialBackoffMs || stableMs < 0
+			|| resumeStaggerMs < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	BusSupervisor *s = (BusSupervisor*) calloc(1, sizeof(BusSupervisor));
+	if (s == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	s->ifIndex = ifIndex;
+	s->refs = 1;
+	s->running = 1;
+	s->initialBackoffMs = initialBackoffMs;
+	s->maxBackoffMs = maxBackoffMs;
+	s->stableMs = stableMs;
+	s->resumeStaggerMs = resumeStaggerMs;
+	s->stats[BUSSUP_STAT_BACKOFF_MS] = initialBackoffMs;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s->wake, &attr);
+	pthread_cond_init(&s->event, &attr);
+	pthread_condattr_destroy(&attr);
+	LinkInfo info;
+	s->netlinkState = netlinkLinkQuery(ifIndex, &info) == 0 && info.values[LINK_INFO_STATE] >= 0;
+
+	pthread_mutex_lock(&busSupervisorsLock);
+	int freeSlot = -1;
+	for (int i = BUS_SUPERVISOR_MAX - 1; i >= 0; i--) {
+		if (busSupervisors[i] != NULL && busSupervisors[i]->ifIndex == ifIndex) {
+			pthread_mutex_unlock(&busSupervisorsLock);
+			busSupervisorPut(s);
+			errno = EEXIST;
+			return -1;
+		}
+		if (busSupervisors[i] == NULL) {
+			freeSlot = i;
+		}
+	}
+	int rc = -1;
+	int err = ENOSPC;
+	if (freeSlot != -1) {
+		s->monitor = errorMonitorAcquire(ifIndex);
+		err = errno;
+		if (s->monitor != NULL) {
+			errorMonitorAddListener(s->monitor, onStateChange, s);
+			err = pthread_create(&s->thread, NULL, busSupervisorWorker, (void*) s);
+			if (err == 0) {
+				busSupervisors[freeSlot] = s;
+				rc = 0;
+			} else {
+				errorMonitorRemoveListener(s->monitor, onStateChange, s);
+				errorMonitorRelease(s->monitor);
+			}
+		}
+	}
+	pthread_mutex_unlock(&busSupervisorsLock);
+	if (rc == -1) {
+		busSupervisorPut(s);
+		errno = err;
+	}
+	return rc;
+}
+
+/* stops supervising the interface, paused transmissions are resumed */
+int busSupervisorStop(int ifIndex) {
+	BusSupervisor *s = NULL;
+	pthread_mutex_lock(&busSupervisorsLock);
+	for (int i = 0; i < BUS_SUPERVISOR_MAX; i++) {
+		if (busSupervisors[i] != NULL && busSupervisors[i]->ifIndex == ifIndex) {
+			s = busSupervisors[i];
+			busSupervisors[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&busSupervisorsLock);
+	if (s == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	pthread_mutex_lock(&s->lock);
+	s->running = 0;
+	pthread_cond_broadcast(&s->wake);
+	pthread_cond_broadcast(&s->event);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+	errorMonitorRemoveListener(s->monitor, onStateChange, s);
+	errorMonitorRelease(s->monitor);
+	busSupervisorPut(s);
+	return 0;
+}
+
+int busSupervisorGetStats(int ifIndex, jlong *stats) {
+	BusSupervisor *s = busSupervisorGet(ifIndex);
+	if (s == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	pthread_mutex_lock(&s->lock);
+	memcpy(stats, s->stats, sizeof(s->stats));
+	pthread_mutex_unlock(&s->lock);
+	busSupervisorPut(s);
+	return 0;
+}
+
+/*
+ * Waits until the event counter differs from seenEvents, the timeout expires
+ * or the supervisor is stopped. Returns the current event counter, -1 with
+ * errno set if the interface is not supervised.
+ */
+jlong busSupervisorAwait(int ifIndex, jlong seenEvents, jint timeoutMs) {
+	BusSupervisor *s = busSupervisorGet(ifIndex);
+	if (s == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	struct timespec deadline;
+	deadlineIn(&deadline, timeoutMs * NSEC_PER_MSEC);
+	pthread_mutex_lock(&s->lock);
+	while (s->running && s->stats[BUSSUP_STAT_EVENTS] == seenEvents) {
+		if (pthread_cond_timedwait(&s->event, &s->lock, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	const jlong events = s->stats[BUSSUP_STAT_EVENTS];
+	pthread_mutex_unlock(&s->lock);
+	busSupervisorPut(s);
+	return events;
+}
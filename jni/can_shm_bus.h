@@ -0,0 +1,62 @@
+/*
+ * Layout of the shared memory frame bus, see shm_bus.cpp.
+ *
+ * Plain C, so processes not using the Java library can read the bus, e.g.
+ *
+ *   int fd = shm_open("/can0", O_RDWR, 0);
+ *   struct can_shm_bus_header *bus = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+ *
+ * with size = CAN_SHM_BUS_SIZE(bus->capacity) after mapping the header alone.
+ * A reader only writes to waiters, a read-only mapping does for readers that
+ * poll head instead of blocking.
+ *
+ * The publisher writes frame n (counting from 0) into slot n % capacity.
+ * Every slot is guarded by a sequence lock: seq is 2n+1 while frame n is
+ * written and 2n+2 once it is complete. A reader of frame n loads seq with
+ * acquire semantics, copies the slot, issues an acquire fence and loads seq
+ * again. The copy is valid if both loads returned 2n+2. A smaller value means
+ * frame n is not published yet, a larger one that the reader was lapped and
+ * has lost frames, it should continue with frame head - capacity.
+ * head is the number of frames published, written with release semantics
+ * after the slot. A reader that wants to block increments waiters, checks
+ * head again and waits with FUTEX_WAIT (not private) on wake, the publisher
+ * increments wake and does a FUTEX_WAKE after each batch if waiters is not 0.
+ * Wakeups may be spurious, a reader closing increments wake as well to end
+ * its own waits.
+ * The publisher holds an exclusive flock() on the segment while it runs, a
+ * reader can tell whether the bus is alive with a LOCK_SH | LOCK_NB attempt.
+ * A restarted publisher creates a new segment, readers have to map it again
+ * (the old one is unlinked but stays valid, it just does not advance).
+ */
+#ifndef CAN_SHM_BUS_H
+#define CAN_SHM_BUS_H
+
+#include <stdint.h>
+#include <linux/can.h>
+
+#define CAN_SHM_BUS_MAGIC						0x42484343U /* "CCHB" */
+#define CAN_SHM_BUS_VERSION						1
+
+struct can_shm_bus_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;			/* number of slots, a power of two */
+	uint32_t slot_size;			/* sizeof(struct can_shm_bus_slot) */
+	int32_t ifindex;			/* interface the frames are received from */
+	uint32_t waiters;
+	uint32_t wake;
+	uint32_t reserved;
+	uint64_t head;
+	uint8_t padding[24];
+};
+
+struct can_shm_bus_slot {
+	uint64_t seq;
+	uint64_t timestamp_ns;		/* CLOCK_REALTIME, taken by the kernel on reception */
+	struct can_frame frame;
+};
+
+#define CAN_SHM_BUS_SIZE(capacity) \
+	(sizeof(struct can_shm_bus_header) + (size_t) (capacity) * sizeof(struct can_shm_bus_slot))
+
+#endif /* CAN_SHM_BUS_H */
@@ -15,6 +15,7 @@
 #include <memory>
 
 extern "C" {
+#include <endian.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -49,12 +50,29 @@ static jint newCanSocket(JNIEnv *env, int socket_type, int protocol) {
 	return -1;
 }
 
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+	canlogInit(vm);
+	return JNI_VERSION_1_6;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1setLogLevel(
+		JNIEnv *env, jclass obj, jint level) {
+	canlogSetLevel(level);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1setLogForwarding(
+		JNIEnv *env, jclass obj, jboolean on) {
+	if (canlogSetForwarding(env, on == JNI_TRUE ? obj : NULL) == -1 && env->ExceptionCheck() != JNI_TRUE) {
+		throwIllegalArgumentException(env, "log forwarding method not found");
+	}
+}
+
 JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket_initCanLibrary(JNIEnv *env, jclass obj) {
 	cyclicalInitLowLevelThread();
 	if(CAN_NPROTO == 8){
-		fprintf(stderr, "CAN Lib: Init lowlevel thread done for kernel 5.1\n");
+		CANLOG_INFO("CAN Lib: Init lowlevel thread done for kernel 5.1");
 	}else{
-		fprintf(stderr, "CAN Lib: Init lowlevel thread done for kernel 4.1\n");
+		CANLOG_INFO("CAN Lib: Init lowlevel thread done for kernel 4.1");
 	}
 
 }
@@ -72,6 +90,7 @@ JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1openSoc
 JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1close
 (JNIEnv *env, jclass obj, jint fd)
 {
+	socketContextDestroy(fd);
 	if (close(fd) == -1) {
 		throwIOExceptionErrno(env, errno);
 	}
@@ -90,9 +109,13 @@ JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1discove
 	memset(&ifreq, 0x0, sizeof(ifreq));
 	env->GetStringUTFRegion(ifName, 0, ifNameSize, ifreq.ifr_name);
 	if (env->ExceptionCheck() == JNI_TRUE) {
-		printf("Error while getting interface name from java.");
+		CANLOG_DEBUG("Error while getting interface name from java.");
 		return -1;
 	}
+	LinkInfo info;
+	if (netlinkLinkLookup(0, ifreq.ifr_name, &info) == 0) {
+		return static_cast<jint>(info.values[LINK_INFO_IFINDEX]);
+	}
 	/* discover interface id */
 	const int err = ioctl(socketFd, SIOCGIFINDEX, &ifreq);
 	if (err == -1) {
@@ -105,6 +128,10 @@ JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1discove
 
 JNIEXPORT jstring JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1discoverInterfaceName(
 		JNIEnv *env, jclass obj, jint fd, jint ifIdx) {
+	LinkInfo info;
+	if (ifIdx > 0 && netlinkLinkLookup(ifIdx, NULL, &info) == 0) {
+		return env->NewStringUTF(info.name);
+	}
 	struct ifreq ifreq;
 	memset(&ifreq, 0x0, sizeof(ifreq));
 	ifreq.ifr_ifindex = ifIdx;
@@ -148,6 +175,16 @@ JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFra
 	if (env->ExceptionCheck() == JNI_TRUE) {
 		return;
 	}
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->txQueue != NULL) {
+		if (txQueueSubmit(ctx->txQueue, if_idx, &frame, 1) == TXQ_ERROR) {
+			statsErrorCntrSend++;
+			throwIOExceptionErrno(env, errno);
+		}
+		socketContextPut(ctx);
+		return;
+	}
+	socketContextPut(ctx);
 	nbytes = sendto(fd, &frame, sizeof(frame), flags,
 			reinterpret_cast<struct sockaddr *>(&addr),
 			sizeof(addr));
@@ -160,34 +197,212 @@ JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFra
 	}
 }
 
+/* send path of bound sockets: no per call address, the kernel uses the bound interface */
+static void sendFrameBound(JNIEnv *env, jint fd, const struct can_frame *frame) {
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->txQueue != NULL) {
+		if (txQueueSubmit(ctx->txQueue, 0, frame, 1) == TXQ_ERROR) {
+			statsErrorCntrSend++;
+			throwIOExceptionErrno(env, errno);
+		}
+		socketContextPut(ctx);
+		return;
+	}
+	socketContextPut(ctx);
+	const ssize_t nbytes = send(fd, frame, sizeof(*frame), 0);
+	if (nbytes == -1) {
+		statsErrorCntrSend++;
+		throwIOExceptionErrno(env, errno);
+	} else if (nbytes != sizeof(*frame)) {
+		statsErrorCntrSend++;
+		throwIOExceptionMsg(env, "send partial frame");
+	}
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFrameBound
+(JNIEnv *env, jclass obj, jint fd, jint canid, jlong payload, jint len)
+{
+	if (len < 0 || len > CAN_MAX_DLEN) {
+		throwIllegalArgumentException(env, "illegal frame length");
+		return;
+	}
+	struct can_frame frame;
+	memset(&frame, 0, offsetof(struct can_frame, data)); //header only, a single store
+	frame.can_id = canid;
+	frame.can_dlc = static_cast<__u8>(len);
+	const __u64 data = htole64(static_cast<__u64>(payload));
+	memcpy(frame.data, &data, sizeof(data));
+	sendFrameBound(env, fd, &frame);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFrameBuffer
+(JNIEnv *env, jclass obj, jint fd, jobject buffer, jint offset)
+{
+	char *base = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+	if (base == NULL) {
+		throwIllegalArgumentException(env, "not a direct buffer");
+		return;
+	}
+	const jlong capacity = env->GetDirectBufferCapacity(buffer);
+	if (offset < 0 || offset + static_cast<jlong>(sizeof(struct can_frame)) > capacity) {
+		throwIllegalArgumentException(env, "frame exceeds the buffer");
+		return;
+	}
+	const struct can_frame *frame = reinterpret_cast<const struct can_frame *>(base + offset);
+	if (frame->can_dlc > CAN_MAX_DLEN) {
+		throwIllegalArgumentException(env, "illegal frame length");
+		return;
+	}
+	sendFrameBound(env, fd, frame);
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFrames(
+		JNIEnv *env, jclass obj, jint fd, jobject buffer, jint offset, jint count) {
+	char *base = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+	if (base == NULL) {
+		throwIllegalArgumentException(env, "not a direct buffer");
+		return -1;
+	}
+	const jlong capacity = env->GetDirectBufferCapacity(buffer);
+	if (offset < 0 || count < 0
+			|| offset + static_cast<jlong>(count) * static_cast<jlong>(sizeof(struct can_frame)) > capacity) {
+		throwIllegalArgumentException(env, "frames exceed the buffer");
+		return -1;
+	}
+	const struct can_frame *frames = reinterpret_cast<const struct can_frame *>(base + offset);
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->txQueue != NULL) {
+		//keep the order with frames already queued
+		for (int i = 0; i < count; i++) {
+			const int rc = txQueueSubmit(ctx->txQueue, 0, &frames[i], 1);
+			if (rc == TXQ_ERROR) {
+				const int err = errno;
+				socketContextPut(ctx);
+				statsErrorCntrSend++;
+				if (i == 0) {
+					throwIOExceptionErrno(env, err);
+					return -1;
+				}
+				return i;
+			}
+		}
+		socketContextPut(ctx);
+		return count;
+	}
+	int sent;
+	if (ctx != NULL && ctx->uring != NULL) {
+		sent = uringSend(ctx->uring, frames, count);
+	} else {
+		socketContextPut(ctx);
+		ctx = NULL;
+		sent = bulkSend(fd, frames, count);
+	}
+	const int err = errno;
+	socketContextPut(ctx);
+	errno = err;
+	if (sent == -1) {
+		statsErrorCntrSend++;
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+	return sent;
+}
+
+/*
+ * Receives through the io_uring engine of the socket, if it has one, until a
+ * frame passes the receive pipeline. ifIndexes is only filled in for count 1,
+ * timestampsNs (room for count receive times) may be NULL. The engine is
+ * retained while waiting, not the context, so closing the socket or
+ * disabling io_uring does not wait for a frame. Returns 0 if the socket has
+ * to be read directly, -1 with errno set on failure.
+ */
+static int recvUring(int fd, struct can_frame *frames, int *ifIndexes, __u64 *timestampsNs, int count) {
+	SocketContext *ctx = socketContextGet(fd);
+	UringEngine *e = ctx != NULL ? ctx->uring : NULL;
+	if (e != NULL) {
+		uringRetain(e);
+	}
+	socketContextPut(ctx);
+	if (e == NULL) {
+		return 0;
+	}
+	int received = 0;
+	while (received == 0) {
+		received = uringRecv(e, frames, ifIndexes, timestampsNs, count);
+		if (received == -1) {
+			break;
+		}
+		ctx = socketContextGet(fd);
+		if (ctx != NULL) {
+			received = rxPipelineFilter(ctx, frames, timestampsNs, received);
+			socketContextPut(ctx);
+		}
+	}
+	const int err = errno;
+	uringRelease(e);
+	if (received == -1) {
+		//multishot recvmsg rejected by the kernel or io_uring disabled meanwhile, stay with recvmmsg
+		if (err == EOPNOTSUPP || err == ECANCELED) {
+			return 0;
+		}
+		errno = err;
+	}
+	return received;
+}
+
+/* passes a frame read directly from the socket through its receive pipeline */
+static int recvAccept(int fd, const struct can_frame *frame) {
+	SocketContext *ctx = socketContextGet(fd);
+	if (ctx == NULL) {
+		return 1;
+	}
+	const int accepted = rxPipelineAccept(ctx, frame);
+	socketContextPut(ctx);
+	return accepted;
+}
+
 JNIEXPORT jobject JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1recvFrame(
 		JNIEnv *env, jclass obj, jint fd) {
 	//const int flags = 0;
 	const int flags = MSG_WAITALL;
 	ssize_t nbytes;
 	struct sockaddr_can addr;
-	socklen_t len = sizeof(addr);
+	socklen_t len;
 	struct can_frame frame;
-	memset(&addr, 0, sizeof(addr));
-	memset(&frame, 0, sizeof(frame));
-	nbytes = recvfrom(fd, &frame, sizeof(frame), flags,
-			reinterpret_cast<struct sockaddr *>(&addr), &len);
-
-	if(   (CAN_NPROTO == 8 && len !=           8 ) //note: linux kernel 5.1:  len ==> 8, probably due to old CAN library support in kunbus connect S
-	   || (CAN_NPROTO == 7 && len != sizeof(addr)) //note: linux kernel 4.19: len ==> sizeof(addr), which is 8 on kunbus connect plus
-					){
-		statsErrorCntrReceive++;
-		throwIllegalArgumentException(env, "illegal AF_CAN address");
-		return NULL;
-	}
-	if (nbytes == -1) {
+	int ifIndex = 0;
+	__u64 timestampNs = 0;
+	const int viaUring = recvUring(fd, &frame, &ifIndex, &timestampNs, 1);
+	if (viaUring == -1) {
 		throwIOExceptionErrno(env, errno);
 		return NULL;
-	} else if (nbytes != sizeof(frame)) {
-		statsErrorCntrReceive++;
-		throwIOExceptionMsg(env, "invalid length of received frame");
-		return NULL;
 	}
+	if (viaUring == 1) {
+		memset(&addr, 0, sizeof(addr));
+		addr.can_ifindex = ifIndex;
+		nbytes = sizeof(frame);
+	} else do {
+		len = sizeof(addr);
+		memset(&addr, 0, sizeof(addr));
+		memset(&frame, 0, sizeof(frame));
+		nbytes = recvfrom(fd, &frame, sizeof(frame), flags,
+				reinterpret_cast<struct sockaddr *>(&addr), &len);
+
+		if(   (CAN_NPROTO == 8 && len !=           8 ) //note: linux kernel 5.1:  len ==> 8, probably due to old CAN library support in kunbus connect S
+		   || (CAN_NPROTO == 7 && len != sizeof(addr)) //note: linux kernel 4.19: len ==> sizeof(addr), which is 8 on kunbus connect plus
+						){
+			statsErrorCntrReceive++;
+			throwIllegalArgumentException(env, "illegal AF_CAN address");
+			return NULL;
+		}
+		if (nbytes == -1) {
+			throwIOExceptionErrno(env, errno);
+			return NULL;
+		} else if (nbytes != sizeof(frame)) {
+			statsErrorCntrReceive++;
+			throwIOExceptionMsg(env, "invalid length of received frame");
+			return NULL;
+		}
+	} while (!recvAccept(fd, &frame));
 	const jsize fsize = static_cast<jsize>(std::min(
 			static_cast<size_t>(frame.can_dlc),
 			static_cast<size_t>(nbytes - offsetof(struct can_frame, data))));
@@ -218,6 +433,195 @@ JNIEXPORT jobject JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1recv
 	return ret;
 }
 
+/* frames per receive call, the receive times for the inventory are kept on the stack */
+#define RECV_FRAMES_BATCH					  64
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1recvFrames(
+		JNIEnv *env, jclass obj, jint fd, jobject buffer, jint offset, jint maxCount) {
+	char *base = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+	if (base == NULL) {
+		throwIllegalArgumentException(env, "not a direct buffer");
+		return -1;
+	}
+	const jlong capacity = env->GetDirectBufferCapacity(buffer);
+	if (offset < 0 || maxCount < 1
+			|| offset + static_cast<jlong>(maxCount) * static_cast<jlong>(sizeof(struct can_frame)) > capacity) {
+		throwIllegalArgumentException(env, "frames exceed the buffer");
+		return -1;
+	}
+	struct can_frame *frames = reinterpret_cast<struct can_frame *>(base + offset);
+	/*
+	 * The receive times are always collected, the kernel only provides them
+	 * while the inventory is enabled, which may happen during the wait. The
+	 * pipeline decides after the receive whether it needs them.
+	 */
+	__u64 timestamps[RECV_FRAMES_BATCH];
+	const int batch = std::min(maxCount, RECV_FRAMES_BATCH);
+	int count = recvUring(fd, frames, NULL, timestamps, batch);
+	if (count == -1) {
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+	//no context held while blocked, closing the socket must not wait for a frame
+	while (count == 0) {
+		count = bulkRecv(fd, frames, timestamps, batch);
+		if (count == -1) {
+			throwIOExceptionErrno(env, errno);
+			return -1;
+		}
+		SocketContext *ctx = socketContextGet(fd);
+		if (ctx != NULL) {
+			count = rxPipelineFilter(ctx, frames, timestamps, count);
+			socketContextPut(ctx);
+		}
+	}
+	return count;
+}
+
+static struct can_filter *getKernelFilters(int fd, socklen_t *size);
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1setIdFilter(
+		JNIEnv *env, jclass obj, jint fd, jintArray ids, jboolean prefilter) {
+	const jsize len = env->GetArrayLength(ids);
+	jint *elements = env->GetIntArrayElements(ids, NULL);
+	if (elements == NULL) {
+		return;
+	}
+	IdFilter *f = idFilterCreate(elements, len);
+	const int err = errno;
+	env->ReleaseIntArrayElements(ids, elements, JNI_ABORT);
+	if (f == NULL) {
+		if (err == EINVAL) {
+			throwIllegalArgumentException(env, "standard CAN ID out of range");
+		} else {
+			throwIOExceptionErrno(env, err);
+		}
+		return;
+	}
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		idFilterDestroy(f);
+		return;
+	}
+	if (prefilter == JNI_TRUE) {
+		//keep the filters of the user to restore them once the ID filter is cleared
+		if (!ctx->idPrefilter) {
+			ctx->savedFilters = getKernelFilters(fd, &ctx->savedFiltersSize);
+			if (ctx->savedFilters == NULL) {
+				throwIOExceptionErrno(env, errno);
+				socketContextUnlock(ctx);
+				idFilterDestroy(f);
+				return;
+			}
+		}
+		struct can_filter filters[2];
+		const int count = idFilterPrefilter(f, filters);
+		if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, count > 0 ? filters : NULL,
+				count * sizeof(struct can_filter)) == -1) {
+			throwIOExceptionErrno(env, errno);
+			if (!ctx->idPrefilter) {
+				free(ctx->savedFilters);
+				ctx->savedFilters = NULL;
+			}
+			socketContextUnlock(ctx);
+			idFilterDestroy(f);
+			return;
+		}
+		ctx->idPrefilter = 1;
+	}
+	rxPipelineSetIdFilter(ctx, f);
+	socketContextUnlock(ctx);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1clearIdFilter(
+		JNIEnv *env, jclass obj, jint fd) {
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return;
+	}
+	if (ctx->idFilter == NULL) {
+		socketContextUnlock(ctx);
+		return;
+	}
+	rxPipelineSetIdFilter(ctx, NULL);
+	if (ctx->idPrefilter) {
+		//the prefilter replaced the kernel filters, restore those of the user
+		ctx->idPrefilter = 0;
+		if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, ctx->savedFiltersSize > 0 ? ctx->savedFilters : NULL,
+				ctx->savedFiltersSize) == -1) {
+			throwIOExceptionErrno(env, errno);
+		}
+		free(ctx->savedFilters);
+		ctx->savedFilters = NULL;
+	}
+	socketContextUnlock(ctx);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1inventoryEnable(
+		JNIEnv *env, jclass obj, jint fd, jboolean enabled) {
+	SocketContext *ctx = enabled == JNI_TRUE ? socketContextCreate(fd) : socketContextGet(fd);
+	if (ctx == NULL) {
+		if (enabled == JNI_TRUE) {
+			throwIOExceptionErrno(env, errno);
+		}
+		return;
+	}
+	if (rxPipelineEnableInventory(ctx, enabled == JNI_TRUE) == -1) {
+		throwIOExceptionErrno(env, errno);
+	}
+	socketContextPut(ctx);
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1inventorySnapshot(
+		JNIEnv *env, jclass obj, jint fd) {
+	SocketContext *ctx = socketContextGet(fd);
+	Inventory *inv = ctx != NULL ? __atomic_load_n(&ctx->inventory, __ATOMIC_ACQUIRE) : NULL;
+	if (inv == NULL) {
+		socketContextPut(ctx);
+		throwIOExceptionMsg(env, "inventory is not enabled");
+		return NULL;
+	}
+	int count = 0;
+	std::unique_ptr<jlong, decltype(&free)> values(inventorySnapshot(inv, &count), &free);
+	socketContextPut(ctx);
+	if (values == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	const jsize len = 1 + count * INVENTORY_FIELDS;
+	const jlongArray result = env->NewLongArray(len);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, len, values.get());
+	return result;
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1rxStats(
+		JNIEnv *env, jclass obj, jint fd) {
+	jlong stats[RX_STATS_COUNT];
+	memset(stats, 0, sizeof(stats));
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL) {
+		rxPipelineGetStats(ctx, stats);
+	}
+	socketContextPut(ctx);
+	const jlongArray result = env->NewLongArray(RX_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, RX_STATS_COUNT, stats);
+	return result;
+}
+
 JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1fetchInterfaceMtu(
 		JNIEnv *env, jclass obj, jint fd, jstring ifName) {
 	struct ifreq ifreq;
@@ -232,6 +636,10 @@ JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1fetchIn
 	if (env->ExceptionCheck() == JNI_TRUE) {
 		return -1;
 	}
+	LinkInfo info;
+	if (netlinkLinkLookup(0, ifreq.ifr_name, &info) == 0) {
+		return static_cast<jint>(info.values[LINK_INFO_MTU]);
+	}
 	if (ioctl(fd, SIOCGIFMTU, &ifreq) == -1) {
 		throwIOExceptionErrno(env, errno);
 		return -1;
@@ -258,7 +666,13 @@ JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1setrece
 	tv.tv_usec = usec;
 	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
 		throwIOExceptionErrno(env, errno);
+		return;
+	}
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->uring != NULL) {
+		uringSetRecvTimeout(ctx->uring, (__u64) sec * 1000000000ULL + (__u64) usec * 1000ULL);
 	}
+	socketContextPut(ctx);
 }
 
 
@@ -385,147 +799,140 @@ size_t getCopySize(size_t sourceSize, size_t destSize) {
 
 
 
-JNIEXPORT jbyteArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1getFilters(
-		JNIEnv *env, jclass obj, jint sock) {
+#define FILTER_TABLE_STACK_SIZE				64
 
-	std::string s; //for logging purposes
+static void setFilterTable(JNIEnv *env, jint fd, const struct can_filter *filters, jint count) {
+	//no filters at all means no frames are received
+	if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, count > 0 ? filters : NULL,
+			count * sizeof(struct can_filter)) == -1) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
 
-	//attempt 1:
-	//socklen_t size = (socklen_t) (sizeof(int) * 4); //Errrm...this is 4 bytes.
-	//attempt 2:
-	//socklen_t size = INT_MAX;
-	//attempt 3:
-	// so, a filter definition is 8 bytes, regardless of platform.
-	// I am making a design decision here to limit the number of filters to 5
-	// so size = 5*8 = 40 bytes
-	socklen_t size = 40;
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1setFilterTable(
+		JNIEnv *env, jclass obj, jint fd, jintArray table) {
+	const jsize len = env->GetArrayLength(table);
+	if (len % 2 != 0) {
+		throwIllegalArgumentException(env, "filter table must hold id/mask pairs");
+		return;
+	}
+	const jint count = len / 2;
+	struct can_filter stackFilters[FILTER_TABLE_STACK_SIZE];
+	std::unique_ptr<struct can_filter[]> heapFilters;
+	struct can_filter *filters = stackFilters;
+	if (count > FILTER_TABLE_STACK_SIZE) {
+		heapFilters.reset(new struct can_filter[count]);
+		filters = heapFilters.get();
+	}
+	//struct can_filter is a pair of 32 bit values, the table is copied as is
+	env->GetIntArrayRegion(table, 0, len, reinterpret_cast<jint *>(filters));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return;
+	}
+	setFilterTable(env, fd, filters, count);
+}
 
-	logthis(s.append("+++++++++++Entering getsockopt"));
-	s = "";
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1setFilterBuffer(
+		JNIEnv *env, jclass obj, jint fd, jobject buffer, jint offset, jint count) {
+	char *base = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+	if (base == NULL) {
+		throwIllegalArgumentException(env, "not a direct buffer");
+		return;
+	}
+	const jlong capacity = env->GetDirectBufferCapacity(buffer);
+	if (offset < 0 || count < 0
+			|| offset + static_cast<jlong>(count) * static_cast<jlong>(sizeof(struct can_filter)) > capacity) {
+		throwIllegalArgumentException(env, "filters exceed the buffer");
+		return;
+	}
+	setFilterTable(env, fd, reinterpret_cast<const struct can_filter *>(base + offset), count);
+}
 
-	std::unique_ptr<char[]> rfilter(new char[size]);
-	// Defer the creation of the out-array until I have a definite on size:
-	// std::unique_ptr<char[]> filters_out(new char[size]);
+/*
+ * Returns the kernel receive filters of the socket (malloc'ed, to be freed by
+ * the caller) and their size in bytes, or NULL with errno set.
+ */
+static struct can_filter *getKernelFilters(int fd, socklen_t *size) {
+	socklen_t capacity = FILTER_TABLE_STACK_SIZE * sizeof(struct can_filter);
+	while (1) {
+		struct can_filter *filters = (struct can_filter*) malloc(capacity);
+		if (filters == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		*size = capacity;
+		if (getsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, size) == -1) {
+			const int err = errno;
+			free(filters);
+			if (err == ERANGE && *size > capacity) {
+				//newer kernels report the required size
+				capacity = *size;
+				continue;
+			}
+			errno = err;
+			return NULL;
+		}
+		if (*size < capacity) {
+			return filters;
+		}
+		//older kernels silently truncate, retry until there is room to spare
+		free(filters);
+		capacity *= 2;
+	}
+}
 
-	int result = getsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, rfilter.get(),
-			&size);
-	if (result == -1) {
+JNIEXPORT jintArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1getFilterTable(
+		JNIEnv *env, jclass obj, jint fd) {
+	socklen_t size;
+	std::unique_ptr<struct can_filter, decltype(&free)> filters(getKernelFilters(fd, &size), &free);
+	if (filters == NULL) {
+		throwIOExceptionErrno(env, errno);
 		return NULL;
 	}
-	// The call to getsockopt has now changed the size argument to the proper size
-	// of the returned result.
-	// See: http://man7.org/linux/man-pages/man2/setsockopt.2.html
-	// I am creating a separate variable here for clarity's sake
-	socklen_t realsize = size;
-	logthis(
-			s.append("Size (bytes) of result after getsockopt: ").append(
-					std::to_string(realsize)));
-	s = "";
-
-	//now, allocate the out-array:
-	std::unique_ptr<char[]> filters_out(new char[realsize]);
-
-	//and copy the results:
-	memcpy(filters_out.get(), rfilter.get(), realsize);
-
-	jbyteArray data = env->NewByteArray(realsize);
-
-	if (data == NULL) {
+	const jsize len = static_cast<jsize>(size / sizeof(jint));
+	const jintArray table = env->NewIntArray(len);
+	if (table == NULL) {
 		if (env->ExceptionCheck() != JNI_TRUE) {
-			throwOutOfMemoryError(env, "could not allocate ByteArray");
+			throwOutOfMemoryError(env, "could not allocate IntArray");
 		}
 		return NULL;
 	}
-
-	env->SetByteArrayRegion(data, 0, realsize,
-			(jbyte *) filters_out.get());
-
-	return data;
+	env->SetIntArrayRegion(table, 0, len, reinterpret_cast<jint *>(filters.get()));
+	return table;
 }
 
-
-JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1setFilters(
-		JNIEnv *env, jclass obj, jint sock, jstring data) {
-
-	std::string s; //for logging purposes
-
-	int numfilter = 0; //to hold the count (number) of filters
-	const char *tempString; // to perform string searches on
-
-	const char *inFilterString = env->GetStringUTFChars(data, NULL);
-	if (NULL == inFilterString)
-			return -1;
-
-	logthis("====== BEGIN setsockopt");
-	// Counting the commas will give us the number of filter definitions
-	// as one filter def has one comma.
-	tempString = inFilterString;
-	std::string noFilter = "0x00000000:0x00000000";
-	while (tempString) {
-		if ((strlen(inFilterString) != 0) && (inFilterString != noFilter))
-			numfilter++;
-		tempString++; /* hop behind the ',' */
-		tempString = strchr(tempString, ','); /* fails if no more commas are found */
-	}
-
-	//Now, numfilter contains the number of filters :)
-	if (numfilter == 0)
-	{
-		logthis("Number of filters is zero; allowing all messages to pass.");
-		return setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, 0, sizeof(0));
-	}
-
-
-	//TODO: This is a VLA, which is not allowed. So, find a way to prevent VLA:
-	struct can_filter rfilter[numfilter];
-	//attempt 1:
-	//typedef can_filter cft;
-	//std::vector<cft> rfilter(numfilter);
-
-
-	// The filter definitions are in the following form: (HEX!):
-	//"0x12345678:0xDFFFFFFF"
-
-	tempString = inFilterString; //re-set the tempString to the full input received.
-	logthis(s.append("Full filter string (setsockopt): ").append(tempString));
-	s = "";
-
-
-	for (int i = 0; i < numfilter; i++) {
-		//cft currentfilter;
-		if (i != 0)
-			tempString = inFilterString + 1; //only hop after the comma on filters after the first;
-		inFilterString = strchr(tempString, ',');
-		sscanf(tempString, "%x:%x", &rfilter[i].can_id, &rfilter[i].can_mask);
-		rfilter[i].can_id |=  CAN_EFF_FLAG;
-		//currentfilter.can_id |=  CAN_EFF_FLAG;
-		rfilter[i].can_mask |= (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK); // I want it all...
-		//currentfilter.can_mask |= (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK); // I want it all...
-		//rfilter.push_back(currentfilter);
-		logthis(
-				s.append("setsockopt filter canid[").append(std::to_string(i)).append(
-						"]:").append(std::to_string(rfilter[i].can_id)));
-		s = "";
-		logthis(
-				s.append("setsockopt filter mask[").append(std::to_string(i)).append(
-						"]:").append(std::to_string(rfilter[i].can_mask)));
-		s = "";
-
-		if (inFilterString == NULL)
-			logthis("NULL");
-	}
-
-	int result = setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter,
-			sizeof(rfilter));
-	logthis(
-			s.append("rfilter size after setsockopt: ").append(
-					std::to_string(sizeof(rfilter))));
-	s = "";
-
-	return result;
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1fetch_1CAN_1RAW_1JOIN_1FILTERS(
+		JNIEnv *env, jclass obj) {
+	return CAN_RAW_JOIN_FILTERS;
 }
 
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1attachBpfFilter(
+		JNIEnv *env, jclass obj, jint fd, jintArray rules) {
+	const jsize len = env->GetArrayLength(rules);
+	jint *elements = env->GetIntArrayElements(rules, NULL);
+	if (elements == NULL) {
+		return;
+	}
+	const int rc = bpfFilterAttach(fd, elements, len);
+	const int err = errno;
+	env->ReleaseIntArrayElements(rules, elements, JNI_ABORT);
+	if (rc == -1) {
+		if (err == E2BIG) {
+			throwIllegalArgumentException(env, "too many filter rules");
+		} else if (err == EINVAL) {
+			throwIllegalArgumentException(env, "malformed filter rules");
+		} else {
+			throwIOExceptionErrno(env, err);
+		}
+	}
+}
 
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1detachBpfFilter(
+		JNIEnv *env, jclass obj, jint fd) {
+	if (bpfFilterDetach(fd) == -1) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
 
 JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendCyclicallyAdd
 (JNIEnv *env, jclass obj, jint fd, jint if_idx, jint canid, jbyteArray data, jint cycleTime)
@@ -621,4 +1028,1064 @@ JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1statsGe
 {
 	jint result = statsGetCanFrameFramesSendPerCycle();
 	return result;
-}
\ No newline at end of file
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1txQueueEnable
+	(JNIEnv *env, jclass obj, jint fd, jint capacity, jint policy, jint order, jint maxInFlight)
+{
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return;
+	}
+	if (ctx->txQueue != NULL) {
+		socketContextUnlock(ctx);
+		throwIOExceptionMsg(env, "transmit queue is already enabled");
+		return;
+	}
+	TxQueue *q = txQueueCreate(fd, capacity, policy, order, maxInFlight);
+	if (q == NULL) {
+		const int err = errno;
+		socketContextUnlock(ctx);
+		throwIOExceptionErrno(env, err);
+		return;
+	}
+	ctx->txQueue = q;
+	socketContextUnlock(ctx);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1txQueueDisable
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	//wake blocked submitters first, they hold the context
+	SocketContext *ctx = socketContextGet(fd);
+	if (ctx == NULL || ctx->txQueue == NULL) {
+		socketContextPut(ctx);
+		return;
+	}
+	TxQueue *q = ctx->txQueue;
+	txQueueStop(q);
+	socketContextPut(ctx);
+	ctx = socketContextLock(fd);
+	if (ctx == NULL || ctx->txQueue != q) {
+		//disabled or closed meanwhile
+		if (ctx != NULL) {
+			socketContextUnlock(ctx);
+		}
+		return;
+	}
+	ctx->txQueue = NULL;
+	socketContextUnlock(ctx);
+	txQueueDestroy(q);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1dispatcherStart
+	(JNIEnv *env, jclass obj, jint fd, jobject listener, jobject buffer, jint maxBatch, jint maxDelayUs)
+{
+	//the dispatch thread reads through the context, it waits for the lock until the dispatcher is registered
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return;
+	}
+	if (ctx->dispatcher != NULL) {
+		socketContextUnlock(ctx);
+		throwIOExceptionMsg(env, "dispatcher is already running");
+		return;
+	}
+	Dispatcher *d = dispatcherCreate(env, fd, listener, buffer, maxBatch, maxDelayUs);
+	if (d == NULL) {
+		const int err = errno;
+		socketContextUnlock(ctx);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return;
+		}
+		if (err == EINVAL) {
+			throwIllegalArgumentException(env, "illegal dispatcher parameters");
+		} else {
+			throwIOExceptionErrno(env, err);
+		}
+		return;
+	}
+	ctx->dispatcher = d;
+	socketContextUnlock(ctx);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1dispatcherStop
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	SocketContext *ctx = socketContextGet(fd);
+	if (ctx == NULL || ctx->dispatcher == NULL) {
+		socketContextPut(ctx);
+		return;
+	}
+	socketContextPut(ctx);
+	ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		return;
+	}
+	Dispatcher *d = ctx->dispatcher;
+	ctx->dispatcher = NULL;
+	socketContextUnlock(ctx);
+	//joins the thread, which takes the context lock itself
+	dispatcherDestroy(d);
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1dispatcherStats
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	jlong stats[DISPATCH_STATS_COUNT];
+	memset(stats, 0, sizeof(stats));
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->dispatcher != NULL) {
+		dispatcherGetStats(ctx->dispatcher, stats);
+	}
+	socketContextPut(ctx);
+	const jlongArray result = env->NewLongArray(DISPATCH_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, DISPATCH_STATS_COUNT, stats);
+	return result;
+}
+
+JNIEXPORT jboolean JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1uringEnable
+	(JNIEnv *env, jclass obj, jint fd, jint rxBuffers, jint txDepth)
+{
+	if (rxBuffers < 1 || rxBuffers > URING_RX_BUFFERS_MAX || (rxBuffers & (rxBuffers - 1)) != 0
+			|| txDepth < 1 || txDepth > URING_TX_DEPTH_MAX) {
+		throwIllegalArgumentException(env, "illegal io_uring parameters");
+		return JNI_FALSE;
+	}
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return JNI_FALSE;
+	}
+	if (ctx->uring != NULL) {
+		socketContextUnlock(ctx);
+		throwIOExceptionMsg(env, "io_uring is already enabled");
+		return JNI_FALSE;
+	}
+	UringEngine *e = uringCreate(fd, rxBuffers, txDepth);
+	if (e != NULL) {
+		ctx->uring = e;
+	}
+	socketContextUnlock(ctx);
+	if (e == NULL) {
+		if (uringUnsupported(errno)) {
+			CANLOG_INFO("CAN socket %d: io_uring not supported (%s), using recvmmsg/sendmmsg", fd,
+					strerror(errno));
+			return JNI_FALSE;
+		}
+		throwIOExceptionErrno(env, errno);
+		return JNI_FALSE;
+	}
+	return JNI_TRUE;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1uringDisable
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	SocketContext *ctx = socketContextGet(fd);
+	if (ctx == NULL || ctx->uring == NULL) {
+		socketContextPut(ctx);
+		return;
+	}
+	socketContextPut(ctx);
+	ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		return;
+	}
+	UringEngine *e = ctx->uring;
+	ctx->uring = NULL;
+	socketContextUnlock(ctx);
+	//a receiver waiting in the engine goes on with recvmmsg, the last one out frees it
+	uringDestroy(e);
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1uringStats
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	jlong stats[URING_STATS_COUNT];
+	memset(stats, 0, sizeof(stats));
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->uring != NULL) {
+		uringGetStats(ctx->uring, stats);
+	}
+	socketContextPut(ctx);
+	const jlongArray result = env->NewLongArray(URING_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, URING_STATS_COUNT, stats);
+	return result;
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1txQueueStats
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	jlong stats[TXQ_STATS_COUNT];
+	memset(stats, 0, sizeof(stats));
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->txQueue != NULL) {
+		txQueueGetStats(ctx->txQueue, stats);
+	}
+	socketContextPut(ctx);
+	const jlongArray result = env->NewLongArray(TXQ_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, TXQ_STATS_COUNT, stats);
+	return result;
+}
+
+/* returns the context of the socket with its timed sender, created on first use */
+static SocketContext *timedSenderContext(int fd) {
+	SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->timedSender != NULL) {
+		return ctx;
+	}
+	socketContextPut(ctx);
+	ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		return NULL;
+	}
+	if (ctx->timedSender == NULL) {
+		ctx->timedSender = timedSenderCreate();
+	}
+	const int created = ctx->timedSender != NULL;
+	const int err = errno;
+	socketContextUnlock(ctx);
+	if (!created) {
+		errno = err;
+		return NULL;
+	}
+	//the sender stays until the socket is closed
+	ctx = socketContextGet(fd);
+	if (ctx == NULL) {
+		errno = EBADF;
+	}
+	return ctx;
+}
+
+JNIEXPORT jlong JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFrameAt
+	(JNIEnv *env, jclass obj, jint fd, jint if_idx, jint canid, jbyteArray data, jlong launchNanos)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	const jsize len = env->GetArrayLength(data);
+	if (len > CAN_MAX_DLEN) {
+		throwIllegalArgumentException(env, "illegal frame length");
+		return 0;
+	}
+	frame.can_id = canid;
+	frame.can_dlc = static_cast<__u8>(len);
+	env->GetByteArrayRegion(data, 0, len, reinterpret_cast<jbyte *>(&frame.data));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return 0;
+	}
+	SocketContext *ctx = timedSenderContext(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	jlong deltaNs = 0;
+	const int rc = timedSend(ctx->timedSender, fd, if_idx, &frame, launchNanos, &deltaNs);
+	const int err = errno;
+	socketContextPut(ctx);
+	if (rc == -1 && err == ERANGE) {
+		throwIllegalArgumentException(env, "launch time is more than 60 s ahead");
+		return 0;
+	}
+	if (rc == -1) {
+		statsErrorCntrSend++;
+		throwIOExceptionErrno(env, err);
+		return 0;
+	}
+	return deltaNs;
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFrameAtMode
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	const SocketContext *ctx = socketContextGet(fd);
+	const jint mode = ctx != NULL && ctx->timedSender != NULL ? timedSenderMode(ctx->timedSender)
+			: TIMED_SEND_MODE_UNKNOWN;
+	socketContextPut(ctx);
+	return mode;
+}
+
+/* returns the context of the socket with its confirm sender, created on first use */
+static SocketContext *confirmSenderContext(int fd) {
+	SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->confirmSender != NULL) {
+		return ctx;
+	}
+	socketContextPut(ctx);
+	ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		return NULL;
+	}
+	if (ctx->confirmSender == NULL) {
+		ctx->confirmSender = confirmSenderCreate();
+	}
+	const int created = ctx->confirmSender != NULL;
+	const int err = errno;
+	socketContextUnlock(ctx);
+	if (!created) {
+		errno = err;
+		return NULL;
+	}
+	ctx = socketContextGet(fd);
+	if (ctx == NULL) {
+		errno = EBADF;
+	}
+	return ctx;
+}
+
+JNIEXPORT jlong JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sendFrameConfirmed
+	(JNIEnv *env, jclass obj, jint fd, jint if_idx, jint canid, jbyteArray data, jint timeoutMs)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	const jsize len = env->GetArrayLength(data);
+	if (len > CAN_MAX_DLEN) {
+		throwIllegalArgumentException(env, "illegal frame length");
+		return 0;
+	}
+	if (if_idx <= 0) {
+		throwIllegalArgumentException(env, "confirmed send needs a specific interface");
+		return 0;
+	}
+	frame.can_id = canid;
+	frame.can_dlc = static_cast<__u8>(len);
+	env->GetByteArrayRegion(data, 0, len, reinterpret_cast<jbyte *>(&frame.data));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return 0;
+	}
+	SocketContext *ctx = confirmSenderContext(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	jlong timestampNs = 0;
+	const int rc = confirmedSend(ctx->confirmSender, ctx->txQueue, if_idx, &frame, timeoutMs, &timestampNs);
+	const int err = errno;
+	socketContextPut(ctx);
+	if (rc == -1) {
+		if (err == ETIMEDOUT) {
+			throwSocketTimeoutException(env, "no echo of the frame seen on the bus");
+		} else {
+			statsErrorCntrSend++;
+			throwIOExceptionErrno(env, err);
+		}
+		return 0;
+	}
+	return timestampNs;
+}
+
+JNIEXPORT jobject JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1txRingCreate
+	(JNIEnv *env, jclass obj, jint fd, jint capacity)
+{
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	if (ctx->txRing != NULL) {
+		socketContextUnlock(ctx);
+		throwIOExceptionMsg(env, "transmit ring is already open");
+		return NULL;
+	}
+	TxRing *r = txRingCreate(fd, capacity);
+	if (r == NULL) {
+		const int err = errno;
+		socketContextUnlock(ctx);
+		throwIOExceptionErrno(env, err);
+		return NULL;
+	}
+	size_t size = 0;
+	void *memory = txRingMemory(r, &size);
+	const jobject buffer = env->NewDirectByteBuffer(memory, static_cast<jlong>(size));
+	if (buffer != NULL) {
+		//released by the Cleaner of the Java ring
+		sharedMemoryRetain(memory);
+		ctx->txRing = r;
+	}
+	socketContextUnlock(ctx);
+	if (buffer == NULL) {
+		txRingDestroy(r);
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate DirectByteBuffer");
+		}
+		return NULL;
+	}
+	return buffer;
+}
+
+JNIEXPORT jlong JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1directBufferAddress
+	(JNIEnv *env, jclass obj, jobject buffer)
+{
+	return reinterpret_cast<jlong>(env->GetDirectBufferAddress(buffer));
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1sharedMemoryRelease
+	(JNIEnv *env, jclass obj, jlong address)
+{
+	sharedMemoryRelease(reinterpret_cast<void *>(address));
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1txRingWake
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->txRing != NULL) {
+		txRingWake(ctx->txRing);
+	}
+	socketContextPut(ctx);
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1txRingDestroy
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		return;
+	}
+	TxRing *r = ctx->txRing;
+	ctx->txRing = NULL;
+	socketContextUnlock(ctx);
+	//the sender thread takes the context, so only after unlocking
+	if (r != NULL) {
+		txRingDestroy(r);
+	}
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1txRingStats
+	(JNIEnv *env, jclass obj, jint fd)
+{
+	jlong stats[TX_RING_STATS_COUNT];
+	memset(stats, 0, sizeof(stats));
+	const SocketContext *ctx = socketContextGet(fd);
+	if (ctx != NULL && ctx->txRing != NULL) {
+		txRingGetStats(ctx->txRing, stats);
+	}
+	socketContextPut(ctx);
+	const jlongArray result = env->NewLongArray(TX_RING_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, TX_RING_STATS_COUNT, stats);
+	return result;
+}
+
+JNIEXPORT jobject JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1errorMonitorOpen
+	(JNIEnv *env, jclass obj, jint ifIndex)
+{
+	ErrorMonitor *m = errorMonitorAcquire(ifIndex);
+	if (m == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	//the buffer keeps its own reference, Java releases it through the cleaner
+	void *memory = errorMonitorMemory(m);
+	sharedMemoryRetain(memory);
+	const jobject buffer = env->NewDirectByteBuffer(memory, ERRMON_SHARED_SIZE);
+	if (buffer == NULL) {
+		sharedMemoryRelease(memory);
+		errorMonitorRelease(m);
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate DirectByteBuffer");
+		}
+		return NULL;
+	}
+	return buffer;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1errorMonitorClose
+	(JNIEnv *env, jclass obj, jlong address)
+{
+	//releases exactly the reference taken by _errorMonitorOpen for this buffer
+	ErrorMonitor *m = errorMonitorOfMemory(reinterpret_cast<const void *>(address));
+	if (m != NULL) {
+		errorMonitorRelease(m);
+	}
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1errorMonitorAwait
+	(JNIEnv *env, jclass obj, jint ifIndex, jint seenChanges, jint timeoutMs)
+{
+	ErrorMonitor *m = errorMonitorGet(ifIndex);
+	if (m == NULL) {
+		throwIOExceptionMsg(env, "error monitor is not open");
+		return -1;
+	}
+	const jint changes = errorMonitorAwait(m, seenChanges, timeoutMs);
+	errorMonitorRelease(m);
+	return changes;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1busSupervisorStart
+	(JNIEnv *env, jclass obj, jint ifIndex, jint initialBackoffMs, jint maxBackoffMs, jint stableMs,
+			jint resumeStaggerMs)
+{
+	if (busSupervisorStart(ifIndex, initialBackoffMs, maxBackoffMs, stableMs, resumeStaggerMs) == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal bus-off supervisor parameters");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1busSupervisorStop
+	(JNIEnv *env, jclass obj, jint ifIndex)
+{
+	busSupervisorStop(ifIndex);
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1busSupervisorStats
+	(JNIEnv *env, jclass obj, jint ifIndex)
+{
+	jlong stats[BUSSUP_STATS_COUNT];
+	if (busSupervisorGetStats(ifIndex, stats) == -1) {
+		throwIOExceptionMsg(env, "interface is not supervised");
+		return NULL;
+	}
+	const jlongArray result = env->NewLongArray(BUSSUP_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, BUSSUP_STATS_COUNT, stats);
+	return result;
+}
+
+JNIEXPORT jlong JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1busSupervisorAwait
+	(JNIEnv *env, jclass obj, jint ifIndex, jlong seenEvents, jint timeoutMs)
+{
+	const jlong events = busSupervisorAwait(ifIndex, seenEvents, timeoutMs);
+	if (events == -1) {
+		throwIOExceptionMsg(env, "interface is not supervised");
+	}
+	return events;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1busLoadStart
+	(JNIEnv *env, jclass obj, jint ifIndex, jint stuffing, jint bitrate, jint dataBitrate)
+{
+	if (busLoadStart(ifIndex, stuffing, bitrate, dataBitrate) == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal bus load parameters or unknown bitrate");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1busLoadStop
+	(JNIEnv *env, jclass obj, jint ifIndex)
+{
+	busLoadStop(ifIndex);
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1busLoadStats
+	(JNIEnv *env, jclass obj, jint ifIndex, jint windowMs)
+{
+	jlong stats[BUSLOAD_STATS_COUNT];
+	if (busLoadGet(ifIndex, windowMs, stats) == -1) {
+		throwIOExceptionMsg(env, "bus load of the interface is not measured");
+		return NULL;
+	}
+	const jlongArray result = env->NewLongArray(BUSLOAD_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, BUSLOAD_STATS_COUNT, stats);
+	return result;
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1frameBits
+	(JNIEnv *env, jclass obj, jint canId, jbyteArray data, jint stuffing)
+{
+	struct canfd_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	const jsize len = env->GetArrayLength(data);
+	if (len > CAN_MAX_DLEN || (stuffing != BUSLOAD_STUFFING_NONE && stuffing != BUSLOAD_STUFFING_WORST
+			&& stuffing != BUSLOAD_STUFFING_EXACT)) {
+		throwIllegalArgumentException(env, "illegal frame length or stuffing mode");
+		return -1;
+	}
+	frame.can_id = (canid_t) canId;
+	frame.len = (__u8) len;
+	env->GetByteArrayRegion(data, 0, len, (jbyte*) frame.data);
+	int dataBits;
+	return frameBits(&frame, 0, stuffing, &dataBits);
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxSubscribe
+	(JNIEnv *env, jclass obj, jint ifIndex, jintArray table, jint capacity)
+{
+	const jsize len = env->GetArrayLength(table);
+	if (len % 2 != 0) {
+		throwIllegalArgumentException(env, "filter table must hold id/mask pairs");
+		return -1;
+	}
+	const jint count = len / 2;
+	struct can_filter stackFilters[FILTER_TABLE_STACK_SIZE];
+	std::unique_ptr<struct can_filter[]> heapFilters;
+	struct can_filter *filters = stackFilters;
+	if (count > FILTER_TABLE_STACK_SIZE) {
+		heapFilters.reset(new struct can_filter[count]);
+		filters = heapFilters.get();
+	}
+	env->GetIntArrayRegion(table, 0, len, reinterpret_cast<jint *>(filters));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	const jint handle = muxSubscribe(ifIndex, filters, count, capacity);
+	if (handle == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal interface index or queue capacity");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+	return handle;
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxSubscribeOnChange
+	(JNIEnv *env, jclass obj, jint ifIndex, jintArray table, jint capacity, jint keepaliveMs,
+			jlong defaultIgnore, jintArray ids, jlongArray ignoreMasks)
+{
+	const jsize len = env->GetArrayLength(table);
+	const jsize maskCount = env->GetArrayLength(ids);
+	if (len % 2 != 0 || env->GetArrayLength(ignoreMasks) != maskCount) {
+		throwIllegalArgumentException(env, "filter table must hold id/mask pairs, one ignore mask per id");
+		return -1;
+	}
+	const jint count = len / 2;
+	struct can_filter stackFilters[FILTER_TABLE_STACK_SIZE];
+	std::unique_ptr<struct can_filter[]> heapFilters;
+	struct can_filter *filters = stackFilters;
+	if (count > FILTER_TABLE_STACK_SIZE) {
+		heapFilters.reset(new struct can_filter[count]);
+		filters = heapFilters.get();
+	}
+	std::unique_ptr<jint[]> maskIds(new jint[std::max(maskCount, 1)]);
+	std::unique_ptr<jlong[]> masks(new jlong[std::max(maskCount, 1)]);
+	env->GetIntArrayRegion(table, 0, len, reinterpret_cast<jint *>(filters));
+	env->GetIntArrayRegion(ids, 0, maskCount, maskIds.get());
+	env->GetLongArrayRegion(ignoreMasks, 0, maskCount, masks.get());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	ChangeFilter *cf = changeFilterCreate(defaultIgnore, maskIds.get(), masks.get(), maskCount, keepaliveMs);
+	const jint handle = cf != NULL ? muxSubscribeOnChange(ifIndex, filters, count, capacity, cf) : -1;
+	if (handle == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal interface index, queue capacity or keepalive");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+	return handle;
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxSubscribeDecimated
+	(JNIEnv *env, jclass obj, jint ifIndex, jintArray table, jint capacity, jintArray rules)
+{
+	const jsize len = env->GetArrayLength(table);
+	const jsize rulesLen = env->GetArrayLength(rules);
+	if (len % 2 != 0 || rulesLen % DECIMATOR_RULE_INTS != 0) {
+		throwIllegalArgumentException(env, "filter table must hold id/mask pairs");
+		return -1;
+	}
+	const jint count = len / 2;
+	struct can_filter stackFilters[FILTER_TABLE_STACK_SIZE];
+	std::unique_ptr<struct can_filter[]> heapFilters;
+	struct can_filter *filters = stackFilters;
+	if (count > FILTER_TABLE_STACK_SIZE) {
+		heapFilters.reset(new struct can_filter[count]);
+		filters = heapFilters.get();
+	}
+	std::unique_ptr<jint[]> ruleTable(new jint[std::max(rulesLen, 1)]);
+	env->GetIntArrayRegion(table, 0, len, reinterpret_cast<jint *>(filters));
+	env->GetIntArrayRegion(rules, 0, rulesLen, ruleTable.get());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	Decimator *dec = decimatorCreate(ruleTable.get(), rulesLen / DECIMATOR_RULE_INTS);
+	const jint handle = dec != NULL ? muxSubscribeDecimated(ifIndex, filters, count, capacity, dec) : -1;
+	if (handle == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal interface index, queue capacity or rate policy");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+	return handle;
+}
+
+JNIEXPORT jintArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxSubscribeSharded
+	(JNIEnv *env, jclass obj, jint ifIndex, jintArray table, jint capacity, jint shards, jintArray rules)
+{
+	const jsize len = env->GetArrayLength(table);
+	const jsize rulesLen = env->GetArrayLength(rules);
+	if (len % 2 != 0 || rulesLen % SHARD_RULE_INTS != 0) {
+		throwIllegalArgumentException(env, "filter table must hold id/mask pairs");
+		return NULL;
+	}
+	const jint count = len / 2;
+	struct can_filter stackFilters[FILTER_TABLE_STACK_SIZE];
+	std::unique_ptr<struct can_filter[]> heapFilters;
+	struct can_filter *filters = stackFilters;
+	if (count > FILTER_TABLE_STACK_SIZE) {
+		heapFilters.reset(new struct can_filter[count]);
+		filters = heapFilters.get();
+	}
+	std::unique_ptr<jint[]> ruleTable(new jint[std::max(rulesLen, 1)]);
+	env->GetIntArrayRegion(table, 0, len, reinterpret_cast<jint *>(filters));
+	env->GetIntArrayRegion(rules, 0, rulesLen, ruleTable.get());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return NULL;
+	}
+	jint handles[SHARDS_MAX];
+	Sharder *sh = sharderCreate(shards, ruleTable.get(), rulesLen / SHARD_RULE_INTS);
+	if (sh == NULL || muxSubscribeSharded(ifIndex, filters, count, capacity, sh, handles) == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal interface index, queue capacity, shard count or range");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+		return NULL;
+	}
+	const jintArray result = env->NewIntArray(shards);
+	if (result == NULL) {
+		for (int i = 0; i < shards; i++) {
+			muxUnsubscribe(handles[i]);
+		}
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate IntArray");
+		}
+		return NULL;
+	}
+	env->SetIntArrayRegion(result, 0, shards, handles);
+	return result;
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxSubscribeWatchdog
+	(JNIEnv *env, jclass obj, jint ifIndex, jintArray ids, jintArray timeoutsMs, jint capacity)
+{
+	const jsize count = env->GetArrayLength(ids);
+	if (env->GetArrayLength(timeoutsMs) != count) {
+		throwIllegalArgumentException(env, "one timeout per id required");
+		return -1;
+	}
+	std::unique_ptr<jint[]> idValues(new jint[std::max(count, 1)]);
+	std::unique_ptr<jint[]> timeoutValues(new jint[std::max(count, 1)]);
+	env->GetIntArrayRegion(ids, 0, count, idValues.get());
+	env->GetIntArrayRegion(timeoutsMs, 0, count, timeoutValues.get());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	const jint handle = muxSubscribeWatchdog(ifIndex, idValues.get(), timeoutValues.get(), count, capacity);
+	if (handle == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal interface index, queue capacity, CAN ids or timeouts");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+	return handle;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxUnsubscribe
+	(JNIEnv *env, jclass obj, jint handle)
+{
+	muxUnsubscribe(handle);
+}
+
+JNIEXPORT jobject JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxRecv
+	(JNIEnv *env, jclass obj, jint handle, jint ifIndex, jint timeoutMs)
+{
+	struct can_frame frame;
+	jlong changed = 0;
+	const int count = muxRecv(handle, &frame, &changed, 1, timeoutMs);
+	if (count == -1) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	if (count == 0) {
+		return NULL;
+	}
+	const jsize fsize = static_cast<jsize>(std::min(static_cast<size_t>(frame.can_dlc),
+			sizeof(frame.data)));
+	const jclass can_frame_clazz = env->FindClass("io/openems/edge/socketcan/driver/"
+			"CanSocket$CanFrame");
+	if (can_frame_clazz == NULL) {
+		return NULL;
+	}
+	const jmethodID can_frame_cstr = env->GetMethodID(can_frame_clazz, "<init>",
+			"(II[BJ)V");
+	if (can_frame_cstr == NULL) {
+		return NULL;
+	}
+	const jbyteArray data = env->NewByteArray(fsize);
+	if (data == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate ByteArray");
+		}
+		return NULL;
+	}
+	env->SetByteArrayRegion(data, 0, fsize, reinterpret_cast<jbyte *>(&frame.data));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return NULL;
+	}
+	return env->NewObject(can_frame_clazz, can_frame_cstr, ifIndex, frame.can_id, data, changed);
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxRecvFrames
+	(JNIEnv *env, jclass obj, jint handle, jobject buffer, jint offset, jint maxCount, jlongArray changes,
+			jint timeoutMs)
+{
+	char *base = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+	if (base == NULL) {
+		throwIllegalArgumentException(env, "not a direct buffer");
+		return -1;
+	}
+	const jlong capacity = env->GetDirectBufferCapacity(buffer);
+	if (offset < 0 || maxCount < 1
+			|| offset + static_cast<jlong>(maxCount) * static_cast<jlong>(sizeof(struct can_frame)) > capacity
+			|| (changes != NULL && env->GetArrayLength(changes) < maxCount)) {
+		throwIllegalArgumentException(env, "frames exceed the buffer");
+		return -1;
+	}
+	std::unique_ptr<jlong[]> bits(changes != NULL ? new jlong[maxCount] : NULL);
+	const int count = muxRecv(handle, reinterpret_cast<struct can_frame *>(base + offset), bits.get(), maxCount,
+			timeoutMs);
+	if (count == -1) {
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+	if (changes != NULL && count > 0) {
+		env->SetLongArrayRegion(changes, 0, count, bits.get());
+	}
+	return count;
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1muxStats
+	(JNIEnv *env, jclass obj, jint handle)
+{
+	jlong stats[MUX_STATS_COUNT];
+	if (muxGetStats(handle, stats) == -1) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	const jlongArray result = env->NewLongArray(MUX_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, MUX_STATS_COUNT, stats);
+	return result;
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1mailboxOpen
+	(JNIEnv *env, jclass obj, jint ifIndex, jintArray ids)
+{
+	const jsize count = env->GetArrayLength(ids);
+	std::unique_ptr<jint[]> values(new jint[std::max(count, 1)]);
+	env->GetIntArrayRegion(ids, 0, count, values.get());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	Mailbox *mb = mailboxCreate(values.get(), count);
+	const jint handle = mb != NULL ? muxSubscribeMailbox(ifIndex, mb) : -1;
+	if (handle == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal interface index or CAN ids");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+	return handle;
+}
+
+JNIEXPORT jobject JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1mailboxBuffer
+	(JNIEnv *env, jclass obj, jint handle)
+{
+	jlong size = 0;
+	void *mem = muxMailboxMemory(handle, &size);
+	if (mem == NULL) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	//the reference is released by the Cleaner of the Java mailbox
+	const jobject buffer = env->NewDirectByteBuffer(mem, size);
+	if (buffer == NULL) {
+		sharedMemoryRelease(mem);
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate DirectByteBuffer");
+		}
+	}
+	return buffer;
+}
+
+/* copies the name of a shared memory bus, returns -1 with an exception pending if it is illegal */
+static int getShmBusName(JNIEnv *env, jstring name, char *buffer) {
+	const jsize nameSize = env->GetStringUTFLength(name);
+	if (nameSize > SHM_BUS_NAME_MAX || nameSize < 1) {
+		throwIllegalArgumentException(env, "illegal shared bus name");
+		return -1;
+	}
+	memset(buffer, 0, SHM_BUS_NAME_MAX + 1);
+	env->GetStringUTFRegion(name, 0, env->GetStringLength(name), buffer);
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	return 0;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1shmBusPublish
+	(JNIEnv *env, jclass obj, jint ifIndex, jstring name, jint capacity)
+{
+	char buffer[SHM_BUS_NAME_MAX + 1];
+	if (getShmBusName(env, name, buffer) == -1) {
+		return;
+	}
+	if (shmBusPublish(ifIndex, buffer, capacity) == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal interface index, name or capacity");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1shmBusUnpublish
+	(JNIEnv *env, jclass obj, jstring name)
+{
+	char buffer[SHM_BUS_NAME_MAX + 1];
+	if (getShmBusName(env, name, buffer) == -1) {
+		return;
+	}
+	shmBusUnpublish(buffer);
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1shmBusOpen
+	(JNIEnv *env, jclass obj, jstring name)
+{
+	char buffer[SHM_BUS_NAME_MAX + 1];
+	if (getShmBusName(env, name, buffer) == -1) {
+		return -1;
+	}
+	const jint handle = shmBusOpen(buffer);
+	if (handle == -1) {
+		if (errno == EINVAL) {
+			throwIllegalArgumentException(env, "illegal shared bus name");
+		} else if (errno == EPROTO) {
+			throwIOExceptionMsg(env, "not a CAN shared bus or incompatible version");
+		} else {
+			throwIOExceptionErrno(env, errno);
+		}
+	}
+	return handle;
+}
+
+JNIEXPORT void JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1shmBusClose
+	(JNIEnv *env, jclass obj, jint handle)
+{
+	shmBusClose(handle);
+}
+
+JNIEXPORT jint JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1shmBusRead
+	(JNIEnv *env, jclass obj, jint handle, jobject buffer, jint offset, jint maxCount, jlongArray timestamps,
+			jint timeoutMs)
+{
+	char *base = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+	if (base == NULL) {
+		throwIllegalArgumentException(env, "not a direct buffer");
+		return -1;
+	}
+	const jlong capacity = env->GetDirectBufferCapacity(buffer);
+	if (offset < 0 || maxCount < 1
+			|| offset + static_cast<jlong>(maxCount) * static_cast<jlong>(sizeof(struct can_frame)) > capacity
+			|| (timestamps != NULL && env->GetArrayLength(timestamps) < maxCount)) {
+		throwIllegalArgumentException(env, "frames exceed the buffer");
+		return -1;
+	}
+	std::unique_ptr<jlong[]> stamps(new jlong[maxCount]);
+	const int count = shmBusRead(handle, reinterpret_cast<struct can_frame *>(base + offset), stamps.get(),
+			maxCount, timeoutMs);
+	if (count == -1) {
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+	if (timestamps != NULL && count > 0) {
+		env->SetLongArrayRegion(timestamps, 0, count, stamps.get());
+	}
+	return count;
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1shmBusStats
+	(JNIEnv *env, jclass obj, jint handle)
+{
+	jlong stats[SHMBUS_STATS_COUNT];
+	if (shmBusGetStats(handle, stats) == -1) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	const jlongArray result = env->NewLongArray(SHMBUS_STATS_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, SHMBUS_STATS_COUNT, stats);
+	return result;
+}
+
+JNIEXPORT jlongArray JNICALL Java_io_openems_edge_socketcan_driver_CanSocket__1linkInfo
+	(JNIEnv *env, jclass obj, jint ifIndex)
+{
+	if (ifIndex <= 0) {
+		throwIllegalArgumentException(env, "illegal interface index");
+		return NULL;
+	}
+	LinkInfo info;
+	if (netlinkLinkQuery(ifIndex, &info) == -1) {
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	const jlongArray result = env->NewLongArray(LINK_INFO_COUNT);
+	if (result == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate LongArray");
+		}
+		return NULL;
+	}
+	env->SetLongArrayRegion(result, 0, LINK_INFO_COUNT, info.values);
+	return result;
+}
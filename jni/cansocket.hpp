@@ -15,12 +15,42 @@
 #include "io_openems_edge_socketcan_driver_CanSocket.h"
 //#endif
 
+#include <pthread.h>
 
-void logthis(std::string msg);
+
+/* asynchronous logging, see native_log.cpp; levels are those of syslog */
+#define CANLOG_LEVEL_ERROR						3
+#define CANLOG_LEVEL_WARN						4
+#define CANLOG_LEVEL_INFO						6
+#define CANLOG_LEVEL_DEBUG						7
+
+/* messages above this level are not compiled in at all */
+#ifndef CANLOG_COMPILE_LEVEL
+#define CANLOG_COMPILE_LEVEL					CANLOG_LEVEL_INFO
+#endif
+
+extern int canlogLevel;
+
+#define CANLOG(level, ...) \
+	do { \
+		if ((level) <= CANLOG_COMPILE_LEVEL && (level) <= __atomic_load_n(&canlogLevel, __ATOMIC_RELAXED)) { \
+			canlogWrite((level), __VA_ARGS__); \
+		} \
+	} while (0)
+#define CANLOG_ERROR(...)						CANLOG(CANLOG_LEVEL_ERROR, __VA_ARGS__)
+#define CANLOG_WARN(...)						CANLOG(CANLOG_LEVEL_WARN, __VA_ARGS__)
+#define CANLOG_INFO(...)						CANLOG(CANLOG_LEVEL_INFO, __VA_ARGS__)
+#define CANLOG_DEBUG(...)						CANLOG(CANLOG_LEVEL_DEBUG, __VA_ARGS__)
+
+void canlogInit(JavaVM *vm);
+void canlogWrite(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void canlogSetLevel(int level);
+int canlogSetForwarding(JNIEnv *env, jclass clazz);
 
 void throwException(JNIEnv *env, const std::string& exception_name, const std::string& msg);
 void throwIOExceptionMsg(JNIEnv *env, const std::string& msg);
 void throwIOExceptionErrno(JNIEnv *env, const int exc_errno);
+void throwSocketTimeoutException(JNIEnv *env, const std::string& message);
 void throwIllegalArgumentException(JNIEnv *env, const std::string& message);
 void throwOutOfMemoryError(JNIEnv *env, const std::string& message);
 
@@ -30,7 +60,438 @@ int cyclicalTaskRemoveCanFrame(jint canid);
 int cyclicalTaskAdoptCanFrame(jint canid, jint len, jbyte *buffer);
 int cyclicalTaskRemoveAll(void);
 int cyclicalAutoIncrementAddFunctionality( jint canid, jint autoIncrementBytePos );
+void cyclicalTaskSetPaused(jint if_idx, int paused);
+void cyclicalTaskRemoveSocket(jint fd);
 int statsGetCanFrameErrorCntrCyclicalSend();
 int statsGetCanFrameFramesSendPerCycle();
 
+/* transmit queue, see tx_queue.cpp */
+#define TXQ_POLICY_BLOCK						0
+#define TXQ_POLICY_DROP_OLDEST					1
+#define TXQ_POLICY_DROP_NEWEST					2
+#define TXQ_POLICY_COALESCE						3
+
+#define TXQ_ORDER_FIFO							0
+#define TXQ_ORDER_PRIORITY						1
+
+#define TXQ_OK									0
+#define TXQ_DROPPED								1
+#define TXQ_ERROR							   -1
+
+#define TXQ_STAT_SUBMITTED						0
+#define TXQ_STAT_SENT							1
+#define TXQ_STAT_DROPPED_OLDEST					2
+#define TXQ_STAT_DROPPED_NEWEST					3
+#define TXQ_STAT_COALESCED						4
+#define TXQ_STAT_BLOCKED						5
+#define TXQ_STAT_CONGESTED						6
+#define TXQ_STAT_ERRORS							7
+#define TXQ_STAT_DEPTH							8
+#define TXQ_STAT_HIGH_WATERMARK					9
+#define TXQ_STATS_COUNT						   10
+
+typedef struct _TxQueue TxQueue;
+
+TxQueue *txQueueCreate(int fd, int capacity, int policy, int order, int maxInFlight);
+void txQueueStop(TxQueue *q);
+void txQueueDestroy(TxQueue *q);
+int txQueueSubmit(TxQueue *q, jint if_idx, const struct can_frame *frame, int mayBlock);
+int txQueueSetPaused(TxQueue *q, int paused);
+int txQueueAwaitIdle(TxQueue *q, __s64 deadlineNs);
+void txQueueGetStats(TxQueue *q, jlong *stats);
+
+/* transmission at a given time, see timed_send.cpp */
+#define TIMED_SEND_MODE_UNKNOWN					0
+#define TIMED_SEND_MODE_ETF						1
+#define TIMED_SEND_MODE_TIMER					2
+
+typedef struct _TimedSender TimedSender;
+
+TimedSender *timedSenderCreate(void);
+void timedSenderWake(TimedSender *ts);
+void timedSenderDestroy(TimedSender *ts);
+int timedSenderMode(TimedSender *ts);
+int timedSend(TimedSender *ts, int fd, jint if_idx, const struct can_frame *frame, jlong launchNs,
+		jlong *deltaNs);
+
+/* transmission confirmed by the echo of the frame, see confirmed_send.cpp */
+typedef struct _ConfirmSender ConfirmSender;
+
+ConfirmSender *confirmSenderCreate(void);
+void confirmSenderWake(ConfirmSender *cs);
+void confirmSenderDestroy(ConfirmSender *cs);
+int confirmedSend(ConfirmSender *cs, TxQueue *q, jint if_idx, const struct can_frame *frame,
+		jint timeoutMs, jlong *timestampNs);
+int confirmSenderTakeCopy(ConfirmSender *cs, const struct can_frame *frame);
+
+/* batched transmission and reception, see bulk_io.cpp */
+int bulkSend(int fd, const struct can_frame *frames, int count);
+__u64 cmsgTimestampNs(struct msghdr *msg);
+int bulkRecv(int fd, struct can_frame *frames, __u64 *timestampsNs, int count);
+int socketErrorBackoff(int fd, int stopFd);
+
+/* memory shared with Java via direct ByteBuffers, see shared_memory.cpp */
+void *sharedMemoryAlloc(size_t size);
+void sharedMemoryRetain(void *mem);
+void sharedMemoryRelease(void *mem);
+
+/* shared memory transmit ring, see tx_ring.cpp */
+#define TX_RING_HEADER_SIZE					  192
+
+#define TX_RING_STAT_SENT						0
+#define TX_RING_STAT_ERRORS						1
+#define TX_RING_STAT_WAKEUPS					2
+#define TX_RING_STAT_PENDING					3
+#define TX_RING_STAT_DROPPED					4
+#define TX_RING_STATS_COUNT						5
+
+typedef struct _TxRing TxRing;
+
+TxRing *txRingCreate(int fd, int capacity);
+void txRingDestroy(TxRing *r);
+void *txRingMemory(TxRing *r, size_t *size);
+void txRingWake(TxRing *r);
+void txRingGetStats(TxRing *r, jlong *stats);
+
+/* receive filters compiled to classic BPF, see bpf_filter.cpp */
+#define BPF_FILTER_MAX_PREDICATES				8
+
+int bpfFilterAttach(int fd, const jint *rules, jint len);
+int bpfFilterDetach(int fd);
+
+/* ID whitelist with constant lookup cost, see id_filter.cpp */
+typedef struct _IdFilter IdFilter;
+
+IdFilter *idFilterCreate(const jint *ids, jint count);
+void idFilterDestroy(IdFilter *f);
+void idFilterLink(IdFilter *f, IdFilter *next);
+int idFilterMatch(const IdFilter *f, canid_t canid);
+int idFilterPrefilter(const IdFilter *f, struct can_filter *filters);
+
+/* error frame monitor per interface, see error_monitor.cpp */
+#define ERRMON_STATE_ERROR_ACTIVE				0
+#define ERRMON_STATE_ERROR_WARNING				1
+#define ERRMON_STATE_ERROR_PASSIVE				2
+#define ERRMON_STATE_BUS_OFF					3
+
+#define ERRMON_STAT_FRAMES						0
+#define ERRMON_STAT_TX_TIMEOUT					1
+#define ERRMON_STAT_LOST_ARBITRATION			2
+#define ERRMON_STAT_CONTROLLER					3
+#define ERRMON_STAT_PROTOCOL					4
+#define ERRMON_STAT_TRANSCEIVER					5
+#define ERRMON_STAT_NO_ACK						6
+#define ERRMON_STAT_BUS_OFF						7
+#define ERRMON_STAT_BUS_ERROR					8
+#define ERRMON_STAT_RESTARTED					9
+#define ERRMON_STAT_RX_OVERFLOW					10
+#define ERRMON_STAT_TX_OVERFLOW					11
+#define ERRMON_STATS_COUNT						12
+
+#define ERRMON_SHARED_SIZE					  128
+
+typedef struct _ErrorMonitor ErrorMonitor;
+typedef void (*ErrorMonitorListener)(void *arg, __u32 state);
+
+ErrorMonitor *errorMonitorAcquire(int ifIndex);
+ErrorMonitor *errorMonitorGet(int ifIndex);
+ErrorMonitor *errorMonitorOfMemory(const void *memory);
+void errorMonitorRelease(ErrorMonitor *m);
+void *errorMonitorMemory(ErrorMonitor *m);
+jint errorMonitorAwait(ErrorMonitor *m, jint seenChanges, jint timeoutMs);
+__u32 errorMonitorState(ErrorMonitor *m);
+int errorMonitorAddListener(ErrorMonitor *m, ErrorMonitorListener fn, void *arg);
+void errorMonitorRemoveListener(ErrorMonitor *m, ErrorMonitorListener fn, void *arg);
+
+/* rtnetlink queries and the cached interface table, see netlink.cpp */
+#define LINK_NAME_SIZE							16
+
+#define LINK_KIND_OTHER							0
+#define LINK_KIND_CAN							1
+#define LINK_KIND_VCAN							2
+#define LINK_KIND_VXCAN							3
+
+#define LINK_INFO_IFINDEX						0
+#define LINK_INFO_MTU							1
+#define LINK_INFO_FLAGS							2
+#define LINK_INFO_KIND							3
+#define LINK_INFO_BITRATE						4
+#define LINK_INFO_SAMPLE_POINT					5
+#define LINK_INFO_TQ							6
+#define LINK_INFO_PROP_SEG						7
+#define LINK_INFO_PHASE_SEG1					8
+#define LINK_INFO_PHASE_SEG2					9
+#define LINK_INFO_SJW							10
+#define LINK_INFO_BRP							11
+#define LINK_INFO_DATA_BITRATE					12
+#define LINK_INFO_DATA_SAMPLE_POINT				13
+#define LINK_INFO_CTRLMODE						14
+#define LINK_INFO_RESTART_MS					15
+#define LINK_INFO_STATE							16
+#define LINK_INFO_BERR_TX						17
+#define LINK_INFO_BERR_RX						18
+#define LINK_INFO_RX_PACKETS					19
+#define LINK_INFO_TX_PACKETS					20
+#define LINK_INFO_RX_BYTES						21
+#define LINK_INFO_TX_BYTES						22
+#define LINK_INFO_RX_ERRORS						23
+#define LINK_INFO_TX_ERRORS						24
+#define LINK_INFO_RX_DROPPED					25
+#define LINK_INFO_TX_DROPPED					26
+#define LINK_INFO_COUNT							27
+
+typedef struct _LinkInfo {
+	char name[LINK_NAME_SIZE];
+	jlong values[LINK_INFO_COUNT];
+} LinkInfo;
+
+int netlinkHasQdisc(int ifIndex, const char *kind);
+int netlinkLinkLookup(int ifIndex, const char *name, LinkInfo *info);
+int netlinkLinkQuery(int ifIndex, LinkInfo *info);
+int netlinkCanRestart(int ifIndex);
+
+/* bus-off supervisor per interface, see bus_supervisor.cpp */
+#define BUSSUP_STAT_PAUSED						0
+#define BUSSUP_STAT_BUS_OFFS					1
+#define BUSSUP_STAT_RESTARTS					2
+#define BUSSUP_STAT_RESTART_FAILURES			3
+#define BUSSUP_STAT_RECOVERIES					4
+#define BUSSUP_STAT_EVENTS						5
+#define BUSSUP_STAT_BACKOFF_MS					6
+#define BUSSUP_STAT_LAST_OUTAGE_MS				7
+#define BUSSUP_STATS_COUNT						8
+
+int busSupervisorStart(int ifIndex, jint initialBackoffMs, jint maxBackoffMs, jint stableMs,
+		jint resumeStaggerMs);
+int busSupervisorStop(int ifIndex);
+int busSupervisorGetStats(int ifIndex, jlong *stats);
+jlong busSupervisorAwait(int ifIndex, jlong seenEvents, jint timeoutMs);
+
+/* on-wire frame length, see frame_bits.cpp */
+#define BUSLOAD_STUFFING_NONE					0
+#define BUSLOAD_STUFFING_WORST					1
+#define BUSLOAD_STUFFING_EXACT					2
+
+int frameBits(const struct canfd_frame *frame, int fd, int stuffing, int *dataBits);
+
+/* bus load meter per interface, see bus_load.cpp; keep in sync with CanSocket.BusLoadMeter */
+#define BUSLOAD_LOAD_PPM						0
+#define BUSLOAD_PEAK_PPM						1
+#define BUSLOAD_FRAMES							2
+#define BUSLOAD_BITS							3
+#define BUSLOAD_WINDOW_MS						4
+#define BUSLOAD_TOTAL_FRAMES					5
+#define BUSLOAD_TOTAL_BITS						6
+#define BUSLOAD_BITRATE							7
+#define BUSLOAD_DATA_BITRATE					8
+#define BUSLOAD_STATS_COUNT						9
+
+int busLoadStart(int ifIndex, int stuffing, jint bitrate, jint dataBitrate);
+int busLoadStop(int ifIndex);
+int busLoadGet(int ifIndex, jint windowMs, jlong *values);
+
+/* latest value per CAN ID in memory shared with Java, see mailbox.cpp */
+#define MAILBOX_SLOT_SIZE						64
+
+typedef struct _Mailbox Mailbox;
+
+Mailbox *mailboxCreate(const jint *ids, int count);
+void mailboxDestroy(Mailbox *mb);
+void *mailboxMemory(Mailbox *mb);
+jlong mailboxSize(const Mailbox *mb);
+int mailboxCount(const Mailbox *mb);
+int mailboxFilters(const Mailbox *mb, struct can_filter *filters);
+int mailboxUpdate(Mailbox *mb, const struct can_frame *frame, __u64 timestampNs);
+
+/* per-ID payload diffing for on-change delivery, see change_filter.cpp */
+typedef struct _ChangeFilter ChangeFilter;
+
+ChangeFilter *changeFilterCreate(jlong defaultIgnore, const jint *ids, const jlong *ignoreMasks, int count,
+		jint keepaliveMs);
+void changeFilterDestroy(ChangeFilter *cf);
+int changeFilterCheck(ChangeFilter *cf, const struct can_frame *frame, __u64 nowNs, __u64 *changed);
+
+/* per-ID receive rate policies, see decimator.cpp; keep in sync with CanSocket.RatePolicy */
+#define DECIMATE_EVERY_NTH						0
+#define DECIMATE_MIN_INTERVAL					1
+#define DECIMATE_LATEST							2
+#define DECIMATOR_RULE_INTS						4
+#define DECIMATOR_RULES_MAX					   64
+#define DECIMATOR_NO_DEADLINE				(~0ULL)
+
+typedef struct _Decimator Decimator;
+
+Decimator *decimatorCreate(const jint *table, int count);
+void decimatorDestroy(Decimator *dec);
+int decimatorCheck(Decimator *dec, const struct can_frame *frame, __u64 nowNs, __u64 *nextNs);
+__u64 decimatorFlush(Decimator *dec, __u64 nowNs, void (*emit)(void *arg, const struct can_frame *frame),
+		void *arg);
+
+/* receive timeouts of periodic IDs, see watchdog.cpp; keep in sync with CanSocket.Watchdog */
+#define WATCHDOG_TIMEOUT						1
+#define WATCHDOG_RECOVERED						2
+#define WATCHDOG_NO_DEADLINE				(~0ULL)
+
+typedef struct _Watchdog Watchdog;
+
+Watchdog *watchdogCreate(const jint *ids, const jint *timeoutsMs, int count, __u64 nowNs);
+void watchdogDestroy(Watchdog *wd);
+int watchdogCount(const Watchdog *wd);
+int watchdogFilters(const Watchdog *wd, struct can_filter *filters);
+void watchdogRefresh(Watchdog *wd, const struct can_frame *frame, __u64 nowNs, __u64 *nextNs,
+		void (*emit)(void *arg, const struct can_frame *frame), void *arg);
+__u64 watchdogAdvance(Watchdog *wd, __u64 nowNs, void (*emit)(void *arg, const struct can_frame *frame),
+		void *arg);
+
+/* CAN ID to consumer shard mapping, see sharder.cpp */
+#define SHARD_RULE_INTS							3
+#define SHARD_RULES_MAX							64
+#define SHARDS_MAX								16
+
+typedef struct _Sharder Sharder;
+
+Sharder *sharderCreate(int shards, const jint *rules, int count);
+void sharderRetain(Sharder *sh);
+void sharderRelease(Sharder *sh);
+int sharderShards(const Sharder *sh);
+int sharderPick(const Sharder *sh, canid_t canid);
+
+/* one receiving socket per interface fanned out to subscribers, see multiplexer.cpp */
+#define MUX_STAT_RECEIVED						0
+#define MUX_STAT_DROPPED						1
+#define MUX_STAT_DEPTH							2
+#define MUX_STAT_SUPPRESSED						3
+#define MUX_STATS_COUNT							4
+
+jint muxSubscribe(int ifIndex, const struct can_filter *filters, int count, int capacity);
+jint muxSubscribeMailbox(int ifIndex, Mailbox *mb);
+jint muxSubscribeOnChange(int ifIndex, const struct can_filter *filters, int count, int capacity,
+		ChangeFilter *cf);
+jint muxSubscribeDecimated(int ifIndex, const struct can_filter *filters, int count, int capacity,
+		Decimator *dec);
+jint muxSubscribeWatchdog(int ifIndex, const jint *ids, const jint *timeoutsMs, int count, int capacity);
+jint muxSubscribeSharded(int ifIndex, const struct can_filter *filters, int count, int capacity, Sharder *sh,
+		jint *handles);
+void *muxMailboxMemory(jint handle, jlong *size);
+void muxUnsubscribe(jint handle);
+int muxRecv(jint handle, struct can_frame *frames, jlong *changes, int maxCount, jint timeoutMs);
+int muxGetStats(jint handle, jlong *stats);
+
+/* frames of an interface published into POSIX shared memory, see shm_bus.cpp */
+#define SHM_BUS_NAME_MAX						64
+
+#define SHMBUS_STAT_IFINDEX						0
+#define SHMBUS_STAT_LOST						1
+#define SHMBUS_STAT_BACKLOG						2
+#define SHMBUS_STAT_PUBLISHED					3
+#define SHMBUS_STATS_COUNT						4
+
+int shmBusPublish(int ifIndex, const char *name, int capacity);
+int shmBusUnpublish(const char *name);
+jint shmBusOpen(const char *name);
+void shmBusClose(jint handle);
+int shmBusRead(jint handle, struct can_frame *frames, jlong *timestamps, int maxCount, jint timeoutMs);
+int shmBusGetStats(jint handle, jlong *stats);
+
+/* statistics per CAN ID received on a socket, see inventory.cpp; keep in sync with CanSocket.IdStatistics */
+#define INVENTORY_CAN_ID						0
+#define INVENTORY_COUNT							1
+#define INVENTORY_FIRST_NS						2
+#define INVENTORY_LAST_NS						3
+#define INVENTORY_MEAN_PERIOD_NS				4
+#define INVENTORY_MIN_PERIOD_NS					5
+#define INVENTORY_MAX_PERIOD_NS					6
+#define INVENTORY_JITTER_NS						7
+#define INVENTORY_DLC_MIN						8
+#define INVENTORY_DLC_MAX						9
+#define INVENTORY_FIELDS						10
+
+typedef struct _Inventory Inventory;
+
+Inventory *inventoryCreate();
+void inventoryDestroy(Inventory *inv);
+int inventoryEnabled(const Inventory *inv);
+void inventorySetEnabled(Inventory *inv, int enabled);
+void inventoryObserve(Inventory *inv, const struct can_frame *frames, const __u64 *timesNs, int count);
+jlong *inventorySnapshot(Inventory *inv, int *count);
+
+/* native receive thread calling a Java listener, see dispatcher.cpp; keep in sync with CanSocket.DispatchStats */
+#define DISPATCH_STAT_FRAMES					0
+#define DISPATCH_STAT_BATCHES					1
+#define DISPATCH_STAT_FULL_BATCHES				2
+#define DISPATCH_STAT_LISTENER_ERRORS			3
+#define DISPATCH_STATS_COUNT					4
+
+typedef struct _Dispatcher Dispatcher;
+
+Dispatcher *dispatcherCreate(JNIEnv *env, int fd, jobject listener, jobject buffer, jint maxBatch,
+		jint maxDelayUs);
+void dispatcherDestroy(Dispatcher *d);
+void dispatcherGetStats(const Dispatcher *d, jlong *stats);
+
+/* io_uring receive/transmit engine, see uring_io.cpp; keep in sync with CanSocket.IoUringStats */
+#define URING_STAT_ENTER_CALLS					0
+#define URING_STAT_RX_FRAMES					1
+#define URING_STAT_TX_FRAMES					2
+#define URING_STAT_RX_ARMS						3
+#define URING_STAT_RX_NO_BUFFERS				4
+#define URING_STAT_RX_SKIPPED					5
+#define URING_STATS_COUNT						6
+
+#define URING_RX_BUFFERS_MAX				32768
+#define URING_TX_DEPTH_MAX					 4096
+
+typedef struct _UringEngine UringEngine;
+
+UringEngine *uringCreate(int fd, int rxBuffers, int txDepth);
+void uringWake(UringEngine *e);
+void uringRetain(UringEngine *e);
+void uringRelease(UringEngine *e);
+void uringDestroy(UringEngine *e);
+int uringUnsupported(int err);
+void uringSetRecvTimeout(UringEngine *e, __u64 timeoutNs);
+int uringRecv(UringEngine *e, struct can_frame *frames, int *ifIndexes, __u64 *timestampsNs, int count);
+int uringSend(UringEngine *e, const struct can_frame *frames, int count);
+void uringGetStats(const UringEngine *e, jlong *stats);
+
+/* native state per socket, see socket_context.cpp */
+#define MAX_SOCKET_CONTEXTS					 1024
+
+#define RX_STAT_ACCEPTED						0
+#define RX_STAT_FILTERED						1
+#define RX_STATS_COUNT							2
+
+typedef struct _SocketContext {
+	int fd;
+	pthread_rwlock_t lock;
+	TxQueue *txQueue;
+	TimedSender *timedSender;
+	ConfirmSender *confirmSender;
+	TxRing *txRing;
+	IdFilter *idFilter;
+	IdFilter *idFilters;
+	int idPrefilter;
+	struct can_filter *savedFilters; //kernel filters of the user while the prefilter is set
+	socklen_t savedFiltersSize;
+	Inventory *inventory;
+	Dispatcher *dispatcher;
+	UringEngine *uring;
+	jlong rxStats[RX_STATS_COUNT];
+} SocketContext;
+
+SocketContext *socketContextGet(int fd);
+void socketContextPut(const SocketContext *ctx);
+SocketContext *socketContextCreate(int fd);
+SocketContext *socketContextLock(int fd);
+void socketContextUnlock(SocketContext *ctx);
+void socketContextDestroy(int fd);
+void socketContextForEach(void (*fn)(SocketContext *ctx, void *arg), void *arg);
+
+/* receive pipeline, see rx_pipeline.cpp */
+int rxPipelineAccept(SocketContext *ctx, const struct can_frame *frame);
+int rxPipelineFilter(SocketContext *ctx, struct can_frame *frames, const __u64 *timestampsNs, int count);
+void rxPipelineSetIdFilter(SocketContext *ctx, IdFilter *f);
+int rxPipelineEnableInventory(SocketContext *ctx, int enabled);
+void rxPipelineGetStats(const SocketContext *ctx, jlong *stats);
+
 #endif /* JNI_CANSOCKET_HPP_ */
@@ -0,0 +1,204 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+#define CHANGE_FILTER_EMPTY_KEY			   0xFFFFFFFFU
+#define CHANGE_FILTER_INITIAL_SIZE				64
+/* table entries, at most half of them are used; further IDs are always delivered */
+#define CHANGE_FILTER_MAX_SIZE				  8192
+
+/*
+ * On-change delivery.
+ *
+ * Keeps the last payload of every CAN ID seen and passes a frame only if its
+ * payload differs from the previous one with that ID, disregarding the bits
+ * of an ignore mask (e.g. alive counters and checksums). A frame with another
+ * length than the previous one always passes. The payload bits are numbered
+ * as in CanFrameBuffer: bit 8 * i + j is bit j of data byte i. With a
+ * keepalive a frame also passes if the last one passed for its ID is older
+ * than that, so a receiver sees steady signals at a reduced rate instead of
+ * never. Remote and error frames always pass.
+ *
+ * Only the multiplexer thread uses a filter, it needs no locking. The table
+ * grows while the thread runs, an ID that does not fit any more is delivered
+ * unfiltered rather than lost.
+ */
+typedef struct _ChangeEntry {
+	__u32 key;
+	__u8 seen;
+	__u8 len;
+	__u64 payload;
+	__u64 ignore;
+	__u64 lastNs;
+} ChangeEntry;
+
+struct _ChangeFilter {
+	ChangeEntry *entries;
+	__u32 mask;
+	__u32 used;
+	__u64 defaultIgnore;
+	__u64 keepaliveNs;
+};
+
+static __u32 changeKey(canid_t canid) {
+	return (canid & CAN_EFF_FLAG) ? canid & (CAN_EFF_FLAG | CAN_EFF_MASK) : canid & CAN_SFF_MASK;
+}
+
+static __u32 changeHash(__u32 key) {
+	return key * 0x9E3779B1U;
+}
+
+static __u64 bytesMask(int len) {
+	return len >= 8 ? ~0ULL : (1ULL << (8 * len)) - 1;
+}
+
+/* the entry of the key, a new one if there is room, NULL otherwise */
+static ChangeEntry *changeLookup(ChangeFilter *cf, __u32 key) {
+	__u32 pos = changeHash(key) & cf->mask;
+	while (cf->entries[pos].key != key) {
+		if (cf->entries[pos].key == CHANGE_FILTER_EMPTY_KEY) {
+			if ((cf->used + 1) * 2 > cf->mask + 1) {
+				return NULL;
+			}
+			cf->used++;
+			ChangeEntry *e = &cf->entries[pos];
+			e->key = key;
+			e->seen = 0;
+			e->ignore = cf->defaultIgnore;
+			return e;
+		}
+		pos = (pos + 1) & cf->mask;
+	}
+	return &cf->entries[pos];
+}
+
+static int changeGrow(ChangeFilter *cf) {
+	const __u32 size = (cf->mask + 1) * 2;
+	if (size > CHANGE_FILTER_MAX_SIZE) {
+		return -1;
+	}
+	ChangeEntry *entries = (ChangeEntry*) malloc(sizeof(ChangeEntry) * size);
+	if (entries == NULL) {
+		return -1;
+	}
+	for (__u32 i = 0; i < size; i++) {
+		entries[i].key = CHANGE_FILTER_EMPTY_KEY;
+	}
+	for (__u32 i = 0; i <= cf->mask; i++) {
+		if (cf->entries[i].key == CHANGE_FILTER_EMPTY_KEY) {
+			continue;
+		}
+		__u32 pos = changeHash(cf->entries[i].key) & (size - 1);
+		while (entries[pos].key != CHANGE_FILTER_EMPTY_KEY) {
+			pos = (pos + 1) & (size - 1);
+		}
+		entries[pos] = cf->entries[i];
+	}
+	free(cf->entries);
+	cf->entries = entries;
+	cf->mask = size - 1;
+	return 0;
+}
+
+static ChangeEntry *changeEntry(ChangeFilter *cf, __u32 key) {
+	ChangeEntry *e = changeLookup(cf, key);
+	if (e == NULL && changeGrow(cf) == 0) {
+		e = changeLookup(cf, key);
+	}
+	return e;
+}
+
+void changeFilterDestroy(ChangeFilter *cf) {
+	if (cf == NULL) {
+		return;
+	}
+	free(cf->entries);
+	free(cf);
+}
+
+/*
+ * Creates a filter ignoring defaultIgnore in all payloads, except for the
+ * count IDs given with masks of their own. keepaliveMs 0 disables the
+ * keepalive. Returns NULL with errno set on failure.
+ */
+ChangeFilter *changeFilterCreate(jlong defaultIgnore, const jint *ids, const jlong *ignoreMasks, int count,
+		jint keepaliveMs) {
+	if (count < 0 || keepaliveMs < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	ChangeFilter *cf = (ChangeFilter*) calloc(1, sizeof(ChangeFilter));
+	if (cf == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	cf->mask = CHANGE_FILTER_INITIAL_SIZE - 1;
+	cf->entries = (ChangeEntry*) malloc(sizeof(ChangeEntry) * CHANGE_FILTER_INITIAL_SIZE);
+	if (cf->entries == NULL) {
+		free(cf);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (__u32 i = 0; i <= cf->mask; i++) {
+		cf->entries[i].key = CHANGE_FILTER_EMPTY_KEY;
+	}
+	cf->defaultIgnore = (__u64) defaultIgnore;
+	cf->keepaliveNs = (__u64) keepaliveMs * 1000000ULL;
+	for (int i = 0; i < count; i++) {
+		ChangeEntry *e = changeEntry(cf, changeKey((canid_t) ids[i]));
+		if (e == NULL) {
+			changeFilterDestroy(cf);
+			errno = ENOSPC;
+			return NULL;
+		}
+		e->ignore = (__u64) ignoreMasks[i];
+	}
+	return cf;
+}
+
+/*
+ * Returns 1 if the frame is to be delivered, with changed set to the payload
+ * bits that differ from the previous frame of the ID (all bits of the first
+ * one, none for a keepalive). Returns 0 if the frame is suppressed.
+ */
+int changeFilterCheck(ChangeFilter *cf, const struct can_frame *frame, __u64 nowNs, __u64 *changed) {
+	*changed = 0;
+	if (frame->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) {
+		return 1;
+	}
+	const int len = frame->can_dlc > CAN_MAX_DLEN ? CAN_MAX_DLEN : frame->can_dlc;
+	__u64 payload = 0;
+	for (int i = 0; i < len; i++) {
+		payload |= (__u64) frame->data[i] << (8 * i);
+	}
+	ChangeEntry *e = changeEntry(cf, changeKey(frame->can_id));
+	if (e == NULL) {
+		*changed = bytesMask(len);
+		return 1;
+	}
+	const int first = !e->seen;
+	__u64 diff = bytesMask(len);
+	if (!first) {
+		diff = ((payload ^ e->payload) & ~e->ignore) | (diff ^ bytesMask(e->len));
+	}
+	e->payload = payload;
+	if (!first && diff == 0 && (cf->keepaliveNs == 0 || nowNs - e->lastNs < cf->keepaliveNs)) {
+		return 0;
+	}
+	e->seen = 1;
+	e->len = (__u8) len;
+	e->lastNs = nowNs;
+	*changed = diff;
+	return 1;
+}
@@ -0,0 +1,324 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define NSEC_PER_SEC				   1000000000LL
+/* copies of confirmed frames expected on the user's socket */
+#define CONFIRM_COPIES_MAX					  16
+/* a copy not read within this time is no longer filtered */
+#define CONFIRM_COPY_TTL_NS			   5000000000LL
+
+typedef struct _ConfirmCopy {
+	struct can_frame frame;
+	__s64 expiresNs;
+} ConfirmCopy;
+
+/*
+ * Confirmed transmission.
+ *
+ * The frame is sent on a private socket with CAN_RAW_RECV_OWN_MSGS enabled,
+ * so the echo of the frame (flagged with MSG_CONFIRM) can be read back without
+ * consuming frames meant for the user's socket. The receive filter of the
+ * private socket is narrowed to the CAN ID of the frame to confirm, thus only
+ * frames with that ID have to be inspected.
+ * The echo is generated by the driver once the frame was transmitted on the
+ * bus, its kernel receive timestamp is the time of transmission.
+ *
+ * Only echoes of the private socket carry MSG_CONFIRM. After a timeout the
+ * private socket is replaced, so a late echo of that frame cannot be taken for
+ * the echo of an identical frame sent later.
+ * A frame sent on the private socket is looped back to the user's socket like
+ * a frame of any other local socket. Once the echo was seen that copy is
+ * already queued on the user's socket; it is recorded here and dropped by the
+ * receive pipeline (see confirmSenderTakeCopy()). The copy of a frame whose
+ * echo timed out is delivered.
+ * Frames pending in the transmit queue of the user's socket are sent first,
+ * a confirmed send waits for the queue to be empty and not paused.
+ * Closing the user's socket ends both waits with EBADF (confirmSenderWake()),
+ * as the caller holds the socket context meanwhile.
+ */
+struct _ConfirmSender {
+	pthread_mutex_t lock;
+	int fd;
+	int stopFd;
+	int stopped;
+	int ifIndex;
+	int filterValid;
+	canid_t filterId;
+	pthread_mutex_t copiesLock;
+	int copyCount;
+	ConfirmCopy copies[CONFIRM_COPIES_MAX];
+};
+
+static __s64 monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__s64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int confirmSenderOpen(ConfirmSender *cs, int ifIndex) {
+	if (cs->fd != -1 && cs->ifIndex == ifIndex) {
+		return 0;
+	}
+	if (cs->fd != -1) {
+		close(cs->fd);
+		cs->fd = -1;
+	}
+	const int fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+	if (fd == -1) {
+		return -1;
+	}
+	const int on = 1;
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifIndex;
+	if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &on, sizeof(on)) == -1
+			|| setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1
+			|| bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	cs->fd = fd;
+	cs->ifIndex = ifIndex;
+	cs->filterValid = 0;
+	return 0;
+}
+
+static int confirmSenderFilter(ConfirmSender *cs, canid_t canid) {
+	if (cs->filterValid && cs->filterId == canid) {
+		return 0;
+	}
+	struct can_filter filter;
+	filter.can_id = canid & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK);
+	filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | ((canid & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+	if (setsockopt(cs->fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter)) == -1) {
+		return -1;
+	}
+	cs->filterValid = 1;
+	cs->filterId = canid;
+	return 0;
+}
+
+static int isEchoOf(const struct can_frame *echo, const struct can_frame *sent) {
+	return echo->can_id == sent->can_id && echo->can_dlc == sent->can_dlc
+			&& memcmp(echo->data, sent->data, sent->can_dlc) == 0;
+}
+
+/*
+ * Waits for the echo of the frame and stores its kernel timestamp
+ * (CLOCK_REALTIME) in timestampNs.
+ * Returns 0 on success and -1 with errno set on failure, ETIMEDOUT if no echo
+ * was seen in time and EBADF if woken by confirmSenderWake().
+ */
+static int awaitEcho(ConfirmSender *cs, const struct can_frame *sent, __s64 deadlineNs, jlong *timestampNs) {
+	const int fd = cs->fd;
+	struct can_frame echo;
+	union {
+		char buf[CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control;
+	while (1) {
+		const __s64 remainingNs = deadlineNs - monotonicNs();
+		if (remainingNs <= 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		struct pollfd pfds[2];
+		pfds[0].fd = fd;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		pfds[1].fd = cs->stopFd;
+		pfds[1].events = POLLIN;
+		pfds[1].revents = 0;
+		const int rc = poll(pfds, 2, (int) ((remainingNs + 999999) / 1000000));
+		if (rc == -1 && errno != EINTR) {
+			return -1;
+		}
+		if (rc <= 0) {
+			continue;
+		}
+		if (pfds[1].revents != 0) {
+			errno = EBADF;
+			return -1;
+		}
+		struct iovec iov;
+		iov.iov_base = &echo;
+		iov.iov_len = sizeof(echo);
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		const ssize_t nbytes = recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (nbytes == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		//frames of other nodes with the same id and echoes of timed out frames are skipped
+		if (nbytes != sizeof(echo) || !(msg.msg_flags & MSG_CONFIRM) || !isEchoOf(&echo, sent)) {
+			continue;
+		}
+		*timestampNs = 0;
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				struct timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				*timestampNs = (jlong) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+			}
+		}
+		return 0;
+	}
+}
+
+ConfirmSender *confirmSenderCreate(void) {
+	ConfirmSender *cs = (ConfirmSender*) calloc(1, sizeof(ConfirmSender));
+	if (cs == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	cs->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (cs->stopFd == -1) {
+		const int err = errno;
+		free(cs);
+		errno = err;
+		return NULL;
+	}
+	pthread_mutex_init(&cs->lock, NULL);
+	pthread_mutex_init(&cs->copiesLock, NULL);
+	cs->fd = -1;
+	return cs;
+}
+
+/* ends the wait for the echo, this and every later send fails with EBADF */
+void confirmSenderWake(ConfirmSender *cs) {
+	__atomic_store_n(&cs->stopped, 1, __ATOMIC_RELEASE);
+	eventfd_write(cs->stopFd, 1);
+}
+
+void confirmSenderDestroy(ConfirmSender *cs) {
+	if (cs->fd != -1) {
+		close(cs->fd);
+	}
+	close(cs->stopFd);
+	pthread_mutex_destroy(&cs->lock);
+	pthread_mutex_destroy(&cs->copiesLock);
+	free(cs);
+}
+
+/* records the copy of a confirmed frame the user's socket is about to read */
+static void confirmSenderAddCopy(ConfirmSender *cs, const struct can_frame *frame) {
+	const __s64 nowNs = monotonicNs();
+	pthread_mutex_lock(&cs->copiesLock);
+	int kept = 0;
+	for (int i = 0; i < cs->copyCount; i++) {
+		if (cs->copies[i].expiresNs > nowNs) {
+			cs->copies[kept++] = cs->copies[i];
+		}
+	}
+	if (kept == CONFIRM_COPIES_MAX) {
+		//the oldest copy is delivered rather than a newer one
+		memmove(&cs->copies[0], &cs->copies[1], (kept - 1) * sizeof(ConfirmCopy));
+		kept--;
+	}
+	cs->copies[kept].frame = *frame;
+	cs->copies[kept].expiresNs = nowNs + CONFIRM_COPY_TTL_NS;
+	__atomic_store_n(&cs->copyCount, kept + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cs->copiesLock);
+}
+
+/*
+ * Returns 1 if the frame received on the user's socket is the looped back copy
+ * of a confirmed frame, which is then no longer expected.
+ */
+int confirmSenderTakeCopy(ConfirmSender *cs, const struct can_frame *frame) {
+	if (__atomic_load_n(&cs->copyCount, __ATOMIC_ACQUIRE) == 0) {
+		return 0;
+	}
+	const __s64 nowNs = monotonicNs();
+	int taken = 0;
+	pthread_mutex_lock(&cs->copiesLock);
+	for (int i = 0; i < cs->copyCount; i++) {
+		if (cs->copies[i].expiresNs > nowNs && isEchoOf(frame, &cs->copies[i].frame)) {
+			memmove(&cs->copies[i], &cs->copies[i + 1], (cs->copyCount - i - 1) * sizeof(ConfirmCopy));
+			__atomic_store_n(&cs->copyCount, cs->copyCount - 1, __ATOMIC_RELEASE);
+			taken = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cs->copiesLock);
+	return taken;
+}
+
+/*
+ * Sends the frame once the transmit queue q of the user's socket (may be
+ * NULL) is idle and waits until its echo is seen on the bus.
+ * Returns 0 with the kernel timestamp of the echo (CLOCK_REALTIME) in
+ * timestampNs, or -1 with errno set (ETIMEDOUT if no echo was seen in time,
+ * ENETDOWN if the queue stayed paused, EBADF if the socket is being closed).
+ */
+int confirmedSend(ConfirmSender *cs, TxQueue *q, jint if_idx, const struct can_frame *frame,
+		jint timeoutMs, jlong *timestampNs) {
+	pthread_mutex_lock(&cs->lock);
+	if (__atomic_load_n(&cs->stopped, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_unlock(&cs->lock);
+		errno = EBADF;
+		return -1;
+	}
+	if (confirmSenderOpen(cs, if_idx) == -1 || confirmSenderFilter(cs, frame->can_id) == -1) {
+		const int err = errno;
+		pthread_mutex_unlock(&cs->lock);
+		errno = err;
+		return -1;
+	}
+	const __s64 deadlineNs = monotonicNs() + (__s64) timeoutMs * 1000000LL;
+	int rc = q != NULL ? txQueueAwaitIdle(q, deadlineNs) : 0;
+	if (rc == -1 && __atomic_load_n(&cs->stopped, __ATOMIC_ACQUIRE)) {
+		//the queue is stopped by the same close
+		errno = EBADF;
+	}
+	if (rc == 0) {
+		const ssize_t nbytes = send(cs->fd, frame, sizeof(*frame), 0);
+		if (nbytes != (ssize_t) sizeof(*frame)) {
+			if (nbytes != -1) {
+				errno = EIO;
+			}
+			rc = -1;
+		} else {
+			rc = awaitEcho(cs, frame, deadlineNs, timestampNs);
+			if (rc == 0) {
+				confirmSenderAddCopy(cs, frame);
+			} else if (errno == ETIMEDOUT) {
+				//the echo may still come, it must not confirm the next frame
+				close(cs->fd);
+				cs->fd = -1;
+			}
+		}
+	}
+	const int err = errno;
+	pthread_mutex_unlock(&cs->lock);
+	errno = err;
+	return rc;
+}
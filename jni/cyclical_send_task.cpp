@@ -35,6 +35,7 @@ extern "C" {
 #define MAX_CAN_FRAMES_SIZE						 8
 #define HARDCODED_100MS             		100000
 #define TIME_BETWEEN_FRAMES           		  1100
+#define MAX_PAUSED_INTERFACES					16
 
 typedef struct _CanFrameStorage {
 	jint fd;
@@ -62,6 +63,9 @@ static int syncAdjust = 0; //basic "simulation" of a thread synchronisation //TO
 static int theOneCycleTime = HARDCODED_100MS;
 static int statsErrorCntrCyclicalSend = 0;
 static int statsFramesSendPerCycle = 0;
+static jint pausedInterfaces[MAX_PAUSED_INTERFACES]; //interface indices, 0 marks a free entry
+//held by the worker while it sends a frame, so a socket removed is not used any more
+static pthread_mutex_t sendLock = PTHREAD_MUTEX_INITIALIZER;
 
 
 void* worker(void *t);
@@ -81,8 +85,8 @@ void cyclicalInitLowLevelThread(void) {
 	//spawn extra thread
 	int rc = pthread_create(&t, NULL, worker, (void*) NULL);
 	if (rc) {
-		perror("[FATAL] Failed spawn the thread..\n");
-		exit(-1);
+		//cyclic frames are not sent, but the JVM keeps running
+		CANLOG_ERROR("CAN Lib: failed to spawn the cyclic send thread: %s", strerror(rc));
 	}
 }
 
@@ -135,7 +139,7 @@ int cyclicalTaskAddCanFrame(jint fd, jint if_idx, jint canid, jint len,
 	if (theOneCycleTime == HARDCODED_100MS && _cylceTime * 1000 != HARDCODED_100MS) {
 		//Note only the first given cycle time is used 
 		theOneCycleTime = _cylceTime * 1000;
-		fprintf(stderr, "CAN Lib: set new cycle time %d us\n", theOneCycleTime);
+		CANLOG_INFO("CAN Lib: set new cycle time %d us", theOneCycleTime);
 	}
 	for (int i = 0; i < storageIdx; i++) {
 		if (canStorage[i].canid == canid) {
@@ -178,6 +182,40 @@ int cyclicalTaskRemoveAll(void) {
 	return 0;
 }
 
+/* removes the frames of a socket about to be closed, returns once none of them is being sent */
+void cyclicalTaskRemoveSocket(jint fd) {
+	pthread_mutex_lock(&sendLock);
+	for (int i = 0; i < storageIdx; i++) {
+		if (canStorage[i].canid != 0 && canStorage[i].fd == fd) {
+			memset(&(canStorage[i]), 0, sizeof(CanFrameStorage));
+		}
+	}
+	pthread_mutex_unlock(&sendLock);
+}
+
+/* frames of a paused interface are skipped, missed cycles are not made up after resuming */
+void cyclicalTaskSetPaused(jint if_idx, int paused) {
+	for (int i = 0; i < MAX_PAUSED_INTERFACES; i++) {
+		jint expected = paused ? 0 : if_idx;
+		if (__atomic_compare_exchange_n(&pausedInterfaces[i], &expected, paused ? if_idx : 0, 0,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return;
+		}
+	}
+}
+
+static int isPaused(jint if_idx) {
+	if (if_idx <= 0) {
+		return 0;
+	}
+	for (int i = 0; i < MAX_PAUSED_INTERFACES; i++) {
+		if (__atomic_load_n(&pausedInterfaces[i], __ATOMIC_ACQUIRE) == if_idx) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 int cyclicalTaskAdoptCanFrame(jint canid, jint len, jbyte *buffer) {
 	jbyte tmpData[MAX_CAN_FRAMES_SIZE];
 	
@@ -202,15 +240,19 @@ void* worker(void *t) {
 	while (1) {
 		framesCnt = 0;
 		for (int i = 0; i < storageIdx; i++) {
-			if (canStorage[i].canid != 0) {
+			if (canStorage[i].canid != 0 && !isPaused(canStorage[i].if_idx)) {
 				while (syncAdjust == 1) {
 					usleep(10);
 				}
+				pthread_mutex_lock(&sendLock);
 				memcpy((void*) &frameToSend, (void*) &(canStorage[i]),
 						sizeof(CanFrameStorage));
-				modifyAutocounters(&frameToSend);
-				sendFrame(&frameToSend);
-				framesCnt++;
+				if (frameToSend.canid != 0) {
+					modifyAutocounters(&frameToSend);
+					sendFrame(&frameToSend);
+					framesCnt++;
+				}
+				pthread_mutex_unlock(&sendLock);
 			}
 		}
 		statsFramesSendPerCycle = framesCnt;
@@ -239,16 +281,25 @@ void sendFrame(CanFrameStorage *frameToSend) {
 	frame.can_id = frameToSend->canid;
 	frame.can_dlc = static_cast<__u8 >(frameToSend->len);
 	memcpy(&(frame.data), frameToSend->data, MAX_CAN_FRAMES_SIZE);
+
+	const SocketContext *ctx = socketContextGet(frameToSend->fd);
+	if (ctx != NULL && ctx->txQueue != NULL) {
+		//never stall the cycle, frames dropped by the queue policy are counted by the queue
+		if (txQueueSubmit(ctx->txQueue, frameToSend->if_idx, &frame, 0) == TXQ_ERROR) {
+			statsErrorCntrCyclicalSend++;
+		}
+		socketContextPut(ctx);
+		return;
+	}
+	socketContextPut(ctx);
 	nbytes = sendto(frameToSend->fd, &frame, sizeof(frame), flags,
 			reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
 
 	if (nbytes == -1) {
 		statsErrorCntrCyclicalSend++;
-//		perror("[FATAL] CAN: (cyclically Thread) Unable to send CAN frames\n");
 	} else if (nbytes != sizeof(frame)) {
 		statsErrorCntrCyclicalSend++;
-		std::string s; //for logging purposes
-		perror("[FATAL] CAN: (cyclically Thread) send partial CAN frame\n");
+		CANLOG_ERROR("CAN Lib: cyclic send of 0x%x sent a partial frame (%zd bytes)", frameToSend->canid, nbytes);
 	}
 }
 
@@ -0,0 +1,247 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+#define DECIMATOR_EMPTY_KEY				   0xFFFFFFFFU
+#define DECIMATOR_INITIAL_SIZE					64
+/* table entries, at most half of them are used; further IDs pass undecimated */
+#define DECIMATOR_MAX_SIZE					  8192
+
+/*
+ * Receive rate policies.
+ *
+ * A list of rules, each with an ID and mask as in struct can_filter, a
+ * policy and its parameter. The first rule matching a frame applies, frames
+ * matching no rule pass. State is kept per CAN ID, a rule covering a range
+ * of IDs decimates each of them on its own:
+ *   DECIMATE_EVERY_NTH     passes the first frame and then every nth one
+ *   DECIMATE_MIN_INTERVAL  passes a frame if the last one passed is at least
+ *                          param ms old
+ *   DECIMATE_LATEST        holds back the frames of a window of param ms
+ *                          starting with the first one and passes the last
+ *                          frame of the window when it ends
+ * Only the multiplexer thread uses a decimator, it needs no locking. It asks
+ * for the time the next window ends and flushes the held frames then.
+ */
+typedef struct _DecimatorRule {
+	struct can_filter filter;
+	int policy;
+	__u64 param;
+} DecimatorRule;
+
+typedef struct _DecimatorEntry {
+	__u32 key;
+	int rule;
+	__u64 count;
+	__u64 lastNs;
+	__u64 windowEndNs;
+	struct can_frame held;
+} DecimatorEntry;
+
+struct _Decimator {
+	DecimatorRule *rules;
+	int ruleCount;
+	DecimatorEntry *entries;
+	__u32 mask;
+	__u32 used;
+	int holding;
+};
+
+static __u32 decimatorKey(canid_t canid) {
+	return (canid & CAN_EFF_FLAG) ? canid & (CAN_EFF_FLAG | CAN_EFF_MASK) : canid & CAN_SFF_MASK;
+}
+
+static __u32 decimatorHash(__u32 key) {
+	return key * 0x9E3779B1U;
+}
+
+static int ruleMatch(const struct can_filter *f, canid_t canid) {
+	const int match = (canid & f->can_mask) == (f->can_id & ~CAN_INV_FILTER & f->can_mask);
+	return (f->can_id & CAN_INV_FILTER) ? !match : match;
+}
+
+/* the entry of the key, a new one if there is room, NULL otherwise */
+static DecimatorEntry *decimatorLookup(Decimator *dec, __u32 key, int rule) {
+	__u32 pos = decimatorHash(key) & dec->mask;
+	while (dec->entries[pos].key != key) {
+		if (dec->entries[pos].key == DECIMATOR_EMPTY_KEY) {
+			if ((dec->used + 1) * 2 > dec->mask + 1) {
+				return NULL;
+			}
+			dec->used++;
+			DecimatorEntry *e = &dec->entries[pos];
+			memset(e, 0, sizeof(*e));
+			e->key = key;
+			e->rule = rule;
+			return e;
+		}
+		pos = (pos + 1) & dec->mask;
+	}
+	return &dec->entries[pos];
+}
+
+static int decimatorGrow(Decimator *dec) {
+	const __u32 size = (dec->mask + 1) * 2;
+	if (size > DECIMATOR_MAX_SIZE) {
+		return -1;
+	}
+	DecimatorEntry *entries = (DecimatorEntry*) malloc(sizeof(DecimatorEntry) * size);
+	if (entries == NULL) {
+		return -1;
+	}
+	for (__u32 i = 0; i < size; i++) {
+		entries[i].key = DECIMATOR_EMPTY_KEY;
+	}
+	for (__u32 i = 0; i <= dec->mask; i++) {
+		if (dec->entries[i].key == DECIMATOR_EMPTY_KEY) {
+			continue;
+		}
+		__u32 pos = decimatorHash(dec->entries[i].key) & (size - 1);
+		while (entries[pos].key != DECIMATOR_EMPTY_KEY) {
+			pos = (pos + 1) & (size - 1);
+		}
+		entries[pos] = dec->entries[i];
+	}
+	free(dec->entries);
+	dec->entries = entries;
+	dec->mask = size - 1;
+	return 0;
+}
+
+void decimatorDestroy(Decimator *dec) {
+	if (dec == NULL) {
+		return;
+	}
+	free(dec->rules);
+	free(dec->entries);
+	free(dec);
+}
+
+/*
+ * Creates a decimator from count rules of DECIMATOR_RULE_INTS ints each: CAN
+ * ID, mask, policy and parameter. Returns NULL with errno set on failure,
+ * EINVAL for an unknown policy or a parameter below 1.
+ */
+Decimator *decimatorCreate(const jint *table, int count) {
+	if (count < 1 || count > DECIMATOR_RULES_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	Decimator *dec = (Decimator*) calloc(1, sizeof(Decimator));
+	if (dec == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	dec->rules = (DecimatorRule*) malloc(sizeof(DecimatorRule) * count);
+	dec->entries = (DecimatorEntry*) malloc(sizeof(DecimatorEntry) * DECIMATOR_INITIAL_SIZE);
+	if (dec->rules == NULL || dec->entries == NULL) {
+		decimatorDestroy(dec);
+		errno = ENOMEM;
+		return NULL;
+	}
+	dec->mask = DECIMATOR_INITIAL_SIZE - 1;
+	for (__u32 i = 0; i <= dec->mask; i++) {
+		dec->entries[i].key = DECIMATOR_EMPTY_KEY;
+	}
+	dec->ruleCount = count;
+	for (int i = 0; i < count; i++) {
+		const jint *r = &table[i * DECIMATOR_RULE_INTS];
+		DecimatorRule *rule = &dec->rules[i];
+		rule->filter.can_id = (canid_t) r[0];
+		rule->filter.can_mask = (canid_t) r[1];
+		rule->policy = r[2];
+		if (r[3] < 1 || (r[2] != DECIMATE_EVERY_NTH && r[2] != DECIMATE_MIN_INTERVAL
+				&& r[2] != DECIMATE_LATEST)) {
+			decimatorDestroy(dec);
+			errno = EINVAL;
+			return NULL;
+		}
+		rule->param = r[2] == DECIMATE_EVERY_NTH ? (__u64) r[3] : (__u64) r[3] * 1000000ULL;
+	}
+	return dec;
+}
+
+/*
+ * Returns 1 if the frame passes, 0 if it is dropped (or replaces the frame
+ * held back so far) and -1 if it is held back opening a window. *nextNs is
+ * lowered to the end of the window. Windows ended by nowNs must have been
+ * flushed before.
+ */
+int decimatorCheck(Decimator *dec, const struct can_frame *frame, __u64 nowNs, __u64 *nextNs) {
+	int rule = -1;
+	for (int i = 0; i < dec->ruleCount && rule == -1; i++) {
+		if (ruleMatch(&dec->rules[i].filter, frame->can_id)) {
+			rule = i;
+		}
+	}
+	if (rule == -1) {
+		return 1;
+	}
+	const __u32 key = decimatorKey(frame->can_id);
+	DecimatorEntry *e = decimatorLookup(dec, key, rule);
+	if (e == NULL && decimatorGrow(dec) == 0) {
+		e = decimatorLookup(dec, key, rule);
+	}
+	if (e == NULL) {
+		return 1;
+	}
+	const DecimatorRule *r = &dec->rules[e->rule];
+	switch (r->policy) {
+	case DECIMATE_EVERY_NTH:
+		return e->count++ % r->param == 0;
+	case DECIMATE_MIN_INTERVAL:
+		if (e->count++ == 0 || nowNs - e->lastNs >= r->param) {
+			e->lastNs = nowNs;
+			return 1;
+		}
+		return 0;
+	default:
+		e->held = *frame;
+		if (e->windowEndNs != 0) {
+			return 0;
+		}
+		e->windowEndNs = nowNs + r->param;
+		dec->holding++;
+		if (e->windowEndNs < *nextNs) {
+			*nextNs = e->windowEndNs;
+		}
+		return -1;
+	}
+}
+
+/*
+ * Passes the held frames of the windows ended by nowNs to emit and returns
+ * the end of the next window, DECIMATOR_NO_DEADLINE if there is none.
+ */
+__u64 decimatorFlush(Decimator *dec, __u64 nowNs, void (*emit)(void *arg, const struct can_frame *frame),
+		void *arg) {
+	__u64 next = DECIMATOR_NO_DEADLINE;
+	if (dec->holding == 0) {
+		return next;
+	}
+	for (__u32 i = 0; i <= dec->mask; i++) {
+		DecimatorEntry *e = &dec->entries[i];
+		if (e->key == DECIMATOR_EMPTY_KEY || e->windowEndNs == 0) {
+			continue;
+		}
+		if (e->windowEndNs <= nowNs) {
+			e->windowEndNs = 0;
+			dec->holding--;
+			emit(arg, &e->held);
+		} else if (e->windowEndNs < next) {
+			next = e->windowEndNs;
+		}
+	}
+	return next;
+}
@@ -0,0 +1,312 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define DISPATCH_RECV_BATCH						64
+#define NSEC_PER_SEC				   1000000000ULL
+
+/*
+ * Listener dispatch.
+ *
+ * A thread per socket waits for frames, reads them with recvmmsg, passes
+ * them through the receive pipeline of the socket and hands them to a Java
+ * listener in batches: onFrames(ByteBuffer, int) with the frames laid out as
+ * struct can_frame (CanSocket.CanFrameBuffer) in a direct buffer owned by
+ * Java. The thread is attached to the JVM once when it starts, so an upcall
+ * costs a method call and no attach; starting fails if it cannot attach.
+ *
+ * A batch is delivered once it holds maxBatch frames or maxDelayNs after its
+ * first frame was read, whichever comes first; a delay of 0 delivers what one
+ * wakeup read. The thread reads nothing while the listener runs, frames
+ * arriving meanwhile wait in the socket's receive queue.
+ * Exceptions thrown by the listener are counted and cleared.
+ */
+struct _Dispatcher {
+	int fd;
+	int stopFd;
+	int running;
+	int selfStop;
+	int maxBatch;
+	__u64 maxDelayNs;
+	JavaVM *vm;
+	jobject listener;
+	jobject buffer;
+	jmethodID onFrames;
+	struct can_frame *frames;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t attached;
+	int attachState; //0 while attaching, 1 once attached, -1 if that failed
+	jlong stats[DISPATCH_STATS_COUNT];
+};
+
+static __u64 monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void count(Dispatcher *d, int counter, jlong n) {
+	__atomic_fetch_add(&d->stats[counter], n, __ATOMIC_RELAXED);
+}
+
+/* reads what is queued, at most max frames, and returns the number accepted by the pipeline */
+static int dispatcherRead(Dispatcher *d, struct can_frame *frames, int max) {
+	struct mmsghdr msgs[DISPATCH_RECV_BATCH];
+	struct iovec iovs[DISPATCH_RECV_BATCH];
+	char controls[DISPATCH_RECV_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+	__u64 timestamps[DISPATCH_RECV_BATCH];
+	const int batch = std::min(max, DISPATCH_RECV_BATCH);
+	for (int i = 0; i < batch; i++) {
+		iovs[i].iov_base = &frames[i];
+		iovs[i].iov_len = sizeof(struct can_frame);
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = controls[i];
+		msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+	}
+	const int n = recvmmsg(d->fd, msgs, batch, MSG_DONTWAIT, NULL);
+	if (n <= 0) {
+		return 0;
+	}
+	int kept = 0;
+	for (int i = 0; i < n; i++) {
+		if (msgs[i].msg_len == sizeof(struct can_frame) && (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) == 0) {
+			if (kept != i) {
+				frames[kept] = frames[i];
+			}
+			timestamps[kept] = cmsgTimestampNs(&msgs[i].msg_hdr);
+			kept++;
+		}
+	}
+	SocketContext *ctx = socketContextGet(d->fd);
+	if (ctx != NULL) {
+		kept = rxPipelineFilter(ctx, frames, timestamps, kept);
+		socketContextPut(ctx);
+	}
+	return kept;
+}
+
+static void dispatcherDeliver(Dispatcher *d, JNIEnv *env, int frames) {
+	env->CallVoidMethod(d->listener, d->onFrames, d->buffer, (jint) frames);
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		env->ExceptionClear();
+		count(d, DISPATCH_STAT_LISTENER_ERRORS, 1);
+	}
+	count(d, DISPATCH_STAT_FRAMES, frames);
+	count(d, DISPATCH_STAT_BATCHES, 1);
+	if (frames >= d->maxBatch) {
+		count(d, DISPATCH_STAT_FULL_BATCHES, 1);
+	}
+}
+
+static void dispatcherFree(Dispatcher *d) {
+	pthread_cond_destroy(&d->attached);
+	pthread_mutex_destroy(&d->lock);
+	close(d->stopFd);
+	free(d);
+}
+
+static void* dispatcherWorker(void *arg) {
+	Dispatcher *d = (Dispatcher*) arg;
+	JNIEnv *env = NULL;
+	const int attached = d->vm->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(&env), NULL) == JNI_OK;
+	pthread_mutex_lock(&d->lock);
+	d->attachState = attached ? 1 : -1;
+	pthread_cond_signal(&d->attached);
+	pthread_mutex_unlock(&d->lock);
+	if (!attached) {
+		//dispatcherCreate() cleans up and reports the failure
+		return NULL;
+	}
+	struct pollfd pfds[2];
+	pfds[0].fd = d->fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = d->stopFd;
+	pfds[1].events = POLLIN;
+	int pending = 0;
+	__u64 deadlineNs = 0;
+
+	while (__atomic_load_n(&d->running, __ATOMIC_ACQUIRE)) {
+		struct timespec timeout;
+		if (pending > 0) {
+			const __u64 now = monotonicNs();
+			if (now >= deadlineNs) {
+				dispatcherDeliver(d, env, pending);
+				pending = 0;
+				continue;
+			}
+			timeout.tv_sec = (deadlineNs - now) / NSEC_PER_SEC;
+			timeout.tv_nsec = (deadlineNs - now) % NSEC_PER_SEC;
+		}
+		pfds[0].revents = 0;
+		pfds[1].revents = 0;
+		if (ppoll(pfds, 2, pending > 0 ? &timeout : NULL, NULL) <= 0) {
+			continue;
+		}
+		if (pfds[0].revents & POLLNVAL) {
+			CANLOG_WARN("CAN dispatcher: socket %d closed, stopping", d->fd);
+			break;
+		}
+		if ((pfds[0].revents & POLLIN) == 0) {
+			if (pfds[0].revents & (POLLERR | POLLHUP)) {
+				if (pending > 0) {
+					dispatcherDeliver(d, env, pending);
+					pending = 0;
+				}
+				socketErrorBackoff(d->fd, d->stopFd);
+			}
+			continue;
+		}
+		const int n = dispatcherRead(d, d->frames + pending, d->maxBatch - pending);
+		if (pending == 0 && n > 0) {
+			deadlineNs = monotonicNs() + d->maxDelayNs;
+		}
+		pending += n;
+		if (pending > 0 && (pending >= d->maxBatch || d->maxDelayNs == 0)) {
+			dispatcherDeliver(d, env, pending);
+			pending = 0;
+		}
+	}
+	env->DeleteGlobalRef(d->listener);
+	env->DeleteGlobalRef(d->buffer);
+	d->vm->DetachCurrentThread();
+	//stopped by the listener itself, nobody joins this thread
+	if (__atomic_load_n(&d->selfStop, __ATOMIC_ACQUIRE)) {
+		dispatcherFree(d);
+	}
+	return NULL;
+}
+
+/*
+ * Starts dispatching the frames of the socket to the listener's
+ * onFrames(ByteBuffer, int) method. buffer is a direct buffer with room for
+ * maxBatch frames. Returns NULL with errno set on failure, EINVAL for
+ * illegal parameters. A Java exception may be pending if the method was not
+ * found or the thread could not attach to the JVM.
+ */
+Dispatcher *dispatcherCreate(JNIEnv *env, int fd, jobject listener, jobject buffer, jint maxBatch,
+		jint maxDelayUs) {
+	void *frames = env->GetDirectBufferAddress(buffer);
+	if (maxBatch < 1 || maxDelayUs < 0 || frames == NULL
+			|| env->GetDirectBufferCapacity(buffer) < (jlong) maxBatch * (jlong) sizeof(struct can_frame)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	const jclass clazz = env->GetObjectClass(listener);
+	const jmethodID onFrames = env->GetMethodID(clazz, "onFrames", "(Ljava/nio/ByteBuffer;I)V");
+	env->DeleteLocalRef(clazz);
+	if (onFrames == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	Dispatcher *d = (Dispatcher*) calloc(1, sizeof(Dispatcher));
+	if (d == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (env->GetJavaVM(&d->vm) != JNI_OK) {
+		free(d);
+		errno = EINVAL;
+		return NULL;
+	}
+	d->fd = fd;
+	d->maxBatch = maxBatch;
+	d->maxDelayNs = (__u64) maxDelayUs * 1000ULL;
+	d->frames = (struct can_frame*) frames;
+	d->onFrames = onFrames;
+	d->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (d->stopFd == -1) {
+		const int err = errno;
+		free(d);
+		errno = err;
+		return NULL;
+	}
+	d->listener = env->NewGlobalRef(listener);
+	d->buffer = env->NewGlobalRef(buffer);
+	if (d->listener == NULL || d->buffer == NULL) {
+		if (d->listener != NULL) {
+			env->DeleteGlobalRef(d->listener);
+		}
+		if (d->buffer != NULL) {
+			env->DeleteGlobalRef(d->buffer);
+		}
+		close(d->stopFd);
+		free(d);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->attached, NULL);
+	d->running = 1;
+	const int rc = pthread_create(&d->thread, NULL, dispatcherWorker, (void*) d);
+	if (rc == 0) {
+		pthread_mutex_lock(&d->lock);
+		while (d->attachState == 0) {
+			pthread_cond_wait(&d->attached, &d->lock);
+		}
+		pthread_mutex_unlock(&d->lock);
+		if (d->attachState == -1) {
+			pthread_join(d->thread, NULL);
+		}
+	}
+	if (rc != 0 || d->attachState == -1) {
+		env->DeleteGlobalRef(d->listener);
+		env->DeleteGlobalRef(d->buffer);
+		dispatcherFree(d);
+		if (rc != 0) {
+			errno = rc;
+		} else {
+			CANLOG_ERROR("CAN dispatcher: could not attach to the JVM");
+			throwIOExceptionMsg(env, "dispatcher thread could not attach to the JVM");
+			errno = EAGAIN;
+		}
+		return NULL;
+	}
+	return d;
+}
+
+/*
+ * Stops the dispatch thread, waiting for a running upcall to return. Called
+ * from the listener itself the thread ends after the upcall instead.
+ */
+void dispatcherDestroy(Dispatcher *d) {
+	if (d == NULL) {
+		return;
+	}
+	if (pthread_equal(pthread_self(), d->thread)) {
+		__atomic_store_n(&d->selfStop, 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&d->running, 0, __ATOMIC_RELEASE);
+		pthread_detach(d->thread);
+		return;
+	}
+	__atomic_store_n(&d->running, 0, __ATOMIC_RELEASE);
+	eventfd_write(d->stopFd, 1);
+	pthread_join(d->thread, NULL);
+	dispatcherFree(d);
+}
+
+void dispatcherGetStats(const Dispatcher *d, jlong *stats) {
+	for (int i = 0; i < DISPATCH_STATS_COUNT; i++) {
+		stats[i] = __atomic_load_n(&d->stats[i], __ATOMIC_RELAXED);
+	}
+}
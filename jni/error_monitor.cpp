@@ -0,0 +1,423 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/can/error.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+/* error counters in data[6] and data[7] are valid, since Linux 5.16 */
+#ifndef CAN_ERR_CNT
+#define CAN_ERR_CNT							0x00000200U
+#endif
+/* recovered to error active state, since Linux 5.16 */
+#ifndef CAN_ERR_CRTL_ACTIVE
+#define CAN_ERR_CRTL_ACTIVE						0x40
+#endif
+
+#define ERROR_MONITOR_MAX						16
+#define ERROR_MONITOR_BATCH						16
+#define ERROR_MONITOR_LISTENERS					 4
+#define NSEC_PER_SEC				   1000000000LL
+
+/*
+ * Error frame monitor.
+ *
+ * One monitor per interface reads the error frames (CAN_ERR_MASK) on a
+ * private socket that receives no data frames, decodes them and keeps the
+ * controller state, the error counters and a counter per error class in
+ * memory shared with Java through a direct ByteBuffer. Only the monitor
+ * thread writes to it, Java reads the fields with acquire semantics.
+ * A state transition increments stateChanges and wakes all threads waiting
+ * for it, so Java neither polls nor parses error frames.
+ *
+ * Layout (keep in sync with CanSocket.ErrorMonitor): state (u32) at 0,
+ * txErrors (u32) at 4, rxErrors (u32) at 8, stateChanges (u32) at 12,
+ * lastChangeNs (CLOCK_MONOTONIC, u64) at 16, counters (u64) from 24 on.
+ */
+typedef struct _ErrorMonitorShared {
+	__u32 state;
+	__u32 txErrors;
+	__u32 rxErrors;
+	__u32 stateChanges;
+	__u64 lastChangeNs;
+	__u64 counters[ERRMON_STATS_COUNT];
+} ErrorMonitorShared;
+
+static_assert(sizeof(ErrorMonitorShared) <= ERRMON_SHARED_SIZE, "unexpected error monitor size");
+
+struct _ErrorMonitor {
+	int ifIndex;
+	int refs;
+	int fd;
+	int stopFd;
+	int running;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	ErrorMonitorListener listeners[ERROR_MONITOR_LISTENERS];
+	void *listenerArgs[ERROR_MONITOR_LISTENERS];
+	ErrorMonitorShared *shared;
+};
+
+static ErrorMonitor *errorMonitors[ERROR_MONITOR_MAX];
+static pthread_mutex_t errorMonitorsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static __s64 monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__s64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void count(ErrorMonitor *m, int counter) {
+	__atomic_store_n(&m->shared->counters[counter], m->shared->counters[counter] + 1, __ATOMIC_RELEASE);
+}
+
+static void setState(ErrorMonitor *m, __u32 state) {
+	if (m->shared->state == state) {
+		return;
+	}
+	pthread_mutex_lock(&m->lock);
+	__atomic_store_n(&m->shared->lastChangeNs, (__u64) monotonicNs(), __ATOMIC_RELEASE);
+	__atomic_store_n(&m->shared->state, state, __ATOMIC_RELEASE);
+	__atomic_store_n(&m->shared->stateChanges, m->shared->stateChanges + 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&m->changed);
+	for (int i = 0; i < ERROR_MONITOR_LISTENERS; i++) {
+		if (m->listeners[i] != NULL) {
+			m->listeners[i](m->listenerArgs[i], state);
+		}
+	}
+	pthread_mutex_unlock(&m->lock);
+	CANLOG_INFO("CAN interface %d: controller state %u", m->ifIndex, state);
+}
+
+static void decode(ErrorMonitor *m, const struct can_frame *frame) {
+	const canid_t cls = frame->can_id & CAN_ERR_MASK;
+	count(m, ERRMON_STAT_FRAMES);
+	if (cls & CAN_ERR_TX_TIMEOUT) {
+		count(m, ERRMON_STAT_TX_TIMEOUT);
+	}
+	if (cls & CAN_ERR_LOSTARB) {
+		count(m, ERRMON_STAT_LOST_ARBITRATION);
+	}
+	if (cls & CAN_ERR_PROT) {
+		count(m, ERRMON_STAT_PROTOCOL);
+	}
+	if (cls & CAN_ERR_TRX) {
+		count(m, ERRMON_STAT_TRANSCEIVER);
+	}
+	if (cls & CAN_ERR_ACK) {
+		count(m, ERRMON_STAT_NO_ACK);
+	}
+	if (cls & CAN_ERR_BUSERROR) {
+		count(m, ERRMON_STAT_BUS_ERROR);
+	}
+	if (cls & CAN_ERR_CNT) {
+		__atomic_store_n(&m->shared->txErrors, frame->data[6], __ATOMIC_RELEASE);
+		__atomic_store_n(&m->shared->rxErrors, frame->data[7], __ATOMIC_RELEASE);
+	}
+	if (cls & CAN_ERR_CRTL) {
+		const __u8 crtl = frame->data[1];
+		count(m, ERRMON_STAT_CONTROLLER);
+		if (crtl & CAN_ERR_CRTL_RX_OVERFLOW) {
+			count(m, ERRMON_STAT_RX_OVERFLOW);
+		}
+		if (crtl & CAN_ERR_CRTL_TX_OVERFLOW) {
+			count(m, ERRMON_STAT_TX_OVERFLOW);
+		}
+		if (crtl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+			setState(m, ERRMON_STATE_ERROR_PASSIVE);
+		} else if (crtl & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) {
+			setState(m, ERRMON_STATE_ERROR_WARNING);
+		} else if (crtl & CAN_ERR_CRTL_ACTIVE) {
+			setState(m, ERRMON_STATE_ERROR_ACTIVE);
+		}
+	}
+	if (cls & CAN_ERR_BUSOFF) {
+		count(m, ERRMON_STAT_BUS_OFF);
+		setState(m, ERRMON_STATE_BUS_OFF);
+	}
+	if (cls & CAN_ERR_RESTARTED) {
+		count(m, ERRMON_STAT_RESTARTED);
+		setState(m, ERRMON_STATE_ERROR_ACTIVE);
+	}
+}
+
+static void* errorMonitorWorker(void *arg) {
+	ErrorMonitor *m = (ErrorMonitor*) arg;
+	struct can_frame frames[ERROR_MONITOR_BATCH];
+	struct mmsghdr msgs[ERROR_MONITOR_BATCH];
+	struct iovec iovs[ERROR_MONITOR_BATCH];
+	struct pollfd pfds[2];
+	pfds[0].fd = m->fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = m->stopFd;
+	pfds[1].events = POLLIN;
+
+	while (__atomic_load_n(&m->running, __ATOMIC_ACQUIRE)) {
+		pfds[0].revents = 0;
+		pfds[1].revents = 0;
+		if (poll(pfds, 2, -1) <= 0) {
+			continue;
+		}
+		if ((pfds[0].revents & POLLIN) == 0) {
+			if (pfds[0].revents & (POLLERR | POLLHUP)) {
+				socketErrorBackoff(m->fd, m->stopFd);
+			}
+			continue;
+		}
+		for (int i = 0; i < ERROR_MONITOR_BATCH; i++) {
+			iovs[i].iov_base = &frames[i];
+			iovs[i].iov_len = sizeof(frames[i]);
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		const int n = recvmmsg(m->fd, msgs, ERROR_MONITOR_BATCH, MSG_DONTWAIT, NULL);
+		for (int i = 0; i < n; i++) {
+			if (msgs[i].msg_len == sizeof(struct can_frame) && (frames[i].can_id & CAN_ERR_FLAG)) {
+				decode(m, &frames[i]);
+			}
+		}
+	}
+	return NULL;
+}
+
+static int errorMonitorStart(ErrorMonitor *m) {
+	const int fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+	if (fd == -1) {
+		return -1;
+	}
+	const can_err_mask_t errMask = CAN_ERR_MASK;
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = m->ifIndex;
+	//no data frames at all, only error frames
+	if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) == -1
+			|| setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errMask, sizeof(errMask)) == -1
+			|| bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	m->fd = fd;
+	m->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m->stopFd == -1) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	m->running = 1;
+	const int rc = pthread_create(&m->thread, NULL, errorMonitorWorker, (void*) m);
+	if (rc) {
+		close(m->stopFd);
+		close(fd);
+		errno = rc;
+		return -1;
+	}
+	return 0;
+}
+
+static void errorMonitorFree(ErrorMonitor *m) {
+	pthread_cond_destroy(&m->changed);
+	pthread_mutex_destroy(&m->lock);
+	sharedMemoryRelease(m->shared);
+	free(m);
+}
+
+/*
+ * Returns the monitor of the interface, started on first use. Every call
+ * has to be paired with errorMonitorRelease().
+ */
+ErrorMonitor *errorMonitorAcquire(int ifIndex) {
+	if (ifIndex <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	pthread_mutex_lock(&errorMonitorsLock);
+	int freeSlot = -1;
+	for (int i = 0; i < ERROR_MONITOR_MAX; i++) {
+		if (errorMonitors[i] != NULL && errorMonitors[i]->ifIndex == ifIndex) {
+			errorMonitors[i]->refs++;
+			ErrorMonitor *m = errorMonitors[i];
+			pthread_mutex_unlock(&errorMonitorsLock);
+			return m;
+		}
+		if (errorMonitors[i] == NULL && freeSlot == -1) {
+			freeSlot = i;
+		}
+	}
+	if (freeSlot == -1) {
+		pthread_mutex_unlock(&errorMonitorsLock);
+		errno = ENOSPC;
+		return NULL;
+	}
+	ErrorMonitor *m = (ErrorMonitor*) calloc(1, sizeof(ErrorMonitor));
+	void *mem = m != NULL ? sharedMemoryAlloc(ERRMON_SHARED_SIZE) : NULL;
+	if (mem == NULL) {
+		free(m);
+		pthread_mutex_unlock(&errorMonitorsLock);
+		errno = ENOMEM;
+		return NULL;
+	}
+	m->shared = (ErrorMonitorShared*) mem;
+	m->shared->state = ERRMON_STATE_ERROR_ACTIVE;
+	m->ifIndex = ifIndex;
+	m->refs = 1;
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&m->changed, &attr);
+	pthread_condattr_destroy(&attr);
+	if (errorMonitorStart(m) == -1) {
+		const int err = errno;
+		errorMonitorFree(m);
+		pthread_mutex_unlock(&errorMonitorsLock);
+		errno = err;
+		return NULL;
+	}
+	errorMonitors[freeSlot] = m;
+	pthread_mutex_unlock(&errorMonitorsLock);
+	return m;
+}
+
+/* takes another reference to the monitor of the interface if it is running, NULL otherwise */
+ErrorMonitor *errorMonitorGet(int ifIndex) {
+	ErrorMonitor *m = NULL;
+	pthread_mutex_lock(&errorMonitorsLock);
+	for (int i = 0; i < ERROR_MONITOR_MAX; i++) {
+		if (errorMonitors[i] != NULL && errorMonitors[i]->ifIndex == ifIndex) {
+			m = errorMonitors[i];
+			m->refs++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&errorMonitorsLock);
+	return m;
+}
+
+/*
+ * Returns the monitor that owns the shared memory at the address without
+ * taking a reference, NULL if there is none. The caller has to hold one.
+ */
+ErrorMonitor *errorMonitorOfMemory(const void *memory) {
+	ErrorMonitor *m = NULL;
+	pthread_mutex_lock(&errorMonitorsLock);
+	for (int i = 0; i < ERROR_MONITOR_MAX; i++) {
+		if (errorMonitors[i] != NULL && errorMonitors[i]->shared == memory) {
+			m = errorMonitors[i];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&errorMonitorsLock);
+	return m;
+}
+
+void errorMonitorRelease(ErrorMonitor *m) {
+	pthread_mutex_lock(&errorMonitorsLock);
+	if (--m->refs > 0) {
+		pthread_mutex_unlock(&errorMonitorsLock);
+		return;
+	}
+	for (int i = 0; i < ERROR_MONITOR_MAX; i++) {
+		if (errorMonitors[i] == m) {
+			errorMonitors[i] = NULL;
+		}
+	}
+	pthread_mutex_unlock(&errorMonitorsLock);
+	__atomic_store_n(&m->running, 0, __ATOMIC_RELEASE);
+	eventfd_write(m->stopFd, 1);
+	pthread_join(m->thread, NULL);
+	close(m->stopFd);
+	close(m->fd);
+	errorMonitorFree(m);
+}
+
+/* the shared memory, refcounted: retain it to keep it beyond the monitor */
+void *errorMonitorMemory(ErrorMonitor *m) {
+	return m->shared;
+}
+
+/*
+ * Waits until stateChanges differs from seenChanges or the timeout expires
+ * and returns the current value of stateChanges. The caller has to hold a
+ * reference to the monitor.
+ */
+jint errorMonitorAwait(ErrorMonitor *m, jint seenChanges, jint timeoutMs) {
+	//the condition waits on CLOCK_MONOTONIC, a change of the wall clock does not affect the timeout
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (long) (timeoutMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= NSEC_PER_SEC) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= NSEC_PER_SEC;
+	}
+	pthread_mutex_lock(&m->lock);
+	while ((jint) m->shared->stateChanges == seenChanges) {
+		if (pthread_cond_timedwait(&m->changed, &m->lock, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	const jint changes = (jint) m->shared->stateChanges;
+	pthread_mutex_unlock(&m->lock);
+	return changes;
+}
+
+/* the controller state as last reported by an error frame */
+__u32 errorMonitorState(ErrorMonitor *m) {
+	return __atomic_load_n(&m->shared->state, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Registers a function called by the monitor thread on every state
+ * transition. It is called with the monitor lock held and must not block.
+ * Returns 0 on success and -1 with errno set if all listener slots are taken.
+ */
+int errorMonitorAddListener(ErrorMonitor *m, ErrorMonitorListener fn, void *arg) {
+	int rc = -1;
+	pthread_mutex_lock(&m->lock);
+	for (int i = 0; i < ERROR_MONITOR_LISTENERS; i++) {
+		if (m->listeners[i] == NULL) {
+			m->listeners[i] = fn;
+			m->listenerArgs[i] = arg;
+			rc = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m->lock);
+	if (rc == -1) {
+		errno = ENOSPC;
+	}
+	return rc;
+}
+
+/* the function is not called anymore once this returns */
+void errorMonitorRemoveListener(ErrorMonitor *m, ErrorMonitorListener fn, void *arg) {
+	pthread_mutex_lock(&m->lock);
+	for (int i = 0; i < ERROR_MONITOR_LISTENERS; i++) {
+		if (m->listeners[i] == fn && m->listenerArgs[i] == arg) {
+			m->listeners[i] = NULL;
+			m->listenerArgs[i] = NULL;
+		}
+	}
+	pthread_mutex_unlock(&m->lock);
+}
@@ -0,0 +1,175 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+}
+
+#include "cansocket.hpp"
+
+/* SOF to the end of the data field of the largest CAN FD frame, plus a classic CRC */
+#define FRAME_BITS_MAX						   600
+/* CRC delimiter, ACK slot, ACK delimiter, end of frame, intermission */
+#define FRAME_BITS_CLASSIC_TAIL					13
+/* ACK slot, ACK delimiter, end of frame, intermission; the CRC delimiter is counted in the data phase */
+#define FRAME_BITS_FD_TAIL						12
+
+/*
+ * On-wire length of CAN and CAN FD frames.
+ *
+ * Counts the bits of a frame from start of frame to the end of the
+ * intermission as in ISO 11898-1, split into the bits sent with the nominal
+ * and with the data bitrate (a CAN FD frame with BRS switches after the BRS
+ * bit and back after the CRC delimiter). Stuff bits are left out, counted for
+ * the worst case (one per four stuffable bits after the first) or exactly by
+ * building the bit stream, with the CRC-15 of classic frames. The CRC field
+ * of CAN FD frames has fixed stuff bits only, so its CRC needs no computing.
+ */
+typedef struct _BitStream {
+	__u8 bits[FRAME_BITS_MAX];
+	int n;
+} BitStream;
+
+static void putBits(BitStream *s, __u32 value, int count) {
+	for (int i = count - 1; i >= 0; i--) {
+		s->bits[s->n++] = (value >> i) & 1;
+	}
+}
+
+static __u32 crc15(const BitStream *s) {
+	__u32 crc = 0;
+	for (int i = 0; i < s->n; i++) {
+		const __u32 next = s->bits[i] ^ ((crc >> 14) & 1);
+		crc = (crc << 1) & 0x7FFF;
+		if (next) {
+			crc ^= 0x4599;
+		}
+	}
+	return crc;
+}
+
+/* stuff bits inserted into the stream, those after the first split bits are added to *late */
+static int stuffBits(const BitStream *s, int split, int *late) {
+	int stuff = 0;
+	int run = 0;
+	int last = -1;
+	*late = 0;
+	for (int i = 0; i < s->n; i++) {
+		if (s->bits[i] == last) {
+			run++;
+		} else {
+			last = s->bits[i];
+			run = 1;
+		}
+		if (run == 5) {
+			stuff++;
+			if (i >= split) {
+				(*late)++;
+			}
+			last = !last;
+			run = 1;
+		}
+	}
+	return stuff;
+}
+
+static int fdDlc(int len) {
+	if (len <= 8) {
+		return len;
+	}
+	static const int lens[] = { 12, 16, 20, 24, 32, 48, 64 };
+	for (int i = 0; i < 7; i++) {
+		if (len <= lens[i]) {
+			return 9 + i;
+		}
+	}
+	return 15;
+}
+
+static void putId(BitStream *s, canid_t canid, int rtr, int fd) {
+	putBits(s, 0, 1);
+	if (canid & CAN_EFF_FLAG) {
+		putBits(s, (canid & CAN_EFF_MASK) >> 18, 11);
+		putBits(s, 1, 1);
+		putBits(s, 1, 1);
+		putBits(s, canid & 0x3FFFF, 18);
+		putBits(s, rtr, 1);
+		if (!fd) {
+			putBits(s, 0, 1);
+		}
+	} else {
+		putBits(s, canid & CAN_SFF_MASK, 11);
+		putBits(s, rtr, 1);
+		putBits(s, 0, 1);
+	}
+}
+
+/*
+ * Returns the bits of the frame sent with the nominal bitrate and sets
+ * *dataBits to those sent with the data bitrate. fd tells a CAN FD frame,
+ * stuffing is one of the BUSLOAD_STUFFING_ values.
+ */
+int frameBits(const struct canfd_frame *frame, int fd, int stuffing, int *dataBits) {
+	const int eff = (frame->can_id & CAN_EFF_FLAG) != 0;
+	const int len = fd ? std::min((int) frame->len, CANFD_MAX_DLEN) : std::min((int) frame->len, CAN_MAX_DLEN);
+	if (!fd) {
+		const int rtr = (frame->can_id & CAN_RTR_FLAG) != 0;
+		const int dataLen = rtr ? 0 : len;
+		const int stuffable = (eff ? 54 : 34) + 8 * dataLen;
+		int stuff = 0;
+		if (stuffing == BUSLOAD_STUFFING_WORST) {
+			stuff = (stuffable - 1) / 4;
+		} else if (stuffing == BUSLOAD_STUFFING_EXACT) {
+			BitStream s;
+			s.n = 0;
+			putId(&s, frame->can_id, rtr, 0);
+			putBits(&s, 0, 1);
+			putBits(&s, frame->len > CAN_MAX_DLEN ? CAN_MAX_DLEN : frame->len, 4);
+			for (int i = 0; i < dataLen; i++) {
+				putBits(&s, frame->data[i], 8);
+			}
+			putBits(&s, crc15(&s), 15);
+			int late;
+			stuff = stuffBits(&s, s.n, &late);
+		}
+		*dataBits = 0;
+		return stuffable + stuff + FRAME_BITS_CLASSIC_TAIL;
+	}
+	const int brs = (frame->flags & CANFD_BRS) != 0;
+	const int arbitration = eff ? 36 : 17;
+	const int dynamic = arbitration + 5 + 8 * len;
+	//stuff count, CRC and the fixed stuff bits before and within them
+	const int crcField = len <= 16 ? 4 + 17 + 6 : 4 + 21 + 7;
+	int stuff = 0;
+	int lateStuff = 0;
+	if (stuffing == BUSLOAD_STUFFING_WORST) {
+		stuff = (dynamic - 1) / 4;
+		lateStuff = stuff - (arbitration - 1) / 4;
+	} else if (stuffing == BUSLOAD_STUFFING_EXACT) {
+		BitStream s;
+		s.n = 0;
+		putId(&s, frame->can_id, 0, 1);
+		putBits(&s, 1, 1);
+		putBits(&s, 0, 1);
+		putBits(&s, brs, 1);
+		putBits(&s, (frame->flags & CANFD_ESI) != 0, 1);
+		putBits(&s, fdDlc(len), 4);
+		for (int i = 0; i < len; i++) {
+			putBits(&s, frame->data[i], 8);
+		}
+		stuff = stuffBits(&s, arbitration, &lateStuff);
+	}
+	const int data = dynamic - arbitration + lateStuff + crcField + 1;
+	const int nominal = arbitration + stuff - lateStuff + FRAME_BITS_FD_TAIL;
+	if (!brs) {
+		*dataBits = 0;
+		return nominal + data;
+	}
+	*dataBits = data;
+	return nominal;
+}
@@ -0,0 +1,147 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+#define ID_FILTER_SFF_WORDS					((CAN_SFF_MASK + 1) / 64)
+#define ID_FILTER_MIN_SLOTS						16
+
+/*
+ * Whitelist of CAN IDs with a constant lookup cost.
+ *
+ * Standard IDs are looked up in a bitmap with one bit per ID, extended IDs in
+ * an open addressing hash table with linear probing, kept at most half full.
+ * Slots hold the ID with CAN_EFF_FLAG set, so 0 marks an empty slot.
+ * A filter is immutable once built. All filters ever set on a socket are
+ * linked into a list and only freed with the socket context, so replacing the
+ * filter needs no lock on the receive path.
+ */
+struct _IdFilter {
+	IdFilter *next;
+	__u64 sff[ID_FILTER_SFF_WORDS];
+	int sffCount;
+	int effCount;
+	canid_t sffAnd, sffOr;
+	canid_t effAnd, effOr;
+	__u32 mask;
+	canid_t *slots;
+};
+
+static inline __u32 idFilterHash(canid_t id) {
+	return (__u32) id * 0x9E3779B1u;
+}
+
+IdFilter *idFilterCreate(const jint *ids, jint count) {
+	int effCount = 0;
+	for (jint i = 0; i < count; i++) {
+		const canid_t id = (canid_t) ids[i];
+		if (id & CAN_EFF_FLAG) {
+			effCount++;
+		} else if (id > CAN_SFF_MASK) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	__u32 slots = ID_FILTER_MIN_SLOTS;
+	while (slots < (__u32) effCount * 2) {
+		slots *= 2;
+	}
+	IdFilter *f = (IdFilter*) calloc(1, sizeof(IdFilter) + slots * sizeof(canid_t));
+	if (f == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	f->slots = (canid_t*) (f + 1);
+	f->mask = slots - 1;
+	f->sffAnd = f->effAnd = ~0u;
+	for (jint i = 0; i < count; i++) {
+		canid_t id = (canid_t) ids[i];
+		if (id & CAN_EFF_FLAG) {
+			id &= CAN_EFF_FLAG | CAN_EFF_MASK;
+			__u32 slot = idFilterHash(id) & f->mask;
+			while (f->slots[slot] != 0 && f->slots[slot] != id) {
+				slot = (slot + 1) & f->mask;
+			}
+			if (f->slots[slot] == 0) {
+				f->slots[slot] = id;
+				f->effCount++;
+				f->effAnd &= id;
+				f->effOr |= id;
+			}
+		} else if (!(f->sff[id / 64] & (1ULL << (id % 64)))) {
+			f->sff[id / 64] |= 1ULL << (id % 64);
+			f->sffCount++;
+			f->sffAnd &= id;
+			f->sffOr |= id;
+		}
+	}
+	return f;
+}
+
+/* frees the filter and all filters linked to it */
+void idFilterDestroy(IdFilter *f) {
+	while (f != NULL) {
+		IdFilter *next = f->next;
+		free(f);
+		f = next;
+	}
+}
+
+void idFilterLink(IdFilter *f, IdFilter *next) {
+	f->next = next;
+}
+
+/* returns 1 if the frame's ID is in the whitelist, error frames always pass */
+int idFilterMatch(const IdFilter *f, canid_t canid) {
+	if (canid & CAN_ERR_FLAG) {
+		return 1;
+	}
+	if (!(canid & CAN_EFF_FLAG)) {
+		const canid_t id = canid & CAN_SFF_MASK;
+		return (f->sff[id / 64] >> (id % 64)) & 1;
+	}
+	const canid_t id = canid & (CAN_EFF_FLAG | CAN_EFF_MASK);
+	__u32 slot = idFilterHash(id) & f->mask;
+	while (f->slots[slot] != 0) {
+		if (f->slots[slot] == id) {
+			return 1;
+		}
+		slot = (slot + 1) & f->mask;
+	}
+	return 0;
+}
+
+/*
+ * Computes a coarse kernel filter letting at least all whitelisted IDs pass:
+ * one can_filter per frame format whose mask covers the bits all IDs of that
+ * format have in common. Returns the number of filters stored (at most 2).
+ */
+int idFilterPrefilter(const IdFilter *f, struct can_filter *filters) {
+	int n = 0;
+	if (f->sffCount > 0) {
+		//bits set in all IDs or clear in all IDs
+		const canid_t common = (f->sffAnd | ~f->sffOr) & CAN_SFF_MASK;
+		filters[n].can_id = f->sffAnd & common;
+		filters[n].can_mask = CAN_EFF_FLAG | common;
+		n++;
+	}
+	if (f->effCount > 0) {
+		const canid_t common = (f->effAnd | ~f->effOr) & CAN_EFF_MASK;
+		filters[n].can_id = CAN_EFF_FLAG | (f->effAnd & common);
+		filters[n].can_mask = CAN_EFF_FLAG | common;
+		n++;
+	}
+	return n;
+}
@@ -0,0 +1,247 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define INVENTORY_EMPTY_KEY				   0xFFFFFFFFU
+#define INVENTORY_INITIAL_SIZE					64
+/* table entries, at most half of them are used; frames of further IDs are only counted */
+#define INVENTORY_MAX_SIZE					 16384
+
+/*
+ * Bus inventory.
+ *
+ * Statistics per CAN ID of the frames received on a socket: count, first and
+ * last reception time, DLC range and the period between two frames with the
+ * ID (mean, minimum, maximum and standard deviation as jitter). Mean and
+ * variance are updated with Welford's method, so a frame costs a hash lookup
+ * and a few arithmetic operations. The table grows as new IDs show up.
+ *
+ * The receive paths of the socket update the inventory while any thread may
+ * take a snapshot, a mutex held for one batch of frames keeps them apart.
+ * Times are CLOCK_MONOTONIC in ns, taken from the kernel receive timestamp of
+ * each frame (SO_TIMESTAMPNS, see rx_pipeline.cpp), so neither batching nor
+ * the scheduling latency of the reader shows in the periods. Error frames are
+ * counted under CAN_ERR_FLAG.
+ */
+typedef struct _InventoryEntry {
+	__u32 key;
+	__u8 dlcMin;
+	__u8 dlcMax;
+	__u64 count;
+	__u64 firstNs;
+	__u64 lastNs;
+	__u64 minPeriodNs;
+	__u64 maxPeriodNs;
+	double meanPeriodNs;
+	double m2;
+} InventoryEntry;
+
+struct _Inventory {
+	pthread_mutex_t lock;
+	int enabled;
+	InventoryEntry *entries;
+	__u32 mask;
+	__u32 used;
+	jlong untracked;
+};
+
+static __u32 inventoryKey(canid_t canid) {
+	if (canid & CAN_ERR_FLAG) {
+		return CAN_ERR_FLAG;
+	}
+	return (canid & CAN_EFF_FLAG) ? canid & (CAN_EFF_FLAG | CAN_EFF_MASK) : canid & CAN_SFF_MASK;
+}
+
+static __u32 inventoryHash(__u32 key) {
+	return key * 0x9E3779B1U;
+}
+
+static InventoryEntry *inventoryAlloc(__u32 size) {
+	InventoryEntry *entries = (InventoryEntry*) malloc(sizeof(InventoryEntry) * size);
+	if (entries != NULL) {
+		for (__u32 i = 0; i < size; i++) {
+			entries[i].key = INVENTORY_EMPTY_KEY;
+		}
+	}
+	return entries;
+}
+
+static int inventoryGrow(Inventory *inv) {
+	const __u32 size = (inv->mask + 1) * 2;
+	if (size > INVENTORY_MAX_SIZE) {
+		return -1;
+	}
+	InventoryEntry *entries = inventoryAlloc(size);
+	if (entries == NULL) {
+		return -1;
+	}
+	for (__u32 i = 0; i <= inv->mask; i++) {
+		if (inv->entries[i].key == INVENTORY_EMPTY_KEY) {
+			continue;
+		}
+		__u32 pos = inventoryHash(inv->entries[i].key) & (size - 1);
+		while (entries[pos].key != INVENTORY_EMPTY_KEY) {
+			pos = (pos + 1) & (size - 1);
+		}
+		entries[pos] = inv->entries[i];
+	}
+	free(inv->entries);
+	inv->entries = entries;
+	inv->mask = size - 1;
+	return 0;
+}
+
+/* the entry of the key, a new one if there is room, NULL otherwise */
+static InventoryEntry *inventoryLookup(Inventory *inv, __u32 key) {
+	__u32 pos = inventoryHash(key) & inv->mask;
+	while (inv->entries[pos].key != key) {
+		if (inv->entries[pos].key == INVENTORY_EMPTY_KEY) {
+			if ((inv->used + 1) * 2 > inv->mask + 1) {
+				if (inventoryGrow(inv) == -1) {
+					return NULL;
+				}
+				return inventoryLookup(inv, key);
+			}
+			inv->used++;
+			InventoryEntry *e = &inv->entries[pos];
+			memset(e, 0, sizeof(*e));
+			e->key = key;
+			return e;
+		}
+		pos = (pos + 1) & inv->mask;
+	}
+	return &inv->entries[pos];
+}
+
+Inventory *inventoryCreate() {
+	Inventory *inv = (Inventory*) calloc(1, sizeof(Inventory));
+	if (inv == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	inv->entries = inventoryAlloc(INVENTORY_INITIAL_SIZE);
+	if (inv->entries == NULL) {
+		free(inv);
+		errno = ENOMEM;
+		return NULL;
+	}
+	inv->mask = INVENTORY_INITIAL_SIZE - 1;
+	pthread_mutex_init(&inv->lock, NULL);
+	return inv;
+}
+
+void inventoryDestroy(Inventory *inv) {
+	if (inv == NULL) {
+		return;
+	}
+	pthread_mutex_destroy(&inv->lock);
+	free(inv->entries);
+	free(inv);
+}
+
+int inventoryEnabled(const Inventory *inv) {
+	return __atomic_load_n(&inv->enabled, __ATOMIC_RELAXED);
+}
+
+/* enabling starts a new inventory, disabling keeps the current one for snapshots */
+void inventorySetEnabled(Inventory *inv, int enabled) {
+	pthread_mutex_lock(&inv->lock);
+	if (enabled && !inv->enabled) {
+		for (__u32 i = 0; i <= inv->mask; i++) {
+			inv->entries[i].key = INVENTORY_EMPTY_KEY;
+		}
+		inv->used = 0;
+		inv->untracked = 0;
+	}
+	__atomic_store_n(&inv->enabled, enabled, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&inv->lock);
+}
+
+/* timesNs holds the receive time of every frame */
+void inventoryObserve(Inventory *inv, const struct can_frame *frames, const __u64 *timesNs, int count) {
+	pthread_mutex_lock(&inv->lock);
+	for (int i = 0; i < count && inv->enabled; i++) {
+		const __u64 nowNs = timesNs[i];
+		InventoryEntry *e = inventoryLookup(inv, inventoryKey(frames[i].can_id));
+		if (e == NULL) {
+			inv->untracked++;
+			continue;
+		}
+		const __u8 dlc = frames[i].can_dlc;
+		if (e->count++ == 0) {
+			e->firstNs = nowNs;
+			e->dlcMin = dlc;
+			e->dlcMax = dlc;
+		} else {
+			//the wall clock the kernel stamps with may have been stepped back
+			const __u64 period = nowNs > e->lastNs ? nowNs - e->lastNs : 0;
+			if (e->count == 2 || period < e->minPeriodNs) {
+				e->minPeriodNs = period;
+			}
+			if (period > e->maxPeriodNs) {
+				e->maxPeriodNs = period;
+			}
+			//Welford over the count - 1 periods
+			const double n = (double) (e->count - 1);
+			const double delta = (double) period - e->meanPeriodNs;
+			e->meanPeriodNs += delta / n;
+			e->m2 += delta * ((double) period - e->meanPeriodNs);
+			e->dlcMin = std::min(e->dlcMin, dlc);
+			e->dlcMax = std::max(e->dlcMax, dlc);
+		}
+		e->lastNs = nowNs;
+	}
+	pthread_mutex_unlock(&inv->lock);
+}
+
+/*
+ * Copies the inventory into a new array, freed by the caller: the number of
+ * frames of IDs not tracked (the table was full) followed by INVENTORY_FIELDS
+ * values per ID. Sets *count to the number of IDs, returns NULL with errno
+ * set on failure.
+ */
+jlong *inventorySnapshot(Inventory *inv, int *count) {
+	pthread_mutex_lock(&inv->lock);
+	jlong *values = (jlong*) malloc(sizeof(jlong) * (1 + (size_t) inv->used * INVENTORY_FIELDS));
+	if (values == NULL) {
+		pthread_mutex_unlock(&inv->lock);
+		errno = ENOMEM;
+		return NULL;
+	}
+	values[0] = inv->untracked;
+	int n = 0;
+	for (__u32 i = 0; i <= inv->mask; i++) {
+		const InventoryEntry *e = &inv->entries[i];
+		if (e->key == INVENTORY_EMPTY_KEY) {
+			continue;
+		}
+		jlong *v = &values[1 + n++ * INVENTORY_FIELDS];
+		v[INVENTORY_CAN_ID] = (jint) e->key;
+		v[INVENTORY_COUNT] = (jlong) e->count;
+		v[INVENTORY_FIRST_NS] = (jlong) e->firstNs;
+		v[INVENTORY_LAST_NS] = (jlong) e->lastNs;
+		v[INVENTORY_MEAN_PERIOD_NS] = (jlong) llround(e->meanPeriodNs);
+		v[INVENTORY_MIN_PERIOD_NS] = (jlong) e->minPeriodNs;
+		v[INVENTORY_MAX_PERIOD_NS] = (jlong) e->maxPeriodNs;
+		v[INVENTORY_JITTER_NS] = e->count > 2 ? (jlong) llround(sqrt(e->m2 / (double) (e->count - 2))) : 0;
+		v[INVENTORY_DLC_MIN] = e->dlcMin;
+		v[INVENTORY_DLC_MAX] = e->dlcMax;
+	}
+	pthread_mutex_unlock(&inv->lock);
+	*count = n;
+	return values;
+}
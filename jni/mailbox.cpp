@@ -0,0 +1,177 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+#define MAILBOX_EMPTY_KEY				   0xFFFFFFFFU
+
+/*
+ * Latest value mailboxes.
+ *
+ * One slot per CAN ID holds the newest frame received with that ID, the
+ * slots are shared with Java through a direct ByteBuffer. Only the receiving
+ * thread writes a slot, guarded by a sequence lock: seq is odd while the slot
+ * is written. A reader loads seq with acquire semantics, retries while it is
+ * odd, reads the fields, issues an acquire fence and loads seq again; the
+ * values are consistent if seq did not change. Readers never block the
+ * writer and a reader needs no native call. The slots are reference counted
+ * shared memory (see shared_memory.cpp), a reader racing with close() still
+ * reads valid memory.
+ *
+ * Slot layout (keep in sync with CanSocket.Mailbox), MAILBOX_SLOT_SIZE bytes
+ * each, in the order of the IDs given: seq (u32) at 0, can_id (u32) at 4,
+ * timestamp (CLOCK_MONOTONIC ns, u64) at 8, updates (u64) at 16, len (u8)
+ * at 24, data (8 bytes) at 32. A slot never updated has updates 0.
+ */
+typedef struct _MailboxSlot {
+	__u32 seq;
+	__u32 canId;
+	__u64 timestampNs;
+	__u64 updates;
+	__u8 len;
+	__u8 pad[7];
+	__u8 data[CAN_MAX_DLEN];
+	__u8 reserved[24];
+} MailboxSlot;
+
+static_assert(sizeof(MailboxSlot) == MAILBOX_SLOT_SIZE, "unexpected mailbox slot size");
+
+struct _Mailbox {
+	int count;
+	__u32 mask;
+	__u32 *keys;
+	int *indices;
+	MailboxSlot *slots;
+};
+
+/* data frames only, the key tells standard and extended IDs apart */
+static __u32 mailboxKey(canid_t canid) {
+	return (canid & CAN_EFF_FLAG) ? canid & (CAN_EFF_FLAG | CAN_EFF_MASK) : canid & CAN_SFF_MASK;
+}
+
+static __u32 mailboxHash(__u32 key) {
+	return key * 0x9E3779B1U;
+}
+
+void mailboxDestroy(Mailbox *mb) {
+	if (mb == NULL) {
+		return;
+	}
+	free(mb->keys);
+	free(mb->indices);
+	sharedMemoryRelease(mb->slots);
+	free(mb);
+}
+
+/*
+ * Creates a mailbox per ID, IDs with CAN_EFF_FLAG are extended IDs.
+ * Returns NULL with errno set on failure, EINVAL for an empty list, a
+ * standard ID out of range or an ID given twice.
+ */
+Mailbox *mailboxCreate(const jint *ids, int count) {
+	if (count < 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+	__u32 size = 1;
+	while (size < (__u32) count * 2) {
+		size <<= 1;
+	}
+	Mailbox *mb = (Mailbox*) calloc(1, sizeof(Mailbox));
+	void *mem = mb != NULL ? sharedMemoryAlloc((size_t) count * sizeof(MailboxSlot)) : NULL;
+	if (mem == NULL) {
+		free(mb);
+		errno = ENOMEM;
+		return NULL;
+	}
+	mb->slots = (MailboxSlot*) mem;
+	mb->count = count;
+	mb->mask = size - 1;
+	mb->keys = (__u32*) malloc(sizeof(__u32) * size);
+	mb->indices = (int*) malloc(sizeof(int) * size);
+	if (mb->keys == NULL || mb->indices == NULL) {
+		mailboxDestroy(mb);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(mb->keys, 0xFF, sizeof(__u32) * size);
+	for (int i = 0; i < count; i++) {
+		const canid_t id = (canid_t) ids[i];
+		if (!(id & CAN_EFF_FLAG) && (id & ~CAN_SFF_MASK) != 0) {
+			mailboxDestroy(mb);
+			errno = EINVAL;
+			return NULL;
+		}
+		const __u32 key = mailboxKey(id);
+		__u32 pos = mailboxHash(key) & mb->mask;
+		while (mb->keys[pos] != MAILBOX_EMPTY_KEY) {
+			if (mb->keys[pos] == key) {
+				mailboxDestroy(mb);
+				errno = EINVAL;
+				return NULL;
+			}
+			pos = (pos + 1) & mb->mask;
+		}
+		mb->keys[pos] = key;
+		mb->indices[pos] = i;
+		mb->slots[i].canId = key;
+	}
+	return mb;
+}
+
+void *mailboxMemory(Mailbox *mb) {
+	return mb->slots;
+}
+
+jlong mailboxSize(const Mailbox *mb) {
+	return (jlong) mb->count * MAILBOX_SLOT_SIZE;
+}
+
+/* one exact kernel filter per ID, filters must have room for all of them */
+int mailboxFilters(const Mailbox *mb, struct can_filter *filters) {
+	for (int i = 0; i < mb->count; i++) {
+		const __u32 key = mb->slots[i].canId;
+		filters[i].can_id = key;
+		filters[i].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | ((key & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+	}
+	return mb->count;
+}
+
+int mailboxCount(const Mailbox *mb) {
+	return mb->count;
+}
+
+/* stores the frame if it has a mailbox and returns 1, called by the receiving thread only */
+int mailboxUpdate(Mailbox *mb, const struct can_frame *frame, __u64 timestampNs) {
+	if (frame->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) {
+		return 0;
+	}
+	const __u32 key = mailboxKey(frame->can_id);
+	__u32 pos = mailboxHash(key) & mb->mask;
+	while (mb->keys[pos] != key) {
+		if (mb->keys[pos] == MAILBOX_EMPTY_KEY) {
+			return 0;
+		}
+		pos = (pos + 1) & mb->mask;
+	}
+	MailboxSlot *slot = &mb->slots[mb->indices[pos]];
+	const __u32 seq = slot->seq;
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->timestampNs = timestampNs;
+	slot->updates++;
+	slot->len = frame->can_dlc;
+	memcpy(slot->data, frame->data, CAN_MAX_DLEN);
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	return 1;
+}
@@ -0,0 +1,809 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define MUX_MAX									16
+#define MUX_SUBSCRIBERS_MAX					  256
+#define MUX_BATCH								32
+#define MUX_QUEUE_MAX						65536
+/* more filters than this and the kernel receives everything, the subscribers filter anyway */
+#define MUX_KERNEL_FILTERS_MAX				  512
+
+/*
+ * Receive multiplexer.
+ *
+ * The kernel clones every received frame into each CAN_RAW socket on the
+ * interface. A multiplexer owns a single socket per interface instead and
+ * fans the frames out to any number of subscribers in user space. Each
+ * subscriber has its own filter list (can_filter semantics as with
+ * CAN_RAW_FILTER) and its own bounded queue, a full queue drops the frame
+ * for that subscriber only and counts it. The kernel filter of the shared
+ * socket is the union of the subscriber filters.
+ * A mailbox subscriber has no queue, the frames of its IDs overwrite the
+ * latest value in the mailbox instead (see mailbox.cpp). An on-change
+ * subscriber only queues frames whose payload changed (see change_filter.cpp),
+ * together with the bits that changed. A decimated subscriber applies rate
+ * policies per ID (see decimator.cpp); the thread wakes up at the end of the
+ * next decimation window to queue the frames held back. A watchdog subscriber
+ * queues receive timeout events instead of frames (see watchdog.cpp), the
+ * thread also wakes up for the slots of its timer wheel. The shard subscribers
+ * of a sharded subscription share their filters and a sharder (see
+ * sharder.cpp), each frame matching the filters is queued for the one shard
+ * its ID maps to. Writing wakeFd makes the thread recompute when to wake up,
+ * and stops it once running is 0.
+ *
+ * The queue of a subscriber is a single producer (the multiplexer thread),
+ * single consumer ring, concurrent receivers of one subscriber serialize on
+ * recvLock. A receiver announces in the sleeping flag that it is going to
+ * wait on the eventfd, the multiplexer thread only makes the wake up call if
+ * the flag is set, once per batch.
+ */
+typedef struct _Mux Mux;
+
+typedef struct _MuxSubscriber {
+	jint handle;
+	int refs;
+	int closed;
+	Mux *mux;
+	Mailbox *mailbox;
+	ChangeFilter *change;
+	Decimator *decimator;
+	Watchdog *watchdog;
+	Sharder *sharder;
+	int shard;
+	struct can_filter *filters;
+	int filterCount;
+	struct can_frame *queue;
+	__u64 *changes;
+	__u32 mask;
+	__u32 head;
+	__u32 tail;
+	int sleeping;
+	int eventFd;
+	pthread_mutex_t recvLock;
+	jlong stats[MUX_STATS_COUNT];
+} MuxSubscriber;
+
+struct _Mux {
+	int ifIndex;
+	int fd;
+	int wakeFd;
+	int running;
+	pthread_t thread;
+	pthread_rwlock_t lock;
+	MuxSubscriber *subscribers[MUX_SUBSCRIBERS_MAX];
+	int count;
+};
+
+static Mux *muxes[MUX_MAX];
+static MuxSubscriber *muxSubscribers[MUX_SUBSCRIBERS_MAX];
+static __u32 muxGeneration;
+static pthread_mutex_t muxLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int filterMatch(const struct can_filter *f, canid_t canid) {
+	const int match = (canid & f->can_mask) == (f->can_id & ~CAN_INV_FILTER & f->can_mask);
+	return (f->can_id & CAN_INV_FILTER) ? !match : match;
+}
+
+static int subscriberMatch(const MuxSubscriber *sub, canid_t canid) {
+	for (int i = 0; i < sub->filterCount; i++) {
+		if (filterMatch(&sub->filters[i], canid)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* called by the multiplexer thread only */
+static int subscriberPush(MuxSubscriber *sub, const struct can_frame *frame, __u64 changed) {
+	const __u32 head = sub->head;
+	if (head - __atomic_load_n(&sub->tail, __ATOMIC_ACQUIRE) > sub->mask) {
+		__atomic_fetch_add(&sub->stats[MUX_STAT_DROPPED], 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	sub->queue[head & sub->mask] = *frame;
+	if (sub->changes != NULL) {
+		sub->changes[head & sub->mask] = changed;
+	}
+	__atomic_store_n(&sub->head, head + 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&sub->stats[MUX_STAT_RECEIVED], 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+static void subscriberWake(MuxSubscriber *sub) {
+	if (__atomic_exchange_n(&sub->sleeping, 0, __ATOMIC_SEQ_CST)) {
+		eventfd_write(sub->eventFd, 1);
+	}
+}
+
+typedef struct _MuxEmit {
+	MuxSubscriber *sub;
+	int *pushed;
+} MuxEmit;
+
+/* queues a frame a decimator held back or a watchdog event */
+static void muxEmit(void *arg, const struct can_frame *frame) {
+	MuxEmit *e = (MuxEmit*) arg;
+	*e->pushed += subscriberPush(e->sub, frame, 0);
+}
+
+static __u64 monotonicNs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (__u64) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void* muxWorker(void *arg) {
+	Mux *mux = (Mux*) arg;
+	struct can_frame frames[MUX_BATCH];
+	struct mmsghdr msgs[MUX_BATCH];
+	struct iovec iovs[MUX_BATCH];
+	int pushed[MUX_SUBSCRIBERS_MAX];
+	struct pollfd pfds[2];
+	pfds[0].fd = mux->fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = mux->wakeFd;
+	pfds[1].events = POLLIN;
+	__u64 nextNs = DECIMATOR_NO_DEADLINE;
+
+	while (__atomic_load_n(&mux->running, __ATOMIC_ACQUIRE)) {
+		int timeoutMs = -1;
+		if (nextNs != DECIMATOR_NO_DEADLINE) {
+			const __u64 nowNs = monotonicNs();
+			timeoutMs = nextNs > nowNs ? (int) ((nextNs - nowNs + 999999) / 1000000) : 0;
+		}
+		pfds[0].revents = 0;
+		pfds[1].revents = 0;
+		if (poll(pfds, 2, timeoutMs) < 0) {
+			continue;
+		}
+		const int woken = pfds[1].revents & POLLIN;
+		if (woken) {
+			eventfd_t value;
+			eventfd_read(mux->wakeFd, &value);
+		}
+		int n = 0;
+		if (pfds[0].revents & POLLIN) {
+			for (int i = 0; i < MUX_BATCH; i++) {
+				iovs[i].iov_base = &frames[i];
+				iovs[i].iov_len = sizeof(frames[i]);
+				memset(&msgs[i], 0, sizeof(msgs[i]));
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			n = std::max(recvmmsg(mux->fd, msgs, MUX_BATCH, MSG_DONTWAIT, NULL), 0);
+		} else if (pfds[0].revents & (POLLERR | POLLHUP)) {
+			//e.g. ENETDOWN while the interface is down, poll() would report it again at once
+			socketErrorBackoff(mux->fd, mux->wakeFd);
+		}
+		if (n == 0 && !woken && nextNs == DECIMATOR_NO_DEADLINE) {
+			continue;
+		}
+		const __u64 nowNs = monotonicNs();
+		pthread_rwlock_rdlock(&mux->lock);
+		memset(pushed, 0, sizeof(int) * mux->count);
+		//held back frames of ended windows go first, a frame of the new window may replace them otherwise
+		nextNs = DECIMATOR_NO_DEADLINE;
+		for (int s = 0; s < mux->count; s++) {
+			MuxSubscriber *sub = mux->subscribers[s];
+			MuxEmit emit = { sub, &pushed[s] };
+			if (sub->decimator != NULL) {
+				nextNs = std::min(nextNs, decimatorFlush(sub->decimator, nowNs, muxEmit, &emit));
+			} else if (sub->watchdog != NULL) {
+				nextNs = std::min(nextNs, watchdogAdvance(sub->watchdog, nowNs, muxEmit, &emit));
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			if (msgs[i].msg_len != sizeof(struct can_frame)) {
+				continue;
+			}
+			for (int s = 0; s < mux->count; s++) {
+				MuxSubscriber *sub = mux->subscribers[s];
+				if (sub->mailbox != NULL) {
+					if (mailboxUpdate(sub->mailbox, &frames[i], nowNs)) {
+						__atomic_fetch_add(&sub->stats[MUX_STAT_RECEIVED], 1, __ATOMIC_RELAXED);
+					}
+				} else if (sub->watchdog != NULL) {
+					MuxEmit emit = { sub, &pushed[s] };
+					watchdogRefresh(sub->watchdog, &frames[i], nowNs, &nextNs, muxEmit, &emit);
+				} else if (subscriberMatch(sub, frames[i].can_id) && (sub->sharder == NULL
+						|| sharderPick(sub->sharder, frames[i].can_id) == sub->shard)) {
+					__u64 changed = 0;
+					const int pass = sub->decimator != NULL
+							? decimatorCheck(sub->decimator, &frames[i], nowNs, &nextNs)
+							: sub->change == NULL || changeFilterCheck(sub->change, &frames[i], nowNs, &changed);
+					if (pass == 1) {
+						pushed[s] += subscriberPush(sub, &frames[i], changed);
+					} else if (pass == 0) {
+						__atomic_fetch_add(&sub->stats[MUX_STAT_SUPPRESSED], 1, __ATOMIC_RELAXED);
+					}
+				}
+			}
+		}
+		for (int s = 0; s < mux->count; s++) {
+			if (pushed[s] > 0) {
+				subscriberWake(mux->subscribers[s]);
+			}
+		}
+		pthread_rwlock_unlock(&mux->lock);
+	}
+	return NULL;
+}
+
+/* whether an earlier shard of the same sharded subscription contributes the filters already */
+static int muxFiltersShared(const Mux *mux, int s) {
+	const Sharder *sh = mux->subscribers[s]->sharder;
+	for (int i = 0; sh != NULL && i < s; i++) {
+		if (mux->subscribers[i]->sharder == sh) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* sets the union of all subscriber filters on the shared socket, called with the write lock held */
+static int muxApplyFilters(Mux *mux) {
+	int total = 0;
+	for (int s = 0; s < mux->count; s++) {
+		if (!muxFiltersShared(mux, s)) {
+			total += mux->subscribers[s]->filterCount;
+		}
+	}
+	if (total > MUX_KERNEL_FILTERS_MAX) {
+		const struct can_filter any = { 0, 0 };
+		return setsockopt(mux->fd, SOL_CAN_RAW, CAN_RAW_FILTER, &any, sizeof(any));
+	}
+	struct can_filter filters[MUX_KERNEL_FILTERS_MAX];
+	int n = 0;
+	for (int s = 0; s < mux->count; s++) {
+		const MuxSubscriber *sub = mux->subscribers[s];
+		if (muxFiltersShared(mux, s)) {
+			continue;
+		}
+		memcpy(&filters[n], sub->filters, sizeof(struct can_filter) * sub->filterCount);
+		n += sub->filterCount;
+	}
+	return setsockopt(mux->fd, SOL_CAN_RAW, CAN_RAW_FILTER, n > 0 ? filters : NULL,
+			sizeof(struct can_filter) * n);
+}
+
+static void muxStop(Mux *mux) {
+	__atomic_store_n(&mux->running, 0, __ATOMIC_RELEASE);
+	eventfd_write(mux->wakeFd, 1);
+	pthread_join(mux->thread, NULL);
+	close(mux->wakeFd);
+	close(mux->fd);
+	pthread_rwlock_destroy(&mux->lock);
+	free(mux);
+}
+
+static Mux *muxStart(int ifIndex) {
+	Mux *mux = (Mux*) calloc(1, sizeof(Mux));
+	if (mux == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	mux->ifIndex = ifIndex;
+	mux->fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+	if (mux->fd == -1) {
+		free(mux);
+		return NULL;
+	}
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifIndex;
+	//nothing is received until the first subscriber sets its filters
+	if (setsockopt(mux->fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) == -1
+			|| bind(mux->fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1
+			|| (mux->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+		const int err = errno;
+		close(mux->fd);
+		free(mux);
+		errno = err;
+		return NULL;
+	}
+	pthread_rwlock_init(&mux->lock, NULL);
+	mux->running = 1;
+	const int rc = pthread_create(&mux->thread, NULL, muxWorker, (void*) mux);
+	if (rc) {
+		pthread_rwlock_destroy(&mux->lock);
+		close(mux->wakeFd);
+		close(mux->fd);
+		free(mux);
+		errno = rc;
+		return NULL;
+	}
+	return mux;
+}
+
+static void subscriberFree(MuxSubscriber *sub) {
+	if (sub->eventFd != -1) {
+		close(sub->eventFd);
+	}
+	pthread_mutex_destroy(&sub->recvLock);
+	mailboxDestroy(sub->mailbox);
+	changeFilterDestroy(sub->change);
+	decimatorDestroy(sub->decimator);
+	watchdogDestroy(sub->watchdog);
+	sharderRelease(sub->sharder);
+	free(sub->changes);
+	free(sub->filters);
+	free(sub->queue);
+	free(sub);
+}
+
+static MuxSubscriber *subscriberCreate(const struct can_filter *filters, int count, int capacity) {
+	__u32 size = 1;
+	while (size < (__u32) capacity) {
+		size <<= 1;
+	}
+	MuxSubscriber *sub = (MuxSubscriber*) calloc(1, sizeof(MuxSubscriber));
+	if (sub == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&sub->recvLock, NULL);
+	sub->refs = 1;
+	sub->mask = size - 1;
+	sub->filterCount = count;
+	sub->queue = (struct can_frame*) malloc(sizeof(struct can_frame) * size);
+	sub->filters = (struct can_filter*) malloc(sizeof(struct can_filter) * std::max(count, 1));
+	sub->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (sub->queue == NULL || sub->filters == NULL || sub->eventFd == -1) {
+		subscriberFree(sub);
+		return NULL;
+	}
+	if (count > 0) {
+		memcpy(sub->filters, filters, sizeof(struct can_filter) * count);
+	}
+	return sub;
+}
+
+static int muxAddAll(int ifIndex, MuxSubscriber **subs, int n);
+
+static jint muxAdd(int ifIndex, MuxSubscriber *sub) {
+	//nobody else knows the handle yet, the subscriber cannot be gone
+	return muxAddAll(ifIndex, &sub, 1) == 0 ? sub->handle : -1;
+}
+
+/* takes a reference to the subscriber, NULL if the handle is stale */
+static MuxSubscriber *subscriberGet(jint handle) {
+	const int slot = handle & (MUX_SUBSCRIBERS_MAX - 1);
+	pthread_mutex_lock(&muxLock);
+	MuxSubscriber *sub = muxSubscribers[slot];
+	if (sub != NULL && sub->handle == handle) {
+		sub->refs++;
+	} else {
+		sub = NULL;
+	}
+	pthread_mutex_unlock(&muxLock);
+	return sub;
+}
+
+static void subscriberPut(MuxSubscriber *sub) {
+	pthread_mutex_lock(&muxLock);
+	const int refs = --sub->refs;
+	pthread_mutex_unlock(&muxLock);
+	if (refs == 0) {
+		subscriberFree(sub);
+	}
+}
+
+/*
+ * Adds a subscriber receiving the frames of the interface that match any of
+ * the filters into a queue of at least capacity frames. The multiplexer of
+ * the interface is started with the first subscriber. Returns the handle of
+ * the subscriber, or -1 with errno set on failure.
+ */
+jint muxSubscribe(int ifIndex, const struct can_filter *filters, int count, int capacity) {
+	if (ifIndex <= 0 || count < 0 || capacity < 1 || capacity > MUX_QUEUE_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	MuxSubscriber *sub = subscriberCreate(filters, count, capacity);
+	if (sub == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return muxAdd(ifIndex, sub);
+}
+
+/*
+ * Adds a subscriber that keeps the latest frame of each ID of the mailbox.
+ * The mailbox is owned by the subscriber from now on, also if this fails.
+ * Returns the handle of the subscriber, or -1 with errno set on failure.
+ */
+jint muxSubscribeMailbox(int ifIndex, Mailbox *mb) {
+	if (ifIndex <= 0) {
+		mailboxDestroy(mb);
+		errno = EINVAL;
+		return -1;
+	}
+	const int count = mailboxCount(mb);
+	struct can_filter *filters = (struct can_filter*) malloc(sizeof(struct can_filter) * count);
+	MuxSubscriber *sub = filters != NULL ? subscriberCreate(NULL, 0, 1) : NULL;
+	if (sub == NULL) {
+		free(filters);
+		mailboxDestroy(mb);
+		errno = ENOMEM;
+		return -1;
+	}
+	//the filters only narrow the kernel filter down, matching is done by the mailbox
+	free(sub->filters);
+	sub->filters = filters;
+	sub->filterCount = mailboxFilters(mb, filters);
+	sub->mailbox = mb;
+	return muxAdd(ifIndex, sub);
+}
+
+/*
+ * Adds a subscriber as with muxSubscribe that only receives the frames the
+ * change filter passes. The filter is owned by the subscriber from now on,
+ * also if this fails.
+ */
+jint muxSubscribeOnChange(int ifIndex, const struct can_filter *filters, int count, int capacity,
+		ChangeFilter *cf) {
+	if (ifIndex <= 0 || count < 0 || capacity < 1 || capacity > MUX_QUEUE_MAX) {
+		changeFilterDestroy(cf);
+		errno = EINVAL;
+		return -1;
+	}
+	MuxSubscriber *sub = subscriberCreate(filters, count, capacity);
+	if (sub != NULL) {
+		sub->change = cf;
+		sub->changes = (__u64*) malloc(sizeof(__u64) * (sub->mask + 1));
+		if (sub->changes == NULL) {
+			subscriberFree(sub);
+			sub = NULL;
+		}
+	} else {
+		changeFilterDestroy(cf);
+	}
+	if (sub == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return muxAdd(ifIndex, sub);
+}
+
+/*
+ * Adds a subscriber as with muxSubscribe whose frames pass the rate policies
+ * of the decimator. The decimator is owned by the subscriber from now on,
+ * also if this fails.
+ */
+jint muxSubscribeDecimated(int ifIndex, const struct can_filter *filters, int count, int capacity,
+		Decimator *dec) {
+	if (ifIndex <= 0 || count < 0 || capacity < 1 || capacity > MUX_QUEUE_MAX) {
+		decimatorDestroy(dec);
+		errno = EINVAL;
+		return -1;
+	}
+	MuxSubscriber *sub = subscriberCreate(filters, count, capacity);
+	if (sub == NULL) {
+		decimatorDestroy(dec);
+		errno = ENOMEM;
+		return -1;
+	}
+	sub->decimator = dec;
+	return muxAdd(ifIndex, sub);
+}
+
+/*
+ * Adds a subscriber that queues a WATCHDOG_TIMEOUT event whenever one of the
+ * IDs is not received within its timeout and a WATCHDOG_RECOVERED event when
+ * it is received again. The timeouts start now. Returns the handle of the
+ * subscriber, or -1 with errno set on failure.
+ */
+jint muxSubscribeWatchdog(int ifIndex, const jint *ids, const jint *timeoutsMs, int count, int capacity) {
+	if (ifIndex <= 0 || capacity < 1 || capacity > MUX_QUEUE_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	Watchdog *wd = watchdogCreate(ids, timeoutsMs, count, monotonicNs());
+	if (wd == NULL) {
+		return -1;
+	}
+	struct can_filter *filters = (struct can_filter*) malloc(sizeof(struct can_filter) * count);
+	MuxSubscriber *sub = filters != NULL ? subscriberCreate(NULL, 0, capacity) : NULL;
+	if (sub == NULL) {
+		free(filters);
+		watchdogDestroy(wd);
+		errno = ENOMEM;
+		return -1;
+	}
+	//the filters only narrow the kernel filter down, matching is done by the watchdog
+	free(sub->filters);
+	sub->filters = filters;
+	sub->filterCount = watchdogFilters(wd, filters);
+	sub->watchdog = wd;
+	return muxAdd(ifIndex, sub);
+}
+
+/*
+ * Adds one subscriber per shard of the sharder, each with the filters and a
+ * queue of at least capacity frames, and stores their handles. A frame
+ * matching the filters is queued for the shard its ID maps to only. The
+ * sharder is owned by the subscribers from now on, also if this fails.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+jint muxSubscribeSharded(int ifIndex, const struct can_filter *filters, int count, int capacity, Sharder *sh,
+		jint *handles) {
+	if (ifIndex <= 0 || count < 0 || capacity < 1 || capacity > MUX_QUEUE_MAX) {
+		sharderRelease(sh);
+		errno = EINVAL;
+		return -1;
+	}
+	const int shards = sharderShards(sh);
+	if (shards > MUX_SUBSCRIBERS_MAX) {
+		sharderRelease(sh);
+		errno = ENOSPC;
+		return -1;
+	}
+	MuxSubscriber *subs[MUX_SUBSCRIBERS_MAX];
+	for (int i = 0; i < shards; i++) {
+		subs[i] = subscriberCreate(filters, count, capacity);
+		if (subs[i] == NULL) {
+			while (--i >= 0) {
+				subscriberFree(subs[i]);
+			}
+			sharderRelease(sh);
+			errno = ENOMEM;
+			return -1;
+		}
+		sharderRetain(sh);
+		subs[i]->sharder = sh;
+		subs[i]->shard = i;
+	}
+	sharderRelease(sh);
+	//all shards start together, no frame is routed to a shard not subscribed yet
+	if (muxAddAll(ifIndex, subs, shards) == -1) {
+		return -1;
+	}
+	for (int i = 0; i < shards; i++) {
+		handles[i] = subs[i]->handle;
+	}
+	return 0;
+}
+
+/*
+ * Registers the subscribers with the multiplexer of the interface, started
+ * if there is none, and sets the kernel filters once for all of them. The
+ * subscribers are freed if this fails. Returns 0 on success, -1 with errno
+ * set on failure.
+ */
+static int muxAddAll(int ifIndex, MuxSubscriber **subs, int n) {
+	pthread_mutex_lock(&muxLock);
+	int slots[MUX_SUBSCRIBERS_MAX];
+	int found = 0;
+	for (int i = 0; i < MUX_SUBSCRIBERS_MAX && found < n; i++) {
+		if (muxSubscribers[i] == NULL) {
+			slots[found++] = i;
+		}
+	}
+	Mux *mux = NULL;
+	int muxSlot = -1;
+	for (int i = 0; i < MUX_MAX; i++) {
+		if (muxes[i] != NULL && muxes[i]->ifIndex == ifIndex) {
+			mux = muxes[i];
+			break;
+		}
+		if (muxes[i] == NULL && muxSlot == -1) {
+			muxSlot = i;
+		}
+	}
+	int err = ENOSPC;
+	if (found == n && mux == NULL && muxSlot != -1) {
+		mux = muxStart(ifIndex);
+		err = errno;
+		if (mux != NULL) {
+			muxes[muxSlot] = mux;
+		}
+	}
+	if (found < n || mux == NULL) {
+		pthread_mutex_unlock(&muxLock);
+		for (int i = 0; i < n; i++) {
+			subscriberFree(subs[i]);
+		}
+		errno = err;
+		return -1;
+	}
+	int watchdogs = 0;
+	for (int i = 0; i < n; i++) {
+		subs[i]->mux = mux;
+		subs[i]->handle = (jint) ((++muxGeneration << 8) & 0x7FFFFFFF) | slots[i];
+		watchdogs |= subs[i]->watchdog != NULL;
+	}
+	pthread_rwlock_wrlock(&mux->lock);
+	for (int i = 0; i < n; i++) {
+		mux->subscribers[mux->count++] = subs[i];
+	}
+	const int rc = muxApplyFilters(mux);
+	err = errno;
+	if (rc == -1) {
+		mux->count -= n;
+	}
+	pthread_rwlock_unlock(&mux->lock);
+	if (rc == -1) {
+		if (mux->count == 0) {
+			muxes[muxSlot] = NULL;
+			muxStop(mux);
+		}
+		pthread_mutex_unlock(&muxLock);
+		for (int i = 0; i < n; i++) {
+			subscriberFree(subs[i]);
+		}
+		errno = err;
+		return -1;
+	}
+	for (int i = 0; i < n; i++) {
+		muxSubscribers[slots[i]] = subs[i];
+	}
+	if (watchdogs) {
+		//arms the timer wheel of the new watchdog
+		eventfd_write(mux->wakeFd, 1);
+	}
+	pthread_mutex_unlock(&muxLock);
+	return 0;
+}
+
+/*
+ * Removes the subscriber, a receiver blocked on it returns with EBADF. The
+ * multiplexer stops with its last subscriber.
+ */
+void muxUnsubscribe(jint handle) {
+	const int slot = handle & (MUX_SUBSCRIBERS_MAX - 1);
+	pthread_mutex_lock(&muxLock);
+	MuxSubscriber *sub = muxSubscribers[slot];
+	if (sub == NULL || sub->handle != handle) {
+		pthread_mutex_unlock(&muxLock);
+		return;
+	}
+	muxSubscribers[slot] = NULL;
+	Mux *mux = sub->mux;
+	pthread_rwlock_wrlock(&mux->lock);
+	for (int s = 0; s < mux->count; s++) {
+		if (mux->subscribers[s] == sub) {
+			mux->subscribers[s] = mux->subscribers[--mux->count];
+			break;
+		}
+	}
+	if (mux->count > 0) {
+		muxApplyFilters(mux);
+	}
+	pthread_rwlock_unlock(&mux->lock);
+	if (mux->count == 0) {
+		for (int i = 0; i < MUX_MAX; i++) {
+			if (muxes[i] == mux) {
+				muxes[i] = NULL;
+			}
+		}
+	} else {
+		mux = NULL;
+	}
+	pthread_mutex_unlock(&muxLock);
+	if (mux != NULL) {
+		muxStop(mux);
+	}
+	__atomic_store_n(&sub->closed, 1, __ATOMIC_SEQ_CST);
+	eventfd_write(sub->eventFd, 1);
+	subscriberPut(sub);
+}
+
+/*
+ * Takes up to maxCount frames from the queue of the subscriber. Waits up to
+ * timeoutMs (forever if negative) for the first one. changes, if not NULL,
+ * receives the changed payload bits of each frame (0 unless the subscriber is
+ * an on-change subscriber). Returns the number of frames, 0 on timeout, -1
+ * with errno set if the subscriber is closed.
+ */
+int muxRecv(jint handle, struct can_frame *frames, jlong *changes, int maxCount, jint timeoutMs) {
+	MuxSubscriber *sub = subscriberGet(handle);
+	if (sub == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const __s64 deadlineMs = (__s64) now.tv_sec * 1000 + now.tv_nsec / 1000000 + timeoutMs;
+	int rc = 0;
+	pthread_mutex_lock(&sub->recvLock);
+	while (1) {
+		const __u32 tail = sub->tail;
+		const __u32 available = __atomic_load_n(&sub->head, __ATOMIC_ACQUIRE) - tail;
+		if (available > 0) {
+			rc = (int) std::min(available, (__u32) maxCount);
+			for (int i = 0; i < rc; i++) {
+				frames[i] = sub->queue[(tail + i) & sub->mask];
+				if (changes != NULL) {
+					changes[i] = sub->changes != NULL ? (jlong) sub->changes[(tail + i) & sub->mask] : 0;
+				}
+			}
+			__atomic_store_n(&sub->tail, tail + rc, __ATOMIC_RELEASE);
+			break;
+		}
+		if (__atomic_load_n(&sub->closed, __ATOMIC_ACQUIRE)) {
+			errno = EBADF;
+			rc = -1;
+			break;
+		}
+		int waitMs = -1;
+		if (timeoutMs >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			waitMs = (int) std::max(deadlineMs - ((__s64) now.tv_sec * 1000 + now.tv_nsec / 1000000), (__s64) 0);
+			if (waitMs == 0) {
+				break;
+			}
+		}
+		__atomic_store_n(&sub->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&sub->head, __ATOMIC_SEQ_CST) == tail && !__atomic_load_n(&sub->closed, __ATOMIC_SEQ_CST)) {
+			struct pollfd pfd;
+			pfd.fd = sub->eventFd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, waitMs) > 0) {
+				eventfd_t value;
+				eventfd_read(sub->eventFd, &value);
+			}
+		}
+		__atomic_store_n(&sub->sleeping, 0, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&sub->recvLock);
+	const int err = errno;
+	subscriberPut(sub);
+	errno = err;
+	return rc;
+}
+
+/*
+ * Returns the slots of a mailbox subscriber and their size in bytes, NULL
+ * with errno set if the handle is not a mailbox subscriber. The caller gets
+ * a reference to the memory and drops it with sharedMemoryRelease().
+ */
+void *muxMailboxMemory(jint handle, jlong *size) {
+	MuxSubscriber *sub = subscriberGet(handle);
+	if (sub == NULL || sub->mailbox == NULL) {
+		if (sub != NULL) {
+			subscriberPut(sub);
+		}
+		errno = EBADF;
+		return NULL;
+	}
+	void *mem = mailboxMemory(sub->mailbox);
+	*size = mailboxSize(sub->mailbox);
+	sharedMemoryRetain(mem);
+	subscriberPut(sub);
+	return mem;
+}
+
+int muxGetStats(jint handle, jlong *stats) {
+	MuxSubscriber *sub = subscriberGet(handle);
+	if (sub == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	for (int i = 0; i < MUX_STATS_COUNT; i++) {
+		stats[i] = __atomic_load_n(&sub->stats[i], __ATOMIC_RELAXED);
+	}
+	stats[MUX_STAT_DEPTH] = __atomic_load_n(&sub->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&sub->tail,
+			__ATOMIC_ACQUIRE);
+	subscriberPut(sub);
+	return 0;
+}
@@ -0,0 +1,214 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <syslog.h>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define CANLOG_RING_SIZE						  256
+#define CANLOG_MSG_SIZE							  240
+#define CANLOG_IDLE_TIMEOUT_MS				 1000
+
+/*
+ * Asynchronous native logging.
+ *
+ * Messages are formatted by the calling thread into a slot of a bounded
+ * lock-free ring (multiple producers, the flusher thread as single consumer,
+ * slots carry a sequence number as in Vyukov's bounded queue). A full ring
+ * drops the message and counts it, so logging never blocks and never
+ * allocates. The flusher writes the messages to syslog, or hands them to the
+ * Java listener if one is registered.
+ * The flusher sleeps on an eventfd after announcing it in the sleeping flag,
+ * producers only make the wake up call if the flag is set.
+ */
+typedef struct _CanLogSlot {
+	__u32 seq;
+	int level;
+	char msg[CANLOG_MSG_SIZE];
+} CanLogSlot;
+
+static CanLogSlot canlogRing[CANLOG_RING_SIZE];
+static __u32 canlogEnqueuePos;
+static __u32 canlogDequeuePos;
+static __u32 canlogDropped;
+static int canlogSleeping;
+static int canlogEventFd = -1;
+static int canlogInitialized;
+
+int canlogLevel = CANLOG_LEVEL_INFO;
+
+static JavaVM *canlogVm;
+static jclass canlogClass;
+static jmethodID canlogMethod;
+static int canlogForwarding;
+static pthread_mutex_t canlogForwardLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* hands a message to the Java listener, returns 0 if forwarding is off */
+static int canlogForward(JNIEnv **env, int level, const char *msg) {
+	if (!__atomic_load_n(&canlogForwarding, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	if (*env == NULL && canlogVm->AttachCurrentThreadAsDaemon(reinterpret_cast<void**>(env), NULL) != JNI_OK) {
+		*env = NULL;
+		return 0;
+	}
+	const jstring str = (*env)->NewStringUTF(msg);
+	if (str != NULL) {
+		(*env)->CallStaticVoidMethod(canlogClass, canlogMethod, (jint) level, str);
+		(*env)->DeleteLocalRef(str);
+	}
+	if ((*env)->ExceptionCheck() == JNI_TRUE) {
+		(*env)->ExceptionClear();
+	}
+	return 1;
+}
+
+static void canlogEmit(JNIEnv **env, int level, const char *msg) {
+	if (!canlogForward(env, level, msg)) {
+		syslog(level, "%s", msg);
+	}
+}
+
+static int canlogFlush(JNIEnv **env) {
+	int flushed = 0;
+	while (1) {
+		CanLogSlot *slot = &canlogRing[canlogDequeuePos % CANLOG_RING_SIZE];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != canlogDequeuePos + 1) {
+			break;
+		}
+		canlogEmit(env, slot->level, slot->msg);
+		__atomic_store_n(&slot->seq, canlogDequeuePos + CANLOG_RING_SIZE, __ATOMIC_RELEASE);
+		canlogDequeuePos++;
+		flushed++;
+	}
+	const __u32 dropped = __atomic_exchange_n(&canlogDropped, 0, __ATOMIC_RELAXED);
+	if (dropped > 0) {
+		char msg[64];
+		snprintf(msg, sizeof(msg), "%u log messages dropped", dropped);
+		canlogEmit(env, CANLOG_LEVEL_WARN, msg);
+	}
+	return flushed;
+}
+
+static int canlogPending(void) {
+	const CanLogSlot *slot = &canlogRing[canlogDequeuePos % CANLOG_RING_SIZE];
+	return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == canlogDequeuePos + 1
+			|| __atomic_load_n(&canlogDropped, __ATOMIC_SEQ_CST) != 0;
+}
+
+static void* canlogFlusher(void *arg) {
+	JNIEnv *env = NULL;
+	openlog("libsocket-can-java", LOG_PID, LOG_USER);
+	while (1) {
+		canlogFlush(&env);
+		__atomic_store_n(&canlogSleeping, 1, __ATOMIC_SEQ_CST);
+		if (!canlogPending()) {
+			struct pollfd pfd;
+			pfd.fd = canlogEventFd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, CANLOG_IDLE_TIMEOUT_MS) > 0) {
+				eventfd_t value;
+				eventfd_read(canlogEventFd, &value);
+			}
+		}
+		__atomic_store_n(&canlogSleeping, 0, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/* starts the flusher thread, called once when the library is loaded */
+void canlogInit(JavaVM *vm) {
+	canlogVm = vm;
+	for (__u32 i = 0; i < CANLOG_RING_SIZE; i++) {
+		canlogRing[i].seq = i;
+	}
+	canlogEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (canlogEventFd == -1) {
+		return;
+	}
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, canlogFlusher, NULL) == 0) {
+		__atomic_store_n(&canlogInitialized, 1, __ATOMIC_RELEASE);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/* use the CANLOG_* macros, they skip the call if the level is disabled */
+void canlogWrite(int level, const char *fmt, ...) {
+	if (!__atomic_load_n(&canlogInitialized, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	__u32 pos = __atomic_load_n(&canlogEnqueuePos, __ATOMIC_RELAXED);
+	CanLogSlot *slot;
+	while (1) {
+		slot = &canlogRing[pos % CANLOG_RING_SIZE];
+		const __s32 diff = (__s32) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&canlogEnqueuePos, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			__atomic_fetch_add(&canlogDropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&canlogEnqueuePos, __ATOMIC_RELAXED);
+		}
+	}
+	slot->level = level;
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(slot->msg, sizeof(slot->msg), fmt, args);
+	va_end(args);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&canlogSleeping, 0, __ATOMIC_SEQ_CST)) {
+		eventfd_write(canlogEventFd, 1);
+	}
+}
+
+void canlogSetLevel(int level) {
+	__atomic_store_n(&canlogLevel, level, __ATOMIC_RELAXED);
+}
+
+/*
+ * Routes the messages to the static method void nativeLog(int, String) of
+ * the given class, or back to syslog if clazz is NULL. The class is resolved
+ * once and kept for the lifetime of the library.
+ */
+int canlogSetForwarding(JNIEnv *env, jclass clazz) {
+	if (clazz == NULL) {
+		__atomic_store_n(&canlogForwarding, 0, __ATOMIC_RELEASE);
+		return 0;
+	}
+	pthread_mutex_lock(&canlogForwardLock);
+	if (canlogClass == NULL) {
+		canlogMethod = env->GetStaticMethodID(clazz, "nativeLog", "(ILjava/lang/String;)V");
+		if (canlogMethod != NULL) {
+			canlogClass = static_cast<jclass>(env->NewGlobalRef(clazz));
+		}
+	}
+	const int ok = canlogClass != NULL;
+	pthread_mutex_unlock(&canlogForwardLock);
+	if (!ok) {
+		return -1;
+	}
+	__atomic_store_n(&canlogForwarding, 1, __ATOMIC_RELEASE);
+	return 0;
+}
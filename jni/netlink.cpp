@@ -0,0 +1,560 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/netlink.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define NETLINK_BUFFER_SIZE					8192
+#define NETLINK_LINK_BUFFER_SIZE			   32768
+#define LINK_TABLE_MAX							64
+
+static int netlinkOpen(__u32 groups) {
+	const int nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl == -1) {
+		return -1;
+	}
+	struct sockaddr_nl local;
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	local.nl_groups = groups;
+	if (bind(nl, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) == -1) {
+		const int err = errno;
+		close(nl);
+		errno = err;
+		return -1;
+	}
+	return nl;
+}
+
+/*
+ * Checks whether a qdisc of the given kind (e.g. "etf") is attached to the
+ * interface.
+ * Returns 1 if so, 0 if not and -1 with errno set if the query failed.
+ */
+int netlinkHasQdisc(int ifIndex, const char *kind) {
+	const int nl = netlinkOpen(0);
+	if (nl == -1) {
+		return -1;
+	}
+
+	struct {
+		struct nlmsghdr nlh;
+		struct tcmsg tcm;
+	} req;
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req.nlh.nlmsg_type = RTM_GETQDISC;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = 1;
+	req.tcm.tcm_family = AF_UNSPEC;
+	if (send(nl, &req, req.nlh.nlmsg_len, 0) == -1) {
+		const int err = errno;
+		close(nl);
+		errno = err;
+		return -1;
+	}
+
+	std::unique_ptr<char[]> buffer(new char[NETLINK_BUFFER_SIZE]);
+	int found = 0;
+	int done = 0;
+	while (!done) {
+		const ssize_t len = recv(nl, buffer.get(), NETLINK_BUFFER_SIZE, 0);
+		if (len == -1) {
+			const int err = errno;
+			close(nl);
+			errno = err;
+			return -1;
+		}
+		int remaining = (int) len;
+		for (struct nlmsghdr *nlh = (struct nlmsghdr*) buffer.get(); NLMSG_OK(nlh, remaining);
+				nlh = NLMSG_NEXT(nlh, remaining)) {
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				const struct nlmsgerr *nlerr = (const struct nlmsgerr*) NLMSG_DATA(nlh);
+				close(nl);
+				errno = -nlerr->error;
+				return -1;
+			}
+			if (nlh->nlmsg_type != RTM_NEWQDISC) {
+				continue;
+			}
+			const struct tcmsg *tcm = (const struct tcmsg*) NLMSG_DATA(nlh);
+			if (tcm->tcm_ifindex != ifIndex) {
+				continue;
+			}
+			int attrLen = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct tcmsg));
+			for (struct rtattr *rta = (struct rtattr*) ((char*) tcm + NLMSG_ALIGN(sizeof(struct tcmsg)));
+					RTA_OK(rta, attrLen); rta = RTA_NEXT(rta, attrLen)) {
+				if (rta->rta_type == TCA_KIND && strcmp((const char*) RTA_DATA(rta), kind) == 0) {
+					found = 1;
+				}
+			}
+		}
+	}
+	close(nl);
+	return found;
+}
+
+static struct rtattr *addAttr(struct nlmsghdr *nlh, int type, const void *data, int len) {
+	struct rtattr *rta = (struct rtattr*) ((char*) nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if (len > 0) {
+		memcpy(RTA_DATA(rta), data, len);
+	}
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	return rta;
+}
+
+static void endNest(struct nlmsghdr *nlh, struct rtattr *nest) {
+	nest->rta_len = (unsigned short) ((char*) nlh + nlh->nlmsg_len - (char*) nest);
+}
+
+/*
+ * Restarts a CAN controller in bus-off state, the same as
+ * "ip link set <dev> type can restart". Needs CAP_NET_ADMIN. The kernel
+ * answers EBUSY if the controller is not in bus-off state (anymore).
+ * Returns 0 on success and -1 with errno set on failure.
+ */
+int netlinkCanRestart(int ifIndex) {
+	const int nl = netlinkOpen(0);
+	if (nl == -1) {
+		return -1;
+	}
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+		char attrs[64];
+	} req;
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.nlh.nlmsg_type = RTM_NEWLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.nlh.nlmsg_seq = 1;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifIndex;
+	const __u32 restart = 1;
+	struct rtattr *linkinfo = addAttr(&req.nlh, IFLA_LINKINFO, NULL, 0);
+	addAttr(&req.nlh, IFLA_INFO_KIND, "can", 3);
+	struct rtattr *data = addAttr(&req.nlh, IFLA_INFO_DATA, NULL, 0);
+	addAttr(&req.nlh, IFLA_CAN_RESTART, &restart, sizeof(restart));
+	endNest(&req.nlh, data);
+	endNest(&req.nlh, linkinfo);
+	if (send(nl, &req, req.nlh.nlmsg_len, 0) == -1) {
+		const int err = errno;
+		close(nl);
+		errno = err;
+		return -1;
+	}
+
+	char buffer[NETLINK_BUFFER_SIZE];
+	while (1) {
+		const ssize_t len = recv(nl, buffer, sizeof(buffer), 0);
+		if (len == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			const int err = errno;
+			close(nl);
+			errno = err;
+			return -1;
+		}
+		int remaining = (int) len;
+		for (struct nlmsghdr *nlh = (struct nlmsghdr*) buffer; NLMSG_OK(nlh, remaining);
+				nlh = NLMSG_NEXT(nlh, remaining)) {
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				const int error = -((const struct nlmsgerr*) NLMSG_DATA(nlh))->error;
+				close(nl);
+				if (error != 0) {
+					errno = error;
+					return -1;
+				}
+				return 0;
+			}
+		}
+	}
+}
+
+/*
+ * Interface table.
+ *
+ * Name, index and MTU of all interfaces are cached and kept up to date by a
+ * thread listening to RTMGRP_LINK notifications, so looking them up costs no
+ * system call. The table is filled by a dump when it is first used and dumped
+ * again if notifications were lost; entries not seen in that dump belong to
+ * links removed meanwhile and are swept. CAN controller state, error counters and
+ * device statistics change without notifications, netlinkLinkQuery() fetches
+ * them with a single RTM_GETLINK request.
+ */
+static LinkInfo linkTable[LINK_TABLE_MAX];
+static __u32 linkTableMarks[LINK_TABLE_MAX]; //generation of the dump that last saw the entry
+static __u32 linkTableGeneration;
+static int linkTableSize;
+static int linkTableOverflow;
+static pthread_mutex_t linkTableLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t linkTableOnce = PTHREAD_ONCE_INIT;
+static int linkTableReady;
+static int linkEventFd = -1;
+static int linkRequestFd = -1;
+static __u32 linkRequestSeq;
+static pthread_mutex_t linkRequestLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void parseCanInfo(const struct rtattr *data, LinkInfo *info) {
+	int len = RTA_PAYLOAD(data);
+	for (const struct rtattr *rta = (const struct rtattr*) RTA_DATA(data); RTA_OK(rta, len);
+			rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_CAN_BITTIMING: {
+			struct can_bittiming bt;
+			memcpy(&bt, RTA_DATA(rta), sizeof(bt));
+			info->values[LINK_INFO_BITRATE] = bt.bitrate;
+			info->values[LINK_INFO_SAMPLE_POINT] = bt.sample_point;
+			info->values[LINK_INFO_TQ] = bt.tq;
+			info->values[LINK_INFO_PROP_SEG] = bt.prop_seg;
+			info->values[LINK_INFO_PHASE_SEG1] = bt.phase_seg1;
+			info->values[LINK_INFO_PHASE_SEG2] = bt.phase_seg2;
+			info->values[LINK_INFO_SJW] = bt.sjw;
+			info->values[LINK_INFO_BRP] = bt.brp;
+			break;
+		}
+		case IFLA_CAN_DATA_BITTIMING: {
+			struct can_bittiming bt;
+			memcpy(&bt, RTA_DATA(rta), sizeof(bt));
+			info->values[LINK_INFO_DATA_BITRATE] = bt.bitrate;
+			info->values[LINK_INFO_DATA_SAMPLE_POINT] = bt.sample_point;
+			break;
+		}
+		case IFLA_CAN_CTRLMODE: {
+			struct can_ctrlmode cm;
+			memcpy(&cm, RTA_DATA(rta), sizeof(cm));
+			info->values[LINK_INFO_CTRLMODE] = cm.flags;
+			break;
+		}
+		case IFLA_CAN_RESTART_MS:
+			info->values[LINK_INFO_RESTART_MS] = *(const __u32*) RTA_DATA(rta);
+			break;
+		case IFLA_CAN_STATE:
+			info->values[LINK_INFO_STATE] = *(const __u32*) RTA_DATA(rta);
+			break;
+		case IFLA_CAN_BERR_COUNTER: {
+			struct can_berr_counter bc;
+			memcpy(&bc, RTA_DATA(rta), sizeof(bc));
+			info->values[LINK_INFO_BERR_TX] = bc.txerr;
+			info->values[LINK_INFO_BERR_RX] = bc.rxerr;
+			break;
+		}
+		}
+	}
+}
+
+static void parseLinkInfo(const struct rtattr *linkinfo, LinkInfo *info) {
+	int len = RTA_PAYLOAD(linkinfo);
+	for (const struct rtattr *rta = (const struct rtattr*) RTA_DATA(linkinfo); RTA_OK(rta, len);
+			rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_INFO_KIND) {
+			const char *kind = (const char*) RTA_DATA(rta);
+			if (strcmp(kind, "can") == 0) {
+				info->values[LINK_INFO_KIND] = LINK_KIND_CAN;
+			} else if (strcmp(kind, "vcan") == 0) {
+				info->values[LINK_INFO_KIND] = LINK_KIND_VCAN;
+			} else if (strcmp(kind, "vxcan") == 0) {
+				info->values[LINK_INFO_KIND] = LINK_KIND_VXCAN;
+			}
+		} else if (rta->rta_type == IFLA_INFO_DATA) {
+			parseCanInfo(rta, info);
+		}
+	}
+}
+
+/* parses an RTM_NEWLINK message, returns the interface index */
+static int parseLink(const struct nlmsghdr *nlh, LinkInfo *info) {
+	const struct ifinfomsg *ifi = (const struct ifinfomsg*) NLMSG_DATA(nlh);
+	memset(info, 0, sizeof(*info));
+	info->values[LINK_INFO_IFINDEX] = ifi->ifi_index;
+	info->values[LINK_INFO_FLAGS] = ifi->ifi_flags;
+	info->values[LINK_INFO_STATE] = -1;
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			strncpy(info->name, (const char*) RTA_DATA(rta), sizeof(info->name) - 1);
+			break;
+		case IFLA_MTU:
+			info->values[LINK_INFO_MTU] = *(const __u32*) RTA_DATA(rta);
+			break;
+		case IFLA_STATS64: {
+			struct rtnl_link_stats64 stats;
+			memset(&stats, 0, sizeof(stats));
+			memcpy(&stats, RTA_DATA(rta), std::min<size_t>(RTA_PAYLOAD(rta), sizeof(stats)));
+			info->values[LINK_INFO_RX_PACKETS] = stats.rx_packets;
+			info->values[LINK_INFO_TX_PACKETS] = stats.tx_packets;
+			info->values[LINK_INFO_RX_BYTES] = stats.rx_bytes;
+			info->values[LINK_INFO_TX_BYTES] = stats.tx_bytes;
+			info->values[LINK_INFO_RX_ERRORS] = stats.rx_errors;
+			info->values[LINK_INFO_TX_ERRORS] = stats.tx_errors;
+			info->values[LINK_INFO_RX_DROPPED] = stats.rx_dropped;
+			info->values[LINK_INFO_TX_DROPPED] = stats.tx_dropped;
+			break;
+		}
+		case IFLA_LINKINFO:
+			parseLinkInfo(rta, info);
+			break;
+		}
+	}
+	return ifi->ifi_index;
+}
+
+/* called with linkTableLock held */
+static void linkTableUpdate(const LinkInfo *info) {
+	const jlong ifIndex = info->values[LINK_INFO_IFINDEX];
+	for (int i = 0; i < linkTableSize; i++) {
+		if (linkTable[i].values[LINK_INFO_IFINDEX] == ifIndex) {
+			linkTable[i] = *info;
+			linkTableMarks[i] = linkTableGeneration;
+			return;
+		}
+	}
+	if (linkTableSize < LINK_TABLE_MAX) {
+		linkTableMarks[linkTableSize] = linkTableGeneration;
+		linkTable[linkTableSize++] = *info;
+	} else if (!linkTableOverflow) {
+		//lookups of the links left out fall back to an ioctl
+		linkTableOverflow = 1;
+		CANLOG_WARN("link table: more than %d links, %s (%lld) and later ones are not cached", LINK_TABLE_MAX,
+				info->name, (long long) ifIndex);
+	}
+}
+
+/* called with linkTableLock held */
+static void linkTableRemove(int ifIndex) {
+	for (int i = 0; i < linkTableSize; i++) {
+		if (linkTable[i].values[LINK_INFO_IFINDEX] == ifIndex) {
+			linkTableSize--;
+			linkTable[i] = linkTable[linkTableSize];
+			linkTableMarks[i] = linkTableMarks[linkTableSize];
+			linkTableOverflow = 0;
+			return;
+		}
+	}
+}
+
+/* called with linkTableLock held, removes the entries not seen by the dump of the current generation */
+static void linkTableSweep(void) {
+	for (int i = 0; i < linkTableSize;) {
+		if (linkTableMarks[i] != linkTableGeneration) {
+			linkTableSize--;
+			linkTable[i] = linkTable[linkTableSize];
+			linkTableMarks[i] = linkTableMarks[linkTableSize];
+			linkTableOverflow = 0;
+		} else {
+			i++;
+		}
+	}
+}
+
+/* handles the RTM_NEWLINK/RTM_DELLINK messages in the buffer, returns 1 on NLMSG_DONE */
+static int linkTableHandle(char *buffer, int len, __u32 seq, int *error) {
+	int done = 0;
+	for (struct nlmsghdr *nlh = (struct nlmsghdr*) buffer; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		if (seq != 0 && nlh->nlmsg_seq != seq) {
+			continue;
+		}
+		if (nlh->nlmsg_type == NLMSG_DONE) {
+			done = 1;
+		} else if (nlh->nlmsg_type == NLMSG_ERROR) {
+			*error = -((const struct nlmsgerr*) NLMSG_DATA(nlh))->error;
+			done = 1;
+		} else if (nlh->nlmsg_type == RTM_NEWLINK) {
+			LinkInfo info;
+			parseLink(nlh, &info);
+			pthread_mutex_lock(&linkTableLock);
+			linkTableUpdate(&info);
+			pthread_mutex_unlock(&linkTableLock);
+		} else if (nlh->nlmsg_type == RTM_DELLINK) {
+			const struct ifinfomsg *ifi = (const struct ifinfomsg*) NLMSG_DATA(nlh);
+			pthread_mutex_lock(&linkTableLock);
+			linkTableRemove(ifi->ifi_index);
+			pthread_mutex_unlock(&linkTableLock);
+		}
+	}
+	return done;
+}
+
+/*
+ * Sends an RTM_GETLINK request on the request socket and processes the
+ * answer, a dump of all links if ifIndex is 0. Called with linkRequestLock
+ * held. Returns 0 on success and -1 with errno set on failure.
+ */
+static int linkRequest(int ifIndex, char *buffer) {
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | (ifIndex == 0 ? NLM_F_DUMP : NLM_F_ACK);
+	req.nlh.nlmsg_seq = ++linkRequestSeq;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifIndex;
+	if (ifIndex == 0) {
+		//every link the dump reports is marked with the new generation
+		pthread_mutex_lock(&linkTableLock);
+		linkTableGeneration++;
+		pthread_mutex_unlock(&linkTableLock);
+	}
+	if (send(linkRequestFd, &req, req.nlh.nlmsg_len, 0) == -1) {
+		return -1;
+	}
+	int error = 0;
+	int done = 0;
+	while (!done) {
+		const ssize_t len = recv(linkRequestFd, buffer, NETLINK_LINK_BUFFER_SIZE, 0);
+		if (len == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		done = linkTableHandle(buffer, (int) len, req.nlh.nlmsg_seq, &error);
+	}
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	if (ifIndex == 0) {
+		pthread_mutex_lock(&linkTableLock);
+		linkTableSweep();
+		pthread_mutex_unlock(&linkTableLock);
+	}
+	return 0;
+}
+
+static void* linkTableWorker(void *arg) {
+	std::unique_ptr<char[]> buffer(new char[NETLINK_LINK_BUFFER_SIZE]);
+	while (1) {
+		const ssize_t len = recv(linkEventFd, buffer.get(), NETLINK_LINK_BUFFER_SIZE, 0);
+		if (len == -1) {
+			if (errno == ENOBUFS) {
+				//notifications were lost, start over
+				pthread_mutex_lock(&linkRequestLock);
+				linkRequest(0, buffer.get());
+				pthread_mutex_unlock(&linkRequestLock);
+			} else if (errno != EINTR) {
+				CANLOG_WARN("link table: netlink receive failed: %s", strerror(errno));
+				return NULL;
+			}
+			continue;
+		}
+		int error = 0;
+		linkTableHandle(buffer.get(), (int) len, 0, &error);
+	}
+	return NULL;
+}
+
+static void linkTableStart(void) {
+	//subscribe first, so no change between the dump and the subscription is missed
+	linkEventFd = netlinkOpen(RTMGRP_LINK);
+	linkRequestFd = netlinkOpen(0);
+	if (linkEventFd == -1 || linkRequestFd == -1) {
+		CANLOG_WARN("link table: netlink not available: %s", strerror(errno));
+		return;
+	}
+	std::unique_ptr<char[]> buffer(new char[NETLINK_LINK_BUFFER_SIZE]);
+	pthread_mutex_lock(&linkRequestLock);
+	const int rc = linkRequest(0, buffer.get());
+	pthread_mutex_unlock(&linkRequestLock);
+	if (rc == -1) {
+		CANLOG_WARN("link table: dump failed: %s", strerror(errno));
+		return;
+	}
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, linkTableWorker, NULL) == 0) {
+		__atomic_store_n(&linkTableReady, 1, __ATOMIC_RELEASE);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * Copies the cached entry of the interface given by index (if > 0) or name.
+ * Returns 0 on success and -1 if the interface is not in the table or the
+ * table is not available, the caller should fall back to an ioctl then.
+ */
+int netlinkLinkLookup(int ifIndex, const char *name, LinkInfo *info) {
+	pthread_once(&linkTableOnce, linkTableStart);
+	if (!__atomic_load_n(&linkTableReady, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+	int rc = -1;
+	pthread_mutex_lock(&linkTableLock);
+	for (int i = 0; i < linkTableSize; i++) {
+		if (ifIndex > 0 ? linkTable[i].values[LINK_INFO_IFINDEX] == ifIndex
+				: strncmp(linkTable[i].name, name, LINK_NAME_SIZE) == 0) {
+			*info = linkTable[i];
+			rc = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&linkTableLock);
+	return rc;
+}
+
+/*
+ * Fetches the current state of the interface, including CAN controller
+ * state, error counters and statistics, and refreshes the cache with it.
+ * Returns 0 on success and -1 with errno set on failure.
+ */
+int netlinkLinkQuery(int ifIndex, LinkInfo *info) {
+	pthread_once(&linkTableOnce, linkTableStart);
+	if (linkRequestFd == -1) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	std::unique_ptr<char[]> buffer(new char[NETLINK_LINK_BUFFER_SIZE]);
+	pthread_mutex_lock(&linkRequestLock);
+	const int rc = linkRequest(ifIndex, buffer.get());
+	const int err = errno;
+	pthread_mutex_unlock(&linkRequestLock);
+	if (rc == -1) {
+		errno = err;
+		return -1;
+	}
+	pthread_mutex_lock(&linkTableLock);
+	int found = -1;
+	for (int i = 0; i < linkTableSize; i++) {
+		if (linkTable[i].values[LINK_INFO_IFINDEX] == ifIndex) {
+			*info = linkTable[i];
+			found = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&linkTableLock);
+	if (found == -1) {
+		errno = ENODEV;
+	}
+	return found;
+}
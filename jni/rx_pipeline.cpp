@@ -0,0 +1,165 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/sockios.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+#define RX_INVENTORY_CHUNK						  64
+#define NSEC_PER_SEC				   1000000000ULL
+
+/*
+ * Receive pipeline.
+ *
+ * Every frame read from a socket with a context passes the stages enabled on
+ * it before it is delivered to Java, on the single frame as well as on the
+ * batched receive path. Stages run in the receiving thread and must not block.
+ * The inventory sees every frame read, before the ID filter. The looped back
+ * copy of a confirmed frame is dropped before the ID filter without being
+ * counted, see confirmed_send.cpp. While the inventory is enabled the socket
+ * has SO_TIMESTAMPNS set and the receive paths pass the kernel receive time
+ * of every frame along.
+ */
+
+static Inventory *rxInventory(SocketContext *ctx) {
+	Inventory *inv = __atomic_load_n(&ctx->inventory, __ATOMIC_ACQUIRE);
+	return inv != NULL && inventoryEnabled(inv) ? inv : NULL;
+}
+
+static __u64 clockNs(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Moves the kernel receive times (CLOCK_REALTIME, 0 if unknown) onto
+ * CLOCK_MONOTONIC for the inventory, frames without one get the time now.
+ */
+static void rxObserve(Inventory *inv, const struct can_frame *frames, const __u64 *timestampsNs, int count) {
+	const __u64 monoNs = clockNs(CLOCK_MONOTONIC);
+	const __u64 realNs = clockNs(CLOCK_REALTIME);
+	__u64 times[RX_INVENTORY_CHUNK];
+	for (int done = 0; done < count;) {
+		const int chunk = std::min(count - done, RX_INVENTORY_CHUNK);
+		for (int i = 0; i < chunk; i++) {
+			const __u64 stamp = timestampsNs != NULL ? timestampsNs[done + i] : 0;
+			times[i] = stamp != 0 ? monoNs - (realNs - stamp) : monoNs;
+		}
+		inventoryObserve(inv, frames + done, times, chunk);
+		done += chunk;
+	}
+}
+
+static int rxIdStage(SocketContext *ctx, const struct can_frame *frame) {
+	if (ctx->confirmSender != NULL && confirmSenderTakeCopy(ctx->confirmSender, frame)) {
+		return 0;
+	}
+	const IdFilter *f = __atomic_load_n(&ctx->idFilter, __ATOMIC_ACQUIRE);
+	if (f != NULL && !idFilterMatch(f, frame->can_id)) {
+		__atomic_fetch_add(&ctx->rxStats[RX_STAT_FILTERED], 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_fetch_add(&ctx->rxStats[RX_STAT_ACCEPTED], 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/* returns 1 if the frame just read from the socket is to be delivered, 0 if it is dropped */
+int rxPipelineAccept(SocketContext *ctx, const struct can_frame *frame) {
+	Inventory *inv = rxInventory(ctx);
+	if (inv != NULL) {
+		//the receive time of the last frame read from the socket
+		struct timespec ts;
+		__u64 stampNs = 0;
+		if (ioctl(ctx->fd, SIOCGSTAMPNS, &ts) == 0) {
+			stampNs = (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+		}
+		rxObserve(inv, frame, &stampNs, 1);
+	}
+	return rxIdStage(ctx, frame);
+}
+
+/*
+ * Drops the frames not accepted by the pipeline and moves the others to the
+ * front, keeping their order. timestampsNs holds the kernel receive time of
+ * every frame (0 if unknown, see cmsgTimestampNs()), NULL if the caller has none.
+ * Returns the number of frames left.
+ */
+int rxPipelineFilter(SocketContext *ctx, struct can_frame *frames, const __u64 *timestampsNs, int count) {
+	Inventory *inv = rxInventory(ctx);
+	if (inv != NULL) {
+		rxObserve(inv, frames, timestampsNs, count);
+	}
+	int kept = 0;
+	for (int i = 0; i < count; i++) {
+		if (rxIdStage(ctx, &frames[i])) {
+			if (kept != i) {
+				frames[kept] = frames[i];
+			}
+			kept++;
+		}
+	}
+	return kept;
+}
+
+/* sets the ID whitelist, NULL delivers all frames again */
+void rxPipelineSetIdFilter(SocketContext *ctx, IdFilter *f) {
+	if (f != NULL) {
+		//keep every filter until the context is destroyed, a receiver may still use the old one
+		IdFilter *head = __atomic_load_n(&ctx->idFilters, __ATOMIC_RELAXED);
+		do {
+			idFilterLink(f, head);
+		} while (!__atomic_compare_exchange_n(&ctx->idFilters, &head, f, 0, __ATOMIC_RELEASE,
+				__ATOMIC_RELAXED));
+	}
+	__atomic_store_n(&ctx->idFilter, f, __ATOMIC_RELEASE);
+}
+
+/*
+ * Starts a new inventory or stops updating it. The inventory is created on
+ * first use and kept until the context is destroyed, a receiver may be using
+ * it. Returns -1 with errno set on failure.
+ */
+int rxPipelineEnableInventory(SocketContext *ctx, int enabled) {
+	Inventory *inv = __atomic_load_n(&ctx->inventory, __ATOMIC_ACQUIRE);
+	const int on = 1;
+	if (enabled && setsockopt(ctx->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1) {
+		return -1;
+	}
+	if (inv == NULL) {
+		if (!enabled) {
+			return 0;
+		}
+		Inventory *created = inventoryCreate();
+		if (created == NULL) {
+			return -1;
+		}
+		if (__atomic_compare_exchange_n(&ctx->inventory, &inv, created, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			inv = created;
+		} else {
+			inventoryDestroy(created);
+		}
+	}
+	inventorySetEnabled(inv, enabled);
+	return 0;
+}
+
+void rxPipelineGetStats(const SocketContext *ctx, jlong *stats) {
+	for (int i = 0; i < RX_STATS_COUNT; i++) {
+		stats[i] = __atomic_load_n(&ctx->rxStats[i], __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,101 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+/*
+ * Receive sharding.
+ *
+ * Maps every CAN ID to one of a fixed number of shards, so the multiplexer
+ * can spread the frames of an interface over the queues of several consumer
+ * threads. The first range rule containing the ID (CAN_EFF_FLAG set for
+ * extended IDs, as in the ranges) decides, IDs in no range are distributed by
+ * a multiplicative hash. An ID always maps to the same shard, the frames of an
+ * ID thus stay in order. Remote and error frames go with their ID.
+ *
+ * The shard subscribers of the multiplexer share one sharder, the last one
+ * removed frees it. Only the multiplexer thread maps IDs.
+ */
+typedef struct _ShardRange {
+	__u32 from;
+	__u32 to;
+	int shard;
+} ShardRange;
+
+struct _Sharder {
+	int refs;
+	int shards;
+	int rangeCount;
+	ShardRange ranges[SHARD_RULES_MAX];
+};
+
+static __u32 shardKey(canid_t canid) {
+	return (canid & CAN_EFF_FLAG) ? canid & (CAN_EFF_FLAG | CAN_EFF_MASK) : canid & CAN_SFF_MASK;
+}
+
+/*
+ * Creates a sharder for shards shards from count rules of SHARD_RULE_INTS
+ * ints each: first ID, last ID and shard. Returns NULL with errno set on
+ * failure, EINVAL for a shard out of range or an empty range.
+ */
+Sharder *sharderCreate(int shards, const jint *rules, int count) {
+	if (shards < 1 || shards > SHARDS_MAX || count < 0 || count > SHARD_RULES_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	Sharder *sh = (Sharder*) calloc(1, sizeof(Sharder));
+	if (sh == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	sh->refs = 1;
+	sh->shards = shards;
+	sh->rangeCount = count;
+	for (int i = 0; i < count; i++) {
+		const jint *r = &rules[i * SHARD_RULE_INTS];
+		ShardRange *range = &sh->ranges[i];
+		range->from = shardKey((canid_t) r[0]);
+		range->to = shardKey((canid_t) r[1]);
+		range->shard = r[2];
+		if (range->from > range->to || range->shard < 0 || range->shard >= shards) {
+			free(sh);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	return sh;
+}
+
+void sharderRetain(Sharder *sh) {
+	__atomic_fetch_add(&sh->refs, 1, __ATOMIC_RELAXED);
+}
+
+void sharderRelease(Sharder *sh) {
+	if (sh != NULL && __atomic_sub_fetch(&sh->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(sh);
+	}
+}
+
+int sharderShards(const Sharder *sh) {
+	return sh->shards;
+}
+
+int sharderPick(const Sharder *sh, canid_t canid) {
+	const __u32 key = shardKey(canid);
+	for (int i = 0; i < sh->rangeCount; i++) {
+		if (key >= sh->ranges[i].from && key <= sh->ranges[i].to) {
+			return sh->ranges[i].shard;
+		}
+	}
+	return (int) (((__u64) (key * 0x9E3779B1U) * (__u64) sh->shards) >> 32);
+}
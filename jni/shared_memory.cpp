@@ -0,0 +1,64 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+/* keeps the memory handed out 64 byte aligned */
+#define SHARED_MEMORY_HEADER_SIZE			  64
+
+/*
+ * Memory shared with Java through a direct ByteBuffer.
+ *
+ * Java may still access such a buffer after the native owner is done with it,
+ * e.g. a producer racing with close(). The memory is therefore reference
+ * counted: the native owner holds the reference taken by sharedMemoryAlloc(),
+ * the Java object wrapping the buffer takes another one with
+ * sharedMemoryRetain() and releases it from its Cleaner once the buffer is
+ * unreachable. The memory is freed with the last reference.
+ */
+typedef struct _SharedMemoryHeader {
+	int refs;
+} SharedMemoryHeader;
+
+static_assert(sizeof(SharedMemoryHeader) <= SHARED_MEMORY_HEADER_SIZE, "shared memory header too large");
+
+static SharedMemoryHeader *sharedMemoryHeader(void *mem) {
+	return (SharedMemoryHeader*) ((char*) mem - SHARED_MEMORY_HEADER_SIZE);
+}
+
+/* returns zeroed memory with one reference, NULL with errno set on failure */
+void *sharedMemoryAlloc(size_t size) {
+	void *block = NULL;
+	if (posix_memalign(&block, SHARED_MEMORY_HEADER_SIZE, SHARED_MEMORY_HEADER_SIZE + size) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(block, 0, SHARED_MEMORY_HEADER_SIZE + size);
+	((SharedMemoryHeader*) block)->refs = 1;
+	return (char*) block + SHARED_MEMORY_HEADER_SIZE;
+}
+
+void sharedMemoryRetain(void *mem) {
+	__atomic_fetch_add(&sharedMemoryHeader(mem)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void sharedMemoryRelease(void *mem) {
+	if (mem == NULL) {
+		return;
+	}
+	SharedMemoryHeader *header = sharedMemoryHeader(mem);
+	if (__atomic_sub_fetch(&header->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(header);
+	}
+}
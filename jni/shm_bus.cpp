@@ -0,0 +1,578 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/futex.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+#include "can_shm_bus.h"
+
+#define SHM_BUS_PUBLISHERS_MAX					16
+#define SHM_BUS_READERS_MAX						64
+#define SHM_BUS_BATCH							32
+#define SHM_BUS_CAPACITY_MAX			  (1 << 20)
+#define NSEC_PER_SEC				   1000000000LL
+
+/*
+ * Shared memory frame bus.
+ *
+ * A publisher receives the frames of an interface on a socket of its own and
+ * writes them with their kernel receive timestamp into a POSIX shared memory
+ * ring, so any number of readers in any process get the frames of the bus
+ * without a socket each. The layout and the reader protocol are described in
+ * can_shm_bus.h. The publisher never waits for readers, a reader that falls
+ * behind by more than the capacity loses the oldest frames and counts them.
+ * The publisher holds an exclusive flock() on its segment, so a segment left
+ * behind by a publisher that died can be told from one still in use.
+ */
+typedef struct _ShmBusPublisher {
+	char name[SHM_BUS_NAME_MAX + 2];
+	int ifIndex;
+	int fd;
+	int stopFd;
+	int shmFd;
+	int running;
+	pthread_t thread;
+	struct can_shm_bus_header *bus;
+	struct can_shm_bus_slot *slots;
+	size_t size;
+} ShmBusPublisher;
+
+typedef struct _ShmBusReader {
+	jint handle;
+	int refs;
+	int closed;
+	struct can_shm_bus_header *bus;
+	const struct can_shm_bus_slot *slots;
+	size_t size;
+	__u64 next;
+	jlong lost;
+	pthread_mutex_t lock;
+} ShmBusReader;
+
+static ShmBusPublisher *shmBusPublishers[SHM_BUS_PUBLISHERS_MAX];
+static ShmBusReader *shmBusReaders[SHM_BUS_READERS_MAX];
+static __u32 shmBusGeneration;
+static pthread_mutex_t shmBusLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int futex(__u32 *addr, int op, __u32 val, const struct timespec *timeout) {
+	return (int) syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/* "/" + name, the name must not contain a slash */
+static int shmBusPath(const char *name, char *path) {
+	const size_t len = strlen(name);
+	if (len == 0 || len > SHM_BUS_NAME_MAX || strchr(name, '/') != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	path[0] = '/';
+	memcpy(path + 1, name, len + 1);
+	return 0;
+}
+
+static __u64 frameTimestamp(struct msghdr *msg) {
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			return (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+		}
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void publish(ShmBusPublisher *p, const struct can_frame *frame, __u64 timestampNs) {
+	const __u64 n = p->bus->head;
+	struct can_shm_bus_slot *slot = &p->slots[n & (p->bus->capacity - 1)];
+	__atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->timestamp_ns = timestampNs;
+	slot->frame = *frame;
+	__atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&p->bus->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Opens the segment, creating it if needed, and locks it for the publisher.
+ * A segment nobody holds the lock on but with a size was left behind by a
+ * publisher that died, it is unlinked and replaced by a new one, so its
+ * readers keep a valid mapping. Returns the locked, empty segment, or -1 with
+ * errno set, EEXIST if a live publisher in any process uses the name.
+ */
+static int shmBusClaim(const char *path) {
+	while (1) {
+		const int shm = shm_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (shm == -1) {
+			return -1;
+		}
+		if (flock(shm, LOCK_EX | LOCK_NB) == -1) {
+			const int err = errno;
+			close(shm);
+			errno = err == EWOULDBLOCK ? EEXIST : err;
+			return -1;
+		}
+		//the name may have been replaced by another process between shm_open() and flock()
+		struct stat locked;
+		struct stat named;
+		const int current = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+		int same = 0;
+		if (current != -1) {
+			same = fstat(shm, &locked) == 0 && fstat(current, &named) == 0 && locked.st_dev == named.st_dev
+					&& locked.st_ino == named.st_ino;
+			close(current);
+		}
+		if (same && locked.st_size == 0) {
+			return shm;
+		}
+		if (same) {
+			shm_unlink(path);
+		}
+		close(shm);
+	}
+}
+
+static void* shmBusPublisherWorker(void *arg) {
+	ShmBusPublisher *p = (ShmBusPublisher*) arg;
+	struct can_frame frames[SHM_BUS_BATCH];
+	struct mmsghdr msgs[SHM_BUS_BATCH];
+	struct iovec iovs[SHM_BUS_BATCH];
+	char controls[SHM_BUS_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+	struct pollfd pfds[2];
+	pfds[0].fd = p->fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = p->stopFd;
+	pfds[1].events = POLLIN;
+
+	while (__atomic_load_n(&p->running, __ATOMIC_ACQUIRE)) {
+		pfds[0].revents = 0;
+		pfds[1].revents = 0;
+		if (poll(pfds, 2, -1) <= 0) {
+			continue;
+		}
+		if ((pfds[0].revents & POLLIN) == 0) {
+			if (pfds[0].revents & (POLLERR | POLLHUP)) {
+				socketErrorBackoff(p->fd, p->stopFd);
+			}
+			continue;
+		}
+		for (int i = 0; i < SHM_BUS_BATCH; i++) {
+			iovs[i].iov_base = &frames[i];
+			iovs[i].iov_len = sizeof(frames[i]);
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = controls[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+		}
+		const int n = recvmmsg(p->fd, msgs, SHM_BUS_BATCH, MSG_DONTWAIT, NULL);
+		int published = 0;
+		for (int i = 0; i < n; i++) {
+			if (msgs[i].msg_len == sizeof(struct can_frame)) {
+				publish(p, &frames[i], frameTimestamp(&msgs[i].msg_hdr));
+				published++;
+			}
+		}
+		if (published > 0) {
+			__atomic_fetch_add(&p->bus->wake, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&p->bus->waiters, __ATOMIC_SEQ_CST) != 0) {
+				futex(&p->bus->wake, FUTEX_WAKE, INT_MAX, NULL);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void shmBusPublisherFree(ShmBusPublisher *p) {
+	if (p->bus != NULL) {
+		munmap(p->bus, p->size);
+	}
+	if (p->shmFd != -1) {
+		//still locked, the name refers to this segment
+		shm_unlink(p->name);
+		close(p->shmFd);
+	}
+	if (p->stopFd != -1) {
+		close(p->stopFd);
+	}
+	if (p->fd != -1) {
+		close(p->fd);
+	}
+	free(p);
+}
+
+static int shmBusPublisherStart(ShmBusPublisher *p, __u32 capacity) {
+	p->fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+	p->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (p->fd == -1 || p->stopFd == -1) {
+		return -1;
+	}
+	const int on = 1;
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = p->ifIndex;
+	if (setsockopt(p->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1
+			|| bind(p->fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1) {
+		return -1;
+	}
+	p->shmFd = shmBusClaim(p->name);
+	if (p->shmFd == -1) {
+		return -1;
+	}
+	p->size = CAN_SHM_BUS_SIZE(capacity);
+	void *mem = MAP_FAILED;
+	if (ftruncate(p->shmFd, (off_t) p->size) == 0) {
+		mem = mmap(NULL, p->size, PROT_READ | PROT_WRITE, MAP_SHARED, p->shmFd, 0);
+	}
+	if (mem == MAP_FAILED) {
+		return -1;
+	}
+	p->bus = (struct can_shm_bus_header*) mem;
+	p->slots = (struct can_shm_bus_slot*) (p->bus + 1);
+	p->bus->capacity = capacity;
+	p->bus->slot_size = sizeof(struct can_shm_bus_slot);
+	p->bus->ifindex = p->ifIndex;
+	p->bus->version = CAN_SHM_BUS_VERSION;
+	__atomic_store_n(&p->bus->magic, CAN_SHM_BUS_MAGIC, __ATOMIC_RELEASE);
+	p->running = 1;
+	const int rc = pthread_create(&p->thread, NULL, shmBusPublisherWorker, (void*) p);
+	if (rc) {
+		errno = rc;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Starts publishing the frames of the interface into the shared memory
+ * segment "/<name>" with capacity slots, rounded up to a power of two.
+ * Returns 0 on success and -1 with errno set on failure, EEXIST if this or
+ * another process publishes under the name already.
+ */
+int shmBusPublish(int ifIndex, const char *name, int capacity) {
+	if (ifIndex <= 0 || capacity < 1 || capacity > SHM_BUS_CAPACITY_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	ShmBusPublisher *p = (ShmBusPublisher*) calloc(1, sizeof(ShmBusPublisher));
+	if (p == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	p->fd = -1;
+	p->stopFd = -1;
+	p->shmFd = -1;
+	p->ifIndex = ifIndex;
+	if (shmBusPath(name, p->name) == -1) {
+		free(p);
+		return -1;
+	}
+	__u32 size = 1;
+	while (size < (__u32) capacity) {
+		size <<= 1;
+	}
+	pthread_mutex_lock(&shmBusLock);
+	int slot = -1;
+	for (int i = 0; i < SHM_BUS_PUBLISHERS_MAX; i++) {
+		if (shmBusPublishers[i] != NULL && strcmp(shmBusPublishers[i]->name, p->name) == 0) {
+			pthread_mutex_unlock(&shmBusLock);
+			free(p);
+			errno = EEXIST;
+			return -1;
+		}
+		if (shmBusPublishers[i] == NULL && slot == -1) {
+			slot = i;
+		}
+	}
+	int rc = -1;
+	int err = ENOSPC;
+	if (slot != -1) {
+		rc = shmBusPublisherStart(p, size);
+		err = errno;
+	}
+	if (rc == 0) {
+		shmBusPublishers[slot] = p;
+	}
+	pthread_mutex_unlock(&shmBusLock);
+	if (rc == -1) {
+		shmBusPublisherFree(p);
+		errno = err;
+	}
+	return rc;
+}
+
+/* stops the publisher and removes the segment, readers keep their mapping */
+int shmBusUnpublish(const char *name) {
+	char path[SHM_BUS_NAME_MAX + 2];
+	if (shmBusPath(name, path) == -1) {
+		return -1;
+	}
+	ShmBusPublisher *p = NULL;
+	pthread_mutex_lock(&shmBusLock);
+	for (int i = 0; i < SHM_BUS_PUBLISHERS_MAX; i++) {
+		if (shmBusPublishers[i] != NULL && strcmp(shmBusPublishers[i]->name, path) == 0) {
+			p = shmBusPublishers[i];
+			shmBusPublishers[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&shmBusLock);
+	if (p == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	__atomic_store_n(&p->running, 0, __ATOMIC_RELEASE);
+	eventfd_write(p->stopFd, 1);
+	pthread_join(p->thread, NULL);
+	shmBusPublisherFree(p);
+	return 0;
+}
+
+static void shmBusReaderFree(ShmBusReader *r) {
+	munmap(r->bus, r->size);
+	pthread_mutex_destroy(&r->lock);
+	free(r);
+}
+
+static ShmBusReader *shmBusReaderGet(jint handle) {
+	const int slot = handle & (SHM_BUS_READERS_MAX - 1);
+	pthread_mutex_lock(&shmBusLock);
+	ShmBusReader *r = shmBusReaders[slot];
+	if (r != NULL && r->handle == handle) {
+		r->refs++;
+	} else {
+		r = NULL;
+	}
+	pthread_mutex_unlock(&shmBusLock);
+	return r;
+}
+
+static void shmBusReaderPut(ShmBusReader *r) {
+	pthread_mutex_lock(&shmBusLock);
+	const int refs = --r->refs;
+	pthread_mutex_unlock(&shmBusLock);
+	if (refs == 0) {
+		shmBusReaderFree(r);
+	}
+}
+
+/*
+ * Maps the segment "/<name>" of a publisher in any process. The reader
+ * starts with the next frame published. Returns a handle, or -1 with errno
+ * set on failure.
+ */
+jint shmBusOpen(const char *name) {
+	char path[SHM_BUS_NAME_MAX + 2];
+	if (shmBusPath(name, path) == -1) {
+		return -1;
+	}
+	const int shm = shm_open(path, O_RDWR | O_CLOEXEC, 0);
+	if (shm == -1) {
+		return -1;
+	}
+	struct stat st;
+	void *mem = MAP_FAILED;
+	int err = EPROTO;
+	if (fstat(shm, &st) == -1) {
+		err = errno;
+	} else if ((size_t) st.st_size >= sizeof(struct can_shm_bus_header)) {
+		mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+		err = errno;
+	}
+	close(shm);
+	if (mem == MAP_FAILED) {
+		errno = err;
+		return -1;
+	}
+	struct can_shm_bus_header *bus = (struct can_shm_bus_header*) mem;
+	if (__atomic_load_n(&bus->magic, __ATOMIC_ACQUIRE) != CAN_SHM_BUS_MAGIC
+			|| bus->version != CAN_SHM_BUS_VERSION || bus->slot_size != sizeof(struct can_shm_bus_slot)
+			|| CAN_SHM_BUS_SIZE(bus->capacity) > (size_t) st.st_size) {
+		munmap(mem, st.st_size);
+		errno = EPROTO;
+		return -1;
+	}
+	ShmBusReader *r = (ShmBusReader*) calloc(1, sizeof(ShmBusReader));
+	if (r == NULL) {
+		munmap(mem, st.st_size);
+		errno = ENOMEM;
+		return -1;
+	}
+	r->bus = bus;
+	r->slots = (const struct can_shm_bus_slot*) (bus + 1);
+	r->size = st.st_size;
+	r->refs = 1;
+	r->next = __atomic_load_n(&bus->head, __ATOMIC_ACQUIRE);
+	pthread_mutex_init(&r->lock, NULL);
+
+	pthread_mutex_lock(&shmBusLock);
+	int slot = -1;
+	for (int i = 0; i < SHM_BUS_READERS_MAX && slot == -1; i++) {
+		if (shmBusReaders[i] == NULL) {
+			slot = i;
+		}
+	}
+	if (slot == -1) {
+		pthread_mutex_unlock(&shmBusLock);
+		shmBusReaderFree(r);
+		errno = ENOSPC;
+		return -1;
+	}
+	r->handle = (jint) ((++shmBusGeneration << 6) & 0x7FFFFFFF) | slot;
+	shmBusReaders[slot] = r;
+	pthread_mutex_unlock(&shmBusLock);
+	return r->handle;
+}
+
+/* closes the reader, a thread blocked in shmBusRead() returns with EBADF */
+void shmBusClose(jint handle) {
+	const int slot = handle & (SHM_BUS_READERS_MAX - 1);
+	pthread_mutex_lock(&shmBusLock);
+	ShmBusReader *r = shmBusReaders[slot];
+	if (r == NULL || r->handle != handle) {
+		pthread_mutex_unlock(&shmBusLock);
+		return;
+	}
+	shmBusReaders[slot] = NULL;
+	pthread_mutex_unlock(&shmBusLock);
+	__atomic_store_n(&r->closed, 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&r->bus->wake, 1, __ATOMIC_SEQ_CST);
+	futex(&r->bus->wake, FUTEX_WAKE, INT_MAX, NULL);
+	shmBusReaderPut(r);
+}
+
+/* continues with the oldest frame still in the ring, called with the reader lock held */
+static void skipLost(ShmBusReader *r) {
+	const __u64 head = __atomic_load_n(&r->bus->head, __ATOMIC_ACQUIRE);
+	if (head - r->next > r->bus->capacity) {
+		r->lost += head - r->bus->capacity - r->next;
+		r->next = head - r->bus->capacity;
+	}
+}
+
+/* copies the frames published since the last call, called with the reader lock held */
+static int shmBusCopy(ShmBusReader *r, struct can_frame *frames, jlong *timestamps, int maxCount) {
+	skipLost(r);
+	const __u64 head = __atomic_load_n(&r->bus->head, __ATOMIC_ACQUIRE);
+	const __u32 mask = r->bus->capacity - 1;
+	int count = 0;
+	while (count < maxCount && r->next < head) {
+		const struct can_shm_bus_slot *slot = &r->slots[r->next & mask];
+		const __u64 expected = 2 * r->next + 2;
+		const __u64 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == expected) {
+			frames[count] = slot->frame;
+			timestamps[count] = (jlong) slot->timestamp_ns;
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == expected) {
+				count++;
+				r->next++;
+				continue;
+			}
+		} else if (seq < expected) {
+			break;
+		}
+		//overwritten while or before it was read
+		r->lost++;
+		r->next++;
+		skipLost(r);
+	}
+	return count;
+}
+
+/*
+ * Copies up to maxCount frames and their receive timestamps, waiting up to
+ * timeoutMs (forever if negative) for the first one. Returns the number of
+ * frames, 0 on timeout, -1 with errno set if the reader is or gets closed.
+ */
+int shmBusRead(jint handle, struct can_frame *frames, jlong *timestamps, int maxCount, jint timeoutMs) {
+	ShmBusReader *r = shmBusReaderGet(handle);
+	if (r == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (long) (timeoutMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= NSEC_PER_SEC) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= NSEC_PER_SEC;
+	}
+	struct can_shm_bus_header *bus = r->bus;
+	pthread_mutex_lock(&r->lock);
+	int count = shmBusCopy(r, frames, timestamps, maxCount);
+	int closed = 0;
+	while (count == 0 && timeoutMs != 0) {
+		struct timespec timeout;
+		if (timeoutMs > 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			__s64 ns = (__s64) (deadline.tv_sec - now.tv_sec) * NSEC_PER_SEC + deadline.tv_nsec - now.tv_nsec;
+			if (ns <= 0) {
+				break;
+			}
+			timeout.tv_sec = ns / NSEC_PER_SEC;
+			timeout.tv_nsec = ns % NSEC_PER_SEC;
+		}
+		const __u32 wake = __atomic_load_n(&bus->wake, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&bus->waiters, 1, __ATOMIC_SEQ_CST);
+		closed = __atomic_load_n(&r->closed, __ATOMIC_SEQ_CST);
+		if (!closed && __atomic_load_n(&bus->head, __ATOMIC_SEQ_CST) == r->next) {
+			futex(&bus->wake, FUTEX_WAIT, wake, timeoutMs > 0 ? &timeout : NULL);
+		}
+		__atomic_fetch_sub(&bus->waiters, 1, __ATOMIC_SEQ_CST);
+		if (closed || __atomic_load_n(&r->closed, __ATOMIC_SEQ_CST)) {
+			closed = 1;
+			break;
+		}
+		count = shmBusCopy(r, frames, timestamps, maxCount);
+	}
+	pthread_mutex_unlock(&r->lock);
+	shmBusReaderPut(r);
+	if (closed) {
+		errno = EBADF;
+		return -1;
+	}
+	return count;
+}
+
+int shmBusGetStats(jint handle, jlong *stats) {
+	ShmBusReader *r = shmBusReaderGet(handle);
+	if (r == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	pthread_mutex_lock(&r->lock);
+	stats[SHMBUS_STAT_IFINDEX] = r->bus->ifindex;
+	stats[SHMBUS_STAT_LOST] = r->lost;
+	stats[SHMBUS_STAT_BACKLOG] = (jlong) (__atomic_load_n(&r->bus->head, __ATOMIC_ACQUIRE) - r->next);
+	stats[SHMBUS_STAT_PUBLISHED] = (jlong) __atomic_load_n(&r->bus->head, __ATOMIC_ACQUIRE);
+	pthread_mutex_unlock(&r->lock);
+	shmBusReaderPut(r);
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+/*
+ * Registry of the native state attached to a CAN socket (transmit queue, ...).
+ * The table is indexed directly by the file descriptor.
+ *
+ * A context and everything attached to it lives as long as anybody uses it:
+ * socketContextGet() returns the context with its lock held for reading, the
+ * caller may use the attached objects until socketContextPut(). Attaching or
+ * detaching an object takes the lock for writing (socketContextLock()), so an
+ * object detached is no longer used by anybody once the writer got the lock;
+ * it is released after socketContextUnlock(), as worker threads of the object
+ * may be waiting for the lock meanwhile. Readers must not block indefinitely
+ * with the lock held, objects a reader may wait on are woken before a writer
+ * waits for the lock.
+ */
+
+static SocketContext *socketContexts[MAX_SOCKET_CONTEXTS];
+static pthread_rwlock_t socketContextsLock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t socketContextsCreateLock = PTHREAD_MUTEX_INITIALIZER;
+
+SocketContext *socketContextGet(int fd) {
+	if (fd < 0 || fd >= MAX_SOCKET_CONTEXTS) {
+		return NULL;
+	}
+	pthread_rwlock_rdlock(&socketContextsLock);
+	SocketContext *ctx = socketContexts[fd];
+	if (ctx != NULL) {
+		pthread_rwlock_rdlock(&ctx->lock);
+	}
+	pthread_rwlock_unlock(&socketContextsLock);
+	return ctx;
+}
+
+void socketContextPut(const SocketContext *ctx) {
+	if (ctx != NULL) {
+		pthread_rwlock_unlock(&const_cast<SocketContext*>(ctx)->lock);
+	}
+}
+
+/*
+ * Returns the context of the socket, created if there is none yet, with its
+ * lock held for writing. Returns NULL with errno set on failure.
+ */
+SocketContext *socketContextLock(int fd) {
+	if (fd < 0 || fd >= MAX_SOCKET_CONTEXTS) {
+		errno = EBADF;
+		return NULL;
+	}
+	pthread_mutex_lock(&socketContextsCreateLock);
+	pthread_rwlock_rdlock(&socketContextsLock);
+	SocketContext *ctx = socketContexts[fd];
+	pthread_rwlock_unlock(&socketContextsLock);
+	if (ctx == NULL) {
+		ctx = (SocketContext*) calloc(1, sizeof(SocketContext));
+		if (ctx == NULL) {
+			pthread_mutex_unlock(&socketContextsCreateLock);
+			errno = ENOMEM;
+			return NULL;
+		}
+		ctx->fd = fd;
+		pthread_rwlock_init(&ctx->lock, NULL);
+		pthread_rwlock_wrlock(&socketContextsLock);
+		socketContexts[fd] = ctx;
+		pthread_rwlock_unlock(&socketContextsLock);
+	}
+	//a context is only removed with the create lock held, so it is still there
+	pthread_rwlock_wrlock(&ctx->lock);
+	pthread_mutex_unlock(&socketContextsCreateLock);
+	return ctx;
+}
+
+void socketContextUnlock(SocketContext *ctx) {
+	pthread_rwlock_unlock(&ctx->lock);
+}
+
+/*
+ * As socketContextGet(), creating the context if there is none yet. Returns
+ * NULL with errno set on failure, EBADF if the socket is closed meanwhile.
+ */
+SocketContext *socketContextCreate(int fd) {
+	SocketContext *ctx = socketContextLock(fd);
+	if (ctx == NULL) {
+		return NULL;
+	}
+	socketContextUnlock(ctx);
+	ctx = socketContextGet(fd);
+	if (ctx == NULL) {
+		errno = EBADF;
+	}
+	return ctx;
+}
+
+/*
+ * Stops everything attached to the socket before it is closed: the cyclic
+ * frames of the socket are removed, blocked readers woken, and the context is
+ * released once the last of them left.
+ */
+void socketContextDestroy(int fd) {
+	if (fd < 0 || fd >= MAX_SOCKET_CONTEXTS) {
+		return;
+	}
+	cyclicalTaskRemoveSocket(fd);
+	pthread_mutex_lock(&socketContextsCreateLock);
+	pthread_rwlock_wrlock(&socketContextsLock);
+	SocketContext *ctx = socketContexts[fd];
+	socketContexts[fd] = NULL;
+	pthread_rwlock_unlock(&socketContextsLock);
+	pthread_mutex_unlock(&socketContextsCreateLock);
+	if (ctx == NULL) {
+		return;
+	}
+	//wake whoever waits with the context in use, then wait for all users to leave
+	pthread_rwlock_rdlock(&ctx->lock);
+	//a confirmed send waiting for the queue sees it stopped by the close
+	if (ctx->confirmSender != NULL) {
+		confirmSenderWake(ctx->confirmSender);
+	}
+	if (ctx->txQueue != NULL) {
+		txQueueStop(ctx->txQueue);
+	}
+	if (ctx->uring != NULL) {
+		uringWake(ctx->uring);
+	}
+	if (ctx->timedSender != NULL) {
+		timedSenderWake(ctx->timedSender);
+	}
+	pthread_rwlock_unlock(&ctx->lock);
+	pthread_rwlock_wrlock(&ctx->lock);
+	pthread_rwlock_unlock(&ctx->lock);
+
+	//nobody can get the context any more, worker threads see the socket without one
+	dispatcherDestroy(ctx->dispatcher);
+	uringDestroy(ctx->uring);
+	//the ring feeds the queue, so it goes first
+	if (ctx->txRing != NULL) {
+		txRingDestroy(ctx->txRing);
+	}
+	if (ctx->txQueue != NULL) {
+		txQueueDestroy(ctx->txQueue);
+	}
+	if (ctx->timedSender != NULL) {
+		timedSenderDestroy(ctx->timedSender);
+	}
+	if (ctx->confirmSender != NULL) {
+		confirmSenderDestroy(ctx->confirmSender);
+	}
+	idFilterDestroy(ctx->idFilters);
+	free(ctx->savedFilters);
+	inventoryDestroy(ctx->inventory);
+	pthread_rwlock_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/* calls fn for every context with its lock held for reading */
+void socketContextForEach(void (*fn)(SocketContext *ctx, void *arg), void *arg) {
+	pthread_rwlock_rdlock(&socketContextsLock);
+	for (int fd = 0; fd < MAX_SOCKET_CONTEXTS; fd++) {
+		SocketContext *ctx = socketContexts[fd];
+		if (ctx != NULL) {
+			pthread_rwlock_rdlock(&ctx->lock);
+			fn(ctx, arg);
+			pthread_rwlock_unlock(&ctx->lock);
+		}
+	}
+	pthread_rwlock_unlock(&socketContextsLock);
+}
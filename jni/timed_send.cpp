@@ -0,0 +1,349 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+/* the timer fallback sleeps until this long before the launch time and spins for the rest */
+#define TIMED_SEND_SPIN_NS				  200000LL
+/* how long to wait for the transmit timestamp after the launch time */
+#define TIMED_SEND_TX_TIMEOUT_NS		100000000LL
+/* without transmit timestamps, how long to wait after the launch time for a missed deadline report */
+#define TIMED_SEND_ETF_GRACE_NS			  2000000LL
+/* launch times further ahead are rejected, the caller would block a close() that long */
+#define TIMED_SEND_MAX_AHEAD_NS		  60000000000LL
+#define NSEC_PER_SEC				   1000000000LL
+
+/*
+ * Transmission at a given CLOCK_MONOTONIC instant.
+ *
+ * If an ETF qdisc is attached to the interface the launch time is passed to
+ * the kernel via SO_TXTIME and the frame is released by the qdisc. Otherwise
+ * the calling thread sleeps until shortly before the launch time, spins for
+ * the remainder and sends the frame itself. The sleep ends early with EBADF
+ * when the socket is closed (timedSenderWake()), as the caller holds the
+ * socket context meanwhile.
+ * The actual transmission time is taken from the software transmit timestamp
+ * of the frame if the driver provides one. Without timestamps an ETF send
+ * waits a short grace period after the launch time for the qdisc to report a
+ * missed deadline; a frame the qdisc drops later than that goes unnoticed.
+ */
+struct _TimedSender {
+	pthread_mutex_t lock;
+	int mode;
+	int ifIndex;
+	int timestamping;
+	int stampSeen;
+	int stopFd;
+	int stopped;
+};
+
+static __s64 clockNs(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (__s64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* offset to add to a CLOCK_MONOTONIC time to get the given clock */
+static __s64 clockOffsetNs(clockid_t clock) {
+	const __s64 mono1 = clockNs(CLOCK_MONOTONIC);
+	const __s64 other = clockNs(clock);
+	const __s64 mono2 = clockNs(CLOCK_MONOTONIC);
+	return other - (mono1 + (mono2 - mono1) / 2);
+}
+
+/* returns 0 at the launch time and -1 with errno EBADF if woken by timedSenderWake() before */
+static int sleepUntilNs(TimedSender *ts, __s64 launchNs) {
+	const __s64 wakeNs = launchNs - TIMED_SEND_SPIN_NS;
+	__s64 remainingNs;
+	while ((remainingNs = wakeNs - clockNs(CLOCK_MONOTONIC)) > 0) {
+		struct timespec timeout;
+		timeout.tv_sec = remainingNs / NSEC_PER_SEC;
+		timeout.tv_nsec = remainingNs % NSEC_PER_SEC;
+		struct pollfd pfd;
+		pfd.fd = ts->stopFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (ppoll(&pfd, 1, &timeout, NULL) > 0) {
+			break;
+		}
+	}
+	if (__atomic_load_n(&ts->stopped, __ATOMIC_ACQUIRE)) {
+		errno = EBADF;
+		return -1;
+	}
+	while (clockNs(CLOCK_MONOTONIC) < launchNs) {
+		/* spin */
+	}
+	return 0;
+}
+
+static void timedSenderSetup(TimedSender *ts, int fd, int ifIndex) {
+	if (ts->timestamping == 0) {
+		const int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+		ts->timestamping = setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0 ? 1 : -1;
+	}
+	if (ts->mode != TIMED_SEND_MODE_UNKNOWN && ts->ifIndex == ifIndex) {
+		return;
+	}
+	ts->ifIndex = ifIndex;
+	ts->mode = TIMED_SEND_MODE_TIMER;
+	if (ifIndex > 0 && netlinkHasQdisc(ifIndex, "etf") == 1) {
+		struct sock_txtime cfg;
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.clockid = CLOCK_TAI;
+		cfg.flags = SOF_TXTIME_REPORT_ERRORS;
+		if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) == 0) {
+			ts->mode = TIMED_SEND_MODE_ETF;
+			if (ts->timestamping == -1) {
+				CANLOG_WARN("CAN socket %d: SO_TIMESTAMPING not available, ETF deadlines missed later than "
+						"%lld us after the launch time are not detected", fd, TIMED_SEND_ETF_GRACE_NS / 1000);
+			}
+		}
+	}
+}
+
+static void drainErrorQueue(int fd) {
+	char data[sizeof(struct can_frame)];
+	char control[256];
+	struct iovec iov;
+	struct msghdr msg;
+	do {
+		iov.iov_base = data;
+		iov.iov_len = sizeof(data);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+	} while (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0);
+}
+
+/*
+ * Waits for the transmit timestamp of the frame just sent.
+ * Returns 1 with the CLOCK_REALTIME timestamp, 0 on timeout or close and -1 with errno
+ * set if the kernel reported an error for the frame (e.g. a missed deadline).
+ */
+static int awaitTxTimestamp(TimedSender *ts, int fd, __s64 deadlineNs, __s64 *realtimeNs) {
+	char data[sizeof(struct can_frame)];
+	char control[512];
+	while (1) {
+		const __s64 remainingNs = deadlineNs - clockNs(CLOCK_MONOTONIC);
+		if (remainingNs <= 0) {
+			return 0;
+		}
+		struct pollfd pfds[2];
+		pfds[0].fd = fd;
+		pfds[0].events = 0; //the error queue is signalled with POLLERR
+		pfds[0].revents = 0;
+		pfds[1].fd = ts->stopFd;
+		pfds[1].events = POLLIN;
+		pfds[1].revents = 0;
+		if (poll(pfds, 2, (int) (remainingNs / 1000000) + 1) <= 0) {
+			continue;
+		}
+		if (pfds[1].revents != 0) {
+			//the socket is being closed, an ETF launch time may still be far ahead
+			return 0;
+		}
+		struct iovec iov;
+		iov.iov_base = data;
+		iov.iov_len = sizeof(data);
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			return 0;
+		}
+		__s64 stamp = 0;
+		int haveStamp = 0;
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				const struct scm_timestamping *tss = (const struct scm_timestamping*) CMSG_DATA(cmsg);
+				stamp = (__s64) tss->ts[0].tv_sec * NSEC_PER_SEC + tss->ts[0].tv_nsec;
+				haveStamp = stamp != 0;
+			} else if (cmsg->cmsg_level == SOL_CAN_RAW && cmsg->cmsg_type == SCM_CAN_RAW_ERRQUEUE) {
+				const struct sock_extended_err *serr = (const struct sock_extended_err*) CMSG_DATA(cmsg);
+				if (serr->ee_origin == SO_EE_ORIGIN_TXTIME) {
+					errno = serr->ee_errno;
+					return -1;
+				}
+			}
+		}
+		if (haveStamp) {
+			*realtimeNs = stamp;
+			return 1;
+		}
+	}
+}
+
+TimedSender *timedSenderCreate(void) {
+	TimedSender *ts = (TimedSender*) calloc(1, sizeof(TimedSender));
+	if (ts == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ts->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ts->stopFd == -1) {
+		const int err = errno;
+		free(ts);
+		errno = err;
+		return NULL;
+	}
+	pthread_mutex_init(&ts->lock, NULL);
+	ts->mode = TIMED_SEND_MODE_UNKNOWN;
+	return ts;
+}
+
+/* ends a sleep until the launch time, this and every later send fails with EBADF */
+void timedSenderWake(TimedSender *ts) {
+	__atomic_store_n(&ts->stopped, 1, __ATOMIC_RELEASE);
+	eventfd_write(ts->stopFd, 1);
+}
+
+void timedSenderDestroy(TimedSender *ts) {
+	close(ts->stopFd);
+	pthread_mutex_destroy(&ts->lock);
+	free(ts);
+}
+
+int timedSenderMode(TimedSender *ts) {
+	pthread_mutex_lock(&ts->lock);
+	const int mode = ts->mode;
+	pthread_mutex_unlock(&ts->lock);
+	return mode;
+}
+
+/*
+ * Sends the frame at the given CLOCK_MONOTONIC time and stores the difference
+ * between the actual and the requested transmission time in deltaNs, or
+ * LLONG_MIN if it could not be measured.
+ * Returns 0 on success and -1 with errno set on failure, ERANGE if the launch
+ * time is more than TIMED_SEND_MAX_AHEAD_NS ahead.
+ */
+int timedSend(TimedSender *ts, int fd, jint if_idx, const struct can_frame *frame, jlong launchNs,
+		jlong *deltaNs) {
+	if (launchNs - clockNs(CLOCK_MONOTONIC) > TIMED_SEND_MAX_AHEAD_NS) {
+		errno = ERANGE;
+		return -1;
+	}
+	pthread_mutex_lock(&ts->lock);
+	if (__atomic_load_n(&ts->stopped, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_unlock(&ts->lock);
+		errno = EBADF;
+		return -1;
+	}
+	timedSenderSetup(ts, fd, if_idx);
+	drainErrorQueue(fd);
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_idx;
+
+	struct iovec iov;
+	iov.iov_base = (void*) frame;
+	iov.iov_len = sizeof(*frame);
+
+	union {
+		char buf[CMSG_SPACE(sizeof(__u32)) + CMSG_SPACE(sizeof(__u64))];
+		struct cmsghdr align;
+	} control;
+	memset(&control, 0, sizeof(control));
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = 0;
+
+	struct cmsghdr *cmsg = (struct cmsghdr*) control.buf;
+	if (ts->timestamping == 1) {
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SO_TIMESTAMPING;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(__u32));
+		const __u32 tsflags = SOF_TIMESTAMPING_TX_SOFTWARE;
+		memcpy(CMSG_DATA(cmsg), &tsflags, sizeof(tsflags));
+		msg.msg_controllen += CMSG_SPACE(sizeof(__u32));
+		cmsg = (struct cmsghdr*) (control.buf + msg.msg_controllen);
+	}
+	if (ts->mode == TIMED_SEND_MODE_ETF) {
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_TXTIME;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(__u64));
+		const __u64 txtime = (__u64) (launchNs + clockOffsetNs(CLOCK_TAI));
+		memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+		msg.msg_controllen += CMSG_SPACE(sizeof(__u64));
+	} else if (sleepUntilNs(ts, launchNs) == -1) {
+		pthread_mutex_unlock(&ts->lock);
+		errno = EBADF;
+		return -1;
+	}
+	if (msg.msg_controllen == 0) {
+		msg.msg_control = NULL;
+	}
+
+	const ssize_t nbytes = sendmsg(fd, &msg, 0);
+	const __s64 sentNs = clockNs(CLOCK_MONOTONIC);
+	if (nbytes != (ssize_t) sizeof(*frame)) {
+		const int err = nbytes == -1 ? errno : EIO;
+		pthread_mutex_unlock(&ts->lock);
+		errno = err;
+		return -1;
+	}
+
+	*deltaNs = ts->mode == TIMED_SEND_MODE_ETF ? LLONG_MIN : sentNs - launchNs;
+	if (ts->timestamping == 1 || ts->mode == TIMED_SEND_MODE_ETF) {
+		//without timestamps only the error report of the qdisc is awaited
+		const __s64 deadlineNs = (launchNs > sentNs ? launchNs : sentNs)
+				+ (ts->timestamping == 1 ? TIMED_SEND_TX_TIMEOUT_NS : TIMED_SEND_ETF_GRACE_NS);
+		__s64 realtimeNs = 0;
+		const int rc = awaitTxTimestamp(ts, fd, deadlineNs, &realtimeNs);
+		if (rc == -1) {
+			const int err = errno;
+			pthread_mutex_unlock(&ts->lock);
+			errno = err;
+			return -1;
+		}
+		if (rc == 1) {
+			ts->stampSeen = 1;
+			*deltaNs = realtimeNs - clockOffsetNs(CLOCK_REALTIME) - launchNs;
+		} else if (ts->timestamping == 1 && !ts->stampSeen) {
+			//the driver does not provide transmit timestamps, do not wait for them again
+			ts->timestamping = -1;
+			if (ts->mode == TIMED_SEND_MODE_ETF) {
+				CANLOG_WARN("CAN socket %d: no transmit timestamps, ETF deadlines missed later than %lld us "
+						"after the launch time are not detected", fd, TIMED_SEND_ETF_GRACE_NS / 1000);
+			}
+		}
+	}
+	pthread_mutex_unlock(&ts->lock);
+	return 0;
+}
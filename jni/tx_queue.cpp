@@ -0,0 +1,430 @@
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define TXQ_POLL_TIMEOUT_MS				  10
+#define TXQ_BACKOFF_MIN_US				 100
+#define TXQ_BACKOFF_MAX_US				5000
+/* approximate kernel memory (truesize) charged to the socket per CAN frame */
+#define TXQ_FRAME_TRUESIZE				 768
+
+typedef struct _TxQueueEntry {
+	__u32 prio;
+	__u64 seq;
+	jint if_idx;
+	struct can_frame frame;
+} TxQueueEntry;
+
+/*
+ * Bounded per socket transmit queue.
+ *
+ * Frames are sent directly as long as the device accepts them. As soon as the
+ * kernel reports congestion (ENOBUFS from a full device queue, EAGAIN from a
+ * full socket buffer) frames are kept here and a drain thread retransmits them
+ * in order once the device accepts frames again.
+ * A frame stays at the head of the queue until it has been handed over to the
+ * kernel, so a direct send can never overtake queued frames.
+ *
+ * The pending frames are kept in a binary heap ordered by (prio, seq). In FIFO
+ * order prio is always 0, in priority order it is the arbitration key of the
+ * frame, so the frame that would win the arbitration on the wire is sent first.
+ * To keep the kernel's FIFO qdisc from defeating the ordering, the number of
+ * frames in flight in the kernel can be limited via the socket send buffer.
+ * While the queue is paused (bus-off) every frame is queued, the overflow
+ * policy applies as usual.
+ */
+struct _TxQueue {
+	int fd;
+	int policy;
+	int order;
+	int capacity;
+	TxQueueEntry *entries;
+	int count;
+	__u64 nextSeq;
+	int savedSndbuf;
+	int running;
+	int paused;
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	pthread_cond_t idle; //empty and not paused, on CLOCK_MONOTONIC
+	pthread_t thread;
+	jlong stats[TXQ_STATS_COUNT];
+};
+
+static int isCongestion(int err) {
+	return err == ENOBUFS || err == EAGAIN || err == EWOULDBLOCK;
+}
+
+/* an interface index of 0 sends on the interface the socket is bound to */
+static ssize_t txQueueTransmit(int fd, const TxQueueEntry *entry) {
+	if (entry->if_idx == 0) {
+		return send(fd, &entry->frame, sizeof(entry->frame), MSG_DONTWAIT);
+	}
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = entry->if_idx;
+	return sendto(fd, &entry->frame, sizeof(entry->frame), MSG_DONTWAIT,
+			reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+}
+
+/* CAN sockets report POLLOUT as long as the socket send buffer has room, even
+ * if the device queue behind it is full. poll() therefore only covers the
+ * socket buffer, the backoff covers the device queue.
+ */
+static void txQueueAwaitWritable(int fd, int err, int backoffUs) {
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	poll(&pfd, 1, TXQ_POLL_TIMEOUT_MS);
+	if (err == ENOBUFS) {
+		usleep(backoffUs);
+	}
+}
+
+/*
+ * Arbitration key of a frame, a lower key wins the arbitration on the wire.
+ * Layout from MSB: base identifier (11 bit), RTR resp. SRR, IDE, identifier
+ * extension (18 bit), RTR of extended frames.
+ */
+static __u32 arbitrationKey(canid_t can_id) {
+	const __u32 rtr = (can_id & CAN_RTR_FLAG) ? 1 : 0;
+	if (can_id & CAN_EFF_FLAG) {
+		const __u32 id = can_id & CAN_EFF_MASK;
+		return ((id >> 18) << 21) | (1U << 20) | (1U << 19) | ((id & 0x3FFFF) << 1) | rtr;
+	}
+	return ((can_id & CAN_SFF_MASK) << 21) | (rtr << 20);
+}
+
+static int entryBefore(const TxQueueEntry *a, const TxQueueEntry *b) {
+	return a->prio < b->prio || (a->prio == b->prio && a->seq < b->seq);
+}
+
+static void heapSiftUp(TxQueueEntry *heap, int i) {
+	while (i > 0) {
+		const int parent = (i - 1) / 2;
+		if (!entryBefore(&heap[i], &heap[parent])) {
+			break;
+		}
+		std::swap(heap[i], heap[parent]);
+		i = parent;
+	}
+}
+
+static void heapSiftDown(TxQueueEntry *heap, int count, int i) {
+	while (1) {
+		const int left = 2 * i + 1;
+		const int right = left + 1;
+		int smallest = i;
+		if (left < count && entryBefore(&heap[left], &heap[smallest])) {
+			smallest = left;
+		}
+		if (right < count && entryBefore(&heap[right], &heap[smallest])) {
+			smallest = right;
+		}
+		if (smallest == i) {
+			break;
+		}
+		std::swap(heap[i], heap[smallest]);
+		i = smallest;
+	}
+}
+
+/* must be called with the queue lock held */
+static void txQueueRemoveAt(TxQueue *q, int i) {
+	q->count--;
+	if (i == q->count) {
+		return;
+	}
+	q->entries[i] = q->entries[q->count];
+	heapSiftDown(q->entries, q->count, i);
+	heapSiftUp(q->entries, i);
+}
+
+static void* txQueueDrain(void *arg) {
+	TxQueue *q = (TxQueue*) arg;
+	int backoff = TXQ_BACKOFF_MIN_US;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->running) {
+		if (q->count == 0 || q->paused) {
+			pthread_cond_wait(&q->notEmpty, &q->lock);
+			continue;
+		}
+		TxQueueEntry *entry = &q->entries[0];
+		const ssize_t nbytes = txQueueTransmit(q->fd, entry);
+		if (nbytes == -1 && isCongestion(errno)) {
+			const int err = errno;
+			q->stats[TXQ_STAT_CONGESTED]++;
+			pthread_mutex_unlock(&q->lock);
+			txQueueAwaitWritable(q->fd, err, backoff);
+			backoff = std::min(backoff * 2, TXQ_BACKOFF_MAX_US);
+			pthread_mutex_lock(&q->lock);
+			continue;
+		}
+		backoff = TXQ_BACKOFF_MIN_US;
+		if (nbytes == sizeof(entry->frame)) {
+			q->stats[TXQ_STAT_SENT]++;
+		} else {
+			//hard error, the frame is discarded
+			q->stats[TXQ_STAT_ERRORS]++;
+		}
+		txQueueRemoveAt(q, 0);
+		pthread_cond_signal(&q->notFull);
+		if (q->count == 0) {
+			pthread_cond_broadcast(&q->idle);
+		}
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/* must be called with the queue lock held */
+static int txQueueInsert(TxQueue *q, const TxQueueEntry *entry, int mayBlock) {
+	if (q->policy == TXQ_POLICY_COALESCE) {
+		for (int i = 0; i < q->count; i++) {
+			TxQueueEntry *pending = &q->entries[i];
+			if (pending->frame.can_id == entry->frame.can_id
+					&& pending->if_idx == entry->if_idx) {
+				//same id means same prio, the position in the heap stays valid
+				pending->frame = entry->frame;
+				q->stats[TXQ_STAT_COALESCED]++;
+				return TXQ_OK;
+			}
+		}
+	}
+	if (q->count == q->capacity) {
+		switch (q->policy) {
+		case TXQ_POLICY_BLOCK:
+			if (!mayBlock) {
+				q->stats[TXQ_STAT_DROPPED_NEWEST]++;
+				return TXQ_DROPPED;
+			}
+			q->stats[TXQ_STAT_BLOCKED]++;
+			while (q->count == q->capacity && q->running) {
+				pthread_cond_wait(&q->notFull, &q->lock);
+			}
+			if (!q->running) {
+				errno = ESHUTDOWN;
+				return TXQ_ERROR;
+			}
+			break;
+		case TXQ_POLICY_DROP_OLDEST: {
+			int oldest = 0;
+			for (int i = 1; i < q->count; i++) {
+				if (q->entries[i].seq < q->entries[oldest].seq) {
+					oldest = i;
+				}
+			}
+			txQueueRemoveAt(q, oldest);
+			q->stats[TXQ_STAT_DROPPED_OLDEST]++;
+			break;
+		}
+		default:
+			//TXQ_POLICY_DROP_NEWEST, TXQ_POLICY_COALESCE without pending frame of that id
+			q->stats[TXQ_STAT_DROPPED_NEWEST]++;
+			return TXQ_DROPPED;
+		}
+	}
+	TxQueueEntry *slot = &q->entries[q->count];
+	*slot = *entry;
+	slot->prio = q->order == TXQ_ORDER_PRIORITY ? arbitrationKey(entry->frame.can_id) : 0;
+	slot->seq = q->nextSeq++;
+	q->count++;
+	heapSiftUp(q->entries, q->count - 1);
+	if (q->count > q->stats[TXQ_STAT_HIGH_WATERMARK]) {
+		q->stats[TXQ_STAT_HIGH_WATERMARK] = q->count;
+	}
+	pthread_cond_signal(&q->notEmpty);
+	return TXQ_OK;
+}
+
+TxQueue *txQueueCreate(int fd, int capacity, int policy, int order, int maxInFlight) {
+	if (capacity < 1 || policy < TXQ_POLICY_BLOCK || policy > TXQ_POLICY_COALESCE
+			|| order < TXQ_ORDER_FIFO || order > TXQ_ORDER_PRIORITY || maxInFlight < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	TxQueue *q = (TxQueue*) calloc(1, sizeof(TxQueue));
+	if (q == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	q->entries = (TxQueueEntry*) calloc(capacity, sizeof(TxQueueEntry));
+	if (q->entries == NULL) {
+		free(q);
+		errno = ENOMEM;
+		return NULL;
+	}
+	q->fd = fd;
+	q->policy = policy;
+	q->order = order;
+	q->capacity = capacity;
+	q->savedSndbuf = -1;
+	if (maxInFlight > 0) {
+		socklen_t len = sizeof(q->savedSndbuf);
+		if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &q->savedSndbuf, &len) == -1) {
+			q->savedSndbuf = -1;
+		}
+		//the kernel doubles the value and enforces a lower bound of a few frames
+		const int sndbuf = maxInFlight * TXQ_FRAME_TRUESIZE / 2;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	}
+	q->running = 1;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->notEmpty, NULL);
+	pthread_cond_init(&q->notFull, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&q->idle, &attr);
+	pthread_condattr_destroy(&attr);
+
+	const int rc = pthread_create(&q->thread, NULL, txQueueDrain, (void*) q);
+	if (rc) {
+		pthread_mutex_destroy(&q->lock);
+		pthread_cond_destroy(&q->notEmpty);
+		pthread_cond_destroy(&q->notFull);
+		pthread_cond_destroy(&q->idle);
+		free(q->entries);
+		free(q);
+		errno = rc;
+		return NULL;
+	}
+	return q;
+}
+
+/* wakes blocked submitters and the drain thread, later submissions fail with ESHUTDOWN */
+void txQueueStop(TxQueue *q) {
+	pthread_mutex_lock(&q->lock);
+	q->running = 0;
+	pthread_cond_broadcast(&q->notEmpty);
+	pthread_cond_broadcast(&q->notFull);
+	pthread_cond_broadcast(&q->idle);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* stops the drain thread, frames still pending are discarded */
+void txQueueDestroy(TxQueue *q) {
+	txQueueStop(q);
+	pthread_join(q->thread, NULL);
+
+	if (q->savedSndbuf > 0) {
+		const int sndbuf = q->savedSndbuf / 2;
+		setsockopt(q->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	}
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->notEmpty);
+	pthread_cond_destroy(&q->notFull);
+	pthread_cond_destroy(&q->idle);
+	free(q->entries);
+	free(q);
+}
+
+int txQueueSubmit(TxQueue *q, jint if_idx, const struct can_frame *frame, int mayBlock) {
+	TxQueueEntry entry;
+	entry.if_idx = if_idx;
+	entry.frame = *frame;
+
+	pthread_mutex_lock(&q->lock);
+	if (!q->running) {
+		pthread_mutex_unlock(&q->lock);
+		errno = ESHUTDOWN;
+		return TXQ_ERROR;
+	}
+	q->stats[TXQ_STAT_SUBMITTED]++;
+	if (q->count == 0 && !q->paused) {
+		const ssize_t nbytes = txQueueTransmit(q->fd, &entry);
+		if (nbytes == sizeof(entry.frame)) {
+			q->stats[TXQ_STAT_SENT]++;
+			pthread_mutex_unlock(&q->lock);
+			return TXQ_OK;
+		}
+		if (nbytes != -1 || !isCongestion(errno)) {
+			const int err = nbytes == -1 ? errno : EIO;
+			q->stats[TXQ_STAT_ERRORS]++;
+			pthread_mutex_unlock(&q->lock);
+			errno = err;
+			return TXQ_ERROR;
+		}
+		q->stats[TXQ_STAT_CONGESTED]++;
+	}
+	const int rc = txQueueInsert(q, &entry, mayBlock);
+	pthread_mutex_unlock(&q->lock);
+	return rc;
+}
+
+/*
+ * Holds back all frames until the queue is resumed, the drain continues in
+ * order. Returns whether the queue was paused before.
+ */
+int txQueueSetPaused(TxQueue *q, int paused) {
+	pthread_mutex_lock(&q->lock);
+	const int wasPaused = q->paused;
+	q->paused = paused;
+	if (!paused) {
+		pthread_cond_signal(&q->notEmpty);
+		if (q->count == 0) {
+			pthread_cond_broadcast(&q->idle);
+		}
+	}
+	pthread_mutex_unlock(&q->lock);
+	return wasPaused;
+}
+
+/*
+ * Waits until no frame is queued and the queue is not paused, so a frame sent
+ * past the queue keeps its place behind the frames submitted before.
+ * deadlineNs is a CLOCK_MONOTONIC time. Returns 0 once idle, -1 with errno
+ * ENETDOWN if still paused at the deadline, ETIMEDOUT if frames are still
+ * pending, ESHUTDOWN if the queue was stopped.
+ */
+int txQueueAwaitIdle(TxQueue *q, __s64 deadlineNs) {
+	struct timespec ts;
+	ts.tv_sec = deadlineNs / 1000000000LL;
+	ts.tv_nsec = deadlineNs % 1000000000LL;
+	int err = 0;
+	pthread_mutex_lock(&q->lock);
+	while (q->running && (q->count > 0 || q->paused) && err == 0) {
+		err = pthread_cond_timedwait(&q->idle, &q->lock, &ts);
+	}
+	if (!q->running) {
+		err = ESHUTDOWN;
+	} else if (q->count == 0 && !q->paused) {
+		err = 0;
+	} else if (q->paused) {
+		err = ENETDOWN;
+	}
+	pthread_mutex_unlock(&q->lock);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void txQueueGetStats(TxQueue *q, jlong *stats) {
+	pthread_mutex_lock(&q->lock);
+	memcpy(stats, q->stats, sizeof(q->stats));
+	stats[TXQ_STAT_DEPTH] = q->count;
+	pthread_mutex_unlock(&q->lock);
+}
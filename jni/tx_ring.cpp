@@ -0,0 +1,223 @@
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+#define TX_RING_SPIN_ROUNDS					 200
+#define TX_RING_IDLE_TIMEOUT_MS				1000
+
+/*
+ * Shared memory transmit ring.
+ *
+ * The ring lives in memory shared with Java through a direct ByteBuffer. Java
+ * is the single producer: it writes a frame into the slot at tail and publishes
+ * it by advancing tail with release semantics. The native sender thread is the
+ * single consumer: it sends all published frames with sendmmsg and advances
+ * head, which Java reads to detect a full ring.
+ * Before the sender thread goes to sleep on its eventfd it sets the sleeping
+ * flag and re-checks tail. Java checks the flag after publishing and only then
+ * calls into native code to wake the thread, so in steady state no JNI call is
+ * needed at all.
+ *
+ * Layout: head at 0, tail at 64, sleeping (u32) at 128, capacity (u32) at 132,
+ * slots of struct can_frame from TX_RING_HEADER_SIZE on. Indices grow
+ * monotonically, the slot is index & (capacity - 1).
+ * The memory outlives the ring until Java released its buffer, see
+ * shared_memory.cpp, so a producer racing with close() writes into memory
+ * nobody reads any more instead of freed memory.
+ */
+typedef struct _TxRingHeader {
+	__u64 head;
+	char pad0[56];
+	__u64 tail;
+	char pad1[56];
+	__u32 sleeping;
+	__u32 capacity;
+	char pad2[56];
+} TxRingHeader;
+
+static_assert(sizeof(TxRingHeader) == TX_RING_HEADER_SIZE, "unexpected TX ring header size");
+
+struct _TxRing {
+	int fd;
+	int eventFd;
+	int running;
+	TxRingHeader *header;
+	struct can_frame *slots;
+	size_t size;
+	pthread_t thread;
+	jlong stats[TX_RING_STATS_COUNT];
+};
+
+/* returns 1 if frames are pending, 0 if the thread should stop */
+static int txRingAwaitFrames(TxRing *r, __u64 head) {
+	for (int i = 0; i < TX_RING_SPIN_ROUNDS; i++) {
+		if (__atomic_load_n(&r->header->tail, __ATOMIC_ACQUIRE) != head) {
+			return 1;
+		}
+	}
+	while (__atomic_load_n(&r->running, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&r->header->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&r->header->tail, __ATOMIC_SEQ_CST) != head) {
+			__atomic_store_n(&r->header->sleeping, 0, __ATOMIC_RELAXED);
+			return 1;
+		}
+		struct pollfd pfd;
+		pfd.fd = r->eventFd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, TX_RING_IDLE_TIMEOUT_MS) > 0) {
+			eventfd_t value;
+			eventfd_read(r->eventFd, &value);
+			__atomic_fetch_add(&r->stats[TX_RING_STAT_WAKEUPS], 1, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&r->header->sleeping, 0, __ATOMIC_RELAXED);
+		if (__atomic_load_n(&r->header->tail, __ATOMIC_ACQUIRE) != head) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Returns the number of frames taken, including those the transmit queue
+ * dropped by its overflow policy (counted in dropped), or -1 with errno set.
+ */
+static int txRingSend(TxRing *r, const struct can_frame *frames, int count, int *dropped) {
+	*dropped = 0;
+	SocketContext *ctx = socketContextGet(r->fd);
+	if (ctx != NULL && ctx->txQueue != NULL) {
+		int taken = 0;
+		while (taken < count) {
+			const int rc = txQueueSubmit(ctx->txQueue, 0, &frames[taken], 1);
+			if (rc == TXQ_ERROR) {
+				break;
+			}
+			if (rc == TXQ_DROPPED) {
+				(*dropped)++;
+			}
+			taken++;
+		}
+		const int err = errno;
+		socketContextPut(ctx);
+		errno = err;
+		return taken > 0 ? taken : -1;
+	}
+	socketContextPut(ctx);
+	return bulkSend(r->fd, frames, count);
+}
+
+static void* txRingWorker(void *arg) {
+	TxRing *r = (TxRing*) arg;
+	const __u32 mask = r->header->capacity - 1;
+	__u64 head = r->header->head;
+
+	while (txRingAwaitFrames(r, head)) {
+		const __u64 tail = __atomic_load_n(&r->header->tail, __ATOMIC_ACQUIRE);
+		//frames up to the end of the ring are contiguous
+		const __u32 first = (__u32) (head & mask);
+		const int count = (int) std::min<__u64>(tail - head, (__u64) (mask + 1 - first));
+		int dropped = 0;
+		const int taken = txRingSend(r, &r->slots[first], count, &dropped);
+		if (taken == -1) {
+			//a frame the kernel refuses is dropped, otherwise the ring would stall
+			CANLOG_WARN("TX ring: dropped frame 0x%x: %s", r->slots[first].can_id, strerror(errno));
+			__atomic_fetch_add(&r->stats[TX_RING_STAT_ERRORS], 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&r->stats[TX_RING_STAT_DROPPED], 1, __ATOMIC_RELAXED);
+			head++;
+		} else {
+			__atomic_fetch_add(&r->stats[TX_RING_STAT_SENT], taken - dropped, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&r->stats[TX_RING_STAT_DROPPED], dropped, __ATOMIC_RELAXED);
+			head += taken;
+		}
+		__atomic_store_n(&r->header->head, head, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+TxRing *txRingCreate(int fd, int capacity) {
+	if (capacity < 1 || (capacity & (capacity - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	TxRing *r = (TxRing*) calloc(1, sizeof(TxRing));
+	if (r == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	r->size = TX_RING_HEADER_SIZE + (size_t) capacity * sizeof(struct can_frame);
+	void *mem = sharedMemoryAlloc(r->size);
+	if (mem == NULL) {
+		free(r);
+		return NULL;
+	}
+	r->header = (TxRingHeader*) mem;
+	r->header->capacity = capacity;
+	r->slots = (struct can_frame*) ((char*) mem + TX_RING_HEADER_SIZE);
+	r->fd = fd;
+	r->running = 1;
+	r->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (r->eventFd == -1) {
+		const int err = errno;
+		sharedMemoryRelease(mem);
+		free(r);
+		errno = err;
+		return NULL;
+	}
+	const int rc = pthread_create(&r->thread, NULL, txRingWorker, (void*) r);
+	if (rc) {
+		close(r->eventFd);
+		sharedMemoryRelease(mem);
+		free(r);
+		errno = rc;
+		return NULL;
+	}
+	return r;
+}
+
+/*
+ * Stops the sender thread, frames not sent yet are discarded. The memory stays
+ * until the buffer Java got from txRingMemory() is released as well.
+ */
+void txRingDestroy(TxRing *r) {
+	__atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+	eventfd_write(r->eventFd, 1);
+	pthread_join(r->thread, NULL);
+	close(r->eventFd);
+	sharedMemoryRelease(r->header);
+	free(r);
+}
+
+/* the ring memory, see shared_memory.cpp for the reference to take for Java */
+void *txRingMemory(TxRing *r, size_t *size) {
+	*size = r->size;
+	return r->header;
+}
+
+void txRingWake(TxRing *r) {
+	eventfd_write(r->eventFd, 1);
+}
+
+void txRingGetStats(TxRing *r, jlong *stats) {
+	for (int i = 0; i < TX_RING_STATS_COUNT; i++) {
+		stats[i] = __atomic_load_n(&r->stats[i], __ATOMIC_RELAXED);
+	}
+	stats[TX_RING_STAT_PENDING] = (jlong) (__atomic_load_n(&r->header->tail, __ATOMIC_ACQUIRE)
+			- __atomic_load_n(&r->header->head, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,676 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include <stdlib.h>
+#include <pthread.h>
+}
+
+#include "cansocket.hpp"
+
+/*
+ * io_uring receive/transmit engine.
+ *
+ * Receiving arms one multishot recvmsg on the socket that takes its buffers
+ * from a ring of provided buffers registered with the kernel. Every frame
+ * posts a completion, so frames already arrived are collected from the
+ * completion queue without any system call; io_uring_enter is only needed to
+ * wait for the next frame or to re-arm the request after the kernel ended it
+ * (buffers exhausted, CQ overflow). Buffers are handed back to the kernel as
+ * soon as their frame was copied out.
+ *
+ * Sending submits a batch of linked send requests with a single
+ * io_uring_enter that also waits for their completions. The links keep the
+ * order of the frames; a failing send cancels the rest of the batch, which
+ * continues on the sendmmsg path (bulkSend) with its congestion retries.
+ *
+ * Receiving and sending use separate rings guarded by separate locks, so a
+ * thread blocked receiving does not hold up senders. Kernels before 6.0 lack
+ * multishot recvmsg or provided buffer rings: creating the engine fails with
+ * one of the errors recognised by uringUnsupported() and the socket stays on
+ * the recvmmsg/sendmmsg path; a kernel rejecting the armed request later
+ * makes uringRecv() fail with EOPNOTSUPP, again leaving the fallback to the
+ * caller.
+ *
+ * The engine is reference counted: the socket context owns one reference, a
+ * receiver takes another with uringRetain() for the time it waits without
+ * holding the context. Disabling wakes such a receiver, uringRecv() returns
+ * ECANCELED and the receiver goes on with recvmmsg; the engine is freed by
+ * whoever releases it last.
+ */
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(__NR_io_uring_setup) && defined(IORING_RECV_MULTISHOT) && defined(IORING_REGISTER_PBUF_RING)
+
+#define URING_RX_SQ_ENTRIES						   4
+#define URING_BUFFER_GROUP						   0
+#define URING_TAG_RECV							   1
+#define URING_TAG_STOP							   2
+#define NSEC_PER_SEC				   1000000000ULL
+
+/* room for the SO_TIMESTAMPNS receive time, the kernel only fills it in if the option is set */
+#define URING_CONTROL_SIZE		   CMSG_SPACE(sizeof(struct timespec))
+/* a provided buffer: recvmsg header, source address, control, frame; CAN FD frames do not fit and are skipped */
+#define URING_BUFFER_SIZE \
+	(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_can) + URING_CONTROL_SIZE \
+			+ sizeof(struct canfd_frame))
+
+typedef struct _UringRing {
+	int fd;
+	unsigned sqEntries;
+	unsigned sqLocalTail;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqMap;
+	size_t sqMapSize;
+	void *cqMap;
+	size_t cqMapSize;
+	size_t sqesSize;
+} UringRing;
+
+struct _UringEngine {
+	int fd;
+	int refs;
+	int stopFd;
+	int closing;
+	int armed;
+	int stopArmed;
+	int rxUnsupported;
+	__u64 rxTimeoutNs;
+	pthread_mutex_t rxLock;
+	pthread_mutex_t txLock;
+	UringRing rx;
+	UringRing tx;
+	struct io_uring_buf_ring *bufRing;
+	size_t bufRingSize;
+	unsigned bufCount;
+	unsigned char *buffers;
+	struct msghdr msg;
+	eventfd_t stopValue;
+	jlong stats[URING_STATS_COUNT];
+};
+
+static int sysUringSetup(unsigned entries, struct io_uring_params *p) {
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, const void *arg,
+		size_t argSize) {
+	return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int sysUringRegister(int fd, unsigned opcode, const void *arg, unsigned args) {
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, args);
+}
+
+static __u64 monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void count(UringEngine *e, int counter, jlong n) {
+	__atomic_fetch_add(&e->stats[counter], n, __ATOMIC_RELAXED);
+}
+
+static void ringClose(UringRing *r) {
+	if (r->sqes != NULL) {
+		munmap(r->sqes, r->sqesSize);
+	}
+	if (r->cqMap != NULL && r->cqMap != r->sqMap) {
+		munmap(r->cqMap, r->cqMapSize);
+	}
+	if (r->sqMap != NULL) {
+		munmap(r->sqMap, r->sqMapSize);
+	}
+	if (r->fd != -1) {
+		close(r->fd);
+	}
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+/* sets up a ring and maps its queues, returns -1 with errno set on failure */
+static int ringOpen(UringRing *r, unsigned entries, unsigned cqEntries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+	p.cq_entries = cqEntries;
+	memset(r, 0, sizeof(*r));
+	r->fd = sysUringSetup(entries, &p);
+	if (r->fd == -1) {
+		return -1;
+	}
+	//the timeout of a wait needs the extended argument (5.11)
+	if ((p.features & IORING_FEAT_EXT_ARG) == 0) {
+		ringClose(r);
+		errno = ENOSYS;
+		return -1;
+	}
+	r->sqEntries = p.sq_entries;
+	r->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->sqMapSize = r->cqMapSize = std::max(r->sqMapSize, r->cqMapSize);
+	}
+	void *sq = mmap(NULL, r->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+			IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) {
+		const int err = errno;
+		ringClose(r);
+		errno = err;
+		return -1;
+	}
+	r->sqMap = sq;
+	void *cq = sq;
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+		cq = mmap(NULL, r->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+				IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED) {
+			const int err = errno;
+			ringClose(r);
+			errno = err;
+			return -1;
+		}
+	}
+	r->cqMap = cq;
+	r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+			IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		const int err = errno;
+		ringClose(r);
+		errno = err;
+		return -1;
+	}
+	r->sqes = (struct io_uring_sqe*) sqes;
+	unsigned char *sqBase = (unsigned char*) sq;
+	unsigned char *cqBase = (unsigned char*) cq;
+	r->sqHead = (unsigned*) (sqBase + p.sq_off.head);
+	r->sqTail = (unsigned*) (sqBase + p.sq_off.tail);
+	r->sqMask = (unsigned*) (sqBase + p.sq_off.ring_mask);
+	r->sqArray = (unsigned*) (sqBase + p.sq_off.array);
+	r->cqHead = (unsigned*) (cqBase + p.cq_off.head);
+	r->cqTail = (unsigned*) (cqBase + p.cq_off.tail);
+	r->cqMask = (unsigned*) (cqBase + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*) (cqBase + p.cq_off.cqes);
+	r->sqLocalTail = *r->sqTail;
+	return 0;
+}
+
+/* returns a cleared submission entry, NULL if the queue is full */
+static struct io_uring_sqe *ringGetSqe(UringRing *r) {
+	const unsigned head = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+	if (r->sqLocalTail - head >= r->sqEntries) {
+		return NULL;
+	}
+	const unsigned index = r->sqLocalTail & *r->sqMask;
+	struct io_uring_sqe *sqe = &r->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sqArray[index] = index;
+	r->sqLocalTail++;
+	return sqe;
+}
+
+/*
+ * Submits the prepared entries and waits for minComplete completions, for at
+ * most timeoutNs if not 0. Returns -1 with errno set on failure, ETIME if the
+ * wait timed out.
+ */
+static int ringEnter(UringEngine *e, UringRing *r, unsigned minComplete, __u64 timeoutNs) {
+	const unsigned toSubmit = r->sqLocalTail - *r->sqTail;
+	__atomic_store_n(r->sqTail, r->sqLocalTail, __ATOMIC_RELEASE);
+	unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	const void *argp = NULL;
+	size_t argSize = 0;
+	if (timeoutNs > 0) {
+		ts.tv_sec = timeoutNs / NSEC_PER_SEC;
+		ts.tv_nsec = timeoutNs % NSEC_PER_SEC;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (__u64) (uintptr_t) &ts;
+		argp = &arg;
+		argSize = sizeof(arg);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+	count(e, URING_STAT_ENTER_CALLS, 1);
+	return sysUringEnter(r->fd, toSubmit, minComplete, flags, argp, argSize);
+}
+
+static struct io_uring_cqe *ringPeek(UringRing *r) {
+	const unsigned head = *r->cqHead;
+	if (head == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &r->cqes[head & *r->cqMask];
+}
+
+static void ringAdvance(UringRing *r) {
+	__atomic_store_n(r->cqHead, *r->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+/* hands buffer bid back to the kernel */
+static void bufferRecycle(UringEngine *e, unsigned bid) {
+	const unsigned short tail = e->bufRing->tail;
+	struct io_uring_buf *buf = &e->bufRing->bufs[tail & (e->bufCount - 1)];
+	buf->addr = (__u64) (uintptr_t) (e->buffers + (size_t) bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = (__u16) bid;
+	__atomic_store_n(&e->bufRing->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
+
+static void engineFree(UringEngine *e) {
+	ringClose(&e->rx);
+	ringClose(&e->tx);
+	if (e->bufRing != NULL) {
+		munmap(e->bufRing, e->bufRingSize);
+	}
+	free(e->buffers);
+	if (e->stopFd != -1) {
+		close(e->stopFd);
+	}
+	pthread_mutex_destroy(&e->rxLock);
+	pthread_mutex_destroy(&e->txLock);
+	free(e);
+}
+
+int uringUnsupported(int err) {
+	return err == ENOSYS || err == EINVAL || err == EOPNOTSUPP || err == EPERM;
+}
+
+/*
+ * Creates the engine for socket fd with rxBuffers provided receive buffers (a
+ * power of two) and up to txDepth sends per submission. Returns NULL with
+ * errno set on failure, see uringUnsupported() for the errors of a kernel
+ * lacking the needed io_uring features.
+ */
+UringEngine *uringCreate(int fd, int rxBuffers, int txDepth) {
+	if (rxBuffers < 1 || rxBuffers > URING_RX_BUFFERS_MAX || (rxBuffers & (rxBuffers - 1)) != 0 || txDepth < 1
+			|| txDepth > URING_TX_DEPTH_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	UringEngine *e = (UringEngine*) calloc(1, sizeof(UringEngine));
+	if (e == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	e->fd = fd;
+	e->refs = 1;
+	e->rx.fd = -1;
+	e->tx.fd = -1;
+	e->stopFd = -1;
+	pthread_mutex_init(&e->rxLock, NULL);
+	pthread_mutex_init(&e->txLock, NULL);
+	//every buffer may complete once before the reader catches up
+	if (ringOpen(&e->rx, URING_RX_SQ_ENTRIES, (unsigned) rxBuffers * 2) == -1
+			|| ringOpen(&e->tx, (unsigned) txDepth, (unsigned) txDepth * 2) == -1) {
+		const int err = errno;
+		engineFree(e);
+		errno = err;
+		return NULL;
+	}
+	e->stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	e->bufCount = (unsigned) rxBuffers;
+	e->bufRingSize = (size_t) rxBuffers * sizeof(struct io_uring_buf);
+	void *ring = mmap(NULL, e->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	e->buffers = (unsigned char*) malloc((size_t) rxBuffers * URING_BUFFER_SIZE);
+	e->bufRing = ring != MAP_FAILED ? (struct io_uring_buf_ring*) ring : NULL;
+	if (e->stopFd == -1 || e->bufRing == NULL || e->buffers == NULL) {
+		const int err = e->stopFd == -1 ? errno : ENOMEM;
+		engineFree(e);
+		errno = err;
+		return NULL;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (__u64) (uintptr_t) ring;
+	reg.ring_entries = (__u32) rxBuffers;
+	reg.bgid = URING_BUFFER_GROUP;
+	//provided buffer rings came with 5.19
+	if (sysUringRegister(e->rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		const int err = errno;
+		engineFree(e);
+		errno = err;
+		return NULL;
+	}
+	for (int i = 0; i < rxBuffers; i++) {
+		bufferRecycle(e, (unsigned) i);
+	}
+	e->msg.msg_namelen = sizeof(struct sockaddr_can);
+	e->msg.msg_controllen = URING_CONTROL_SIZE;
+	struct timeval tv;
+	socklen_t len = sizeof(tv);
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) == 0) {
+		e->rxTimeoutNs = (__u64) tv.tv_sec * NSEC_PER_SEC + (__u64) tv.tv_usec * 1000ULL;
+	}
+	return e;
+}
+
+/* makes a thread waiting in uringRecv() and all later calls return ECANCELED */
+void uringWake(UringEngine *e) {
+	__atomic_store_n(&e->closing, 1, __ATOMIC_RELEASE);
+	eventfd_write(e->stopFd, 1);
+}
+
+void uringRetain(UringEngine *e) {
+	__atomic_fetch_add(&e->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drops a reference, the last one frees the engine. Closing the rings
+ * cancels the armed request, frames in not yet collected buffers are lost.
+ */
+void uringRelease(UringEngine *e) {
+	if (e != NULL && __atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		engineFree(e);
+	}
+}
+
+/* wakes the receivers, see uringWake(), and drops the reference of the socket context */
+void uringDestroy(UringEngine *e) {
+	if (e == NULL) {
+		return;
+	}
+	uringWake(e);
+	uringRelease(e);
+}
+
+/* timeout of uringRecv(), 0 waits forever as SO_RCVTIMEO does */
+void uringSetRecvTimeout(UringEngine *e, __u64 timeoutNs) {
+	__atomic_store_n(&e->rxTimeoutNs, timeoutNs, __ATOMIC_RELAXED);
+}
+
+/* queues the multishot recvmsg and, once, a read of the stop event */
+static int uringArm(UringEngine *e) {
+	if (!e->stopArmed) {
+		struct io_uring_sqe *sqe = ringGetSqe(&e->rx);
+		if (sqe == NULL) {
+			errno = EBUSY;
+			return -1;
+		}
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = e->stopFd;
+		sqe->addr = (__u64) (uintptr_t) &e->stopValue;
+		sqe->len = sizeof(e->stopValue);
+		sqe->user_data = URING_TAG_STOP;
+		e->stopArmed = 1;
+	}
+	struct io_uring_sqe *sqe = ringGetSqe(&e->rx);
+	if (sqe == NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = e->fd;
+	sqe->addr = (__u64) (uintptr_t) &e->msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = URING_TAG_RECV;
+	e->armed = 1;
+	count(e, URING_STAT_RX_ARMS, 1);
+	return 0;
+}
+
+/*
+ * Collects completions into frames until count frames are stored, the rest
+ * stays queued for the next call. Returns the number of frames stored, or -1
+ * with errno set if the request ended with an error.
+ */
+static int uringCollect(UringEngine *e, struct can_frame *frames, int *ifIndexes, __u64 *timestampsNs,
+		int count) {
+	int received = 0;
+	int err = 0;
+	struct io_uring_cqe *cqe;
+	while (received < count && (cqe = ringPeek(&e->rx)) != NULL) {
+		if (cqe->user_data != URING_TAG_RECV) {
+			ringAdvance(&e->rx);
+			continue;
+		}
+		const int res = cqe->res;
+		const unsigned flags = cqe->flags;
+		if (flags & IORING_CQE_F_BUFFER) {
+			const unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+			const unsigned char *buf = e->buffers + (size_t) bid * URING_BUFFER_SIZE;
+			const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out*) buf;
+			if (res >= (int) sizeof(*out) && out->payloadlen == sizeof(struct can_frame)
+					&& (out->flags & MSG_TRUNC) == 0) {
+				const unsigned char *name = buf + sizeof(*out);
+				unsigned char *control = (unsigned char*) name + e->msg.msg_namelen;
+				memcpy(&frames[received], control + e->msg.msg_controllen, sizeof(struct can_frame));
+				if (ifIndexes != NULL) {
+					struct sockaddr_can addr;
+					memset(&addr, 0, sizeof(addr));
+					memcpy(&addr, name, std::min((size_t) out->namelen, sizeof(addr)));
+					ifIndexes[received] = addr.can_ifindex;
+				}
+				if (timestampsNs != NULL) {
+					struct msghdr msg;
+					memset(&msg, 0, sizeof(msg));
+					msg.msg_control = control;
+					msg.msg_controllen = out->controllen;
+					timestampsNs[received] = cmsgTimestampNs(&msg);
+				}
+				received++;
+			} else {
+				count(e, URING_STAT_RX_SKIPPED, 1);
+			}
+			bufferRecycle(e, bid);
+		} else if (res == -ENOBUFS) {
+			count(e, URING_STAT_RX_NO_BUFFERS, 1);
+		} else if (res == -EINVAL || res == -EOPNOTSUPP) {
+			//no multishot recvmsg in this kernel
+			e->rxUnsupported = 1;
+		} else if (res < 0 && res != -ECANCELED) {
+			err = -res;
+		}
+		if ((flags & IORING_CQE_F_MORE) == 0) {
+			e->armed = 0;
+		}
+		ringAdvance(&e->rx);
+	}
+	if (received == 0 && err != 0) {
+		errno = err;
+		return -1;
+	}
+	return received;
+}
+
+/*
+ * Receives up to count frames, blocking until the first one arrives or the
+ * receive timeout passed (EAGAIN as with SO_RCVTIMEO). Frames already
+ * completed are taken without a system call. ifIndexes, if not NULL, gets
+ * the interface of every frame, timestampsNs its receive time (see
+ * cmsgTimestampNs()). Returns the number of frames stored, or -1
+ * with errno set; EOPNOTSUPP if the kernel rejects multishot recvmsg and
+ * ECANCELED once the engine is disabled, the socket has to be read with
+ * recvmmsg then.
+ */
+int uringRecv(UringEngine *e, struct can_frame *frames, int *ifIndexes, __u64 *timestampsNs, int count) {
+	pthread_mutex_lock(&e->rxLock);
+	const __u64 timeoutNs = __atomic_load_n(&e->rxTimeoutNs, __ATOMIC_RELAXED);
+	const __u64 deadlineNs = timeoutNs > 0 ? monotonicNs() + timeoutNs : 0;
+	int received = 0;
+	while (received == 0) {
+		if (__atomic_load_n(&e->closing, __ATOMIC_ACQUIRE)) {
+			pthread_mutex_unlock(&e->rxLock);
+			errno = ECANCELED;
+			return -1;
+		}
+		received = uringCollect(e, frames, ifIndexes, timestampsNs, count);
+		if (received == 0 && e->rxUnsupported) {
+			pthread_mutex_unlock(&e->rxLock);
+			errno = EOPNOTSUPP;
+			return -1;
+		}
+		if (received != 0) {
+			break;
+		}
+		if (!e->armed && uringArm(e) == -1) {
+			received = -1;
+			break;
+		}
+		__u64 waitNs = 0;
+		if (deadlineNs > 0) {
+			const __u64 now = monotonicNs();
+			if (now >= deadlineNs) {
+				errno = EAGAIN;
+				received = -1;
+				break;
+			}
+			waitNs = deadlineNs - now;
+		}
+		if (ringEnter(e, &e->rx, 1, waitNs) == -1 && errno != EINTR && errno != ETIME) {
+			received = -1;
+			break;
+		}
+	}
+	const int err = errno;
+	pthread_mutex_unlock(&e->rxLock);
+	if (received > 0) {
+		count(e, URING_STAT_RX_FRAMES, received);
+	}
+	errno = err;
+	return received;
+}
+
+/*
+ * Sends count frames with one io_uring_enter per batch of up to txDepth
+ * frames, resuming with bulkSend() after a failed send. Returns the number of
+ * frames accepted by the kernel, or -1 with errno set if not a single frame
+ * could be sent.
+ */
+int uringSend(UringEngine *e, const struct can_frame *frames, int count) {
+	pthread_mutex_lock(&e->txLock);
+	int sent = 0;
+	int failed = 0;
+	while (sent < count && !failed) {
+		const int batch = std::min(count - sent, (int) e->tx.sqEntries);
+		for (int i = 0; i < batch; i++) {
+			struct io_uring_sqe *sqe = ringGetSqe(&e->tx);
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = e->fd;
+			sqe->addr = (__u64) (uintptr_t) &frames[sent + i];
+			sqe->len = sizeof(struct can_frame);
+			sqe->user_data = (__u64) i;
+			//linked sends go out in order, a failure cancels the rest
+			if (i < batch - 1) {
+				sqe->flags = IOSQE_IO_LINK;
+			}
+		}
+		int completed = 0;
+		int accepted = batch;
+		while (completed < batch) {
+			struct io_uring_cqe *cqe = ringPeek(&e->tx);
+			if (cqe == NULL) {
+				if (ringEnter(e, &e->tx, batch - completed, 0) == -1 && errno != EINTR) {
+					//take back what the kernel did not consume, those frames were not sent
+					const int err = errno;
+					const unsigned head = __atomic_load_n(e->tx.sqHead, __ATOMIC_ACQUIRE);
+					__atomic_store_n(e->tx.sqTail, head, __ATOMIC_RELEASE);
+					e->tx.sqLocalTail = head;
+					pthread_mutex_unlock(&e->txLock);
+					errno = err;
+					return sent > 0 ? sent : -1;
+				}
+				continue;
+			}
+			if (cqe->res != (int) sizeof(struct can_frame)) {
+				accepted = std::min(accepted, (int) cqe->user_data);
+				failed = 1;
+			}
+			ringAdvance(&e->tx);
+			completed++;
+		}
+		sent += accepted;
+	}
+	pthread_mutex_unlock(&e->txLock);
+	count(e, URING_STAT_TX_FRAMES, sent);
+	if (sent < count) {
+		const int rest = bulkSend(e->fd, frames + sent, count - sent);
+		if (rest == -1) {
+			return sent > 0 ? sent : -1;
+		}
+		sent += rest;
+	}
+	return sent;
+}
+
+void uringGetStats(const UringEngine *e, jlong *stats) {
+	for (int i = 0; i < URING_STATS_COUNT; i++) {
+		stats[i] = __atomic_load_n(&e->stats[i], __ATOMIC_RELAXED);
+	}
+}
+
+#else
+
+/* built without io_uring headers: every socket stays on the recvmmsg/sendmmsg path */
+struct _UringEngine {
+	int fd;
+};
+
+int uringUnsupported(int err) {
+	return err == ENOSYS;
+}
+
+UringEngine *uringCreate(int fd, int rxBuffers, int txDepth) {
+	errno = ENOSYS;
+	return NULL;
+}
+
+void uringWake(UringEngine *e) {
+}
+
+void uringRetain(UringEngine *e) {
+}
+
+void uringRelease(UringEngine *e) {
+}
+
+void uringDestroy(UringEngine *e) {
+}
+
+void uringSetRecvTimeout(UringEngine *e, __u64 timeoutNs) {
+}
+
+int uringRecv(UringEngine *e, struct can_frame *frames, int *ifIndexes, __u64 *timestampsNs, int count) {
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int uringSend(UringEngine *e, const struct can_frame *frames, int count) {
+	return bulkSend(e->fd, frames, count);
+}
+
+void uringGetStats(const UringEngine *e, jlong *stats) {
+	memset(stats, 0, URING_STATS_COUNT * sizeof(jlong));
+}
+
+#endif
@@ -34,16 +34,6 @@ static const int ERRNO_BUFFER_LEN = 1024;
 typedef unsigned char BYTE;
 
 
-void logthis(std::string msg) {
-	openlog("libsocket-can-java native library ", LOG_CONS, LOG_USER);
-	std::stringstream strs;
-	strs << msg;
-	std::string temp_str = strs.str();
-	char* char_type = (char*) temp_str.c_str();
-	syslog(LOG_INFO, char_type);
-
-}
-
 void throwException(JNIEnv *env, const std::string& exception_name,
 		const std::string& msg) {
 	const jclass exception = env->FindClass(exception_name.c_str());
@@ -78,6 +68,10 @@ void throwIOExceptionErrno(JNIEnv *env, const int exc_errno) {
 	}
 }
 
+void throwSocketTimeoutException(JNIEnv *env, const std::string& message) {
+	throwException(env, "java/net/SocketTimeoutException", message);
+}
+
 void throwIllegalArgumentException(JNIEnv *env,
 		const std::string& message) {
 	throwException(env, "java/lang/IllegalArgumentException", message);
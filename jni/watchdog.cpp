@@ -0,0 +1,251 @@
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+
+#include <stdlib.h>
+}
+
+#include "cansocket.hpp"
+
+#define WATCHDOG_EMPTY_KEY				   0xFFFFFFFFU
+#define WATCHDOG_TICK_NS				  10000000ULL
+#define WATCHDOG_WHEEL_SLOTS				   512
+
+/*
+ * Receive timeout watchdog.
+ *
+ * Every registered CAN ID has a timeout, each frame received with the ID
+ * moves its deadline to now + timeout. That is all the receiving thread does
+ * per frame: a hash lookup and a store. The deadlines are kept in a hashed
+ * timer wheel of WATCHDOG_WHEEL_SLOTS slots of WATCHDOG_TICK_NS each. An entry
+ * stays in the slot of the deadline it was inserted with; when the slot comes
+ * due the entry either has timed out or is put into the slot of its current
+ * deadline. Timeouts are thus detected at most one tick late and refreshing a
+ * deadline never touches the wheel.
+ *
+ * An ID times out once, the next frame with it reports the recovery and arms
+ * it again. IDs never received time out after their timeout as well.
+ *
+ * Events are passed as struct can_frame to the owner (the multiplexer queues
+ * them): can_id is the registered ID, can_dlc the event (WATCHDOG_TIMEOUT or
+ * WATCHDOG_RECOVERED) and data the CLOCK_MONOTONIC time of the event in ns,
+ * least significant byte first. Only the multiplexer thread uses a watchdog.
+ */
+typedef struct _WatchdogEntry {
+	__u32 key;
+	int armed;
+	int timedOut;
+	int next;
+	__u64 timeoutNs;
+	__u64 deadlineNs;
+} WatchdogEntry;
+
+struct _Watchdog {
+	int count;
+	__u32 mask;
+	__u32 *keys;
+	int *indices;
+	WatchdogEntry *entries;
+	int wheel[WATCHDOG_WHEEL_SLOTS];
+	int armed;
+	__u64 tick;
+};
+
+static __u32 watchdogKey(canid_t canid) {
+	return (canid & CAN_EFF_FLAG) ? canid & (CAN_EFF_FLAG | CAN_EFF_MASK) : canid & CAN_SFF_MASK;
+}
+
+static __u32 watchdogHash(__u32 key) {
+	return key * 0x9E3779B1U;
+}
+
+/* first tick at or after the deadline, always later than the tick processed last */
+static void watchdogArm(Watchdog *wd, int index) {
+	WatchdogEntry *e = &wd->entries[index];
+	const __u64 tick = (e->deadlineNs + WATCHDOG_TICK_NS - 1) / WATCHDOG_TICK_NS;
+	const int slot = (int) (tick % WATCHDOG_WHEEL_SLOTS);
+	e->next = wd->wheel[slot];
+	wd->wheel[slot] = index;
+	if (!e->armed) {
+		e->armed = 1;
+		wd->armed++;
+	}
+}
+
+static void watchdogEvent(const WatchdogEntry *e, int event, __u64 nowNs,
+		void (*emit)(void *arg, const struct can_frame *frame), void *arg) {
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = e->key;
+	frame.can_dlc = (__u8) event;
+	for (int i = 0; i < CAN_MAX_DLEN; i++) {
+		frame.data[i] = (__u8) (nowNs >> (8 * i));
+	}
+	emit(arg, &frame);
+}
+
+void watchdogDestroy(Watchdog *wd) {
+	if (wd == NULL) {
+		return;
+	}
+	free(wd->keys);
+	free(wd->indices);
+	free(wd->entries);
+	free(wd);
+}
+
+/*
+ * Creates a watchdog for count IDs (CAN_EFF_FLAG set for extended IDs) with
+ * timeouts in ms, starting now. Returns NULL with errno set on failure,
+ * EINVAL for an empty list, a standard ID out of range, an ID given twice or a
+ * timeout below 1 ms.
+ */
+Watchdog *watchdogCreate(const jint *ids, const jint *timeoutsMs, int count, __u64 nowNs) {
+	if (count < 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+	__u32 size = 1;
+	while (size < (__u32) count * 2) {
+		size <<= 1;
+	}
+	Watchdog *wd = (Watchdog*) calloc(1, sizeof(Watchdog));
+	if (wd == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	wd->count = count;
+	wd->mask = size - 1;
+	wd->keys = (__u32*) malloc(sizeof(__u32) * size);
+	wd->indices = (int*) malloc(sizeof(int) * size);
+	wd->entries = (WatchdogEntry*) calloc(count, sizeof(WatchdogEntry));
+	if (wd->keys == NULL || wd->indices == NULL || wd->entries == NULL) {
+		watchdogDestroy(wd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(wd->keys, 0xFF, sizeof(__u32) * size);
+	for (int i = 0; i < WATCHDOG_WHEEL_SLOTS; i++) {
+		wd->wheel[i] = -1;
+	}
+	wd->tick = nowNs / WATCHDOG_TICK_NS;
+	for (int i = 0; i < count; i++) {
+		const canid_t id = (canid_t) ids[i];
+		if ((!(id & CAN_EFF_FLAG) && (id & ~CAN_SFF_MASK) != 0) || timeoutsMs[i] < 1) {
+			watchdogDestroy(wd);
+			errno = EINVAL;
+			return NULL;
+		}
+		const __u32 key = watchdogKey(id);
+		__u32 pos = watchdogHash(key) & wd->mask;
+		while (wd->keys[pos] != WATCHDOG_EMPTY_KEY) {
+			if (wd->keys[pos] == key) {
+				watchdogDestroy(wd);
+				errno = EINVAL;
+				return NULL;
+			}
+			pos = (pos + 1) & wd->mask;
+		}
+		wd->keys[pos] = key;
+		wd->indices[pos] = i;
+		WatchdogEntry *e = &wd->entries[i];
+		e->key = key;
+		e->timeoutNs = (__u64) timeoutsMs[i] * 1000000ULL;
+		e->deadlineNs = nowNs + e->timeoutNs;
+		watchdogArm(wd, i);
+	}
+	return wd;
+}
+
+/* one exact kernel filter per ID, filters must have room for all of them */
+int watchdogFilters(const Watchdog *wd, struct can_filter *filters) {
+	for (int i = 0; i < wd->count; i++) {
+		const __u32 key = wd->entries[i].key;
+		filters[i].can_id = key;
+		filters[i].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | ((key & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+	}
+	return wd->count;
+}
+
+int watchdogCount(const Watchdog *wd) {
+	return wd->count;
+}
+
+/*
+ * Refreshes the deadline of the frame's ID, reporting a recovery if it had
+ * timed out. *nextNs is lowered to the deadline of an ID armed again.
+ */
+void watchdogRefresh(Watchdog *wd, const struct can_frame *frame, __u64 nowNs, __u64 *nextNs,
+		void (*emit)(void *arg, const struct can_frame *frame), void *arg) {
+	if (frame->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) {
+		return;
+	}
+	const __u32 key = watchdogKey(frame->can_id);
+	__u32 pos = watchdogHash(key) & wd->mask;
+	while (wd->keys[pos] != key) {
+		if (wd->keys[pos] == WATCHDOG_EMPTY_KEY) {
+			return;
+		}
+		pos = (pos + 1) & wd->mask;
+	}
+	const int index = wd->indices[pos];
+	WatchdogEntry *e = &wd->entries[index];
+	e->deadlineNs = nowNs + e->timeoutNs;
+	if (e->timedOut) {
+		e->timedOut = 0;
+		watchdogEvent(e, WATCHDOG_RECOVERED, nowNs, emit, arg);
+	}
+	if (!e->armed) {
+		watchdogArm(wd, index);
+		if (e->deadlineNs < *nextNs) {
+			*nextNs = e->deadlineNs;
+		}
+	}
+}
+
+/*
+ * Processes the ticks up to nowNs, reporting the IDs timed out, and returns
+ * the time the next slot with entries comes due, WATCHDOG_NO_DEADLINE if no
+ * ID is armed.
+ */
+__u64 watchdogAdvance(Watchdog *wd, __u64 nowNs, void (*emit)(void *arg, const struct can_frame *frame),
+		void *arg) {
+	const __u64 nowTick = nowNs / WATCHDOG_TICK_NS;
+	//a full lap visits every slot, entries of later laps are put back
+	const __u64 first = nowTick - wd->tick > WATCHDOG_WHEEL_SLOTS ? nowTick - WATCHDOG_WHEEL_SLOTS : wd->tick;
+	for (__u64 tick = first + 1; tick <= nowTick; tick++) {
+		const int slot = (int) (tick % WATCHDOG_WHEEL_SLOTS);
+		int index = wd->wheel[slot];
+		wd->wheel[slot] = -1;
+		wd->tick = tick;
+		while (index != -1) {
+			WatchdogEntry *e = &wd->entries[index];
+			const int next = e->next;
+			if (e->deadlineNs <= nowNs) {
+				e->armed = 0;
+				wd->armed--;
+				e->timedOut = 1;
+				watchdogEvent(e, WATCHDOG_TIMEOUT, nowNs, emit, arg);
+			} else {
+				watchdogArm(wd, index);
+			}
+			index = next;
+		}
+	}
+	wd->tick = nowTick;
+	if (wd->armed == 0) {
+		return WATCHDOG_NO_DEADLINE;
+	}
+	for (__u64 tick = nowTick + 1; tick <= nowTick + WATCHDOG_WHEEL_SLOTS; tick++) {
+		if (wd->wheel[tick % WATCHDOG_WHEEL_SLOTS] != -1) {
+			return tick * WATCHDOG_TICK_NS;
+		}
+	}
+	return WATCHDOG_NO_DEADLINE;
+}
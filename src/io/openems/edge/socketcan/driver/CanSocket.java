@@ -7,18 +7,30 @@ import java.io.FileNotFoundException;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.VarHandle;
+import java.lang.ref.Cleaner;
+import java.net.SocketTimeoutException;
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.nio.file.Files;
 import java.nio.file.Path;
 import java.nio.file.StandardOpenOption;
 import java.nio.file.attribute.FileAttribute;
 import java.nio.file.attribute.PosixFilePermission;
 import java.nio.file.attribute.PosixFilePermissions;
+import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.Collections;
 import java.util.EnumSet;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
 import java.util.Objects;
 import java.util.Set;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.Executor;
+import java.util.concurrent.atomic.AtomicBoolean;
 
 public final class CanSocket implements Closeable {
 	static {
@@ -83,6 +95,51 @@ public final class CanSocket implements Closeable {
 	public static final CanInterface CAN_ALL_INTERFACES = new CanInterface(0);
 
 	private static native void initCanLibrary();
+
+	private static native void _setLogLevel(final int level);
+
+	private static native void _setLogForwarding(final boolean on);
+
+	/**
+	 * Receives the messages of the native library, e.g. to route them into the application's logging.
+	 * Called from a single native background thread, never from the thread that produced the message.
+	 */
+	public interface NativeLogListener {
+		/** the levels are those of syslog */
+		public static final int ERROR = 3;
+		public static final int WARN = 4;
+		public static final int INFO = 6;
+		public static final int DEBUG = 7;
+
+		void log(int level, String message);
+	}
+
+	private static volatile NativeLogListener nativeLogListener;
+
+	/**
+	 * @brief routes the native log messages to the listener instead of syslog
+	 * @param listener the listener, null to write to syslog again
+	 */
+	public static void setNativeLogListener(NativeLogListener listener) {
+		nativeLogListener = listener;
+		_setLogForwarding(listener != null);
+	}
+
+	/**
+	 * @brief sets the most verbose level logged by the native library, see {@link NativeLogListener}.
+	 *        Messages above it are discarded before they are even formatted.
+	 */
+	public static void setNativeLogLevel(int level) {
+		_setLogLevel(level);
+	}
+
+	/* called by the native log flusher */
+	private static void nativeLog(int level, String message) {
+		final NativeLogListener listener = nativeLogListener;
+		if (listener != null) {
+			listener.log(level, message);
+		}
+	}
 	
 	private static native int _getCANID_SFF(final int canid);
 
@@ -128,9 +185,130 @@ public final class CanSocket implements Closeable {
 
 	private static native CanFrame _recvFrame(final int fd) throws IOException;
 
+	private static native int _recvFrames(final int fd, final ByteBuffer buffer, final int offset,
+			final int maxCount) throws IOException;
+
+	private static native void _setIdFilter(final int fd, final int[] ids, final boolean prefilter)
+			throws IOException;
+
+	private static native void _clearIdFilter(final int fd) throws IOException;
+
+	private static native long[] _rxStats(final int fd) throws IOException;
+
+	private static native void _inventoryEnable(final int fd, final boolean enabled) throws IOException;
+
+	private static native long[] _inventorySnapshot(final int fd) throws IOException;
+
+	private static native void _dispatcherStart(final int fd, final FrameListener listener, final ByteBuffer buffer,
+			final int maxBatch, final int maxDelayUs) throws IOException;
+
+	private static native void _dispatcherStop(final int fd);
+
+	private static native long[] _dispatcherStats(final int fd) throws IOException;
+
+	private static native boolean _uringEnable(final int fd, final int rxBuffers, final int txDepth)
+			throws IOException;
+
+	private static native void _uringDisable(final int fd);
+
+	private static native long[] _uringStats(final int fd) throws IOException;
+
 	private static native void _sendFrame(final int fd, final int canif, final int canid, final byte[] data)
 			throws IOException;
 
+	private static native void _sendFrameBound(final int fd, final int canid, final long payload, final int len)
+			throws IOException;
+
+	private static native void _sendFrameBuffer(final int fd, final ByteBuffer buffer, final int offset)
+			throws IOException;
+
+	private static native int _sendFrames(final int fd, final ByteBuffer buffer, final int offset, final int count)
+			throws IOException;
+
+	private static native ByteBuffer _txRingCreate(final int fd, final int capacity) throws IOException;
+
+	private static native void _txRingWake(final int fd);
+
+	private static native void _txRingDestroy(final int fd);
+
+	private static native long[] _txRingStats(final int fd);
+
+	private static native long _directBufferAddress(final ByteBuffer buffer);
+
+	private static native void _sharedMemoryRelease(final long address);
+
+	private static native long[] _linkInfo(final int ifIndex) throws IOException;
+
+	private static native ByteBuffer _errorMonitorOpen(final int ifIndex) throws IOException;
+
+	private static native void _errorMonitorClose(final long address);
+
+	private static native int _errorMonitorAwait(final int ifIndex, final int seenChanges, final int timeoutMs)
+			throws IOException;
+
+	private static native void _busSupervisorStart(final int ifIndex, final int initialBackoffMs,
+			final int maxBackoffMs, final int stableMs, final int resumeStaggerMs) throws IOException;
+
+	private static native void _busSupervisorStop(final int ifIndex);
+
+	private static native long[] _busSupervisorStats(final int ifIndex) throws IOException;
+
+	private static native long _busSupervisorAwait(final int ifIndex, final long seenEvents, final int timeoutMs)
+			throws IOException;
+
+	private static native void _busLoadStart(final int ifIndex, final int stuffing, final int bitrate,
+			final int dataBitrate) throws IOException;
+
+	private static native void _busLoadStop(final int ifIndex);
+
+	private static native long[] _busLoadStats(final int ifIndex, final int windowMs) throws IOException;
+
+	private static native int _frameBits(final int canId, final byte[] data, final int stuffing);
+
+	private static native int _muxSubscribe(final int ifIndex, final int[] table, final int capacity)
+			throws IOException;
+
+	private static native int _muxSubscribeOnChange(final int ifIndex, final int[] table, final int capacity,
+			final int keepaliveMs, final long defaultIgnore, final int[] ids, final long[] ignoreMasks)
+			throws IOException;
+
+	private static native int _muxSubscribeDecimated(final int ifIndex, final int[] table, final int capacity,
+			final int[] rules) throws IOException;
+
+	private static native int _muxSubscribeWatchdog(final int ifIndex, final int[] ids, final int[] timeoutsMs,
+			final int capacity) throws IOException;
+
+	private static native int[] _muxSubscribeSharded(final int ifIndex, final int[] table, final int capacity,
+			final int shards, final int[] rules) throws IOException;
+
+	private static native void _muxUnsubscribe(final int handle);
+
+	private static native CanFrame _muxRecv(final int handle, final int ifIndex, final int timeoutMs)
+			throws IOException;
+
+	private static native int _muxRecvFrames(final int handle, final ByteBuffer buffer, final int offset,
+			final int maxCount, final long[] changes, final int timeoutMs) throws IOException;
+
+	private static native long[] _muxStats(final int handle) throws IOException;
+
+	private static native int _mailboxOpen(final int ifIndex, final int[] ids) throws IOException;
+
+	private static native ByteBuffer _mailboxBuffer(final int handle) throws IOException;
+
+	private static native void _shmBusPublish(final int ifIndex, final String name, final int capacity)
+			throws IOException;
+
+	private static native void _shmBusUnpublish(final String name);
+
+	private static native int _shmBusOpen(final String name) throws IOException;
+
+	private static native void _shmBusClose(final int handle);
+
+	private static native int _shmBusRead(final int handle, final ByteBuffer buffer, final int offset,
+			final int maxCount, final long[] timestamps, final int timeoutMs) throws IOException;
+
+	private static native long[] _shmBusStats(final int handle) throws IOException;
+
 	private static native void _sendCyclicallyAdd(final int fd, final int canif, final int canid, final byte[] data, final int cycleTime)
 			throws IOException;
 
@@ -157,6 +335,21 @@ public final class CanSocket implements Closeable {
 	private static native int _statsGetCanFrameFramesSendPerCycle(final int fd)
 			throws IOException;
 
+	private static native void _txQueueEnable(final int fd, final int capacity, final int policy, final int order,
+			final int maxInFlight) throws IOException;
+
+	private static native void _txQueueDisable(final int fd) throws IOException;
+
+	private static native long[] _txQueueStats(final int fd) throws IOException;
+
+	private static native long _sendFrameAt(final int fd, final int canif, final int canid, final byte[] data,
+			final long launchNanos) throws IOException;
+
+	private static native int _sendFrameAtMode(final int fd);
+
+	private static native long _sendFrameConfirmed(final int fd, final int canif, final int canid, final byte[] data,
+			final int timeoutMs) throws IOException;
+
 
 	public static final int CAN_MTU = _fetch_CAN_MTU();
 	public static final int CAN_FD_MTU = _fetch_CAN_FD_MTU();
@@ -171,9 +364,18 @@ public final class CanSocket implements Closeable {
 
 	private static native int _fetch_CAN_RAW_FD_FRAMES();
 
-	private static native int _setFilters(final int fd, String data);
+	private static native int _fetch_CAN_RAW_JOIN_FILTERS();
+
+	private static native void _setFilterTable(final int fd, final int[] table) throws IOException;
+
+	private static native void _setFilterBuffer(final int fd, final ByteBuffer buffer, final int offset,
+			final int count) throws IOException;
+
+	private static native int[] _getFilterTable(final int fd) throws IOException;
 
-	private static native byte[] _getFilters(final int fd);
+	private static native void _attachBpfFilter(final int fd, final int[] rules) throws IOException;
+
+	private static native void _detachBpfFilter(final int fd) throws IOException;
 
 
 
@@ -192,31 +394,97 @@ public final class CanSocket implements Closeable {
 	 * @param data contains an array of CanFilter objects. The method will loop
 	 *             through all of them and set the appropriate filter on the CanBus
 	 *             socket.
+	 * @note for compatibility every filter is forced to match extended frames (CAN_EFF_FLAG
+	 *       and CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK or-ed into id and mask), use
+	 *       {@link #setFilterTable(int[])} to set filters as they are
+	 * @note an empty array receives everything as it did before, unlike an empty
+	 *       {@link #setFilterTable(int[])}
 	 */
 	public void setFilters(CanFilter[] data)
-	// public void setFilters(Object[] data)
-
 	{
-		String filterString = ""; // set the default to accept everything
-		// method as a comma-separated String of filter definitions (canid:canmask)
-		// The native method expects a filter definition in the following form (HEX!):
-		// "0x12345678:0xDFFFFFFF"
-		// First, let's reset the filters:
-		int numfilter = 0;
-		int filtercounter = data.length - 1;
-		if (CanSocket._setFilters(_fd, "0x00000000:0x00000000") == -1)
-			System.out.println("Unable to reset filter");
-		for (CanFilter f : data) {
-			filterString += f.getIdHex() + ":" + f.getMaskHex();
-			if (numfilter < filtercounter)
-				filterString += ",";
-			numfilter++;
-
-			System.out.println("filterData is: " + filterString);
+		if (data.length == 0) {
+			try {
+				setFilterTable(new int[] { 0, 0 });
+			} catch (IOException e) {
+				System.out.println("Filter errors: " + e.getMessage());
+			}
+			return;
+		}
+		final int[] table = new int[data.length * 2];
+		for (int i = 0; i < data.length; i++) {
+			table[2 * i] = data[i].getId() | LEGACY_FILTER_ID_FLAGS;
+			table[2 * i + 1] = (int) data[i].getMask() | LEGACY_FILTER_MASK_FLAGS;
+		}
+		try {
+			setFilterTable(table);
+		} catch (IOException e) {
+			System.out.println("Filter errors: " + e.getMessage());
 		}
+	}
+
+	/**
+	 * Sets the kernel receive filters (CAN_RAW_FILTER) exactly as given, without any parsing or logging.
+	 * A frame is received if (received_can_id & mask) == (can_id & mask) for any filter, or for all of them
+	 * with {@link #setJoinFilters(boolean)}. CAN_INV_FILTER in can_id inverts a filter.
+	 * 
+	 * @param idMaskPairs can_id and can_mask of each filter, e.g. built by {@link CanFilter#toTable}. An
+	 *                    empty table disables reception, {0, 0} receives everything.
+	 * @throws IOException
+	 */
+	public void setFilterTable(int[] idMaskPairs) throws IOException {
+		_setFilterTable(_fd, idMaskPairs);
+	}
+
+	/**
+	 * Sets the kernel receive filters from a direct buffer holding count pairs of can_id and can_mask as
+	 * ints in native byte order, starting at the buffer's position.
+	 * 
+	 * @throws IOException
+	 */
+	public void setFilterTable(ByteBuffer idMaskPairs, int count) throws IOException {
+		_setFilterBuffer(_fd, idMaskPairs, idMaskPairs.position(), count);
+	}
+
+	/**
+	 * @return can_id and can_mask of all kernel receive filters currently set, without any limit on their
+	 *         number
+	 * @throws IOException
+	 */
+	public int[] getFilterTable() throws IOException {
+		return _getFilterTable(_fd);
+	}
+
+	/**
+	 * @param on if true a frame has to match all filters instead of any (CAN_RAW_JOIN_FILTERS)
+	 * @throws IOException
+	 */
+	public void setJoinFilters(final boolean on) throws IOException {
+		_setsockopt(_fd, CAN_RAW_JOIN_FILTERS, on ? 1 : 0);
+	}
+
+	public boolean getJoinFilters() throws IOException {
+		return _getsockopt(_fd, CAN_RAW_JOIN_FILTERS) == 1;
+	}
+
+	/**
+	 * Compiles the filters into a BPF program and attaches it to the socket (SO_ATTACH_FILTER). A frame is
+	 * received if any of the filters matches, all others are dropped by the kernel before they are copied
+	 * to user space. The program applies in addition to the filters set with {@link #setFilterTable(int[])}.
+	 * 
+	 * @param filters ID filters with optional payload predicates, no filter at all drops every frame
+	 * @throws IOException
+	 */
+	public void attachFilter(PayloadFilter... filters) throws IOException {
+		_attachBpfFilter(_fd, PayloadFilter.toRules(filters));
+	}
 
-		if (CanSocket._setFilters(_fd, filterString) == -1)
-			System.out.println("Filter errors");
+	/**
+	 * Removes the BPF program attached with {@link #attachFilter(PayloadFilter...)}.
+	 * 
+	 * @throws IOException
+	 */
+	public void detachFilter() throws IOException {
+		_detachBpfFilter(_fd);
 	}
 
 	static int bitExtract(int number, int k, int p) {
@@ -233,38 +501,18 @@ public final class CanSocket implements Closeable {
 	}
 
 	public void getFilters() {
-		int FILTER_SIZE = 8;
-		int numFilter = 0;
-		byte[] filterData = CanSocket._getFilters(_fd);
-
-		if (filterData != null)
-			numFilter = filterData.length / FILTER_SIZE;
-
+		int[] table;
+		try {
+			table = getFilterTable();
+		} catch (IOException e) {
+			System.out.println("Unable to get filters: " + e.getMessage());
+			return;
+		}
+		final int numFilter = table.length / 2;
 		System.out.println("I have found " + numFilter + " filter(s).");
-		System.out.println("Full filter in HEX: " + CanSocket.bytesToHex(filterData));
-
 		for (int i = 0; i < numFilter; i++) {
-			int startingPos = i * 8;
-			int endPos = i * 8 + 4;
-			System.out.println("Looping " + i + 1 + " out of " + numFilter + ", startingPos, endPos=" + startingPos
-					+ ", " + endPos);
-			byte[] canid = reverseBytes(Arrays.copyOfRange(filterData, startingPos, startingPos + 4));
-			byte[] mask = reverseBytes(Arrays.copyOfRange(filterData, endPos, endPos + 4));
-			ByteBuffer bb = ByteBuffer.wrap(canid);
-			int cannumber = bb.getInt();
-			// int CAN_EFF_MASK = 0b11111111111111111111111111111; //29 bits
-			// int can2 = cannumber & CAN_EFF_MASK;
-			ByteBuffer bbm = ByteBuffer.wrap(mask);
-			int intMask = bbm.getInt();
-			intMask = ~intMask;
-			long unsignedMask = intMask;
-			unsignedMask = unsignedMask & 0xffffffff;
-			cannumber = CanSocket.bitExtract(cannumber, 29, 1);
-			System.out.println("The 29 bits are: " + cannumber);
-			System.out.println("The mask is: " + unsignedMask);
-
+			System.out.println(String.format("Filter %d: id=0x%08X mask=0x%08X", i, table[2 * i], table[2 * i + 1]));
 		}
-
 	}
 
 	private static final int CAN_RAW_FILTER = _fetch_CAN_RAW_FILTER();
@@ -280,6 +528,13 @@ public final class CanSocket implements Closeable {
 	private static final int CAN_RAW_LOOPBACK = _fetch_CAN_RAW_LOOPBACK();
 	private static final int CAN_RAW_RECV_OWN_MSGS = _fetch_CAN_RAW_RECV_OWN_MSGS();
 	private static final int CAN_RAW_FD_FRAMES = _fetch_CAN_RAW_FD_FRAMES();
+	private static final int CAN_RAW_JOIN_FILTERS = _fetch_CAN_RAW_JOIN_FILTERS();
+
+	private static final int LEGACY_FILTER_ID_FLAGS = 0x80000000; // CAN_EFF_FLAG
+	private static final int LEGACY_FILTER_MASK_FLAGS = 0xC00007FF; // CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK
+
+	/* releases native memory wrapped by direct buffers once they are unreachable, see jni/shared_memory.cpp */
+	private static final Cleaner SHARED_MEMORY_CLEANER = Cleaner.create();
 
 	private static native void _setsockopt(final int fd, final int op, final int stat) throws IOException;
 
@@ -469,6 +724,75 @@ public final class CanSocket implements Closeable {
 		}
 	}
 
+	/**
+	 * A {@link CanFilter} extended by predicates on single payload bytes, for use with
+	 * {@link CanSocket#attachFilter(PayloadFilter...)}. A frame matches if its ID matches the CAN filter and
+	 * (data[index] & mask) == value holds for every predicate. Frames too short for a predicate do not match.
+	 */
+	public static final class PayloadFilter {
+
+		/**
+		 * Maximum number of payload predicates per filter.
+		 */
+		public static final int MAX_PREDICATES = 8;
+
+		private final CanFilter filter;
+		private final int[] predicates = new int[MAX_PREDICATES * 3];
+		private int count = 0;
+
+		/**
+		 * @param filter the filter for the CAN ID, CanFilter.INVERTED_BIT in the ID inverts it
+		 */
+		public PayloadFilter(CanFilter filter) {
+			this.filter = filter;
+		}
+
+		/**
+		 * Requires the payload byte at index to equal value.
+		 */
+		public PayloadFilter matchByte(int index, int value) {
+			return matchByte(index, value, 0xFF);
+		}
+
+		/**
+		 * Requires (data[index] & mask) == (value & mask).
+		 *
+		 * @param index index of the payload byte, 0 to 63
+		 * @param value the expected value
+		 * @param mask  the bits of the byte to compare
+		 */
+		public PayloadFilter matchByte(int index, int value, int mask) {
+			if (count == MAX_PREDICATES) {
+				throw new IllegalArgumentException("more than " + MAX_PREDICATES + " payload predicates");
+			}
+			if (index < 0 || index > 63) {
+				throw new IllegalArgumentException("payload index " + index + " out of range");
+			}
+			predicates[3 * count] = index;
+			predicates[3 * count + 1] = value & 0xFF;
+			predicates[3 * count + 2] = mask & 0xFF;
+			count++;
+			return this;
+		}
+
+		static int[] toRules(PayloadFilter... filters) {
+			int len = 0;
+			for (PayloadFilter f : filters) {
+				len += 3 + 3 * f.count;
+			}
+			final int[] rules = new int[len];
+			int i = 0;
+			for (PayloadFilter f : filters) {
+				rules[i++] = f.filter.id._canId;
+				rules[i++] = f.filter.mask;
+				rules[i++] = f.count;
+				System.arraycopy(f.predicates, 0, rules, i, 3 * f.count);
+				i += 3 * f.count;
+			}
+			return rules;
+		}
+	}
+
 	/**
 	 * @author awaal This class prepares a read filter for the canbus. It takes a
 	 *         CanId to represent the can-id, and a filter mask (4 bytes) to
@@ -565,6 +889,22 @@ public final class CanSocket implements Closeable {
 			return mask;
 		}
 
+		/**
+		 * Builds a table for {@link CanSocket#setFilterTable(int[])}. The CAN IDs are taken as they are,
+		 * including the EFF, RTR and inversion flags.
+		 *
+		 * @param filters the filters
+		 * @return can_id and can_mask of each filter
+		 */
+		public static int[] toTable(CanFilter... filters) {
+			final int[] table = new int[filters.length * 2];
+			for (int i = 0; i < filters.length; i++) {
+				table[2 * i] = filters[i].id._canId;
+				table[2 * i + 1] = filters[i].mask;
+			}
+			return table;
+		}
+
 		/**
 		 * Checks if this filter is inverted.
 		 *
@@ -696,22 +1036,35 @@ public final class CanSocket implements Closeable {
 		private final CanInterface canIf;
 		private final CanId canId;
 		private final byte[] data;
+		private final long changedBits;
 
 		public CanFrame(final CanInterface canIf, final CanId canId, byte[] data) {
+			this(canIf, canId, data, 0);
+		}
+
+		private CanFrame(final CanInterface canIf, final CanId canId, byte[] data, long changedBits) {
 			this.canIf = canIf;
 			this.canId = canId;
 			this.data = data;
+			this.changedBits = changedBits;
 		}
 
 		/* this constructor is used in native code */
 		@SuppressWarnings("unused")
 		private CanFrame(int canIf, int canid, byte[] data) {
+			this(canIf, canid, data, 0);
+		}
+
+		/* this constructor is used in native code */
+		private CanFrame(int canIf, int canid, byte[] data, long changedBits) {
+			this(new CanInterface(canIf), new CanId(canid), _checkLength(data), changedBits);
+		}
+
+		private static byte[] _checkLength(byte[] data) {
 			if (data.length > 8) {
 				throw new IllegalArgumentException();
 			}
-			this.canIf = new CanInterface(canIf);
-			this.canId = new CanId(canid);
-			this.data = data;
+			return data;
 		}
 
 		public CanId getCanId() {
@@ -726,6 +1079,16 @@ public final class CanSocket implements Closeable {
 			return canIf;
 		}
 
+		/**
+		 * The payload bits that differ from the previous frame with this id, for frames received on an
+		 * on-change subscription (see {@link CanSocket#subscribeOnChange(CanInterface, int, int, long,
+		 * Map, CanFilter...)}), 0 otherwise. Bit {@code 8 * i + j} is bit {@code j} of data byte {@code i}.
+		 * 0 on a frame delivered only as keepalive.
+		 */
+		public long getChangedBits() {
+			return changedBits;
+		}
+
 		@Override
 		public String toString() {
 			return "CanFrame [canIf=" + canIf + ", canId=" + canId + ", data=" + Arrays.toString(data) + "]";
@@ -733,67 +1096,2153 @@ public final class CanSocket implements Closeable {
 
 		@Override
 		protected Object clone() {
-			return new CanFrame(canIf, (CanId) canId.clone(), Arrays.copyOf(data, data.length));
+			return new CanFrame(canIf, (CanId) canId.clone(), Arrays.copyOf(data, data.length), changedBits);
 		}
 	}
 
-	public static enum Mode {
-		RAW, BCM
-	}
+	/**
+	 * Helpers for frames stored in a direct {@link ByteBuffer} in the layout of the kernel's
+	 * {@code struct can_frame}: CAN ID as int in native byte order at offset 0, length at offset 4 and
+	 * 8 data bytes at offset 8, {@link #FRAME_SIZE} bytes per frame.
+	 * 
+	 * As a {@code long} payload data byte 0 is the least significant byte.
+	 */
+	public final static class CanFrameBuffer {
+		public static final int FRAME_SIZE = 16;
+		public static final int OFFSET_CAN_ID = 0;
+		public static final int OFFSET_LENGTH = 4;
+		public static final int OFFSET_DATA = 8;
 
-	private int _fd;
-	private final Mode _mode;
-	private CanInterface _boundTo;
+		private static final boolean BIG_ENDIAN = ByteOrder.nativeOrder() == ByteOrder.BIG_ENDIAN;
 
-	public CanSocket(Mode mode) { // throws IOException {
-		switch (mode) {
-		case BCM:
-			try {
-				_fd = _openSocketBCM();
-			} catch (IOException e) {
-				// TODO Auto-generated catch block
-				e.printStackTrace();
+		private CanFrameBuffer() {
+		}
+
+		/**
+		 * @return a direct buffer in native byte order with room for the given number of frames
+		 */
+		public static ByteBuffer allocate(int frames) {
+			return ByteBuffer.allocateDirect(frames * FRAME_SIZE).order(ByteOrder.nativeOrder());
+		}
+
+		public static void put(ByteBuffer buffer, int index, int canid, long payload, int len) {
+			final int offset = index * FRAME_SIZE;
+			buffer.putInt(offset + OFFSET_CAN_ID, canid);
+			buffer.putInt(offset + OFFSET_LENGTH, 0);
+			buffer.put(offset + OFFSET_LENGTH, (byte) len);
+			buffer.putLong(offset + OFFSET_DATA, BIG_ENDIAN ? Long.reverseBytes(payload) : payload);
+		}
+
+		public static void put(ByteBuffer buffer, int index, int canid, byte[] data) {
+			if (data.length > 8) {
+				throw new IllegalArgumentException();
 			}
-			break;
-		case RAW:
-			try {
-				_fd = _openSocketRAW();
-			} catch (IOException e) {
-				// TODO Auto-generated catch block
-				e.printStackTrace();
+			final int offset = index * FRAME_SIZE;
+			buffer.putInt(offset + OFFSET_CAN_ID, canid);
+			buffer.putInt(offset + OFFSET_LENGTH, 0);
+			buffer.put(offset + OFFSET_LENGTH, (byte) data.length);
+			buffer.putLong(offset + OFFSET_DATA, 0L);
+			for (int i = 0; i < data.length; i++) {
+				buffer.put(offset + OFFSET_DATA + i, data[i]);
 			}
-			break;
-		default:
-			break;
-		// throw new IllegalStateException("unkown mode " + mode);
 		}
-		this._mode = mode;
-	}
 
-	public void bind(CanInterface canInterface) throws IOException {
-		_bindToSocket(_fd, canInterface._ifIndex);
-		this._boundTo = canInterface;
-	}
+		public static void put(ByteBuffer buffer, int index, CanFrame frame) {
+			put(buffer, index, frame.canId._canId, frame.data);
+		}
 
-	public void send(CanFrame frame) throws IOException {
-		_sendFrame(_fd, frame.canIf._ifIndex, frame.canId._canId, frame.data);
-	}
+		public static int getCanId(ByteBuffer buffer, int index) {
+			return buffer.getInt(index * FRAME_SIZE + OFFSET_CAN_ID);
+		}
 
-	public CanFrame recv() throws IOException {
-		return _recvFrame(_fd);
-	}
+		public static int getLength(ByteBuffer buffer, int index) {
+			return buffer.get(index * FRAME_SIZE + OFFSET_LENGTH) & 0xff;
+		}
 
-	@Override
-	public void close() throws IOException {
-		_close(_fd);
+		public static long getPayload(ByteBuffer buffer, int index) {
+			final long payload = buffer.getLong(index * FRAME_SIZE + OFFSET_DATA);
+			return BIG_ENDIAN ? Long.reverseBytes(payload) : payload;
+		}
+
+		public static byte[] getData(ByteBuffer buffer, int index) {
+			final int len = Math.min(getLength(buffer, index), 8);
+			final byte[] data = new byte[len];
+			for (int i = 0; i < len; i++) {
+				data[i] = buffer.get(index * FRAME_SIZE + OFFSET_DATA + i);
+			}
+			return data;
+		}
 	}
 
 	/**
-	 * sets the sockets read timeout, if 0 the socket returns from NON-BLOCKING to BLOCKING
-	 * @param _secs
-	 * @param _usecs
-	 * @throws IOException
-	 *
+	 * Transmit ring shared with a native sender thread.
+	 * 
+	 * Frames are written directly into native memory and published with release semantics, the native
+	 * thread sends them in batches with sendmmsg. A JNI call is only made to wake the sender thread after it
+	 * went idle, so a steady stream of frames is transmitted without any JNI transition.
+	 * 
+	 * The ring has a single producer: offer must not be called concurrently from several threads.
+	 */
+	public final static class TxRing {
+		private static final VarHandle LONG = MethodHandles.byteBufferViewVarHandle(long[].class,
+				ByteOrder.nativeOrder());
+		private static final VarHandle INT = MethodHandles.byteBufferViewVarHandle(int[].class,
+				ByteOrder.nativeOrder());
+
+		/* keep in sync with jni/tx_ring.cpp */
+		private static final int OFFSET_HEAD = 0;
+		private static final int OFFSET_TAIL = 64;
+		private static final int OFFSET_SLEEPING = 128;
+		private static final int OFFSET_CAPACITY = 132;
+		private static final int HEADER_SIZE = 192;
+
+		private final CanSocket socket;
+		private final ByteBuffer buffer;
+		private final ByteBuffer slots;
+		private final int capacity;
+		private long tail;
+		private long cachedHead;
+		private volatile boolean closed;
+
+		private TxRing(CanSocket socket, ByteBuffer buffer) {
+			// the native memory is kept until this ring and its buffers are unreachable
+			final long address = _directBufferAddress(buffer);
+			SHARED_MEMORY_CLEANER.register(this, () -> _sharedMemoryRelease(address));
+			this.socket = socket;
+			this.buffer = buffer.order(ByteOrder.nativeOrder());
+			this.capacity = this.buffer.getInt(OFFSET_CAPACITY);
+			this.buffer.position(HEADER_SIZE);
+			this.slots = this.buffer.slice().order(ByteOrder.nativeOrder());
+			this.buffer.position(0);
+			this.tail = (long) LONG.getAcquire(this.buffer, OFFSET_TAIL);
+			this.cachedHead = (long) LONG.getAcquire(this.buffer, OFFSET_HEAD);
+		}
+
+		/**
+		 * @param canid   the CAN ID including the EFF/RTR flags
+		 * @param payload the data bytes, data byte 0 is the least significant byte
+		 * @param len     number of data bytes, 0 to 8
+		 * @return false if the ring is full
+		 */
+		public boolean offer(int canid, long payload, int len) {
+			if (!_reserve()) {
+				return false;
+			}
+			CanFrameBuffer.put(slots, (int) (tail & (capacity - 1)), canid, payload, len);
+			_publish();
+			return true;
+		}
+
+		/**
+		 * @return false if the ring is full
+		 */
+		public boolean offer(CanFrame frame) {
+			if (!_reserve()) {
+				return false;
+			}
+			CanFrameBuffer.put(slots, (int) (tail & (capacity - 1)), frame);
+			_publish();
+			return true;
+		}
+
+		/**
+		 * @return number of frames published but not yet sent
+		 */
+		public int pending() {
+			return (int) (tail - (long) LONG.getAcquire(buffer, OFFSET_HEAD));
+		}
+
+		public int capacity() {
+			return capacity;
+		}
+
+		/**
+		 * @return counters of the sender thread: sent, errors, wakeups, pending and dropped frames
+		 */
+		public long[] stats() {
+			return _txRingStats(socket._fd);
+		}
+
+		/**
+		 * @return frames taken from the ring but not sent, refused by the kernel or dropped by the overflow
+		 *         policy of the native transmit queue
+		 */
+		public long dropped() {
+			return stats()[4];
+		}
+
+		private boolean _reserve() {
+			if (closed) {
+				throw new IllegalStateException("transmit ring is closed");
+			}
+			if (tail - cachedHead < capacity) {
+				return true;
+			}
+			cachedHead = (long) LONG.getAcquire(buffer, OFFSET_HEAD);
+			return tail - cachedHead < capacity;
+		}
+
+		private void _publish() {
+			tail++;
+			LONG.setRelease(buffer, OFFSET_TAIL, tail);
+			// the tail store has to be visible before the sleeping flag is read
+			VarHandle.fullFence();
+			if ((int) INT.getVolatile(buffer, OFFSET_SLEEPING) != 0) {
+				_txRingWake(socket._fd);
+			}
+		}
+	}
+
+	public static enum Mode {
+		RAW, BCM
+	}
+
+	/**
+	 * Behaviour of the native transmit queue once it is full.
+	 */
+	public static enum TxQueuePolicy {
+		/** the sending thread waits until the queue has room again */
+		BLOCK,
+		/** the oldest pending frame is discarded in favour of the new one */
+		DROP_OLDEST,
+		/** the new frame is discarded */
+		DROP_NEWEST,
+		/**
+		 * a pending frame with the same CAN ID is replaced by the new one, if there
+		 * is none the new frame is discarded when the queue is full
+		 */
+		COALESCE
+	}
+
+	/**
+	 * Order in which the native transmit queue hands pending frames to the kernel.
+	 */
+	public static enum TxQueueOrder {
+		/** frames are sent in the order they were queued */
+		FIFO,
+		/**
+		 * frames are sent in the order of the CAN arbitration, lowest CAN ID first, so
+		 * urgent frames overtake pending bulk traffic
+		 */
+		PRIORITY
+	}
+
+	/**
+	 * How the stuff bits of a frame are accounted for in its on-wire length.
+	 */
+	public static enum BitStuffing {
+		/** no stuff bits, the lower bound */
+		NONE,
+		/** one stuff bit per four stuffable bits after the first, the upper bound */
+		WORST_CASE,
+		/** the stuff bits of the actual bit stream, CRC included */
+		EXACT
+	}
+
+	/**
+	 * State of a CAN controller, the values are those of enum can_state of linux/can/netlink.h.
+	 */
+	public static enum CanState {
+		ERROR_ACTIVE, ERROR_WARNING, ERROR_PASSIVE, BUS_OFF, STOPPED, SLEEPING;
+
+		static CanState valueOf(int state) {
+			final CanState[] values = values();
+			return state >= 0 && state < values.length ? values[state] : ERROR_ACTIVE;
+		}
+	}
+
+	/**
+	 * Snapshot of the rtnetlink information of an interface: bit timing, controller state and error
+	 * counters (CAN devices only) and device statistics.
+	 */
+	public final static class CanLinkInfo {
+		/** kind of the link as reported by IFLA_INFO_KIND */
+		public static enum Kind {
+			OTHER, CAN, VCAN, VXCAN
+		}
+
+		private final long[] info;
+
+		private CanLinkInfo(long[] info) {
+			this.info = info;
+		}
+
+		public int getInterfaceIndex() {
+			return (int) info[0];
+		}
+
+		public int getMtu() {
+			return (int) info[1];
+		}
+
+		/** the IFF_* flags of the interface */
+		public int getFlags() {
+			return (int) info[2];
+		}
+
+		public Kind getKind() {
+			return Kind.values()[(int) info[3]];
+		}
+
+		/** the nominal bitrate in bit/s, 0 if unknown (e.g. virtual CAN) */
+		public int getBitrate() {
+			return (int) info[4];
+		}
+
+		/** the sample point in tenths of a percent */
+		public int getSamplePoint() {
+			return (int) info[5];
+		}
+
+		/** the time quantum in nanoseconds */
+		public int getTimeQuantum() {
+			return (int) info[6];
+		}
+
+		public int getPropagationSegment() {
+			return (int) info[7];
+		}
+
+		public int getPhaseSegment1() {
+			return (int) info[8];
+		}
+
+		public int getPhaseSegment2() {
+			return (int) info[9];
+		}
+
+		public int getSyncJumpWidth() {
+			return (int) info[10];
+		}
+
+		public int getBitratePrescaler() {
+			return (int) info[11];
+		}
+
+		/** the CAN FD data bitrate in bit/s, 0 if not configured */
+		public int getDataBitrate() {
+			return (int) info[12];
+		}
+
+		public int getDataSamplePoint() {
+			return (int) info[13];
+		}
+
+		/** the CAN_CTRLMODE_* flags */
+		public int getControlMode() {
+			return (int) info[14];
+		}
+
+		/** the automatic restart delay after bus off in ms, 0 if disabled */
+		public int getRestartMs() {
+			return (int) info[15];
+		}
+
+		/** the controller state, null if the device does not report one */
+		public CanState getState() {
+			return info[16] < 0 ? null : CanState.valueOf((int) info[16]);
+		}
+
+		public int getTxErrorCounter() {
+			return (int) info[17];
+		}
+
+		public int getRxErrorCounter() {
+			return (int) info[18];
+		}
+
+		public long getRxPackets() {
+			return info[19];
+		}
+
+		public long getTxPackets() {
+			return info[20];
+		}
+
+		public long getRxBytes() {
+			return info[21];
+		}
+
+		public long getTxBytes() {
+			return info[22];
+		}
+
+		public long getRxErrors() {
+			return info[23];
+		}
+
+		public long getTxErrors() {
+			return info[24];
+		}
+
+		public long getRxDropped() {
+			return info[25];
+		}
+
+		public long getTxDropped() {
+			return info[26];
+		}
+
+		@Override
+		public String toString() {
+			return "CanLinkInfo [ifIndex=" + getInterfaceIndex() + ", kind=" + getKind() + ", mtu=" + getMtu()
+					+ ", bitrate=" + getBitrate() + ", dataBitrate=" + getDataBitrate() + ", state=" + getState()
+					+ ", txErrors=" + getTxErrorCounter() + ", rxErrors=" + getRxErrorCounter() + ", rxPackets="
+					+ getRxPackets() + ", txPackets=" + getTxPackets() + ", rxDropped=" + getRxDropped()
+					+ ", txDropped=" + getTxDropped() + "]";
+		}
+	}
+
+	/**
+	 * Decoded error frames of one interface, maintained by a native thread. All accessors read shared memory
+	 * without a native call; {@link #awaitStateChange(int, int)} blocks natively until the controller state
+	 * changes. Monitors of the same interface share one native monitor.
+	 */
+	public final static class ErrorMonitor implements AutoCloseable {
+		private static final VarHandle LONG = MethodHandles.byteBufferViewVarHandle(long[].class,
+				ByteOrder.nativeOrder());
+		private static final VarHandle INT = MethodHandles.byteBufferViewVarHandle(int[].class,
+				ByteOrder.nativeOrder());
+
+		/* keep in sync with jni/error_monitor.cpp */
+		private static final int OFFSET_STATE = 0;
+		private static final int OFFSET_TX_ERRORS = 4;
+		private static final int OFFSET_RX_ERRORS = 8;
+		private static final int OFFSET_STATE_CHANGES = 12;
+		private static final int OFFSET_LAST_CHANGE = 16;
+		private static final int OFFSET_COUNTERS = 24;
+
+		private final int ifIndex;
+		private final long address;
+		private final ByteBuffer buffer;
+		private final AtomicBoolean closed = new AtomicBoolean();
+
+		private ErrorMonitor(int ifIndex, ByteBuffer buffer) {
+			// the shared memory is kept until this monitor is unreachable, a read racing with close() stays safe
+			this.address = _directBufferAddress(buffer);
+			SHARED_MEMORY_CLEANER.register(this, () -> _sharedMemoryRelease(address));
+			this.ifIndex = ifIndex;
+			this.buffer = buffer.order(ByteOrder.nativeOrder());
+		}
+
+		public CanState getState() {
+			return CanState.valueOf(_getInt(OFFSET_STATE));
+		}
+
+		/** the transmit error counter, if the driver reports it */
+		public int getTxErrorCounter() {
+			return _getInt(OFFSET_TX_ERRORS);
+		}
+
+		/** the receive error counter, if the driver reports it */
+		public int getRxErrorCounter() {
+			return _getInt(OFFSET_RX_ERRORS);
+		}
+
+		/** number of state transitions seen so far */
+		public int getStateChanges() {
+			return _getInt(OFFSET_STATE_CHANGES);
+		}
+
+		/** CLOCK_MONOTONIC time of the last state transition in nanoseconds, 0 if there was none */
+		public long getLastStateChangeNanos() {
+			return _getLong(OFFSET_LAST_CHANGE);
+		}
+
+		public long getErrorFrames() {
+			return _getCounter(0);
+		}
+
+		public long getTxTimeouts() {
+			return _getCounter(1);
+		}
+
+		public long getLostArbitrations() {
+			return _getCounter(2);
+		}
+
+		public long getControllerErrors() {
+			return _getCounter(3);
+		}
+
+		public long getProtocolViolations() {
+			return _getCounter(4);
+		}
+
+		public long getTransceiverErrors() {
+			return _getCounter(5);
+		}
+
+		public long getNoAcks() {
+			return _getCounter(6);
+		}
+
+		public long getBusOffs() {
+			return _getCounter(7);
+		}
+
+		public long getBusErrors() {
+			return _getCounter(8);
+		}
+
+		public long getRestarts() {
+			return _getCounter(9);
+		}
+
+		public long getRxOverflows() {
+			return _getCounter(10);
+		}
+
+		public long getTxOverflows() {
+			return _getCounter(11);
+		}
+
+		/**
+		 * Waits until the number of state transitions differs from seenChanges.
+		 * 
+		 * @param seenChanges the value of {@link #getStateChanges()} already handled
+		 * @param timeoutMs   maximum time to wait
+		 * @return the current number of state transitions, equal to seenChanges on timeout
+		 * @throws IOException
+		 */
+		public int awaitStateChange(int seenChanges, int timeoutMs) throws IOException {
+			_checkOpen();
+			return _errorMonitorAwait(ifIndex, seenChanges, timeoutMs);
+		}
+
+		@Override
+		public void close() {
+			if (closed.compareAndSet(false, true)) {
+				_errorMonitorClose(address);
+			}
+		}
+
+		@Override
+		public String toString() {
+			return "ErrorMonitor [ifIndex=" + ifIndex + ", state=" + getState() + ", txErrors="
+					+ getTxErrorCounter() + ", rxErrors=" + getRxErrorCounter() + ", errorFrames="
+					+ getErrorFrames() + ", busOffs=" + getBusOffs() + "]";
+		}
+
+		private int _getInt(int offset) {
+			_checkOpen();
+			return (int) INT.getAcquire(buffer, offset);
+		}
+
+		private long _getLong(int offset) {
+			_checkOpen();
+			return (long) LONG.getAcquire(buffer, offset);
+		}
+
+		private long _getCounter(int index) {
+			return _getLong(OFFSET_COUNTERS + 8 * index);
+		}
+
+		private void _checkOpen() {
+			if (closed.get()) {
+				throw new IllegalStateException("error monitor is closed");
+			}
+		}
+	}
+
+	/**
+	 * Native bus-off recovery of one interface, see {@link CanSocket#superviseBusOff(CanInterface, int, int, int, int)}.
+	 * The getters return a snapshot taken on each call; {@link #awaitEvent(long, int)} blocks natively until the
+	 * interface goes bus-off or has recovered.
+	 */
+	public final static class BusSupervisor implements AutoCloseable {
+		private final int ifIndex;
+		private volatile boolean closed;
+
+		private BusSupervisor(int ifIndex) {
+			this.ifIndex = ifIndex;
+		}
+
+		/** whether the interface is bus-off right now, its cyclic and queued frames are held back meanwhile */
+		public boolean isBusOff() throws IOException {
+			return _stat(0) != 0;
+		}
+
+		public long getBusOffs() throws IOException {
+			return _stat(1);
+		}
+
+		/** restarts requested via netlink, restarts done by the kernel (restart-ms) are not counted */
+		public long getRestarts() throws IOException {
+			return _stat(2);
+		}
+
+		public long getRestartFailures() throws IOException {
+			return _stat(3);
+		}
+
+		public long getRecoveries() throws IOException {
+			return _stat(4);
+		}
+
+		/** number of bus-off and recovery events so far */
+		public long getEvents() throws IOException {
+			return _stat(5);
+		}
+
+		/** delay before the next restart */
+		public long getBackoffMillis() throws IOException {
+			return _stat(6);
+		}
+
+		/** duration of the last bus-off, from detection to recovery */
+		public long getLastOutageMillis() throws IOException {
+			return _stat(7);
+		}
+
+		/**
+		 * Waits until the number of events differs from seenEvents.
+		 * 
+		 * @param seenEvents the value of {@link #getEvents()} already handled
+		 * @param timeoutMs  maximum time to wait
+		 * @return the current number of events, equal to seenEvents on timeout
+		 * @throws IOException
+		 */
+		public long awaitEvent(long seenEvents, int timeoutMs) throws IOException {
+			_checkOpen();
+			return _busSupervisorAwait(ifIndex, seenEvents, timeoutMs);
+		}
+
+		/** stops the supervision, frames held back are released */
+		@Override
+		public void close() {
+			if (!closed) {
+				closed = true;
+				_busSupervisorStop(ifIndex);
+			}
+		}
+
+		@Override
+		public String toString() {
+			try {
+				return "BusSupervisor [ifIndex=" + ifIndex + ", busOff=" + isBusOff() + ", busOffs=" + getBusOffs()
+						+ ", recoveries=" + getRecoveries() + ", restartFailures=" + getRestartFailures() + "]";
+			} catch (IOException | IllegalStateException e) {
+				return "BusSupervisor [ifIndex=" + ifIndex + ", closed]";
+			}
+		}
+
+		private long _stat(int index) throws IOException {
+			_checkOpen();
+			return _busSupervisorStats(ifIndex)[index];
+		}
+
+		private void _checkOpen() {
+			if (closed) {
+				throw new IllegalStateException("bus supervisor is closed");
+			}
+		}
+	}
+
+	/**
+	 * Native bus load measurement of one interface, see {@link CanSocket#measureBusLoad(CanInterface, BitStuffing, int, int)}.
+	 * The load of a window is the time the frames seen in it occupied the bus divided by its length, computed
+	 * in buckets of 100 ms; windows of up to 60 s reach back from the last complete bucket.
+	 */
+	public final static class BusLoadMeter implements AutoCloseable {
+		private final int ifIndex;
+		private volatile boolean closed;
+
+		private BusLoadMeter(int ifIndex) {
+			this.ifIndex = ifIndex;
+		}
+
+		/**
+		 * @param windowMs length of the window, rounded up to 100 ms and limited to 60 s
+		 * @return the bus load in the window, 0.0 to 1.0
+		 * @throws IOException
+		 */
+		public double getLoad(int windowMs) throws IOException {
+			return _stats(windowMs)[0] / 1_000_000.0;
+		}
+
+		/** the highest load of a 100 ms bucket in the window */
+		public double getPeakLoad(int windowMs) throws IOException {
+			return _stats(windowMs)[1] / 1_000_000.0;
+		}
+
+		public long getFrames(int windowMs) throws IOException {
+			return _stats(windowMs)[2];
+		}
+
+		/** bits on the wire in the window, stuff bits as configured */
+		public long getBits(int windowMs) throws IOException {
+			return _stats(windowMs)[3];
+		}
+
+		public long getTotalFrames() throws IOException {
+			return _stats(100)[5];
+		}
+
+		public long getTotalBits() throws IOException {
+			return _stats(100)[6];
+		}
+
+		public long getBitrate() throws IOException {
+			return _stats(100)[7];
+		}
+
+		public long getDataBitrate() throws IOException {
+			return _stats(100)[8];
+		}
+
+		/** stops the measurement */
+		@Override
+		public void close() {
+			if (!closed) {
+				closed = true;
+				_busLoadStop(ifIndex);
+			}
+		}
+
+		@Override
+		public String toString() {
+			try {
+				final long[] stats = _stats(1000);
+				return "BusLoadMeter [ifIndex=" + ifIndex + ", load=" + stats[0] / 10_000.0 + "%, peak="
+						+ stats[1] / 10_000.0 + "%, windowMs=" + stats[4] + ", frames=" + stats[2] + "]";
+			} catch (IOException | IllegalStateException e) {
+				return "BusLoadMeter [ifIndex=" + ifIndex + ", closed]";
+			}
+		}
+
+		/** load (ppm), peak (ppm), frames, bits, window measured, total frames, total bits, bitrates */
+		private long[] _stats(int windowMs) throws IOException {
+			if (closed) {
+				throw new IllegalStateException("bus load meter is closed");
+			}
+			return _busLoadStats(ifIndex, windowMs);
+		}
+	}
+
+	/**
+	 * Limits the rate at which the frames of the ids matching a filter are received, see
+	 * {@link CanSocket#subscribe(CanInterface, int, RatePolicy[], CanFilter...)}. Each id matched is limited on
+	 * its own.
+	 */
+	public final static class RatePolicy {
+		/* keep in sync with jni/cansocket.hpp */
+		private static final int EVERY_NTH = 0;
+		private static final int MIN_INTERVAL = 1;
+		private static final int LATEST = 2;
+
+		private final CanFilter filter;
+		private final int policy;
+		private final int param;
+
+		private RatePolicy(CanFilter filter, int policy, int param) {
+			if (param < 1) {
+				throw new IllegalArgumentException("rate policy parameter must be positive");
+			}
+			this.filter = filter;
+			this.policy = policy;
+			this.param = param;
+		}
+
+		/** receives the first frame and then every nth one */
+		public static RatePolicy everyNth(CanFilter filter, int n) {
+			return new RatePolicy(filter, EVERY_NTH, n);
+		}
+
+		/** receives a frame only if the last one received is at least intervalMs old */
+		public static RatePolicy minInterval(CanFilter filter, int intervalMs) {
+			return new RatePolicy(filter, MIN_INTERVAL, intervalMs);
+		}
+
+		/**
+		 * holds back the frames of a window of windowMs starting with the first one and receives the last
+		 * frame of the window when it ends
+		 */
+		public static RatePolicy latest(CanFilter filter, int windowMs) {
+			return new RatePolicy(filter, LATEST, windowMs);
+		}
+
+		private static int[] toTable(RatePolicy[] policies) {
+			final int[] table = new int[policies.length * 4];
+			for (int i = 0; i < policies.length; i++) {
+				table[i * 4] = policies[i].filter.id._canId;
+				table[i * 4 + 1] = policies[i].filter.mask;
+				table[i * 4 + 2] = policies[i].policy;
+				table[i * 4 + 3] = policies[i].param;
+			}
+			return table;
+		}
+
+		@Override
+		public String toString() {
+			return "RatePolicy [filter=" + filter + ", policy=" + policy + ", param=" + param + "]";
+		}
+	}
+
+	/**
+	 * Assigns a range of ids to a shard of a sharded subscription, see
+	 * {@link CanSocket#subscribeSharded(CanInterface, int, int, ShardRule[], CanFilter...)}.
+	 */
+	public final static class ShardRule {
+		private final int fromId;
+		private final int toId;
+		private final int shard;
+
+		private ShardRule(int fromId, int toId, int shard) {
+			this.fromId = fromId;
+			this.toId = toId;
+			this.shard = shard;
+		}
+
+		/**
+		 * the ids from fromId to toId, both included; for extended ids both have CAN_EFF_FLAG (bit 31) set
+		 */
+		public static ShardRule range(int fromId, int toId, int shard) {
+			return new ShardRule(fromId, toId, shard);
+		}
+
+		public static ShardRule id(int canId, int shard) {
+			return new ShardRule(canId, canId, shard);
+		}
+
+		private static int[] toTable(ShardRule[] rules) {
+			final int[] table = new int[rules.length * 3];
+			for (int i = 0; i < rules.length; i++) {
+				table[i * 3] = rules[i].fromId;
+				table[i * 3 + 1] = rules[i].toId;
+				table[i * 3 + 2] = rules[i].shard;
+			}
+			return table;
+		}
+
+		@Override
+		public String toString() {
+			return "ShardRule [fromId=" + Integer.toHexString(fromId) + ", toId=" + Integer.toHexString(toId)
+					+ ", shard=" + shard + "]";
+		}
+	}
+
+	/**
+	 * A logical receiver on an interface, see {@link CanSocket#subscribe(CanInterface, int, CanFilter...)}.
+	 * Frames are received with the filters and from the queue of this subscription only.
+	 */
+	public final static class Subscription implements AutoCloseable {
+		private final int handle;
+		private final int ifIndex;
+		private volatile boolean closed;
+
+		private Subscription(int handle, int ifIndex) {
+			this.handle = handle;
+			this.ifIndex = ifIndex;
+		}
+
+		/**
+		 * @param timeoutMs maximum time to wait, negative to wait forever
+		 * @return the next frame, null on timeout
+		 * @throws IOException if the subscription was closed
+		 */
+		public CanFrame recv(int timeoutMs) throws IOException {
+			return _muxRecv(handle, ifIndex, timeoutMs);
+		}
+
+		public CanFrame recv() throws IOException {
+			return recv(-1);
+		}
+
+		/**
+		 * Takes the frames already queued into a buffer laid out by {@link CanFrameBuffer}, starting at the
+		 * buffer's position.
+		 * 
+		 * @param buffer    a direct buffer in native byte order, see {@link CanFrameBuffer#allocate(int)}
+		 * @param maxCount  maximum number of frames to take
+		 * @param timeoutMs maximum time to wait for the first frame, negative to wait forever
+		 * @return the number of frames stored, 0 on timeout
+		 * @throws IOException if the subscription was closed
+		 */
+		public int recvFrames(ByteBuffer buffer, int maxCount, int timeoutMs) throws IOException {
+			return _muxRecvFrames(handle, buffer, buffer.position(), maxCount, null, timeoutMs);
+		}
+
+		/**
+		 * As {@link #recvFrames(ByteBuffer, int, int)}, also storing the changed payload bits of each frame
+		 * (see {@link CanFrame#getChangedBits()}) into changes.
+		 */
+		public int recvFrames(ByteBuffer buffer, int maxCount, long[] changes, int timeoutMs) throws IOException {
+			return _muxRecvFrames(handle, buffer, buffer.position(), maxCount, changes, timeoutMs);
+		}
+
+		/** frames put into the queue so far */
+		public long getReceived() throws IOException {
+			return _muxStats(handle)[0];
+		}
+
+		/** frames matching the filters but dropped because the queue was full */
+		public long getDropped() throws IOException {
+			return _muxStats(handle)[1];
+		}
+
+		/** frames waiting in the queue */
+		public int getDepth() throws IOException {
+			return (int) _muxStats(handle)[2];
+		}
+
+		/**
+		 * frames not queued because their payload did not change (on-change subscriptions) or because of a
+		 * {@link RatePolicy}
+		 */
+		public long getSuppressed() throws IOException {
+			return _muxStats(handle)[3];
+		}
+
+		/** a receiver blocked in this subscription gets an IOException */
+		@Override
+		public void close() {
+			if (!closed) {
+				closed = true;
+				_muxUnsubscribe(handle);
+			}
+		}
+	}
+
+	/**
+	 * The latest frame of each of a fixed set of CAN ids, see {@link CanSocket#openMailbox(CanInterface, int...)}.
+	 * A native thread overwrites the slot of an id with every frame received; all reads go to shared memory
+	 * without a native call and never block the writer.
+	 */
+	public final static class Mailbox implements AutoCloseable {
+		private static final VarHandle LONG = MethodHandles.byteBufferViewVarHandle(long[].class,
+				ByteOrder.nativeOrder());
+		private static final VarHandle INT = MethodHandles.byteBufferViewVarHandle(int[].class,
+				ByteOrder.nativeOrder());
+
+		/* keep in sync with jni/mailbox.cpp */
+		private static final int SLOT_SIZE = 64;
+		private static final int OFFSET_SEQ = 0;
+		private static final int OFFSET_CAN_ID = 4;
+		private static final int OFFSET_TIMESTAMP = 8;
+		private static final int OFFSET_UPDATES = 16;
+		private static final int OFFSET_LENGTH = 24;
+		private static final int OFFSET_DATA = 32;
+
+		/** a consistent copy of one slot, reused by {@link Mailbox#read(int, Snapshot)} */
+		public final static class Snapshot {
+			/** the id as given when the mailbox was opened */
+			public int canId;
+			public int length;
+			public final byte[] data = new byte[8];
+			/** reception time on the time base of {@link System#nanoTime()} */
+			public long timestampNanos;
+			/** frames received with this id, 0 if none yet */
+			public long updates;
+
+			public byte[] getData() {
+				return Arrays.copyOf(data, length);
+			}
+		}
+
+		private final int handle;
+		private final Map<Integer, Integer> indices;
+		private final ByteBuffer buffer;
+		private volatile boolean closed;
+
+		private Mailbox(int handle, int[] canIds, ByteBuffer buffer) {
+			// the slots are kept until this mailbox is unreachable, a read racing with close() stays safe
+			final long address = _directBufferAddress(buffer);
+			SHARED_MEMORY_CLEANER.register(this, () -> _sharedMemoryRelease(address));
+			this.handle = handle;
+			this.indices = new HashMap<>(canIds.length * 2);
+			for (int i = 0; i < canIds.length; i++) {
+				this.indices.put(canIds[i], i);
+			}
+			this.buffer = buffer.order(ByteOrder.nativeOrder());
+		}
+
+		/** number of ids */
+		public int size() {
+			return indices.size();
+		}
+
+		/** the slot of the id as given when the mailbox was opened, -1 if it has none */
+		public int indexOf(int canId) {
+			final Integer index = indices.get(canId);
+			return index == null ? -1 : index;
+		}
+
+		/**
+		 * Copies the slot, retrying while the native thread updates it.
+		 * 
+		 * @return false if no frame has been received for the id yet
+		 */
+		public boolean read(int index, Snapshot snapshot) {
+			final int base = _slot(index);
+			while (true) {
+				final int seq = (int) INT.getAcquire(buffer, base + OFFSET_SEQ);
+				if ((seq & 1) != 0) {
+					Thread.onSpinWait();
+					continue;
+				}
+				snapshot.canId = (int) INT.get(buffer, base + OFFSET_CAN_ID);
+				snapshot.timestampNanos = (long) LONG.get(buffer, base + OFFSET_TIMESTAMP);
+				snapshot.updates = (long) LONG.get(buffer, base + OFFSET_UPDATES);
+				snapshot.length = Math.min(buffer.get(base + OFFSET_LENGTH) & 0xFF, 8);
+				for (int i = 0; i < 8; i++) {
+					snapshot.data[i] = buffer.get(base + OFFSET_DATA + i);
+				}
+				VarHandle.acquireFence();
+				if ((int) INT.get(buffer, base + OFFSET_SEQ) == seq) {
+					return snapshot.updates != 0;
+				}
+			}
+		}
+
+		/** the data of the latest frame, null if none has been received yet */
+		public byte[] getData(int index) {
+			final Snapshot snapshot = new Snapshot();
+			return read(index, snapshot) ? snapshot.getData() : null;
+		}
+
+		/** frames received for the id so far */
+		public long getUpdates(int index) {
+			return (long) LONG.getAcquire(buffer, _slot(index) + OFFSET_UPDATES);
+		}
+
+		/** reception time of the latest frame on the time base of {@link System#nanoTime()} */
+		public long getTimestampNanos(int index) {
+			final Snapshot snapshot = new Snapshot();
+			read(index, snapshot);
+			return snapshot.timestampNanos;
+		}
+
+		/** frames stored into any of the slots so far */
+		public long getReceived() throws IOException {
+			return _muxStats(handle)[0];
+		}
+
+		/** the slots must not be read any more once the mailbox is closed */
+		@Override
+		public void close() {
+			if (!closed) {
+				closed = true;
+				_muxUnsubscribe(handle);
+			}
+		}
+
+		private int _slot(int index) {
+			if (closed) {
+				throw new IllegalStateException("mailbox is closed");
+			}
+			Objects.checkIndex(index, indices.size());
+			return index * SLOT_SIZE;
+		}
+	}
+
+	/**
+	 * Receive timeouts of periodic ids, see {@link CanSocket#watchReceive(CanInterface, int, int[], int[])}. The
+	 * deadlines are refreshed and checked natively, Java only sees an event when an id times out or is
+	 * received again after a timeout.
+	 */
+	public final static class Watchdog implements AutoCloseable {
+		/* keep in sync with jni/cansocket.hpp */
+		private static final int TIMEOUT = 1;
+
+		/** a timeout or recovery of one id */
+		public final static class Event {
+			private final int canId;
+			private final boolean timeout;
+			private final long timestampNanos;
+
+			private Event(int canId, boolean timeout, long timestampNanos) {
+				this.canId = canId;
+				this.timeout = timeout;
+				this.timestampNanos = timestampNanos;
+			}
+
+			/** the id as registered */
+			public int getCanId() {
+				return canId;
+			}
+
+			/** true if the id timed out, false if it is received again */
+			public boolean isTimeout() {
+				return timeout;
+			}
+
+			/** time of the event on the time base of {@link System#nanoTime()} */
+			public long getTimestampNanos() {
+				return timestampNanos;
+			}
+
+			@Override
+			public String toString() {
+				return "Event [canId=0x" + Integer.toHexString(canId) + ", " + (timeout ? "timeout" : "recovered")
+						+ ", timestampNanos=" + timestampNanos + "]";
+			}
+		}
+
+		private final Subscription subscription;
+		private final ByteBuffer buffer = CanFrameBuffer.allocate(1);
+
+		private Watchdog(Subscription subscription) {
+			this.subscription = subscription;
+		}
+
+		/**
+		 * @param timeoutMs maximum time to wait, negative to wait forever
+		 * @return the next event, null on timeout
+		 * @throws IOException if the watchdog was closed
+		 */
+		public synchronized Event next(int timeoutMs) throws IOException {
+			buffer.clear();
+			if (subscription.recvFrames(buffer, 1, timeoutMs) == 0) {
+				return null;
+			}
+			return new Event(eventCanId(buffer, 0), isTimeout(buffer, 0), eventNanos(buffer, 0));
+		}
+
+		/**
+		 * Takes the events already queued into a buffer laid out by {@link CanFrameBuffer} without allocating,
+		 * decode them with {@link #eventCanId(ByteBuffer, int)}, {@link #isTimeout(ByteBuffer, int)} and
+		 * {@link #eventNanos(ByteBuffer, int)}.
+		 * 
+		 * @return the number of events stored, 0 on timeout
+		 * @throws IOException if the watchdog was closed
+		 */
+		public int nextEvents(ByteBuffer buffer, int maxCount, int timeoutMs) throws IOException {
+			return subscription.recvFrames(buffer, maxCount, timeoutMs);
+		}
+
+		public static int eventCanId(ByteBuffer buffer, int index) {
+			return CanFrameBuffer.getCanId(buffer, index);
+		}
+
+		public static boolean isTimeout(ByteBuffer buffer, int index) {
+			return CanFrameBuffer.getLength(buffer, index) == TIMEOUT;
+		}
+
+		public static long eventNanos(ByteBuffer buffer, int index) {
+			return CanFrameBuffer.getPayload(buffer, index);
+		}
+
+		/** events queued so far */
+		public long getEvents() throws IOException {
+			return subscription.getReceived();
+		}
+
+		/** events lost because the queue was full */
+		public long getDropped() throws IOException {
+			return subscription.getDropped();
+		}
+
+		/** a thread blocked in {@link #next(int)} gets an IOException */
+		@Override
+		public void close() {
+			subscription.close();
+		}
+	}
+
+	/**
+	 * Publishes the frames of an interface into POSIX shared memory, see
+	 * {@link CanSocket#publishSharedBus(CanInterface, String, int)}.
+	 */
+	public final static class SharedBusPublisher implements AutoCloseable {
+		private final String name;
+		private volatile boolean closed;
+
+		private SharedBusPublisher(String name) {
+			this.name = name;
+		}
+
+		public String getName() {
+			return name;
+		}
+
+		/** stops publishing and removes the segment, readers attached to it see no new frames */
+		@Override
+		public void close() {
+			if (!closed) {
+				closed = true;
+				_shmBusUnpublish(name);
+			}
+		}
+	}
+
+	/**
+	 * Reads the frames of a shared bus published by any process, see {@link CanSocket#openSharedBus(String)}.
+	 * A reader starts with the frames published after it was opened. The publisher never waits for readers,
+	 * a reader more than the capacity of the bus behind loses the oldest frames.
+	 */
+	public final static class SharedBusReader implements AutoCloseable {
+		private final int handle;
+		private volatile boolean closed;
+
+		private SharedBusReader(int handle) {
+			this.handle = handle;
+		}
+
+		/**
+		 * @param buffer     a direct buffer in native byte order, see {@link CanFrameBuffer#allocate(int)}; the
+		 *                   frames are stored starting at the buffer's position
+		 * @param maxCount   maximum number of frames to take
+		 * @param timestamps receives the kernel receive time of each frame (CLOCK_REALTIME, nanoseconds), may
+		 *                   be null
+		 * @param timeoutMs  maximum time to wait for the first frame, negative to wait forever
+		 * @return the number of frames stored, 0 on timeout
+		 * @throws IOException also if the reader is closed while waiting
+		 */
+		public int read(ByteBuffer buffer, int maxCount, long[] timestamps, int timeoutMs) throws IOException {
+			return _shmBusRead(handle, buffer, buffer.position(), maxCount, timestamps, timeoutMs);
+		}
+
+		/** index of the interface the frames were received on */
+		public int getInterfaceIndex() throws IOException {
+			return (int) _shmBusStats(handle)[0];
+		}
+
+		/** frames overwritten before this reader got them */
+		public long getLost() throws IOException {
+			return _shmBusStats(handle)[1];
+		}
+
+		/** frames published but not read yet */
+		public long getBacklog() throws IOException {
+			return _shmBusStats(handle)[2];
+		}
+
+		/** frames published since the publisher started */
+		public long getPublished() throws IOException {
+			return _shmBusStats(handle)[3];
+		}
+
+		@Override
+		public void close() {
+			if (!closed) {
+				closed = true;
+				_shmBusClose(handle);
+			}
+		}
+	}
+
+	/**
+	 * Mechanism used by {@link CanSocket#sendAt(CanFrame, long)}.
+	 */
+	public static enum LaunchTimeMode {
+		/** sendAt has not been used yet */
+		UNKNOWN,
+		/** the launch time is passed to an ETF qdisc via SO_TXTIME */
+		ETF,
+		/** a native high resolution timer sends the frame at the launch time */
+		TIMER
+	}
+
+	/**
+	 * Snapshot of the counters of the native receive path.
+	 */
+	public final static class RxStats {
+		private final long[] stats;
+
+		private RxStats(long[] stats) {
+			this.stats = stats;
+		}
+
+		/** frames delivered to the application */
+		public long getAccepted() {
+			return stats[0];
+		}
+
+		/** frames dropped by the ID whitelist */
+		public long getFiltered() {
+			return stats[1];
+		}
+
+		@Override
+		public String toString() {
+			return "RxStats [accepted=" + getAccepted() + ", filtered=" + getFiltered() + "]";
+		}
+	}
+
+	/**
+	 * Statistics of the frames with one CAN id received on a socket, see {@link CanSocket#getInventory()}. Times
+	 * are the kernel receive times of the frames on the time base of {@link System#nanoTime()}, so frames read
+	 * in one batch still get their own period.
+	 */
+	public final static class IdStatistics {
+		/* keep in sync with jni/cansocket.hpp */
+		private static final int FIELDS = 10;
+
+		private final long[] values;
+		private final int offset;
+
+		private IdStatistics(long[] values, int offset) {
+			this.values = values;
+			this.offset = offset;
+		}
+
+		/** the id with CAN_EFF_FLAG set for extended ids, CAN_ERR_FLAG for all error frames */
+		public int getCanId() {
+			return (int) values[offset];
+		}
+
+		public long getCount() {
+			return values[offset + 1];
+		}
+
+		public long getFirstNanos() {
+			return values[offset + 2];
+		}
+
+		public long getLastNanos() {
+			return values[offset + 3];
+		}
+
+		/** mean time between two frames, 0 before the second frame */
+		public long getMeanPeriodNanos() {
+			return values[offset + 4];
+		}
+
+		public long getMinPeriodNanos() {
+			return values[offset + 5];
+		}
+
+		public long getMaxPeriodNanos() {
+			return values[offset + 6];
+		}
+
+		/** standard deviation of the time between two frames */
+		public long getJitterNanos() {
+			return values[offset + 7];
+		}
+
+		public int getMinLength() {
+			return (int) values[offset + 8];
+		}
+
+		public int getMaxLength() {
+			return (int) values[offset + 9];
+		}
+
+		/** mean frames per second, 0 before the second frame */
+		public double getRate() {
+			final long mean = getMeanPeriodNanos();
+			return mean > 0 ? 1e9 / mean : 0;
+		}
+
+		@Override
+		public String toString() {
+			return "IdStatistics [canId=0x" + Integer.toHexString(getCanId()) + ", count=" + getCount()
+					+ ", meanPeriodNanos=" + getMeanPeriodNanos() + ", jitterNanos=" + getJitterNanos()
+					+ ", minPeriodNanos=" + getMinPeriodNanos() + ", maxPeriodNanos=" + getMaxPeriodNanos()
+					+ ", length=" + getMinLength() + ".." + getMaxLength() + "]";
+		}
+	}
+
+	/**
+	 * Snapshot of the bus inventory of a socket, see {@link CanSocket#getInventory()}.
+	 */
+	public final static class BusInventory {
+		private final long[] values;
+		private final List<IdStatistics> ids;
+
+		private BusInventory(long[] values) {
+			this.values = values;
+			final int count = (values.length - 1) / IdStatistics.FIELDS;
+			final List<IdStatistics> list = new ArrayList<>(count);
+			for (int i = 0; i < count; i++) {
+				list.add(new IdStatistics(values, 1 + i * IdStatistics.FIELDS));
+			}
+			this.ids = Collections.unmodifiableList(list);
+		}
+
+		/** one entry per id received, in no particular order */
+		public List<IdStatistics> getIds() {
+			return ids;
+		}
+
+		/** frames of ids not tracked because the native table was full */
+		public long getUntracked() {
+			return values[0];
+		}
+
+		@Override
+		public String toString() {
+			return "BusInventory [ids=" + ids.size() + ", untracked=" + getUntracked() + "]";
+		}
+	}
+
+	/**
+	 * Snapshot of the counters of the native transmit queue.
+	 */
+	public final static class TxQueueStats {
+		private final long[] stats;
+
+		private TxQueueStats(long[] stats) {
+			this.stats = stats;
+		}
+
+		/** frames handed to the queue, either sent directly or queued */
+		public long getSubmitted() {
+			return stats[0];
+		}
+
+		public long getSent() {
+			return stats[1];
+		}
+
+		public long getDroppedOldest() {
+			return stats[2];
+		}
+
+		public long getDroppedNewest() {
+			return stats[3];
+		}
+
+		public long getCoalesced() {
+			return stats[4];
+		}
+
+		/** number of times a sender had to wait for room with policy BLOCK */
+		public long getBlocked() {
+			return stats[5];
+		}
+
+		/** number of times the kernel reported ENOBUFS or EAGAIN */
+		public long getCongested() {
+			return stats[6];
+		}
+
+		/** frames discarded due to errors other than congestion */
+		public long getErrors() {
+			return stats[7];
+		}
+
+		/** frames currently pending in the queue */
+		public long getDepth() {
+			return stats[8];
+		}
+
+		public long getHighWatermark() {
+			return stats[9];
+		}
+
+		@Override
+		public String toString() {
+			return "TxQueueStats [submitted=" + getSubmitted() + ", sent=" + getSent() + ", droppedOldest="
+					+ getDroppedOldest() + ", droppedNewest=" + getDroppedNewest() + ", coalesced=" + getCoalesced()
+					+ ", blocked=" + getBlocked() + ", congested=" + getCongested() + ", errors=" + getErrors()
+					+ ", depth=" + getDepth() + ", highWatermark=" + getHighWatermark() + "]";
+		}
+	}
+
+	/**
+	 * Receives the frames of a socket from its native dispatch thread, see
+	 * {@link CanSocket#startDispatcher(FrameListener, int, int)}.
+	 */
+	public interface FrameListener {
+		/**
+		 * Called from the dispatch thread with the frames of one batch. The next batch is not delivered before
+		 * this returns, a slow listener leaves the frames in the socket's receive queue.
+		 * 
+		 * @param frames the frames laid out by {@link CanFrameBuffer}, to be read by index with its static
+		 *               getters; the buffer is reused for the next batch
+		 * @param count  number of frames, at least one
+		 */
+		void onFrames(ByteBuffer frames, int count);
+	}
+
+	public final static class DispatchStats {
+		private final long[] stats;
+
+		private DispatchStats(long[] stats) {
+			this.stats = stats;
+		}
+
+		/** frames handed to the listener */
+		public long getFrames() {
+			return stats[0];
+		}
+
+		/** number of upcalls */
+		public long getBatches() {
+			return stats[1];
+		}
+
+		/** batches delivered because they reached the maximum size before the maximum delay */
+		public long getFullBatches() {
+			return stats[2];
+		}
+
+		/** upcalls the listener left with an exception */
+		public long getListenerErrors() {
+			return stats[3];
+		}
+
+		@Override
+		public String toString() {
+			return "DispatchStats [frames=" + getFrames() + ", batches=" + getBatches() + ", fullBatches="
+					+ getFullBatches() + ", listenerErrors=" + getListenerErrors() + "]";
+		}
+	}
+
+	public final static class IoUringStats {
+		private final long[] stats;
+
+		private IoUringStats(long[] stats) {
+			this.stats = stats;
+		}
+
+		/** io_uring_enter system calls, for receiving and sending */
+		public long getEnterCalls() {
+			return stats[0];
+		}
+
+		/** frames received through the engine, before the receive filters */
+		public long getRxFrames() {
+			return stats[1];
+		}
+
+		/** frames sent through the engine */
+		public long getTxFrames() {
+			return stats[2];
+		}
+
+		/** times the multishot receive was armed, once plus once per restart by the kernel */
+		public long getRxArms() {
+			return stats[3];
+		}
+
+		/** restarts because all receive buffers were in use, frames waited in the socket meanwhile */
+		public long getRxNoBuffers() {
+			return stats[4];
+		}
+
+		/** received messages that were not a classic CAN frame */
+		public long getRxSkipped() {
+			return stats[5];
+		}
+
+		/** system calls per frame received or sent */
+		public double getEnterCallsPerFrame() {
+			final long frames = getRxFrames() + getTxFrames();
+			return frames == 0 ? 0 : (double) getEnterCalls() / frames;
+		}
+
+		@Override
+		public String toString() {
+			return "IoUringStats [enterCalls=" + getEnterCalls() + ", rxFrames=" + getRxFrames() + ", txFrames="
+					+ getTxFrames() + ", rxArms=" + getRxArms() + ", rxNoBuffers=" + getRxNoBuffers()
+					+ ", rxSkipped=" + getRxSkipped() + "]";
+		}
+	}
+
+	private int _fd;
+	private final Mode _mode;
+	private CanInterface _boundTo;
+	private TxRing _txRing;
+
+	public CanSocket(Mode mode) { // throws IOException {
+		switch (mode) {
+		case BCM:
+			try {
+				_fd = _openSocketBCM();
+			} catch (IOException e) {
+				// TODO Auto-generated catch block
+				e.printStackTrace();
+			}
+			break;
+		case RAW:
+			try {
+				_fd = _openSocketRAW();
+			} catch (IOException e) {
+				// TODO Auto-generated catch block
+				e.printStackTrace();
+			}
+			break;
+		default:
+			break;
+		// throw new IllegalStateException("unkown mode " + mode);
+		}
+		this._mode = mode;
+	}
+
+	public void bind(CanInterface canInterface) throws IOException {
+		_bindToSocket(_fd, canInterface._ifIndex);
+		this._boundTo = canInterface;
+	}
+
+	public void send(CanFrame frame) throws IOException {
+		_sendFrame(_fd, frame.canIf._ifIndex, frame.canId._canId, frame.data);
+	}
+
+	/**
+	 * Fast path for sockets bound to a specific interface: no frame object, no array copy and no per call
+	 * address.
+	 * 
+	 * @param canid   the CAN ID including the EFF/RTR flags
+	 * @param payload the data bytes, data byte 0 is the least significant byte
+	 * @param len     number of data bytes, 0 to 8
+	 * @throws IOException
+	 */
+	public void send(int canid, long payload, int len) throws IOException {
+		_checkBoundToInterface();
+		_sendFrameBound(_fd, canid, payload, len);
+	}
+
+	/**
+	 * Fast path for sockets bound to a specific interface, sends the frame stored at the given offset of a
+	 * direct buffer in the layout described by {@link CanFrameBuffer}.
+	 * 
+	 * @param buffer a direct buffer
+	 * @param offset byte offset of the frame within the buffer
+	 * @throws IOException
+	 */
+	public void send(ByteBuffer buffer, int offset) throws IOException {
+		_checkBoundToInterface();
+		_sendFrameBuffer(_fd, buffer, offset);
+	}
+
+	/**
+	 * Sends a batch of frames with a minimum of system calls (sendmmsg). Meant for firmware blocks and
+	 * configuration tables of hundreds of frames.
+	 * 
+	 * If the kernel accepts only part of the batch the transmission resumes with the first frame not
+	 * accepted, a congested device is retried for a bounded time.
+	 * 
+	 * @param packed a direct buffer holding the frames in the layout described by {@link CanFrameBuffer},
+	 *               starting at its position
+	 * @param count  number of frames to send
+	 * @return the number of frames accepted by the kernel, frames from this index on have to be resent
+	 * @throws IOException if not a single frame could be sent
+	 */
+	public int sendFrames(ByteBuffer packed, int count) throws IOException {
+		_checkBoundToInterface();
+		return _sendFrames(_fd, packed, packed.position(), count);
+	}
+
+	/**
+	 * Opens the shared memory transmit ring of this socket, see {@link TxRing}.
+	 * 
+	 * @param capacity number of frames, a power of two
+	 * @throws IOException
+	 */
+	public TxRing openTxRing(int capacity) throws IOException {
+		_checkBoundToInterface();
+		if (_txRing != null) {
+			throw new IllegalStateException("transmit ring is already open");
+		}
+		_txRing = new TxRing(this, _txRingCreate(_fd, capacity));
+		return _txRing;
+	}
+
+	/**
+	 * Stops the native sender thread of the transmit ring, frames not yet sent are discarded.
+	 */
+	public void closeTxRing() {
+		if (_txRing != null) {
+			_txRing.closed = true;
+			_txRingDestroy(_fd);
+			_txRing = null;
+		}
+	}
+
+	/**
+	 * @brief fetches bit timing, controller state, error counters and statistics of the interface with a
+	 *        single rtnetlink request. Interface names, indices and MTUs are served from a native table kept
+	 *        up to date by link notifications, so looking them up repeatedly is cheap.
+	 * @throws IOException
+	 */
+	public static CanLinkInfo getLinkInfo(CanInterface canif) throws IOException {
+		return new CanLinkInfo(_linkInfo(canif._ifIndex));
+	}
+
+	/**
+	 * @brief starts decoding the error frames of the interface, see {@link ErrorMonitor}. The monitor
+	 *        receives the error frames on a socket of its own, the filters of this socket do not matter.
+	 * @throws IOException
+	 */
+	public static ErrorMonitor openErrorMonitor(CanInterface canif) throws IOException {
+		return new ErrorMonitor(canif._ifIndex, _errorMonitorOpen(canif._ifIndex));
+	}
+
+	/**
+	 * @brief recovers the interface from bus-off natively. On bus-off the cyclic frames and the transmit queues
+	 *        of the sockets bound to the interface are paused and the controller is restarted via netlink
+	 *        (needs CAP_NET_ADMIN), the delay before a restart doubles from initialBackoffMs up to maxBackoffMs
+	 *        and is reset once the bus stayed up for stableMs. After the recovery the queues are resumed one by
+	 *        one, resumeStaggerMs apart, then the cyclic frames. Only the transmit queues and cyclic frames are
+	 *        held back: direct, bulk, {@link TxRing} and io_uring sends reach the driver as before and fail or
+	 *        are dropped there while the controller is bus-off.
+	 * @throws IOException if the interface is supervised already
+	 */
+	public static BusSupervisor superviseBusOff(CanInterface canif, int initialBackoffMs, int maxBackoffMs,
+			int stableMs, int resumeStaggerMs) throws IOException {
+		_busSupervisorStart(canif._ifIndex, initialBackoffMs, maxBackoffMs, stableMs, resumeStaggerMs);
+		return new BusSupervisor(canif._ifIndex);
+	}
+
+	/**
+	 * @brief {@link #superviseBusOff(CanInterface, int, int, int, int)} with a backoff from 100 ms up to 10 s,
+	 *        reset after 30 s without bus-off, and queues resumed 10 ms apart.
+	 * @throws IOException
+	 */
+	public static BusSupervisor superviseBusOff(CanInterface canif) throws IOException {
+		return superviseBusOff(canif, 100, 10000, 30000, 10);
+	}
+
+	/**
+	 * @brief measures the load of the interface natively. A socket of its own receives every frame of the
+	 *        interface, including those sent from this host unless the sending socket disabled loopback, and
+	 *        accounts for its on-wire length: identifier format, data length, stuff bits as given and for
+	 *        CAN FD frames with BRS the part sent with the data bitrate.
+	 * @param bitrate     nominal bitrate in bit/s, 0 for the one configured (a virtual interface has none)
+	 * @param dataBitrate CAN FD data bitrate in bit/s, 0 for the one configured or the nominal bitrate
+	 * @throws IOException if the load of the interface is measured already
+	 */
+	public static BusLoadMeter measureBusLoad(CanInterface canif, BitStuffing stuffing, int bitrate, int dataBitrate)
+			throws IOException {
+		_busLoadStart(canif._ifIndex, stuffing.ordinal(), bitrate, dataBitrate);
+		return new BusLoadMeter(canif._ifIndex);
+	}
+
+	/**
+	 * @brief {@link #measureBusLoad(CanInterface, BitStuffing, int, int)} with the exact stuff bits and the
+	 *        configured bitrates
+	 * @throws IOException
+	 */
+	public static BusLoadMeter measureBusLoad(CanInterface canif) throws IOException {
+		return measureBusLoad(canif, BitStuffing.EXACT, 0, 0);
+	}
+
+	/**
+	 * @brief the number of bits the classic CAN frame occupies on the bus, from start of frame to the end of
+	 *        the intermission, e.g. 111 to 135 for a standard frame with 8 data bytes
+	 */
+	public static int frameBitLength(CanFrame frame, BitStuffing stuffing) {
+		return _frameBits(frame.canId._canId, frame.data, stuffing.ordinal());
+	}
+
+	/**
+	 * @brief receives frames of the interface without a kernel socket of its own. One native socket per
+	 *        interface is shared by all subscriptions and the frames are distributed in user space, so the
+	 *        kernel copies each frame once no matter how many subscribers there are. The kernel filter of
+	 *        the shared socket is the union of the subscriber filters.
+	 * @param capacity frames the queue of the subscription holds, a full queue drops new frames for this
+	 *                 subscription only
+	 * @param filters  the frames to receive as with {@link #setFilters(CanFilter[])}, none receives every frame
+	 * @throws IOException
+	 */
+	public static Subscription subscribe(CanInterface canif, int capacity, CanFilter... filters)
+			throws IOException {
+		final int[] table = filters.length == 0 ? CanFilter.toTable(CanFilter.ANY) : CanFilter.toTable(filters);
+		return new Subscription(_muxSubscribe(canif._ifIndex, table, capacity), canif._ifIndex);
+	}
+
+	/**
+	 * @brief as {@link #subscribe(CanInterface, int, CanFilter...)}, with the rate of the ids matched by the
+	 *        policies limited natively: frames not needed are dropped on the receiving thread before they
+	 *        reach the queue. The first policy matching a frame applies, frames matching none are received
+	 *        unlimited.
+	 * @throws IOException
+	 */
+	public static Subscription subscribe(CanInterface canif, int capacity, RatePolicy[] policies,
+			CanFilter... filters) throws IOException {
+		final int[] table = filters.length == 0 ? CanFilter.toTable(CanFilter.ANY) : CanFilter.toTable(filters);
+		final int[] rules = RatePolicy.toTable(policies);
+		return new Subscription(_muxSubscribeDecimated(canif._ifIndex, table, capacity, rules), canif._ifIndex);
+	}
+
+	/**
+	 * @brief as {@link #subscribe(CanInterface, int, CanFilter...)}, but a frame is only queued if its payload
+	 *        differs from the previous frame with the same id. The comparison is done natively on the
+	 *        receiving thread, so unchanged cyclic frames never cross into Java. Frames carry the bits that
+	 *        changed, see {@link CanFrame#getChangedBits()}; the first frame of an id and frames with another
+	 *        length than the previous one are always queued.
+	 * @param keepaliveMs   an unchanged frame is queued anyway if the last one queued for its id is at least
+	 *                      this old, 0 for no keepalive
+	 * @param defaultIgnore payload bits not compared, e.g. alive counters and checksums, numbered as in
+	 *                      {@link CanFrame#getChangedBits()}
+	 * @param ignoreMasks   ignore masks of single ids replacing defaultIgnore, may be null
+	 * @throws IOException
+	 */
+	public static Subscription subscribeOnChange(CanInterface canif, int capacity, int keepaliveMs,
+			long defaultIgnore, Map<Integer, Long> ignoreMasks, CanFilter... filters) throws IOException {
+		final int[] table = filters.length == 0 ? CanFilter.toTable(CanFilter.ANY) : CanFilter.toTable(filters);
+		final int size = ignoreMasks == null ? 0 : ignoreMasks.size();
+		final int[] ids = new int[size];
+		final long[] masks = new long[size];
+		if (ignoreMasks != null) {
+			int i = 0;
+			for (Map.Entry<Integer, Long> entry : ignoreMasks.entrySet()) {
+				ids[i] = entry.getKey();
+				masks[i++] = entry.getValue();
+			}
+		}
+		return new Subscription(
+				_muxSubscribeOnChange(canif._ifIndex, table, capacity, keepaliveMs, defaultIgnore, ids, masks),
+				canif._ifIndex);
+	}
+
+	/**
+	 * @brief {@link #subscribeOnChange(CanInterface, int, int, long, Map, CanFilter...)} comparing the whole
+	 *        payload
+	 * @throws IOException
+	 */
+	public static Subscription subscribeOnChange(CanInterface canif, int capacity, int keepaliveMs,
+			CanFilter... filters) throws IOException {
+		return subscribeOnChange(canif, capacity, keepaliveMs, 0, null, filters);
+	}
+
+	/**
+	 * @brief watches that each of the ids is received at least once within its timeout. The watchdog is a
+	 *        subscriber of the interface's receive multiplexer (see
+	 *        {@link #subscribe(CanInterface, int, CanFilter...)}): the receiving thread refreshes a deadline per
+	 *        frame and a timer wheel with 10 ms ticks reports timeouts, so an id missing is reported at most
+	 *        one tick after its timeout. Timeouts start now, an id never received times out as well.
+	 * @param capacity   events the queue holds
+	 * @param canIds     the ids, with CAN_EFF_FLAG (bit 31) set for extended ids
+	 * @param timeoutsMs the timeout of each id
+	 * @throws IOException
+	 */
+	public static Watchdog watchReceive(CanInterface canif, int capacity, int[] canIds, int[] timeoutsMs)
+			throws IOException {
+		final int handle = _muxSubscribeWatchdog(canif._ifIndex, canIds, timeoutsMs, capacity);
+		return new Watchdog(new Subscription(handle, canif._ifIndex));
+	}
+
+	/**
+	 * @brief splits the frames of the interface over several subscriptions, one per consumer thread. The
+	 *        receive multiplexer queues each frame matching the filters for exactly one shard: the shard of
+	 *        the first rule whose range contains its id, otherwise the shard chosen by a hash of the id. An id
+	 *        always goes to the same shard, so the frames of an id stay in order. Each shard has a queue of
+	 *        its own, a consumer falling behind only drops frames of its shard. Frames of a shard closed are
+	 *        discarded.
+	 * @param shards   number of shards, 1 to 16
+	 * @param capacity frames the queue of each shard holds
+	 * @param rules    ranges of ids assigned to a shard, up to 64
+	 * @return one subscription per shard, index i receiving shard i
+	 * @throws IOException
+	 */
+	public static Subscription[] subscribeSharded(CanInterface canif, int shards, int capacity, ShardRule[] rules,
+			CanFilter... filters) throws IOException {
+		final int[] table = filters.length == 0 ? CanFilter.toTable(CanFilter.ANY) : CanFilter.toTable(filters);
+		final int[] handles = _muxSubscribeSharded(canif._ifIndex, table, capacity, shards,
+				ShardRule.toTable(rules));
+		final Subscription[] subscriptions = new Subscription[handles.length];
+		for (int i = 0; i < handles.length; i++) {
+			subscriptions[i] = new Subscription(handles[i], canif._ifIndex);
+		}
+		return subscriptions;
+	}
+
+	/**
+	 * @brief {@link #subscribeSharded(CanInterface, int, int, ShardRule[], CanFilter...)} distributing all ids
+	 *        by their hash
+	 * @throws IOException
+	 */
+	public static Subscription[] subscribeSharded(CanInterface canif, int shards, int capacity,
+			CanFilter... filters) throws IOException {
+		return subscribeSharded(canif, shards, capacity, new ShardRule[0], filters);
+	}
+
+	/**
+	 * @brief keeps the latest frame of each of the ids in memory shared with the native receiver, for
+	 *        signals where only the current value matters. The mailbox is a subscriber of the interface's
+	 *        receive multiplexer, see {@link #subscribe(CanInterface, int, CanFilter...)}, with one exact
+	 *        kernel filter per id. Remote and error frames are not stored.
+	 * @param canIds the ids, with CAN_EFF_FLAG (bit 31) set for extended ids
+	 * @throws IOException
+	 */
+	public static Mailbox openMailbox(CanInterface canif, int... canIds) throws IOException {
+		final int handle = _mailboxOpen(canif._ifIndex, canIds);
+		try {
+			return new Mailbox(handle, canIds, _mailboxBuffer(handle));
+		} catch (IOException | RuntimeException e) {
+			_muxUnsubscribe(handle);
+			throw e;
+		}
+	}
+
+	/**
+	 * @brief receives all frames of the interface on one native socket and publishes them with their receive
+	 *        timestamps into the POSIX shared memory segment /name. Readers in any process attach with
+	 *        {@link #openSharedBus(String)}, or from C with the layout in jni/can_shm_bus.h, so one socket per
+	 *        bus serves the whole machine. A segment left behind by a publisher that died is replaced, readers
+	 *        still attached to it have to open the bus again.
+	 * @param capacity frames kept in the ring, rounded up to a power of two
+	 * @throws IOException if a publisher in this or another process uses the name already
+	 */
+	public static SharedBusPublisher publishSharedBus(CanInterface canif, String name, int capacity)
+			throws IOException {
+		_shmBusPublish(canif._ifIndex, name, capacity);
+		return new SharedBusPublisher(name);
+	}
+
+	/**
+	 * @brief attaches to the shared bus /name published by this or another process
+	 * @throws IOException
+	 */
+	public static SharedBusReader openSharedBus(String name) throws IOException {
+		return new SharedBusReader(_shmBusOpen(name));
+	}
+
+	private void _checkBoundToInterface() {
+		if (_boundTo == null || _boundTo._ifIndex == 0) {
+			throw new IllegalStateException("socket is not bound to a specific interface");
+		}
+	}
+
+	/**
+	 * Sends the frame at the given point in time.
+	 * 
+	 * If an ETF qdisc is attached to the interface the launch time is handed to the kernel via SO_TXTIME,
+	 * otherwise the calling thread waits natively until the launch time and sends the frame itself. The call
+	 * returns once the frame has been sent. Closing the socket ends the wait with an IOException.
+	 * 
+	 * @param frame         the frame to send
+	 * @param monotonicNanos the launch time on the CLOCK_MONOTONIC time base, which is the time base of
+	 *                      {@link System#nanoTime()} on Linux
+	 * @return actual minus requested transmission time in ns, taken from the transmit timestamp of the
+	 *         driver if available, otherwise from the return of the send call. {@link Long#MIN_VALUE} if
+	 *         it could not be measured
+	 * @throws IOException e.g. if the ETF qdisc reports a missed deadline. Without transmit timestamps
+	 *                     the report is only awaited for 2 ms after the launch time, a later drop goes
+	 *                     unnoticed and a warning is logged natively
+	 * @throws IllegalArgumentException if the launch time is more than 60 s ahead
+	 */
+	public long sendAt(CanFrame frame, long monotonicNanos) throws IOException {
+		return _sendFrameAt(_fd, frame.canIf._ifIndex, frame.canId._canId, frame.data, monotonicNanos);
+	}
+
+	/**
+	 * Sends the frame and waits until its own echo is seen on the bus.
+	 * 
+	 * The frame is sent via a private socket of this CanSocket with CAN_RAW_RECV_OWN_MSGS enabled, so
+	 * frames pending for {@link #recv()} are not consumed. The echo is generated by the driver once the
+	 * frame has been transmitted. With the native transmit queue enabled the frame is sent once the
+	 * frames queued before have been sent and the queue is not paused.
+	 * 
+	 * The copy of the frame the kernel loops back to this socket is not delivered by the receive methods.
+	 * If the echo times out, the copy is delivered like a frame of another node.
+	 * 
+	 * @param frame     the frame to send, its interface must not be {@link #CAN_ALL_INTERFACES}
+	 * @param timeoutMs maximum time to wait for the echo
+	 * @return the kernel timestamp of the echo in ns since the epoch (CLOCK_REALTIME)
+	 * @throws SocketTimeoutException if no echo was seen within timeoutMs
+	 * @throws IOException e.g. ENETDOWN if the transmit queue stayed paused (bus-off) for timeoutMs, EBADF
+	 *                     if the socket is closed meanwhile
+	 */
+	public long sendConfirmed(CanFrame frame, int timeoutMs) throws IOException {
+		return _sendFrameConfirmed(_fd, frame.canIf._ifIndex, frame.canId._canId, frame.data, timeoutMs);
+	}
+
+	/**
+	 * Asynchronous variant of {@link #sendConfirmed(CanFrame, int)}, the confirmation is awaited on the
+	 * given executor.
+	 * 
+	 * @return a future completed with the kernel timestamp of the echo, or exceptionally with a
+	 *         {@link SocketTimeoutException} or an {@link IOException}
+	 */
+	public CompletableFuture<Long> sendConfirmedAsync(CanFrame frame, int timeoutMs, Executor executor) {
+		final CompletableFuture<Long> future = new CompletableFuture<>();
+		executor.execute(() -> {
+			try {
+				future.complete(sendConfirmed(frame, timeoutMs));
+			} catch (IOException | RuntimeException e) {
+				future.completeExceptionally(e);
+			}
+		});
+		return future;
+	}
+
+	/**
+	 * @return the mechanism used by {@link #sendAt(CanFrame, long)} for the last interface it was used on
+	 */
+	public LaunchTimeMode getLaunchTimeMode() {
+		return LaunchTimeMode.values()[_sendFrameAtMode(_fd)];
+	}
+
+	public CanFrame recv() throws IOException {
+		return _recvFrame(_fd);
+	}
+
+	/**
+	 * @brief receives a batch of frames with as few system calls as possible into a buffer laid out by
+	 *        {@link CanFrameBuffer}, starting at the buffer's position. Blocks until at least one frame
+	 *        passed the receive filters, then takes only the frames already queued.
+	 * @param buffer   a direct buffer in native byte order, see {@link CanFrameBuffer#allocate(int)}
+	 * @param maxCount maximum number of frames to receive, at most 64 are received per call
+	 * @return the number of frames stored
+	 * @throws IOException
+	 */
+	public int recvFrames(ByteBuffer buffer, int maxCount) throws IOException {
+		return _recvFrames(_fd, buffer, buffer.position(), maxCount);
+	}
+
+	/**
+	 * @brief delivers only frames whose ID is in the whitelist, error frames always pass. The lookup cost
+	 *        is constant regardless of the number of IDs, so thousands of IDs are no problem unlike kernel
+	 *        filters, which are checked one after the other. Applies to {@link #recv()} and
+	 *        {@link #recvFrames(ByteBuffer, int)}.
+	 * @param ids       the CAN IDs, with CAN_EFF_FLAG set for extended IDs (as in {@link CanId})
+	 * @param prefilter if true the kernel filters are replaced by a coarse filter on the bits all IDs
+	 *                  have in common, so most other frames are not even copied to user space. The
+	 *                  kernel filters set before are restored by {@link #clearIdFilter()}
+	 * @throws IOException
+	 */
+	public void setIdFilter(int[] ids, boolean prefilter) throws IOException {
+		_setIdFilter(_fd, ids, prefilter);
+	}
+
+	/**
+	 * @brief see {@link #setIdFilter(int[], boolean)}
+	 */
+	public void setIdFilter(boolean prefilter, CanId... ids) throws IOException {
+		final int[] raw = new int[ids.length];
+		for (int i = 0; i < ids.length; i++) {
+			raw[i] = ids[i]._canId;
+		}
+		setIdFilter(raw, prefilter);
+	}
+
+	/**
+	 * @brief removes the ID whitelist, a kernel prefilter set with it is replaced by the kernel filters
+	 *        set before
+	 * @throws IOException
+	 */
+	public void clearIdFilter() throws IOException {
+		_clearIdFilter(_fd);
+	}
+
+	/**
+	 * @brief gets the counters of the native receive path, all zero if no receive stage is enabled
+	 * @throws IOException
+	 */
+	public RxStats getRxStats() throws IOException {
+		return new RxStats(_rxStats(_fd));
+	}
+
+	/**
+	 * @brief starts a new bus inventory: every frame read from this socket, before the ID whitelist, updates
+	 *        natively kept statistics of its id (count, period, jitter, length, last seen). The frames still
+	 *        have to be received as usual, preferably with {@link #recvFrames(ByteBuffer, int)}.
+	 * @throws IOException
+	 */
+	public void enableInventory() throws IOException {
+		_inventoryEnable(_fd, true);
+	}
+
+	/**
+	 * @brief stops updating the bus inventory, it can still be read with {@link #getInventory()}
+	 * @throws IOException
+	 */
+	public void disableInventory() throws IOException {
+		_inventoryEnable(_fd, false);
+	}
+
+	/**
+	 * @brief copies the bus inventory of all ids with a single native call
+	 * @throws IOException if the inventory was never enabled
+	 */
+	public BusInventory getInventory() throws IOException {
+		return new BusInventory(_inventorySnapshot(_fd));
+	}
+
+	/**
+	 * @brief starts a native thread reading the frames of this socket and handing them to the listener in
+	 *        batches, so no Java thread has to block in {@link #recv()}. A batch is delivered once it holds
+	 *        maxBatch frames or maxDelayMicros after its first frame was read; with a delay of 0 every wakeup
+	 *        delivers what it read. The frames pass the receive stages of the socket (ID whitelist,
+	 *        inventory). The socket must not be read otherwise while the dispatcher runs.
+	 * @param maxBatch       maximum number of frames per upcall
+	 * @param maxDelayMicros maximum time a frame waits for the batch to fill up
+	 * @throws IOException if a dispatcher is already running on this socket
+	 */
+	public void startDispatcher(FrameListener listener, int maxBatch, int maxDelayMicros) throws IOException {
+		if (listener == null || maxBatch < 1) {
+			throw new IllegalArgumentException();
+		}
+		_dispatcherStart(_fd, listener, CanFrameBuffer.allocate(maxBatch), maxBatch, maxDelayMicros);
+	}
+
+	/**
+	 * @brief {@link #startDispatcher(FrameListener, int, int)} with up to 64 frames per upcall and no delay
+	 * @throws IOException
+	 */
+	public void startDispatcher(FrameListener listener) throws IOException {
+		startDispatcher(listener, 64, 0);
+	}
+
+	/**
+	 * @brief stops the dispatch thread after a running upcall returned, frames of an incomplete batch are
+	 *        discarded. May be called from the listener. Closing the socket stops the dispatcher as well.
+	 * @throws IOException
+	 */
+	public void stopDispatcher() throws IOException {
+		_dispatcherStop(_fd);
+	}
+
+	/**
+	 * @brief gets the counters of the dispatcher, all zero if none is running
+	 * @throws IOException
+	 */
+	public DispatchStats getDispatchStats() throws IOException {
+		return new DispatchStats(_dispatcherStats(_fd));
+	}
+
+	/**
+	 * @brief moves {@link #recv()}, {@link #recvFrames(ByteBuffer, int)} and
+	 *        {@link #sendFrames(ByteBuffer, int)} onto io_uring: a multishot recvmsg with a ring of
+	 *        provided buffers collects the frames, so frames already arrived are taken without a system
+	 *        call, and a batch of frames is sent with one system call per txDepth frames. The receive
+	 *        timeout and the receive filters apply as before. Not to be combined with a dispatcher.
+	 * @param rxBuffers number of receive buffers, a power of two; frames beyond wait in the socket
+	 * @param txDepth   maximum number of frames per send submission
+	 * @return false if the kernel lacks multishot recvmsg or provided buffer rings (before 6.0) or
+	 *         io_uring is disabled, the socket then keeps using recvmmsg/sendmmsg
+	 * @throws IOException if io_uring is already enabled on this socket
+	 */
+	public boolean enableIoUring(int rxBuffers, int txDepth) throws IOException {
+		return _uringEnable(_fd, rxBuffers, txDepth);
+	}
+
+	/**
+	 * @brief {@link #enableIoUring(int, int)} with 256 receive buffers and up to 64 frames per submission
+	 * @throws IOException
+	 */
+	public boolean enableIoUring() throws IOException {
+		return enableIoUring(256, 64);
+	}
+
+	/**
+	 * @brief goes back to recvmmsg/sendmmsg, frames received into buffers but not yet collected are lost. A
+	 *        thread waiting for frames in the engine goes on with recvmmsg. Closing the socket releases the engine
+	 *        as well.
+	 */
+	public void disableIoUring() {
+		_uringDisable(_fd);
+	}
+
+	/**
+	 * @brief gets the counters of the io_uring engine, all zero if it is not enabled
+	 * @throws IOException
+	 */
+	public IoUringStats getIoUringStats() throws IOException {
+		return new IoUringStats(_uringStats(_fd));
+	}
+
+	@Override
+	public void close() throws IOException {
+		if (_txRing != null) {
+			_txRing.closed = true;
+			_txRing = null;
+		}
+		_close(_fd);
+	}
+
+	/**
+	 * sets the sockets read timeout, if 0 the socket returns from NON-BLOCKING to BLOCKING
+	 * @param _secs
+	 * @param _usecs
+	 * @throws IOException
+	 *
 	 */
 	public void setReceiveTimeout(int _secs, int _usecs) throws IOException {
 		_setreceivetimeout(_fd, _secs, _usecs);
@@ -915,6 +3364,56 @@ public final class CanSocket implements Closeable {
 		return _statsGetCanFrameFramesSendPerCycle(_fd);
 	}
 
+	/**
+	 * @brief enables a bounded native transmit queue for this socket.
+	 * 
+	 * Frames sent by {@link #send(CanFrame)} and by the native cyclical send task are still sent directly
+	 * as long as the device accepts them. If the interface reports congestion (ENOBUFS) they are queued
+	 * and retransmitted in order by a native thread once the device accepts frames again.
+	 * @param capacity maximum number of pending frames
+	 * @param policy what to do with new frames once the queue is full
+	 * @throws IOException
+	 * @note the cyclical send task never blocks, with policy BLOCK its frames are dropped when the queue is full
+	 */
+	public void enableTxQueue(int capacity, TxQueuePolicy policy) throws IOException{
+		_txQueueEnable(_fd, capacity, policy.ordinal(), TxQueueOrder.FIFO.ordinal(), 0);
+	}
+
+	/**
+	 * @brief enables a bounded native transmit queue for this socket with the given ordering.
+	 * 
+	 * With {@link TxQueueOrder#PRIORITY} pending frames are sent lowest CAN ID first, as the arbitration
+	 * on the wire would do. As the kernel queue in front of the device is FIFO, maxInFlight should be
+	 * small for the ordering to take effect.
+	 * @param capacity maximum number of pending frames
+	 * @param policy what to do with new frames once the queue is full
+	 * @param order order in which pending frames are sent
+	 * @param maxInFlight approximate number of frames handed to the kernel but not yet sent, 0 for no limit
+	 * @throws IOException
+	 * @note maxInFlight is enforced via the socket send buffer, the kernel imposes a lower bound of a few frames
+	 */
+	public void enableTxQueue(int capacity, TxQueuePolicy policy, TxQueueOrder order, int maxInFlight)
+			throws IOException{
+		_txQueueEnable(_fd, capacity, policy.ordinal(), order.ordinal(), maxInFlight);
+	}
+
+	/**
+	 * @brief disables the native transmit queue, pending frames are discarded.
+	 * @throws IOException
+	 * @note must not be called while other threads are sending on this socket
+	 */
+	public void disableTxQueue() throws IOException{
+		_txQueueDisable(_fd);
+	}
+
+	/**
+	 * @brief gets the counters of the native transmit queue, all zero if the queue is not enabled.
+	 * @throws IOException
+	 */
+	public TxQueueStats getTxQueueStats() throws IOException{
+		return new TxQueueStats(_txQueueStats(_fd));
+	}
+
 	
 	
 }